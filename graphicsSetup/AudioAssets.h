@@ -0,0 +1,236 @@
+// Audio asset manager
+// irrKlang memory sources reference https://www.ambiera.com/irrklang/docu/classirrklang_1_1_i_sound_engine.html
+// Short effects are decoded to PCM once on a worker thread, through an irrKlang engine with no output device,
+// and handed to the audio backend as clips so playing them never decodes on the render thread.
+// Decoded clips are kept under a byte budget and the least recently played ones are dropped first. Long
+// tracks are streamed from disk instead. Every audio call made through here on the render thread is timed.
+
+#ifndef AUDIOASSETS_H
+#define AUDIOASSETS_H
+#include <irrklang/irrKlang.h>
+#include "AudioBackend.h"
+#include "ThreadPool.h"
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <set>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <cstring>
+#include <iostream>
+
+// adds the time spent in its scope to a counter
+struct AudioCallTimer {
+    double& total;
+    std::chrono::high_resolution_clock::time_point start;
+    AudioCallTimer(double& total) : total(total), start(std::chrono::high_resolution_clock::now()) {}
+    ~AudioCallTimer()
+    {
+        total += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+};
+
+class AudioAssets
+{
+public:
+    size_t budgetBytes = 16 * 1024 * 1024; // decoded pcm kept resident
+    size_t streamFileBytes = 1024 * 1024;  // files bigger than this are streamed instead of decoded
+    double callMs = 0.0;                    // time in audio calls since the last report
+
+    AudioAssets(AudioBackend& backend, ThreadPool& pool)
+        : backend(backend), pool(pool)
+    {
+        decoder = irrklang::createIrrKlangDevice(irrklang::ESOD_NULL, 0);
+        if (!decoder)
+            std::cout << "Audio decoder failed to start :( effects will be decoded when played" << std::endl;
+    }
+
+    ~AudioAssets()
+    {
+        pool.Wait(); // decode jobs still write into this
+        for (std::map<std::string, Entry>::iterator it = cache.begin(); it != cache.end(); ++it)
+        {
+            backend.UnloadClip(pcmName(it->first));
+            delete it->second.clip;
+        }
+        for (unsigned int i = 0; i < decoded.size(); i++)
+            delete decoded[i].second;
+        if (decoder)
+            decoder->drop();
+    }
+
+    // decodes a short effect in the background, big files are registered for streaming right away
+    void Preload(const std::string& path)
+    {
+        if (cache.count(path) || decoding.count(path))
+            return;
+        std::ifstream file(path.c_str(), std::ios::binary | std::ios::ate);
+        if (!file || !decoder || (size_t)file.tellg() > streamFileBytes)
+        {
+            Stream(path);
+            return;
+        }
+        decoding.insert(path);
+        pool.Submit([this, path]() { decode(path); });
+    }
+
+    // a clip made elsewhere, like a generated tone, played by path like a decoded file. Owned from here on and
+    // registered with the backend in the next Update
+    void AddClip(const std::string& path, PcmClip* clip)
+    {
+        std::lock_guard<std::mutex> lock(decodedMutex);
+        decoded.push_back(std::make_pair(path, clip));
+    }
+
+    // long tracks are read from disk while they play
+    void Stream(const std::string& path)
+    {
+        AudioCallTimer timer(callMs);
+        streamed.insert(path);
+        backend.LoadStream(path);
+    }
+
+    // blocks until every requested clip is decoded, for loading time
+    void WaitForLoads()
+    {
+        pool.Wait();
+        Update();
+    }
+
+    // registers finished clips with the backend and trims the cache, once per frame
+    void Update()
+    {
+        AudioCallTimer timer(callMs);
+        frames++;
+        std::vector<std::pair<std::string, PcmClip*> > done;
+        {
+            std::lock_guard<std::mutex> lock(decodedMutex);
+            done.swap(decoded);
+        }
+        for (unsigned int i = 0; i < done.size(); i++)
+        {
+            const std::string& path = done[i].first;
+            PcmClip* clip = done[i].second;
+            decoding.erase(path);
+            if (!clip || !backend.LoadClip(pcmName(path), clip))
+            {
+                // undecodable, leave it to the backend to open the file when played
+                std::cout << "Audio clip failed to decode :( Path: " << path << std::endl;
+                delete clip;
+                continue;
+            }
+            lru.push_front(path);
+            Entry entry = { clip, lru.begin() };
+            cache[path] = entry;
+            residentBytes += clip->data.size();
+        }
+        evict();
+    }
+
+    // the name to play a file by: the decoded clip when it is resident, otherwise the file itself, and a clip
+    // that is still decoding or was evicted is requested again
+    std::string Get(const std::string& path)
+    {
+        if (streamed.count(path))
+            return path;
+        std::map<std::string, Entry>::iterator it = cache.find(path);
+        if (it == cache.end())
+        {
+            misses++;
+            Preload(path);
+            return path;
+        }
+        hits++;
+        lru.splice(lru.begin(), lru, it->second.use);
+        return pcmName(path);
+    }
+
+    // plays from memory when the clip is resident, otherwise from the file like before
+    unsigned int Play2D(const std::string& path, bool looped = false, float volume = 1.0f)
+    {
+        std::string name = Get(path);
+        AudioCallTimer timer(callMs);
+        return backend.Play(name, 0, looped, volume, 1.0f, 0);
+    }
+
+    void Report(float time)
+    {
+        if (time - lastReport < 2.0f)
+            return;
+        lastReport = time;
+        std::cout << "Audio: " << cache.size() << " clips resident (" << residentBytes / 1024 << "/" << budgetBytes / 1024 << " KB), "
+            << decoding.size() << " decoding, " << hits << " hits, " << misses << " misses, "
+            << (frames ? callMs / frames : 0.0) << " ms/update in audio calls" << std::endl;
+        callMs = 0.0;
+        frames = 0;
+    }
+
+private:
+    struct Entry {
+        PcmClip* clip;
+        std::list<std::string>::iterator use;
+    };
+
+    AudioBackend& backend;
+    irrklang::ISoundEngine* decoder = 0;
+    ThreadPool& pool;
+    std::map<std::string, Entry> cache;
+    std::list<std::string> lru; // most recently played first
+    std::set<std::string> decoding;
+    std::set<std::string> streamed;
+    std::vector<std::pair<std::string, PcmClip*> > decoded;
+    std::mutex decodedMutex;
+    std::mutex decoderMutex;
+    size_t residentBytes = 0;
+    unsigned int hits = 0, misses = 0, frames = 0;
+    float lastReport = 0.0f;
+
+    // the clip needs its own name, the path stays free for playing straight from the file
+    static std::string pcmName(const std::string& path)
+    {
+        return path + ".pcm";
+    }
+
+    // runs on a worker
+    void decode(const std::string& path)
+    {
+        PcmClip* clip = 0;
+        {
+            std::lock_guard<std::mutex> lock(decoderMutex);
+            irrklang::ISoundSource* source = decoder->addSoundSourceFromFile(path.c_str(), irrklang::ESM_NO_STREAMING, true);
+            void* samples = source ? source->getSampleData() : 0;
+            if (samples && source->getAudioFormat().getSampleDataSize() > 0)
+            {
+                clip = new PcmClip();
+                clip->format = source->getAudioFormat();
+                clip->data.resize(clip->format.getSampleDataSize());
+                memcpy(&clip->data[0], samples, clip->data.size());
+            }
+            if (source)
+                decoder->removeSoundSource(source);
+        }
+        std::lock_guard<std::mutex> lock(decodedMutex);
+        decoded.push_back(std::make_pair(path, clip));
+    }
+
+    // drops the least recently played clips that are not playing right now
+    void evict()
+    {
+        std::list<std::string>::iterator it = lru.end();
+        while (residentBytes > budgetBytes && it != lru.begin())
+        {
+            --it;
+            Entry& entry = cache[*it];
+            if (backend.ClipInUse(pcmName(*it)))
+                continue;
+            backend.UnloadClip(pcmName(*it));
+            residentBytes -= entry.clip->data.size();
+            delete entry.clip;
+            cache.erase(*it);
+            it = lru.erase(it);
+        }
+    }
+};
+#endif
@@ -0,0 +1,226 @@
+// Audio output backends
+// Everything above this (assets, emitters, the audio thread) talks to an AudioBackend instead of irrKlang so the
+// scene can run with no sound device. The irrKlang backend plays through the sound card, the null backend
+// accepts every call and plays nothing. The software mixer that renders to a wav file is in MixerBackend.h.
+// Voices are plain ids, 0 is never a voice.
+
+#ifndef AUDIOBACKEND_H
+#define AUDIOBACKEND_H
+#include <irrklang/irrKlang.h>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <iostream>
+
+// decoded sample data of one clip, backends read it in place so it has to outlive the clip
+struct PcmClip {
+    irrklang::SAudioStreamFormat format;
+    std::vector<char> data;
+};
+
+class AudioBackend
+{
+public:
+    virtual ~AudioBackend() {}
+    virtual const char* Name() const = 0;
+
+    // decoded clips registered under a name and files streamed from disk under their path
+    virtual bool LoadClip(const std::string& name, const PcmClip* clip) = 0;
+    virtual void UnloadClip(const std::string& name) = 0;
+    virtual bool ClipInUse(const std::string& name) = 0;
+    virtual bool LoadStream(const std::string& path) = 0;
+
+    // pos is 0 for sounds without a position, offsetMs is where playback starts
+    virtual unsigned int Play(const std::string& name, const glm::vec3* pos, bool looped, float volume, float minDistance, unsigned int offsetMs) = 0;
+    virtual void SetVoicePosition(unsigned int voice, const glm::vec3& pos) = 0;
+    virtual bool VoiceFinished(unsigned int voice) = 0;
+    virtual void StopVoice(unsigned int voice) = 0;
+    virtual void SetListener(const glm::vec3& pos, const glm::vec3& front) = 0;
+
+    // advances the output by dt seconds, once per audio tick. Finished one shots are released here, so a voice
+    // nobody keeps, like a Play2D beep, does not pile up; a released voice reads as finished
+    virtual void Update(float dt) {}
+    virtual void Report(float time) {}
+};
+
+// plays through the sound card
+class IrrKlangBackend : public AudioBackend
+{
+public:
+    // takes over the reference of an engine from createIrrKlangDevice
+    IrrKlangBackend(irrklang::ISoundEngine* engine)
+        : engine(engine)
+    {
+    }
+
+    ~IrrKlangBackend()
+    {
+        for (std::map<unsigned int, irrklang::ISound*>::iterator it = voices.begin(); it != voices.end(); ++it)
+        {
+            it->second->stop();
+            it->second->drop();
+        }
+        engine->drop();
+    }
+
+    const char* Name() const { return "irrKlang"; }
+
+    bool LoadClip(const std::string& name, const PcmClip* clip)
+    {
+        return engine->addSoundSourceFromPCMData((void*)&clip->data[0], (irrklang::ik_s32)clip->data.size(), name.c_str(), clip->format, false) != 0;
+    }
+
+    void UnloadClip(const std::string& name)
+    {
+        engine->removeSoundSource(name.c_str());
+    }
+
+    bool ClipInUse(const std::string& name)
+    {
+        return engine->isCurrentlyPlaying(name.c_str());
+    }
+
+    bool LoadStream(const std::string& path)
+    {
+        if (engine->getSoundSource(path.c_str(), false))
+            return true;
+        return engine->addSoundSourceFromFile(path.c_str(), irrklang::ESM_STREAMING, false) != 0;
+    }
+
+    // a name irrKlang does not know yet is opened as a file
+    unsigned int Play(const std::string& name, const glm::vec3* pos, bool looped, float volume, float minDistance, unsigned int offsetMs)
+    {
+        irrklang::ISoundSource* source = engine->getSoundSource(name.c_str(), false);
+        irrklang::ISound* sound;
+        if (pos)
+        {
+            irrklang::vec3df p(pos->x, pos->y, pos->z);
+            sound = source ? engine->play3D(source, p, looped, true, true) : engine->play3D(name.c_str(), p, looped, true, true);
+        }
+        else
+            sound = source ? engine->play2D(source, looped, true, true) : engine->play2D(name.c_str(), looped, true, true);
+        if (!sound)
+            return 0;
+        sound->setVolume(volume);
+        sound->setMinDistance(minDistance);
+        irrklang::ik_u32 length = sound->getPlayLength();
+        if (offsetMs && length > 0 && length != (irrklang::ik_u32)-1 && sound->getSoundSource()->getIsSeekingSupported())
+            sound->setPlayPosition(looped ? offsetMs % length : glm::min(offsetMs, length));
+        sound->setIsPaused(false);
+        voices[++lastVoice] = sound;
+        return lastVoice;
+    }
+
+    void SetVoicePosition(unsigned int voice, const glm::vec3& pos)
+    {
+        std::map<unsigned int, irrklang::ISound*>::iterator it = voices.find(voice);
+        if (it != voices.end())
+            it->second->setPosition(irrklang::vec3df(pos.x, pos.y, pos.z));
+    }
+
+    bool VoiceFinished(unsigned int voice)
+    {
+        std::map<unsigned int, irrklang::ISound*>::iterator it = voices.find(voice);
+        return it == voices.end() || it->second->isFinished();
+    }
+
+    void StopVoice(unsigned int voice)
+    {
+        std::map<unsigned int, irrklang::ISound*>::iterator it = voices.find(voice);
+        if (it == voices.end())
+            return;
+        it->second->stop();
+        it->second->drop();
+        voices.erase(it);
+    }
+
+    void SetListener(const glm::vec3& pos, const glm::vec3& front)
+    {
+        engine->setListenerPosition(irrklang::vec3df(pos.x, pos.y, pos.z), irrklang::vec3df(front.x, front.y, front.z));
+    }
+
+    void Update(float dt)
+    {
+        std::map<unsigned int, irrklang::ISound*>::iterator it = voices.begin();
+        while (it != voices.end())
+        {
+            if (it->second->isFinished())
+            {
+                it->second->drop();
+                it = voices.erase(it);
+            }
+            else
+                ++it;
+        }
+    }
+
+private:
+    irrklang::ISoundEngine* engine;
+    std::map<unsigned int, irrklang::ISound*> voices;
+    unsigned int lastVoice = 0;
+};
+
+// accepts everything and plays nothing, voices only remember whether they loop
+class NullBackend : public AudioBackend
+{
+public:
+    const char* Name() const { return "null"; }
+
+    bool LoadClip(const std::string& name, const PcmClip* clip) { calls++; clips.insert(name); return true; }
+    void UnloadClip(const std::string& name) { calls++; clips.erase(name); }
+    bool ClipInUse(const std::string& name) { calls++; return false; }
+    bool LoadStream(const std::string& path) { calls++; return true; }
+
+    unsigned int Play(const std::string& name, const glm::vec3* pos, bool looped, float volume, float minDistance, unsigned int offsetMs)
+    {
+        calls++;
+        plays++;
+        voices[++lastVoice] = looped;
+        return lastVoice;
+    }
+
+    void SetVoicePosition(unsigned int voice, const glm::vec3& pos) { calls++; }
+
+    // one shots finish straight away
+    bool VoiceFinished(unsigned int voice)
+    {
+        calls++;
+        std::map<unsigned int, bool>::iterator it = voices.find(voice);
+        return it == voices.end() || !it->second;
+    }
+
+    void StopVoice(unsigned int voice) { calls++; voices.erase(voice); }
+    void SetListener(const glm::vec3& pos, const glm::vec3& front) { calls++; }
+
+    void Update(float dt)
+    {
+        std::map<unsigned int, bool>::iterator it = voices.begin();
+        while (it != voices.end())
+        {
+            if (!it->second)
+                it = voices.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    void Report(float time)
+    {
+        if (time - lastReport < 2.0f)
+            return;
+        lastReport = time;
+        std::cout << "Null audio: " << calls << " backend calls, " << plays << " plays, " << voices.size() << " voices, " << clips.size() << " clips" << std::endl;
+        calls = 0;
+        plays = 0;
+    }
+
+private:
+    std::set<std::string> clips;
+    std::map<unsigned int, bool> voices;
+    unsigned int lastVoice = 0;
+    unsigned int calls = 0, plays = 0;
+    float lastReport = 0.0f;
+};
+#endif
@@ -0,0 +1,157 @@
+// Audio voice scheduling and mixing benchmark
+// Started with --audiobench, runs before the window opens and exits with 1 if a check fails. A generated tone is
+// played through SoundEmitters into the software mixer from the right, the left, straight ahead and further away,
+// and the wav it writes is read back: each channel's peak has to match the equal power pan and rolloff, the tone
+// has to last as long as the clip, and once the one shots finish, a Play2D among them, the clip is no longer in use. Then a crowd of looping
+// emitters around a moving listener is run through the null backend and the mixer, timing each audio update.
+
+#ifndef AUDIOBENCHMARK_H
+#define AUDIOBENCHMARK_H
+#include "AudioAssets.h"
+#include "SoundEmitters.h"
+#include "MixerBackend.h"
+#include "ThreadPool.h"
+#include <glm/glm.hpp>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+class AudioBenchmark
+{
+public:
+    float toneSeconds = 0.5f;
+    float toneHz = 440.0f;
+    int toneRate = 22050;          // half the mixer's rate so resampling is exercised
+    float toneAmplitude = 0.5f;
+    float tickSeconds = 1.0f / 60.0f;
+    unsigned int benchUpdates = 600; // ten seconds of audio at 60 ticks a second
+    const char* wavPath = "audioBench.wav";
+
+    // 0 when every check passes
+    int Run()
+    {
+        ThreadPool pool;
+        bool pass = true;
+        std::printf("Audio, %.0f Hz tone of %.2f s at %d Hz into the %d Hz mixer\n", toneHz, toneSeconds, toneRate, mixRate);
+        std::printf("%10s %12s %12s %12s %12s %10s %8s\n", "emitter", "left peak", "expected", "right peak", "expected", "length s", "result");
+        // listener at the origin facing -z, so +x is its right
+        pass = panRow("right", glm::vec3(1.0f, 0.0f, 0.0f), 0.0f, 1.0f, pool) && pass;
+        pass = panRow("left", glm::vec3(-1.0f, 0.0f, 0.0f), 1.0f, 0.0f, pool) && pass;
+        pass = panRow("ahead", glm::vec3(0.0f, 0.0f, -1.0f), std::sqrt(0.5f), std::sqrt(0.5f), pool) && pass;
+        pass = panRow("far right", glm::vec3(4.0f, 0.0f, 0.0f), 0.0f, 0.25f, pool) && pass;
+
+        std::printf("%16s %10s %8s %14s %12s\n", "backend", "emitters", "voices", "ms/update", "x realtime");
+        unsigned int crowds[2] = { 64, 1024 };
+        for (unsigned int emitters : crowds)
+        {
+            NullBackend null;
+            benchRow(null, emitters, pool);
+            MixerBackend mixer(wavPath, mixRate);
+            benchRow(mixer, emitters, pool);
+        }
+        std::remove(wavPath);
+        std::printf(pass ? "every check passes\n" : "CHECK FAILED\n");
+        return pass ? 0 : 1;
+    }
+
+private:
+    typedef std::chrono::high_resolution_clock Clock;
+    const int mixRate = 44100;
+    const glm::vec3 listenerFront = glm::vec3(0.0f, 0.0f, -1.0f);
+
+    // mono 16 bit sine
+    PcmClip* tone(float seconds) const
+    {
+        PcmClip* clip = new PcmClip();
+        int frames = (int)(seconds * toneRate);
+        clip->format.ChannelCount = 1;
+        clip->format.FrameCount = frames;
+        clip->format.SampleRate = toneRate;
+        clip->format.SampleFormat = irrklang::ESF_S16;
+        clip->data.resize(frames * sizeof(int16_t));
+        int16_t* samples = (int16_t*)&clip->data[0];
+        for (int i = 0; i < frames; i++)
+            samples[i] = (int16_t)(std::sin(6.2831853f * toneHz * i / toneRate) * toneAmplitude * 32767.0f);
+        return clip;
+    }
+
+    // one shot of the tone from pos, for twice its length, then the wav is checked against the expected channel gains
+    bool panRow(const char* name, const glm::vec3& pos, float leftGain, float rightGain, ThreadPool& pool)
+    {
+        bool released;
+        {
+            MixerBackend mixer(wavPath, mixRate);
+            AudioAssets audio(mixer, pool);
+            audio.AddClip("tone", tone(toneSeconds));
+            audio.Update();
+            SoundEmitters emitters(audio, mixer);
+            emitters.Add("tone", pos, 1.0f, 1.0f, false);
+            audio.Play2D("tone", false, 0.0f); // silent, nothing keeps its voice so only the backend can let go of it
+            for (float time = 0.0f; time < toneSeconds * 2.0f; time += tickSeconds)
+            {
+                emitters.Update(time, glm::vec3(0.0f), listenerFront);
+                mixer.Update(tickSeconds);
+            }
+            released = !mixer.ClipInUse("tone.pcm");
+        }
+
+        std::ifstream file(wavPath, std::ios::binary);
+        std::vector<char> wav((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        const int16_t* samples = wav.size() > 44 ? (const int16_t*)&wav[44] : NULL;
+        size_t frames = wav.size() > 44 ? (wav.size() - 44) / 4 : 0;
+        float peak[2] = { 0.0f, 0.0f };
+        size_t last = 0; // one past the last frame the tone is heard in
+        float audible = toneAmplitude * 32767.0f * 0.05f;
+        for (size_t i = 0; i < frames; i++)
+            for (int c = 0; c < 2; c++)
+            {
+                float s = std::fabs((float)samples[i * 2 + c]);
+                peak[c] = glm::max(peak[c], s);
+                if (s > audible)
+                    last = i + 1;
+            }
+
+        // within 3% for the linear resampling, and two periods of the tone for where it fades out
+        float expected[2] = { leftGain * toneAmplitude * 32767.0f, rightGain * toneAmplitude * 32767.0f };
+        bool pass = released;
+        for (int c = 0; c < 2; c++)
+            pass = pass && std::fabs(peak[c] - expected[c]) <= 0.03f * toneAmplitude * 32767.0f + 2.0f;
+        float length = (float)last / mixRate;
+        pass = pass && std::fabs(length - toneSeconds) <= 2.0f / toneHz;
+        std::printf("%10s %12.0f %12.0f %12.0f %12.0f %10.3f %8s%s\n", name, peak[0], expected[0], peak[1], expected[1], length,
+            pass ? "pass" : "FAIL", released ? "" : " (clip still in use)");
+        return pass;
+    }
+
+    // looping emitters scattered over 40 m around a listener walking in a circle
+    void benchRow(AudioBackend& backend, unsigned int count, ThreadPool& pool)
+    {
+        std::mt19937 random(7);
+        std::uniform_real_distribution<float> spread(-20.0f, 20.0f);
+        AudioAssets audio(backend, pool);
+        audio.AddClip("loop", tone(2.0f));
+        audio.Update();
+        SoundEmitters emitters(audio, backend);
+        for (unsigned int i = 0; i < count; i++)
+            emitters.Add("loop", glm::vec3(spread(random), 0.0f, spread(random)), 1.0f, 2.0f);
+
+        Clock::time_point start = Clock::now();
+        float time = 0.0f;
+        for (unsigned int i = 0; i < benchUpdates; i++)
+        {
+            glm::vec3 listener(std::cos(time * 0.5f) * 10.0f, 0.0f, std::sin(time * 0.5f) * 10.0f);
+            emitters.Update(time, listener, glm::vec3(-std::sin(time * 0.5f), 0.0f, std::cos(time * 0.5f)));
+            backend.Update(tickSeconds);
+            time += tickSeconds;
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        std::printf("%16s %10u %8u %14.3f %12.0f\n", backend.Name(), count, emitters.maxVoices, seconds * 1000.0 / benchUpdates,
+            benchUpdates * tickSeconds / seconds);
+    }
+};
+#endif
@@ -0,0 +1,204 @@
+// Audio update thread
+// The render loop only pushes commands into a lock-free queue, a thread of its own drains it, moves the
+// emitters and the listener and drives the audio backend at a fixed rate. Nothing on the render thread waits on the
+// sound engine, when the queue is full the command is dropped and counted.
+
+#ifndef AUDIOTHREAD_H
+#define AUDIOTHREAD_H
+#include <glm/glm.hpp>
+#include "AudioAssets.h"
+#include "SoundEmitters.h"
+#include "AudioBackend.h"
+#include "SpscQueue.h"
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+
+enum AudioCommandType { AUDIO_LISTENER, AUDIO_EMITTER_POSITION, AUDIO_PLAY_2D, AUDIO_PLAY_3D };
+
+struct AudioCommand {
+    AudioCommandType type;
+    unsigned int emitter;
+    const char* clip;   // has to outlive the command, the paths are string literals
+    glm::vec3 pos;
+    glm::vec3 front;
+    float volume;
+    float minDistance;
+    std::chrono::steady_clock::time_point queued;
+};
+
+const unsigned int AUDIO_QUEUE_SIZE = 1024;
+
+class AudioThread
+{
+public:
+    float tickSeconds = 0.01f; // the audio thread runs at 100Hz
+    double pushMs = 0.0;        // time spent queueing on the render thread since the last report
+
+    AudioThread(AudioAssets& audio, SoundEmitters& emitters, AudioBackend& backend)
+        : audio(audio), emitters(emitters), backend(backend), commands(AUDIO_QUEUE_SIZE)
+    {
+    }
+
+    ~AudioThread()
+    {
+        Stop();
+    }
+
+    // the assets and emitters belong to the audio thread from here on
+    void Start()
+    {
+        running = true;
+        thread = std::thread([this] { loop(); });
+    }
+
+    void Stop()
+    {
+        running = false;
+        if (thread.joinable())
+            thread.join();
+    }
+
+    // render thread side, none of these block
+    void SetListener(const glm::vec3& pos, const glm::vec3& front)
+    {
+        AudioCommand c = command(AUDIO_LISTENER);
+        c.pos = pos;
+        c.front = front;
+        push(c);
+    }
+
+    void SetEmitterPosition(unsigned int emitter, const glm::vec3& pos)
+    {
+        AudioCommand c = command(AUDIO_EMITTER_POSITION);
+        c.emitter = emitter;
+        c.pos = pos;
+        push(c);
+    }
+
+    void Play2D(const char* clip)
+    {
+        AudioCommand c = command(AUDIO_PLAY_2D);
+        c.clip = clip;
+        push(c);
+    }
+
+    // a one shot emitter that competes for a voice like the others
+    void Play3D(const char* clip, const glm::vec3& pos, float volume, float minDistance)
+    {
+        AudioCommand c = command(AUDIO_PLAY_3D);
+        c.clip = clip;
+        c.pos = pos;
+        c.volume = volume;
+        c.minDistance = minDistance;
+        push(c);
+    }
+
+    void Report(float time)
+    {
+        if (time - lastReport < 2.0f)
+            return;
+        float elapsed = time - lastReport;
+        lastReport = time;
+        unsigned int count = applied.exchange(0);
+        double latency = latencyUs.exchange(0) / 1000.0;
+        double worst = latencyMaxUs.exchange(0) / 1000.0;
+        std::cout << "Audio thread: " << commands.Size() << " commands queued, " << count / elapsed << " applied/s, latency avg "
+            << (count ? latency / count : 0.0) << " ms max " << worst << " ms, " << dropped << " dropped, render thread "
+            << pushMs << " ms queueing" << std::endl;
+        pushMs = 0.0;
+    }
+
+private:
+    AudioAssets& audio;
+    SoundEmitters& emitters;
+    AudioBackend& backend;
+    SpscQueue<AudioCommand> commands;
+    std::thread thread;
+    std::atomic<bool> running{ false };
+    std::atomic<unsigned long long> latencyUs{ 0 };
+    std::atomic<unsigned long long> latencyMaxUs{ 0 };
+    std::atomic<unsigned int> applied{ 0 };
+    unsigned int dropped = 0;
+    float lastReport = 0.0f;
+
+    // audio thread state
+    glm::vec3 listenerPos = glm::vec3(0.0f);
+    glm::vec3 listenerFront = glm::vec3(0.0f, 0.0f, -1.0f);
+
+    AudioCommand command(AudioCommandType type)
+    {
+        AudioCommand c;
+        c.type = type;
+        c.emitter = 0;
+        c.clip = 0;
+        c.pos = glm::vec3(0.0f);
+        c.front = glm::vec3(0.0f);
+        c.volume = 1.0f;
+        c.minDistance = 1.0f;
+        return c;
+    }
+
+    void push(AudioCommand& c)
+    {
+        AudioCallTimer timer(pushMs);
+        c.queued = std::chrono::steady_clock::now();
+        if (!commands.Push(c))
+            dropped++;
+    }
+
+    void loop()
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point next = start;
+        float last = 0.0f;
+        while (running)
+        {
+            AudioCommand c;
+            while (commands.Pop(c))
+                apply(c);
+
+            float clock = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+            audio.Update();
+            emitters.Update(clock, listenerPos, listenerFront);
+            backend.Update(clock - last);
+            last = clock;
+            audio.Report(clock);
+            emitters.Report(clock);
+            backend.Report(clock);
+
+            // after a stall carry on from now instead of running a burst of ticks
+            next = std::max(next + std::chrono::microseconds((long long)(tickSeconds * 1.0e6f)), std::chrono::steady_clock::now());
+            std::this_thread::sleep_until(next);
+        }
+    }
+
+    void apply(const AudioCommand& c)
+    {
+        unsigned long long us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - c.queued).count();
+        latencyUs += us;
+        unsigned long long worst = latencyMaxUs.load();
+        while (us > worst && !latencyMaxUs.compare_exchange_weak(worst, us)) {}
+        applied++;
+
+        switch (c.type)
+        {
+        case AUDIO_LISTENER:
+            listenerPos = c.pos;
+            listenerFront = c.front;
+            break;
+        case AUDIO_EMITTER_POSITION:
+            emitters.SetPosition(c.emitter, c.pos);
+            break;
+        case AUDIO_PLAY_2D:
+            audio.Play2D(c.clip);
+            break;
+        case AUDIO_PLAY_3D:
+            emitters.Add(c.clip, c.pos, c.volume, c.minDistance, false);
+            break;
+        }
+    }
+};
+#endif
@@ -0,0 +1,104 @@
+// Axis aligned bounding boxes used by the culling code
+// Transforming a box by a matrix reference https://gist.github.com/cmf028/81e8d3907035640ee0e3fdd69ada543f (Arvo's method)
+// Frustum plane extraction reference https://www.gamedevs.org/uploads/fast-extraction-viewing-frustum-planes-from-world-view-projection-matrix.pdf
+
+#ifndef BOUNDS_H
+#define BOUNDS_H
+#include <glm/glm.hpp>
+#include <cfloat>
+
+struct AABB {
+    glm::vec3 min = glm::vec3(FLT_MAX);
+    glm::vec3 max = glm::vec3(-FLT_MAX);
+
+    void Grow(const glm::vec3& p)
+    {
+        min = glm::min(min, p);
+        max = glm::max(max, p);
+    }
+
+    void Grow(const AABB& box)
+    {
+        min = glm::min(min, box.min);
+        max = glm::max(max, box.max);
+    }
+
+    bool Valid() const
+    {
+        return min.x <= max.x && min.y <= max.y && min.z <= max.z;
+    }
+
+    glm::vec3 Center() const { return (min + max) * 0.5f; }
+    glm::vec3 Extent() const { return (max - min) * 0.5f; }
+};
+
+// draw and triangle counts the culling passes report
+struct CullStats {
+    unsigned int draws = 0;
+    unsigned int drawsCulled = 0;
+    unsigned int triangles = 0;
+    unsigned int trianglesCulled = 0;
+    unsigned int retested = 0;
+    unsigned int retestVisible = 0;
+};
+
+// world space box of a model space box, still axis aligned so it may be a bit larger
+inline AABB TransformAABB(const glm::mat4& m, const AABB& box)
+{
+    AABB out;
+    glm::vec3 t(m[3]);
+    out.min = t;
+    out.max = t;
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            float a = m[j][i] * box.min[j];
+            float b = m[j][i] * box.max[j];
+            out.min[i] += a < b ? a : b;
+            out.max[i] += a < b ? b : a;
+        }
+    }
+    return out;
+}
+
+// six planes pulled out of a view projection matrix, normals point inwards
+struct Frustum {
+    glm::vec4 planes[6];
+
+    Frustum(const glm::mat4& viewProj = glm::mat4(1.0f))
+    {
+        glm::mat4 m = glm::transpose(viewProj);
+        planes[0] = m[3] + m[0]; // left
+        planes[1] = m[3] - m[0]; // right
+        planes[2] = m[3] + m[1]; // bottom
+        planes[3] = m[3] - m[1]; // top
+        planes[4] = m[3] + m[2]; // near
+        planes[5] = m[3] - m[2]; // far
+        for (int i = 0; i < 6; i++)
+            planes[i] /= glm::length(glm::vec3(planes[i]));
+    }
+
+    bool SphereVisible(const glm::vec3& centre, float radius) const
+    {
+        for (int i = 0; i < 6; i++)
+            if (glm::dot(glm::vec3(planes[i]), centre) + planes[i].w < -radius)
+                return false;
+        return true;
+    }
+
+    bool BoxVisible(const AABB& box) const
+    {
+        for (int i = 0; i < 6; i++)
+        {
+            // corner furthest along the plane normal
+            glm::vec3 p(planes[i].x > 0.0f ? box.max.x : box.min.x,
+                        planes[i].y > 0.0f ? box.max.y : box.min.y,
+                        planes[i].z > 0.0f ? box.max.z : box.min.z);
+            if (glm::dot(glm::vec3(planes[i]), p) + planes[i].w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+};
+#endif
@@ -0,0 +1,619 @@
+// Bounding volume hierarchy over world space instance boxes, for frustum, ray and sphere queries
+// Binned SAH build reference https://jacco.ompf2.com/2022/04/21/how-to-build-a-bvh-part-3-quick-builds/
+// Four wide nodes reference https://www.uni-ulm.de/fileadmin/website_uni_ulm/iui.inst.100/institut/Papers/QBVH.pdf
+// Every instance is a box with a number the caller picks. Build splits them into a binary tree with a binned
+// surface area heuristic, then folds it into nodes of four children whose boxes are stored lane by lane, so one
+// SSE test covers all four against a frustum plane, a ray or a sphere. Moving instances only refit the boxes from
+// the leaves up, and once refitting has made the tree much worse than a fresh one it is rebuilt. Adding or
+// removing instances rebuilds on the next Update. Nothing here touches OpenGL.
+
+#ifndef BVH_H
+#define BVH_H
+#include <glm/glm.hpp>
+#include "Bounds.h"
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cfloat>
+#include <iostream>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BVH_SSE 1
+#endif
+
+const unsigned int BVH_LEAF_SIZE = 4;   // most instances in one leaf lane
+const unsigned int BVH_BINS = 16;       // split candidates per axis
+const float BVH_REBUILD_GROWTH = 1.5f;  // refitted node area, against the area right after the build, that rebuilds
+const int BVH_STACK = 256;              // nodes waiting during a query, far more than the depth of any real tree
+
+// four children, boxes stored lane by lane for the SSE tests
+struct BvhNode {
+    float minX[4], minY[4], minZ[4];
+    float maxX[4], maxY[4], maxZ[4];
+    int child[4];          // node index, or the first of its instances in the leaf order for a leaf lane
+    unsigned int count[4]; // instances of a leaf lane, 0 for a node
+    int used;              // bit per lane holding something
+};
+
+class Bvh
+{
+public:
+    // a new instance, its number is passed back by the queries. Returns the handle for Move and Remove
+    int Insert(const AABB& box, unsigned int data)
+    {
+        int proxy;
+        if (!freeProxies.empty())
+        {
+            proxy = freeProxies.back();
+            freeProxies.pop_back();
+        }
+        else
+        {
+            proxy = (int)proxies.size();
+            proxies.push_back(Proxy());
+        }
+        proxies[proxy].box = box;
+        proxies[proxy].data = data;
+        proxies[proxy].live = true;
+        live++;
+        structureChanged = true;
+        return proxy;
+    }
+
+    void Move(int proxy, const AABB& box)
+    {
+        proxies[proxy].box = box;
+        moved = true;
+    }
+
+    void Remove(int proxy)
+    {
+        proxies[proxy].live = false;
+        freeProxies.push_back(proxy);
+        live--;
+        structureChanged = true;
+    }
+
+    unsigned int Count() const
+    {
+        return live;
+    }
+
+    unsigned int NodeCount() const
+    {
+        return (unsigned int)nodes.size();
+    }
+
+    // brings the tree up to date after Insert, Move or Remove, call before querying
+    void Update()
+    {
+        if (structureChanged)
+            Build();
+        else if (moved)
+            Refit();
+    }
+
+    // a fresh tree over every live instance
+    void Build()
+    {
+        Clock::time_point start = Clock::now();
+        items.clear();
+        nodes.clear();
+        binary.clear();
+        centroids.resize(proxies.size());
+        for (unsigned int i = 0; i < proxies.size(); i++)
+        {
+            if (!proxies[i].live)
+                continue;
+            items.push_back((int)i);
+            centroids[i] = proxies[i].box.Center();
+        }
+        if (!items.empty())
+        {
+            split(0, (unsigned int)items.size());
+            if (binary[0].left < 0)
+            {
+                // few enough for a single leaf
+                nodes.push_back(emptyNode());
+                setLane(nodes[0], 0, binary[0].box, (int)binary[0].first, binary[0].count);
+            }
+            else
+                collapse(0);
+        }
+        builtArea = area();
+        structureChanged = moved = false;
+        builds++;
+        buildMs = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+    }
+
+    // new boxes for moved instances, children always come after their parent so one backward sweep does it
+    void Refit()
+    {
+        Clock::time_point start = Clock::now();
+        for (int n = (int)nodes.size() - 1; n >= 0; n--)
+        {
+            BvhNode& node = nodes[n];
+            for (int k = 0; k < 4; k++)
+            {
+                if (!(node.used & (1 << k)))
+                    continue;
+                AABB box;
+                if (node.count[k])
+                {
+                    for (unsigned int i = 0; i < node.count[k]; i++)
+                        box.Grow(proxies[items[node.child[k] + i]].box);
+                }
+                else
+                    box = nodeBox(nodes[node.child[k]]);
+                setLane(node, k, box, node.child[k], node.count[k]);
+            }
+        }
+        moved = false;
+        refits++;
+        refitMs = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+        if (area() > builtArea * BVH_REBUILD_GROWTH)
+        {
+            Build();
+            rebuilds++;
+        }
+    }
+
+    // every instance whose box is at least partly inside the frustum
+    template <typename Visit>
+    void Query(const Frustum& frustum, Visit visit) const
+    {
+        if (nodes.empty())
+            return;
+        int stack[BVH_STACK];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0)
+        {
+            const BvhNode& node = nodes[stack[--top]];
+            int mask = frustumMask(node, frustum) & node.used;
+            for (int k = 0; k < 4; k++)
+            {
+                if (!(mask & (1 << k)))
+                    continue;
+                if (!node.count[k])
+                {
+                    stack[top++] = node.child[k];
+                    continue;
+                }
+                for (unsigned int i = 0; i < node.count[k]; i++)
+                {
+                    const Proxy& proxy = proxies[items[node.child[k] + i]];
+                    if (frustum.BoxVisible(proxy.box))
+                        visit(proxy.data);
+                }
+            }
+        }
+    }
+
+    // every instance whose box touches the sphere
+    template <typename Visit>
+    void Query(const glm::vec3& centre, float radius, Visit visit) const
+    {
+        if (nodes.empty())
+            return;
+        int stack[BVH_STACK];
+        int top = 0;
+        stack[top++] = 0;
+        float radius2 = radius * radius;
+        while (top > 0)
+        {
+            const BvhNode& node = nodes[stack[--top]];
+            int mask = sphereMask(node, centre, radius2) & node.used;
+            for (int k = 0; k < 4; k++)
+            {
+                if (!(mask & (1 << k)))
+                    continue;
+                if (!node.count[k])
+                {
+                    stack[top++] = node.child[k];
+                    continue;
+                }
+                for (unsigned int i = 0; i < node.count[k]; i++)
+                {
+                    const Proxy& proxy = proxies[items[node.child[k] + i]];
+                    glm::vec3 d = glm::max(glm::max(proxy.box.min - centre, centre - proxy.box.max), glm::vec3(0.0f));
+                    if (glm::dot(d, d) <= radius2)
+                        visit(proxy.data);
+                }
+            }
+        }
+    }
+
+    // walks the boxes along the ray nearest first. hit(data, tBox, tMax) is called for every instance box the ray
+    // enters before tMax, and returns true after lowering tMax to a hit it found, so a finer test such as the
+    // triangles of a mesh can stand behind each box. Returns whether anything was hit
+    template <typename Hit>
+    bool Raycast(const glm::vec3& origin, const glm::vec3& dir, float& tMax, Hit hit) const
+    {
+        if (nodes.empty())
+            return false;
+        glm::vec3 inv = InverseDir(dir);
+        struct Entry {
+            int node;
+            float t;
+        };
+        Entry stack[BVH_STACK];
+        int top = 0;
+        stack[top++] = Entry{ 0, 0.0f };
+        bool found = false;
+        while (top > 0)
+        {
+            Entry entry = stack[--top];
+            if (entry.t > tMax)
+                continue;
+            const BvhNode& node = nodes[entry.node];
+            float tNear[4];
+            int mask = rayMask(node, origin, inv, tMax, tNear) & node.used;
+            // nodes are pushed furthest first so the nearest is taken next
+            Entry children[4];
+            int childCount = 0;
+            for (int k = 0; k < 4; k++)
+            {
+                if (!(mask & (1 << k)))
+                    continue;
+                if (!node.count[k])
+                {
+                    children[childCount++] = Entry{ node.child[k], tNear[k] };
+                    continue;
+                }
+                for (unsigned int i = 0; i < node.count[k]; i++)
+                {
+                    const Proxy& proxy = proxies[items[node.child[k] + i]];
+                    float tBox;
+                    if (RayBox(proxy.box, origin, inv, tMax, tBox) && hit(proxy.data, tBox, tMax))
+                        found = true;
+                }
+            }
+            for (int c = 1; c < childCount; c++)
+                for (int j = c; j > 0 && children[j - 1].t < children[j].t; j--)
+                    std::swap(children[j - 1], children[j]);
+            for (int c = 0; c < childCount; c++)
+                stack[top++] = children[c];
+        }
+        return found;
+    }
+
+    // the nearest instance box along the ray
+    bool Raycast(const glm::vec3& origin, const glm::vec3& dir, float& tMax, unsigned int& data) const
+    {
+        return Raycast(origin, dir, tMax, [&](unsigned int hitData, float tBox, float& t)
+        {
+            t = tBox;
+            data = hitData;
+            return true;
+        });
+    }
+
+    // slab test with the ray's inverse direction, where it enters the box when that is before tMax
+    static bool RayBox(const AABB& box, const glm::vec3& origin, const glm::vec3& inv, float tMax, float& tEnter)
+    {
+        glm::vec3 t1 = (box.min - origin) * inv;
+        glm::vec3 t2 = (box.max - origin) * inv;
+        glm::vec3 tLow = glm::min(t1, t2);
+        glm::vec3 tHigh = glm::max(t1, t2);
+        tEnter = std::max(std::max(tLow.x, tLow.y), std::max(tLow.z, 0.0f));
+        float tExit = std::min(std::min(tHigh.x, tHigh.y), std::min(tHigh.z, tMax));
+        return tEnter <= tExit;
+    }
+
+    // 1 / dir with zero components nudged so the slab tests never multiply zero by infinity
+    static glm::vec3 InverseDir(const glm::vec3& dir)
+    {
+        glm::vec3 inv;
+        for (int i = 0; i < 3; i++)
+            inv[i] = 1.0f / (std::fabs(dir[i]) > 1e-20f ? dir[i] : (dir[i] < 0.0f ? -1e-20f : 1e-20f));
+        return inv;
+    }
+
+    void Report(float time)
+    {
+        if (time - lastReport < 2.0f)
+            return;
+        lastReport = time;
+        std::cout << "Scene BVH: " << live << " instances in " << nodes.size() << " nodes, build " << buildMs << " ms, refit "
+            << refitMs << " ms, " << builds << " builds (" << rebuilds << " after refits)" << std::endl;
+    }
+
+private:
+    typedef std::chrono::high_resolution_clock Clock;
+
+    struct Proxy {
+        AABB box;
+        unsigned int data = 0;
+        bool live = false;
+    };
+
+    // binary tree the build makes before folding it into four wide nodes
+    struct BinaryNode {
+        AABB box;
+        int left, right;     // -1 for a leaf
+        unsigned int first, count;
+    };
+
+    std::vector<Proxy> proxies;
+    std::vector<int> freeProxies;
+    std::vector<int> items;          // live proxies in leaf order
+    std::vector<glm::vec3> centroids;
+    std::vector<BinaryNode> binary;
+    std::vector<BvhNode> nodes;
+    unsigned int live = 0;
+    bool structureChanged = false, moved = false;
+    float builtArea = 0.0f;
+    float buildMs = 0.0f, refitMs = 0.0f;
+    unsigned int builds = 0, refits = 0, rebuilds = 0;
+    float lastReport = 0.0f;
+
+    static float surfaceArea(const AABB& box)
+    {
+        if (!box.Valid())
+            return 0.0f;
+        glm::vec3 d = box.max - box.min;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    static BvhNode emptyNode()
+    {
+        BvhNode node;
+        for (int k = 0; k < 4; k++)
+        {
+            node.minX[k] = node.minY[k] = node.minZ[k] = FLT_MAX;
+            node.maxX[k] = node.maxY[k] = node.maxZ[k] = -FLT_MAX;
+            node.child[k] = -1;
+            node.count[k] = 0;
+        }
+        node.used = 0;
+        return node;
+    }
+
+    static void setLane(BvhNode& node, int k, const AABB& box, int child, unsigned int count)
+    {
+        node.minX[k] = box.min.x;
+        node.minY[k] = box.min.y;
+        node.minZ[k] = box.min.z;
+        node.maxX[k] = box.max.x;
+        node.maxY[k] = box.max.y;
+        node.maxZ[k] = box.max.z;
+        node.child[k] = child;
+        node.count[k] = count;
+        node.used |= 1 << k;
+    }
+
+    static AABB nodeBox(const BvhNode& node)
+    {
+        AABB box;
+        for (int k = 0; k < 4; k++)
+        {
+            if (!(node.used & (1 << k)))
+                continue;
+            box.Grow(glm::vec3(node.minX[k], node.minY[k], node.minZ[k]));
+            box.Grow(glm::vec3(node.maxX[k], node.maxY[k], node.maxZ[k]));
+        }
+        return box;
+    }
+
+    // summed area of every lane, what the surface area heuristic charges for a query
+    float area() const
+    {
+        float sum = 0.0f;
+        for (const BvhNode& node : nodes)
+            for (int k = 0; k < 4; k++)
+                if (node.used & (1 << k))
+                    sum += surfaceArea(AABB{ glm::vec3(node.minX[k], node.minY[k], node.minZ[k]), glm::vec3(node.maxX[k], node.maxY[k], node.maxZ[k]) });
+        return sum;
+    }
+
+    // binary node over items[first, first + count), splitting at the cheapest bin boundary of the widest spread
+    int split(unsigned int first, unsigned int count)
+    {
+        int index = (int)binary.size();
+        binary.push_back(BinaryNode());
+        AABB box, centres;
+        for (unsigned int i = first; i < first + count; i++)
+        {
+            box.Grow(proxies[items[i]].box);
+            centres.Grow(centroids[items[i]]);
+        }
+        binary[index].box = box;
+        binary[index].first = first;
+        binary[index].count = count;
+        binary[index].left = binary[index].right = -1;
+        if (count <= BVH_LEAF_SIZE)
+            return index;
+
+        int bestAxis = -1;
+        unsigned int bestBin = 0;
+        float bestCost = FLT_MAX;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float extent = centres.max[axis] - centres.min[axis];
+            if (extent <= 0.0f)
+                continue;
+            AABB binBoxes[BVH_BINS];
+            unsigned int binCounts[BVH_BINS] = {};
+            float scale = BVH_BINS / extent;
+            for (unsigned int i = first; i < first + count; i++)
+            {
+                unsigned int b = binOf(centroids[items[i]][axis], centres.min[axis], scale);
+                binBoxes[b].Grow(proxies[items[i]].box);
+                binCounts[b]++;
+            }
+            // areas left of every boundary sweeping forwards, right of it sweeping back
+            float leftArea[BVH_BINS - 1];
+            unsigned int leftCount[BVH_BINS - 1];
+            AABB grow;
+            unsigned int n = 0;
+            for (unsigned int b = 0; b < BVH_BINS - 1; b++)
+            {
+                grow.Grow(binBoxes[b]);
+                n += binCounts[b];
+                leftArea[b] = surfaceArea(grow);
+                leftCount[b] = n;
+            }
+            grow = AABB();
+            n = 0;
+            for (unsigned int b = BVH_BINS - 1; b > 0; b--)
+            {
+                grow.Grow(binBoxes[b]);
+                n += binCounts[b];
+                if (leftCount[b - 1] == 0 || n == 0)
+                    continue;
+                float cost = leftArea[b - 1] * leftCount[b - 1] + surfaceArea(grow) * n;
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = b;
+                }
+            }
+        }
+
+        unsigned int middle = first + count / 2;
+        if (bestAxis >= 0)
+        {
+            float scale = BVH_BINS / (centres.max[bestAxis] - centres.min[bestAxis]);
+            float lo = centres.min[bestAxis];
+            const std::vector<glm::vec3>& c = centroids;
+            middle = (unsigned int)(std::partition(items.begin() + first, items.begin() + first + count, [&](int proxy)
+            {
+                return binOf(c[proxy][bestAxis], lo, scale) < bestBin;
+            }) - items.begin());
+        }
+        // every centre in one spot, halves in whatever order they are in
+        if (middle == first || middle == first + count)
+            middle = first + count / 2;
+
+        int left = split(first, middle - first);
+        int right = split(middle, first + count - middle);
+        binary[index].left = left;
+        binary[index].right = right;
+        return index;
+    }
+
+    static unsigned int binOf(float centre, float lo, float scale)
+    {
+        unsigned int b = (unsigned int)((centre - lo) * scale);
+        return b < BVH_BINS ? b : BVH_BINS - 1;
+    }
+
+    // four wide node from a binary node, opening the largest child nodes until there are four lanes
+    int collapse(int b)
+    {
+        int index = (int)nodes.size();
+        nodes.push_back(emptyNode());
+        int lanes[4] = { binary[b].left, binary[b].right, -1, -1 };
+        int laneCount = 2;
+        while (laneCount < 4)
+        {
+            int widest = -1;
+            float widestArea = -1.0f;
+            for (int k = 0; k < laneCount; k++)
+            {
+                const BinaryNode& lane = binary[lanes[k]];
+                if (lane.left >= 0 && surfaceArea(lane.box) > widestArea)
+                {
+                    widest = k;
+                    widestArea = surfaceArea(lane.box);
+                }
+            }
+            if (widest < 0)
+                break;
+            int opened = lanes[widest];
+            lanes[widest] = binary[opened].left;
+            lanes[laneCount++] = binary[opened].right;
+        }
+        for (int k = 0; k < laneCount; k++)
+        {
+            const BinaryNode& lane = binary[lanes[k]];
+            if (lane.left < 0)
+                setLane(nodes[index], k, lane.box, (int)lane.first, lane.count);
+            else
+            {
+                int child = collapse(lanes[k]); // may grow nodes, so nodes[index] is looked up again after
+                setLane(nodes[index], k, lane.box, child, 0);
+            }
+        }
+        return index;
+    }
+
+    // lanes whose box is on the inside of all six planes
+    static int frustumMask(const BvhNode& node, const Frustum& frustum)
+    {
+#ifdef BVH_SSE
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int i = 0; i < 6; i++)
+        {
+            const glm::vec4& p = frustum.planes[i];
+            // corner of each box furthest along the plane normal
+            __m128 x = _mm_loadu_ps(p.x > 0.0f ? node.maxX : node.minX);
+            __m128 y = _mm_loadu_ps(p.y > 0.0f ? node.maxY : node.minY);
+            __m128 z = _mm_loadu_ps(p.z > 0.0f ? node.maxZ : node.minZ);
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(p.x)), _mm_mul_ps(y, _mm_set1_ps(p.y))),
+                _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(p.z)), _mm_set1_ps(p.w)));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(d, _mm_setzero_ps()));
+        }
+        return _mm_movemask_ps(inside);
+#else
+        int mask = 0;
+        for (int k = 0; k < 4; k++)
+            if (frustum.BoxVisible(AABB{ glm::vec3(node.minX[k], node.minY[k], node.minZ[k]), glm::vec3(node.maxX[k], node.maxY[k], node.maxZ[k]) }))
+                mask |= 1 << k;
+        return mask;
+#endif
+    }
+
+    // lanes whose box the ray enters before tMax, with where it enters
+    static int rayMask(const BvhNode& node, const glm::vec3& origin, const glm::vec3& inv, float tMax, float* tNear)
+    {
+#ifdef BVH_SSE
+        __m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z);
+        __m128 ix = _mm_set1_ps(inv.x), iy = _mm_set1_ps(inv.y), iz = _mm_set1_ps(inv.z);
+        __m128 x1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minX), ox), ix);
+        __m128 x2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxX), ox), ix);
+        __m128 y1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minY), oy), iy);
+        __m128 y2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxY), oy), iy);
+        __m128 z1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minZ), oz), iz);
+        __m128 z2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxZ), oz), iz);
+        __m128 enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(x1, x2), _mm_min_ps(y1, y2)), _mm_max_ps(_mm_min_ps(z1, z2), _mm_setzero_ps()));
+        __m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(x1, x2), _mm_max_ps(y1, y2)), _mm_min_ps(_mm_max_ps(z1, z2), _mm_set1_ps(tMax)));
+        _mm_storeu_ps(tNear, enter);
+        return _mm_movemask_ps(_mm_cmple_ps(enter, exit));
+#else
+        int mask = 0;
+        for (int k = 0; k < 4; k++)
+            if (RayBox(AABB{ glm::vec3(node.minX[k], node.minY[k], node.minZ[k]), glm::vec3(node.maxX[k], node.maxY[k], node.maxZ[k]) }, origin, inv, tMax, tNear[k]))
+                mask |= 1 << k;
+        return mask;
+#endif
+    }
+
+    // lanes whose box is within the radius, distances squared
+    static int sphereMask(const BvhNode& node, const glm::vec3& centre, float radius2)
+    {
+#ifdef BVH_SSE
+        __m128 zero = _mm_setzero_ps();
+        __m128 cx = _mm_set1_ps(centre.x), cy = _mm_set1_ps(centre.y), cz = _mm_set1_ps(centre.z);
+        __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(node.minX), cx), _mm_sub_ps(cx, _mm_loadu_ps(node.maxX))), zero);
+        __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(node.minY), cy), _mm_sub_ps(cy, _mm_loadu_ps(node.maxY))), zero);
+        __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(node.minZ), cz), _mm_sub_ps(cz, _mm_loadu_ps(node.maxZ))), zero);
+        __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+        return _mm_movemask_ps(_mm_cmple_ps(d2, _mm_set1_ps(radius2)));
+#else
+        int mask = 0;
+        for (int k = 0; k < 4; k++)
+        {
+            glm::vec3 lo(node.minX[k], node.minY[k], node.minZ[k]), hi(node.maxX[k], node.maxY[k], node.maxZ[k]);
+            glm::vec3 d = glm::max(glm::max(lo - centre, centre - hi), glm::vec3(0.0f));
+            if (glm::dot(d, d) <= radius2)
+                mask |= 1 << k;
+        }
+        return mask;
+#endif
+    }
+};
+#endif
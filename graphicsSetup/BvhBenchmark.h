@@ -0,0 +1,203 @@
+// Scene BVH microbenchmarks
+// Started with --bvhbench, runs before the window opens and quits. Scatters instance boxes over a square of
+// ground like a large town, then times a full build, a refit after every instance has moved a little, and
+// frustum, ray and sphere queries against the same queries walking the flat list. The query results of both are
+// compared so a broken tree shows up as a mismatch rather than a fast number.
+
+#ifndef BVHBENCHMARK_H
+#define BVHBENCHMARK_H
+#include "Bvh.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <chrono>
+#include <random>
+#include <cstdio>
+#include <vector>
+
+class BvhBenchmark
+{
+public:
+    unsigned int instances = 100000;
+    float worldSize = 2000.0f;     // side of the square the instances are spread over, in metres
+    unsigned int frustums = 200;
+    unsigned int rays = 100000;
+    unsigned int spheres = 100000;
+    float sphereRadius = 15.0f;    // about how far a sound or a point light reaches
+    unsigned int linearSamples = 200; // queries of each kind timed on the flat list, it is far slower
+
+    void Run()
+    {
+        std::mt19937 random(1234);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        boxes.resize(instances);
+        for (unsigned int i = 0; i < instances; i++)
+        {
+            glm::vec3 pos((unit(random) - 0.5f) * worldSize, unit(random) * 5.0f, (unit(random) - 0.5f) * worldSize);
+            glm::vec3 half(0.25f + unit(random) * 2.0f, 0.5f + unit(random) * 4.0f, 0.25f + unit(random) * 2.0f);
+            boxes[i].min = pos - half;
+            boxes[i].max = pos + half;
+        }
+
+        Bvh bvh;
+        std::vector<int> proxies(instances);
+        for (unsigned int i = 0; i < instances; i++)
+            proxies[i] = bvh.Insert(boxes[i], i);
+        Clock::time_point start = Clock::now();
+        bvh.Build();
+        double build = seconds(start);
+
+        // every instance shuffles up to half a metre, like a crowd between two frames
+        for (unsigned int i = 0; i < instances; i++)
+        {
+            glm::vec3 step((unit(random) - 0.5f), 0.0f, (unit(random) - 0.5f));
+            boxes[i].min += step;
+            boxes[i].max += step;
+            bvh.Move(proxies[i], boxes[i]);
+        }
+        start = Clock::now();
+        bvh.Refit();
+        double refit = seconds(start);
+
+        std::printf("Scene BVH, %u instances in %u nodes\n", instances, bvh.NodeCount());
+        std::printf("build %.2f ms, refit %.2f ms\n", build * 1000.0, refit * 1000.0);
+        std::printf("%10s %14s %14s %10s %12s %9s\n", "query", "bvh /s", "list /s", "speedup", "hits each", "matches");
+        frustumRow(bvh, random);
+        rayRow(bvh, random);
+        sphereRow(bvh, random);
+    }
+
+private:
+    typedef std::chrono::high_resolution_clock Clock;
+    std::vector<AABB> boxes;
+
+    static double seconds(Clock::time_point start)
+    {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    static void row(const char* name, double bvhTime, unsigned int bvhCount, double listTime, unsigned int listCount, double hits, bool matches)
+    {
+        double bvhRate = bvhCount / bvhTime;
+        double listRate = listCount / listTime;
+        std::printf("%10s %14.0f %14.0f %9.1fx %12.1f %9s\n", name, bvhRate, listRate, bvhRate / listRate, hits, matches ? "yes" : "NO");
+    }
+
+    glm::vec3 groundPoint(std::mt19937& random) const
+    {
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        return glm::vec3((unit(random) - 0.5f) * worldSize, 2.0f, (unit(random) - 0.5f) * worldSize);
+    }
+
+    // a camera at head height looking somewhere level, seeing 300 m like the scene's far plane
+    void frustumRow(const Bvh& bvh, std::mt19937& random)
+    {
+        std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 300.0f);
+        std::vector<Frustum> views(frustums);
+        for (unsigned int i = 0; i < frustums; i++)
+        {
+            glm::vec3 eye = groundPoint(random);
+            float a = angle(random);
+            views[i] = Frustum(projection * glm::lookAt(eye, eye + glm::vec3(std::cos(a), -0.1f, std::sin(a)), glm::vec3(0.0f, 1.0f, 0.0f)));
+        }
+        std::vector<unsigned int> bvhHits(frustums, 0), listHits(frustums, 0);
+        Clock::time_point start = Clock::now();
+        for (unsigned int i = 0; i < frustums; i++)
+            bvh.Query(views[i], [&](unsigned int) { bvhHits[i]++; });
+        double bvhTime = seconds(start);
+        unsigned int samples = std::min(linearSamples, frustums);
+        start = Clock::now();
+        for (unsigned int i = 0; i < samples; i++)
+            for (const AABB& box : boxes)
+                if (views[i].BoxVisible(box))
+                    listHits[i]++;
+        double listTime = seconds(start);
+        row("frustum", bvhTime, frustums, listTime, samples, average(bvhHits), matches(bvhHits, listHits, samples));
+    }
+
+    // nearest box along rays from head height towards random points on the ground
+    void rayRow(const Bvh& bvh, std::mt19937& random)
+    {
+        std::vector<glm::vec3> origins(rays), dirs(rays);
+        for (unsigned int i = 0; i < rays; i++)
+        {
+            origins[i] = groundPoint(random);
+            glm::vec3 target = origins[i] + (groundPoint(random) - origins[i]) * 0.05f;
+            target.y = 0.0f;
+            dirs[i] = glm::normalize(target - origins[i]);
+        }
+        std::vector<unsigned int> bvhHits(rays, 0), listHits(rays, 0);
+        std::vector<float> bvhT(rays), listT(rays);
+        Clock::time_point start = Clock::now();
+        for (unsigned int i = 0; i < rays; i++)
+        {
+            float t = FLT_MAX;
+            unsigned int data;
+            bvhHits[i] = bvh.Raycast(origins[i], dirs[i], t, data) ? 1 : 0;
+            bvhT[i] = t;
+        }
+        double bvhTime = seconds(start);
+        unsigned int samples = std::min(linearSamples, rays);
+        start = Clock::now();
+        for (unsigned int i = 0; i < samples; i++)
+        {
+            glm::vec3 inv = Bvh::InverseDir(dirs[i]);
+            float t = FLT_MAX;
+            for (const AABB& box : boxes)
+            {
+                float enter;
+                if (Bvh::RayBox(box, origins[i], inv, t, enter))
+                {
+                    t = enter;
+                    listHits[i] = 1;
+                }
+            }
+            listT[i] = t;
+        }
+        double listTime = seconds(start);
+        bool same = matches(bvhHits, listHits, samples);
+        for (unsigned int i = 0; i < samples; i++)
+            same = same && (!listHits[i] || std::fabs(bvhT[i] - listT[i]) < 1e-3f);
+        row("ray", bvhTime, rays, listTime, samples, average(bvhHits), same);
+    }
+
+    void sphereRow(const Bvh& bvh, std::mt19937& random)
+    {
+        std::vector<glm::vec3> centres(spheres);
+        for (unsigned int i = 0; i < spheres; i++)
+            centres[i] = groundPoint(random);
+        std::vector<unsigned int> bvhHits(spheres, 0), listHits(spheres, 0);
+        Clock::time_point start = Clock::now();
+        for (unsigned int i = 0; i < spheres; i++)
+            bvh.Query(centres[i], sphereRadius, [&](unsigned int) { bvhHits[i]++; });
+        double bvhTime = seconds(start);
+        unsigned int samples = std::min(linearSamples, spheres);
+        float radius2 = sphereRadius * sphereRadius;
+        start = Clock::now();
+        for (unsigned int i = 0; i < samples; i++)
+            for (const AABB& box : boxes)
+            {
+                glm::vec3 d = glm::max(glm::max(box.min - centres[i], centres[i] - box.max), glm::vec3(0.0f));
+                if (glm::dot(d, d) <= radius2)
+                    listHits[i]++;
+            }
+        double listTime = seconds(start);
+        row("sphere", bvhTime, spheres, listTime, samples, average(bvhHits), matches(bvhHits, listHits, samples));
+    }
+
+    static double average(const std::vector<unsigned int>& hits)
+    {
+        double total = 0.0;
+        for (unsigned int h : hits)
+            total += h;
+        return hits.empty() ? 0.0 : total / hits.size();
+    }
+
+    static bool matches(const std::vector<unsigned int>& a, const std::vector<unsigned int>& b, unsigned int count)
+    {
+        for (unsigned int i = 0; i < count; i++)
+            if (a[i] != b[i])
+                return false;
+        return true;
+    }
+};
+#endif
@@ -0,0 +1,192 @@
+// DDS files of block compressed textures
+// DDS reference https://learn.microsoft.com/en-us/windows/win32/direct3ddds/dx-graphics-dds-pguide
+// Only what TextureCooker.h writes is read back: BC1, BC3 and BC5 with a full mip chain, stored under the legacy
+// DXT1, DXT5 and ATI2 four character codes so no DX10 header is needed. The blocks are uploaded as they are with
+// glCompressedTexImage2D. BC1 and BC3 come from EXT_texture_compression_s3tc, which every desktop driver has
+// but is not core, so its enums are defined here and the loaders fall back to the source image without it.
+
+#ifndef DDS_H
+#define DDS_H
+#include <glad/glad.h>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+enum DdsFormat { DDS_BC1, DDS_BC3, DDS_BC5 };
+
+struct DdsImage {
+    DdsFormat format = DDS_BC1;
+    int width = 0, height = 0;
+    std::vector<std::vector<unsigned char>> levels; // largest first, blocks in rows from the top of the image
+};
+
+// bytes in one 4x4 block
+inline int DdsBlockBytes(DdsFormat format)
+{
+    return format == DDS_BC1 ? 8 : 16;
+}
+
+inline int DdsLevelBytes(DdsFormat format, int width, int height)
+{
+    return ((width + 3) / 4) * ((height + 3) / 4) * DdsBlockBytes(format);
+}
+
+inline GLenum DdsGLFormat(DdsFormat format)
+{
+    switch (format)
+    {
+    case DDS_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case DDS_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    default: return GL_COMPRESSED_RG_RGTC2;
+    }
+}
+
+// the s3tc formats need the extension, RGTC for BC5 is core since 3.0
+inline bool DdsSupported(DdsFormat format)
+{
+    static int s3tc = -1;
+    if (format == DDS_BC5)
+        return true;
+    if (s3tc < 0)
+    {
+        s3tc = 0;
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; i++)
+            if (std::strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), "GL_EXT_texture_compression_s3tc") == 0)
+                s3tc = 1;
+    }
+    return s3tc == 1;
+}
+
+namespace dds {
+    const uint32_t MAGIC = 0x20534444; // "DDS "
+    const uint32_t FLAGS = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000; // caps, height, width, pixel format, mip count, linear size
+    const uint32_t PF_FOURCC = 0x4;
+    const uint32_t CAPS_TEXTURE = 0x1000, CAPS_COMPLEX = 0x8, CAPS_MIPMAP = 0x400000;
+
+    struct PixelFormat {
+        uint32_t size, flags, fourCC, rgbBitCount, rMask, gMask, bMask, aMask;
+    };
+
+    struct Header {
+        uint32_t size, flags, height, width, pitchOrLinearSize, depth, mipMapCount;
+        uint32_t reserved1[11];
+        PixelFormat pixelFormat;
+        uint32_t caps, caps2, caps3, caps4, reserved2;
+    };
+
+    inline uint32_t FourCC(char a, char b, char c, char d)
+    {
+        return (uint32_t)(unsigned char)a | ((uint32_t)(unsigned char)b << 8) | ((uint32_t)(unsigned char)c << 16) | ((uint32_t)(unsigned char)d << 24);
+    }
+
+    inline uint32_t FourCC(DdsFormat format)
+    {
+        switch (format)
+        {
+        case DDS_BC1: return FourCC('D', 'X', 'T', '1');
+        case DDS_BC3: return FourCC('D', 'X', 'T', '5');
+        default: return FourCC('A', 'T', 'I', '2');
+        }
+    }
+}
+
+inline bool WriteDds(const std::string& path, const DdsImage& image)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    dds::Header header;
+    std::memset(&header, 0, sizeof(header));
+    header.size = sizeof(dds::Header);
+    header.flags = dds::FLAGS;
+    header.height = image.height;
+    header.width = image.width;
+    header.pitchOrLinearSize = DdsLevelBytes(image.format, image.width, image.height);
+    header.mipMapCount = (uint32_t)image.levels.size();
+    header.pixelFormat.size = sizeof(dds::PixelFormat);
+    header.pixelFormat.flags = dds::PF_FOURCC;
+    header.pixelFormat.fourCC = dds::FourCC(image.format);
+    header.caps = dds::CAPS_TEXTURE | (image.levels.size() > 1 ? dds::CAPS_COMPLEX | dds::CAPS_MIPMAP : 0);
+    file.write((const char*)&dds::MAGIC, sizeof(dds::MAGIC));
+    file.write((const char*)&header, sizeof(header));
+    for (const std::vector<unsigned char>& level : image.levels)
+        file.write((const char*)&level[0], level.size());
+    return (bool)file;
+}
+
+// false when the file is missing or is not one the cooker wrote
+inline bool ReadDds(const std::string& path, DdsImage& image)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    uint32_t magic = 0;
+    dds::Header header;
+    file.read((char*)&magic, sizeof(magic));
+    file.read((char*)&header, sizeof(header));
+    if (!file || magic != dds::MAGIC || header.size != sizeof(dds::Header) || !(header.pixelFormat.flags & dds::PF_FOURCC))
+        return false;
+    DdsFormat formats[] = { DDS_BC1, DDS_BC3, DDS_BC5 };
+    bool known = false;
+    for (DdsFormat format : formats)
+        if (header.pixelFormat.fourCC == dds::FourCC(format))
+        {
+            image.format = format;
+            known = true;
+        }
+    if (!known || header.width == 0 || header.height == 0)
+        return false;
+    image.width = header.width;
+    image.height = header.height;
+    image.levels.assign(header.mipMapCount ? header.mipMapCount : 1, std::vector<unsigned char>());
+    int w = image.width, h = image.height;
+    for (std::vector<unsigned char>& level : image.levels)
+    {
+        level.resize(DdsLevelBytes(image.format, w, h));
+        file.read((char*)&level[0], level.size());
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+    }
+    if (!file)
+    {
+        std::cout << "DDS file is cut short: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// uploads the levels into target of the bound texture, only the first when mips is false
+inline void UploadDds(GLenum target, const DdsImage& image, bool mips = true)
+{
+    int count = mips ? (int)image.levels.size() : 1;
+    int w = image.width, h = image.height;
+    for (int level = 0; level < count; level++)
+    {
+        glCompressedTexImage2D(target, level, DdsGLFormat(image.format), w, h, 0, (GLsizei)image.levels[level].size(), &image.levels[level][0]);
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+    }
+}
+
+// where the cooked copy of an image lives, the same name with .dds on the end
+inline std::string DdsPath(const std::string& imagePath)
+{
+    std::string::size_type dot = imagePath.find_last_of('.');
+    std::string::size_type slash = imagePath.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return imagePath + ".dds";
+    return imagePath.substr(0, dot) + ".dds";
+}
+#endif
@@ -0,0 +1,265 @@
+// Deferred renderer, an alternative to lighting every fragment in manyLights.fs
+// Deferred shading reference https://learnopengl.com/Advanced-Lighting/Deferred-Shading
+// The opaque meshes write a thin G-buffer: albedo in RGBA8 and an octahedral normal with the material id in
+// RGB10_A2. The position is rebuilt from the scene depth, which is the HDR target's own depth texture so fog,
+// culling and snow keep working. A single fullscreen pass then lights each pixel once. Extra point lights are
+// binned on the cpu into screen tiles so a pixel only loops over the lights whose range covers its tile.
+
+#ifndef DEFERRED_H
+#define DEFERRED_H
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "shader.h"
+#include "DrawList.h"
+#include "LightBuffer.h"
+#include <vector>
+#include <string>
+#include <cfloat>
+#include <iostream>
+
+const int DEFERRED_TILE_SIZE = 16; // pixels per side of a light tile
+
+class DeferredRenderer
+{
+public:
+    DeferredRenderer()
+        : geometryShader("manyLights.vs", "gbuffer.fs"), lightShader("hiz.vs", "deferred.fs")
+    {
+        glGenFramebuffers(1, &gBufferFBO);
+        glGenFramebuffers(1, &lightFBO);
+        glGenVertexArrays(1, &emptyVAO);
+        glGenBuffers(1, &tileLightsTBO);
+        glGenTextures(1, &tileLightsTex);
+        glBindBuffer(GL_TEXTURE_BUFFER, tileLightsTBO);
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(unsigned int), NULL, GL_STREAM_DRAW);
+        glBindTexture(GL_TEXTURE_BUFFER, tileLightsTex);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, tileLightsTBO);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    ~DeferredRenderer()
+    {
+        glDeleteFramebuffers(1, &gBufferFBO);
+        glDeleteFramebuffers(1, &lightFBO);
+        glDeleteVertexArrays(1, &emptyVAO);
+        glDeleteTextures(1, &tileLightsTex);
+        glDeleteBuffers(1, &tileLightsTBO);
+        if (albedoTex)
+        {
+            glDeleteTextures(1, &albedoTex);
+            glDeleteTextures(1, &normalTex);
+            glDeleteTextures(1, &tileRangesTex);
+        }
+    }
+
+    // draws the G-buffer for anything drawn with it, textured surfaces keep materialId 0
+    Shader& GeometryShader()
+    {
+        return geometryShader;
+    }
+
+    // the light pass reads the same lighting uniforms as manyLights.fs and shad.fs, set them on this too
+    Shader& LightShader()
+    {
+        return lightShader;
+    }
+
+    // binds the G-buffer on top of the scene depth, which is neither cleared nor resized here. The depth is
+    // attached every frame since the HDR target makes a new one when the window changes size
+    void Begin(int width, int height, unsigned int depthTex)
+    {
+        bool resized = width != texW || height != texH;
+        if (resized)
+            textureSetup(width, height);
+        glBindFramebuffer(GL_FRAMEBUFFER, gBufferFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthTex, 0);
+        if (resized && glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "G-buffer failed to complete :(" << std::endl;
+        glViewport(0, 0, texW, texH);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+
+    // the draw list's batches, each item's material id goes into the G-buffer for the light pass to look up
+    void Draw(DrawList& list, const glm::mat4& view, const glm::mat4& projection)
+    {
+        geometryShader.use();
+        geometryShader.setMat4("view", view);
+        geometryShader.setMat4("projection", projection);
+        geometryShader.setBool("instanced", false);
+        list.BeginItems(geometryShader);
+        for (const DrawBatch& batch : list.Batches())
+            list.Submit(geometryShader, batch);
+        list.EndItems();
+        drawn = (unsigned int)list.Batches().size();
+    }
+
+    // lights the G-buffer into the HDR colour and leaves sceneFramebuffer bound for whatever draws next
+    void LightPass(const glm::mat4& view, const glm::mat4& projection, LightBuffer& lights, unsigned int hdrColorTex,
+        unsigned int depthTex, unsigned int sceneFramebuffer)
+    {
+        binLights(view, projection, lights);
+
+        // the depth is read here so it cannot be attached, only the colour is
+        glBindFramebuffer(GL_FRAMEBUFFER, lightFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, hdrColorTex, 0);
+        glDisable(GL_DEPTH_TEST);
+        lightShader.use();
+        lightShader.setInt("gAlbedo", 0);
+        lightShader.setInt("gNormal", 1);
+        lightShader.setInt("sceneDepth", 2);
+        lightShader.setInt("extraLights", 3);
+        lightShader.setInt("tileLights", 4);
+        lightShader.setInt("tileRanges", 5);
+        lightShader.setInt("tileSize", DEFERRED_TILE_SIZE);
+        lightShader.setVec2("screenSize", (float)texW, (float)texH);
+        lightShader.setMat4("invViewProj", glm::inverse(projection * view));
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, albedoTex);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, normalTex);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, depthTex);
+        lights.Bind(3);
+        glActiveTexture(GL_TEXTURE4);
+        glBindTexture(GL_TEXTURE_BUFFER, tileLightsTex);
+        glActiveTexture(GL_TEXTURE5);
+        glBindTexture(GL_TEXTURE_2D, tileRangesTex);
+        glBindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        glActiveTexture(GL_TEXTURE0);
+        glEnable(GL_DEPTH_TEST);
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+    }
+
+    void Report(float time)
+    {
+        if (time - lastReport < 2.0f)
+            return;
+        lastReport = time;
+        int tiles = tilesX * tilesY;
+        std::cout << "Deferred: " << drawn << " draws into the G-buffer, " << tiles << " tiles, "
+            << (tiles ? (float)binned / tiles : 0.0f) << " extra lights per tile" << std::endl;
+    }
+
+private:
+    Shader geometryShader;
+    Shader lightShader;
+    unsigned int gBufferFBO = 0, lightFBO = 0, emptyVAO = 0;
+    unsigned int albedoTex = 0, normalTex = 0, tileRangesTex = 0;
+    unsigned int tileLightsTBO = 0, tileLightsTex = 0;
+    int texW = 0, texH = 0;
+    int tilesX = 0, tilesY = 0;
+    std::vector<unsigned int> tileCounts;   // lights per tile, then where each tile's list starts
+    std::vector<unsigned int> tileRanges;   // first index and count per tile
+    std::vector<unsigned int> tileLights;
+    std::vector<glm::ivec4> lightRects;     // tiles covered by each light, x0 y0 x1 y1
+    unsigned int drawn = 0, binned = 0;
+    float lastReport = 0.0f;
+
+    // screen rectangle of every light's sphere, then a counting sort of the lights into the tiles they touch
+    void binLights(const glm::mat4& view, const glm::mat4& projection, const LightBuffer& lights)
+    {
+        int tileCount = tilesX * tilesY;
+        tileCounts.assign(tileCount, 0);
+        lightRects.resize(lights.Count());
+        float nearPlane = projection[3][2] / (projection[2][2] - 1.0f);
+        for (unsigned int i = 0; i < lights.Count(); i++)
+        {
+            const PointLightData& light = lights.lights[i];
+            glm::vec3 c = glm::vec3(view * glm::vec4(light.pos, 1.0f));
+            float r = light.radius;
+            glm::ivec4 rect(0, 0, tilesX - 1, tilesY - 1); // crossing the near plane covers the whole screen
+            if (c.z - r > -nearPlane)
+                rect = glm::ivec4(1, 1, 0, 0); // behind the camera, covers nothing
+            else if (c.z + r < -nearPlane)
+            {
+                // the corners of the box around the sphere, all in front of the camera
+                glm::vec2 lo(FLT_MAX), hi(-FLT_MAX);
+                for (int k = 0; k < 8; k++)
+                {
+                    glm::vec3 corner = c + r * glm::vec3(k & 1 ? 1.0f : -1.0f, k & 2 ? 1.0f : -1.0f, k & 4 ? 1.0f : -1.0f);
+                    glm::vec4 clip = projection * glm::vec4(corner, 1.0f);
+                    glm::vec2 ndc = glm::vec2(clip) / clip.w;
+                    lo = glm::min(lo, ndc);
+                    hi = glm::max(hi, ndc);
+                }
+                glm::vec2 size((float)texW / DEFERRED_TILE_SIZE, (float)texH / DEFERRED_TILE_SIZE);
+                glm::ivec2 a = glm::ivec2(glm::floor((lo * 0.5f + 0.5f) * size));
+                glm::ivec2 b = glm::ivec2(glm::floor((hi * 0.5f + 0.5f) * size));
+                rect = glm::ivec4(glm::max(a.x, 0), glm::max(a.y, 0), glm::min(b.x, tilesX - 1), glm::min(b.y, tilesY - 1));
+            }
+            lightRects[i] = rect;
+            for (int y = rect.y; y <= rect.w; y++)
+                for (int x = rect.x; x <= rect.z; x++)
+                    tileCounts[y * tilesX + x]++;
+        }
+
+        tileRanges.resize(tileCount * 2);
+        unsigned int start = 0;
+        for (int t = 0; t < tileCount; t++)
+        {
+            tileRanges[t * 2] = start;
+            tileRanges[t * 2 + 1] = tileCounts[t];
+            start += tileCounts[t];
+            tileCounts[t] = tileRanges[t * 2];
+        }
+        binned = start;
+        tileLights.resize(glm::max(start, 1u));
+        for (unsigned int i = 0; i < lightRects.size(); i++)
+        {
+            const glm::ivec4& rect = lightRects[i];
+            for (int y = rect.y; y <= rect.w; y++)
+                for (int x = rect.x; x <= rect.z; x++)
+                    tileLights[tileCounts[y * tilesX + x]++] = i;
+        }
+
+        glBindBuffer(GL_TEXTURE_BUFFER, tileLightsTBO);
+        glBufferData(GL_TEXTURE_BUFFER, tileLights.size() * sizeof(unsigned int), &tileLights[0], GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D, tileRangesTex);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, tilesX, tilesY, GL_RG_INTEGER, GL_UNSIGNED_INT, &tileRanges[0]);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    void textureSetup(int width, int height)
+    {
+        if (albedoTex)
+        {
+            glDeleteTextures(1, &albedoTex);
+            glDeleteTextures(1, &normalTex);
+            glDeleteTextures(1, &tileRangesTex);
+        }
+        texW = width;
+        texH = height;
+        tilesX = (texW + DEFERRED_TILE_SIZE - 1) / DEFERRED_TILE_SIZE;
+        tilesY = (texH + DEFERRED_TILE_SIZE - 1) / DEFERRED_TILE_SIZE;
+
+        albedoTex = target(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, texW, texH);
+        normalTex = target(GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV, texW, texH);
+        tileRangesTex = target(GL_RG32UI, GL_RG_INTEGER, GL_UNSIGNED_INT, tilesX, tilesY);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, gBufferFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedoTex, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normalTex, 0);
+        unsigned int attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, attachments);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    static unsigned int target(GLenum internalFormat, GLenum format, GLenum type, int width, int height)
+    {
+        unsigned int tex;
+        glGenTextures(1, &tex);
+        glBindTexture(GL_TEXTURE_2D, tex);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return tex;
+    }
+};
+#endif
@@ -0,0 +1,352 @@
+// Opaque draw list with an optional depth pre-pass
+// Depth pre-pass reference https://therealmjp.github.io/posts/to-early-z-or-not-to-early-z/
+// The opaque meshes of a frame are collected here instead of drawn straight away. They go out front to back so
+// the depth test throws away hidden fragments before manyLights.fs runs its five lights on them. With the
+// pre-pass on, every item is first drawn with only its positions into the depth buffer, then shaded with
+// GL_EQUAL and depth writes off so each pixel is lit once. An occlusion query counts the fragments that reach
+// the lighting shaders, and the overdraw view draws them as additive heat instead of lighting them.
+// Each item's model matrix, normal matrix and material id are written once a frame into a DrawBlock in a
+// DynamicBuffer when the list is sorted. Items of the same mesh and shader are gathered into batches whose blocks
+// sit back to back, so a batch is one instanced draw reading its block by gl_InstanceID, whatever the materials
+// of its items, and every pass binds that range instead of setting uniforms per draw.
+
+#ifndef DRAWLIST_H
+#define DRAWLIST_H
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "shader.h"
+#include "Mesh.h"
+#include "Model.h"
+#include "Bounds.h"
+#include "DynamicBuffer.h"
+#include "MaterialTable.h"
+#include <vector>
+#include <set>
+#include <map>
+#include <algorithm>
+#include <functional>
+#include <iostream>
+
+const GLuint DRAW_BLOCK_BINDING = 0;    // DrawBlock in manyLights.vs, shad.vs and depth.vs
+const unsigned int MAX_DRAW_BATCH = 16; // MAX_DRAW_BATCH in the same shaders
+
+// std140 layout of one entry of the DrawBlock uniform block
+struct DrawBlock {
+    glm::mat4 model;
+    glm::mat4 normalMatrix;
+    glm::ivec4 material; // x is the MaterialTable id
+};
+
+struct DrawItem {
+    Mesh* mesh;
+    Shader* shader;
+    unsigned int material; // MaterialTable id, 0 for shaders that take their colours from textures
+    glm::mat4 model;
+    float depth;           // distance from the camera to the closest point of the bounds
+    unsigned int group;    // order of its mesh and shader by their nearest item, while sorting
+};
+
+// items first to first + count share a mesh and shader and are drawn as one instanced draw
+struct DrawBatch {
+    unsigned int first;
+    unsigned int count;
+    GLintptr block;        // offset of the batch's DrawBlock in the dynamic buffer, -1 when it did not fit
+};
+
+class DrawList
+{
+public:
+    bool prepass = true;
+    bool showOverdraw = false;
+
+    DrawList()
+        : depthShader("depth.vs", "depth.fs"), overdrawShader("depth.vs", "overdraw.fs")
+    {
+        glGenQueries(2, samplesQuery);
+        drawData.Bind(DRAW_BLOCK_BINDING, 0, BATCH_BYTES); // DrawBlock is never left without a buffer, even unused
+    }
+
+    ~DrawList()
+    {
+        glDeleteQueries(2, samplesQuery);
+    }
+
+    // starts a frame, the dynamic buffer moves on to a region the gpu is done with
+    void Clear()
+    {
+        items.clear();
+        batches.clear();
+        drawData.BeginFrame();
+    }
+
+    void Add(Mesh& mesh, Shader& shader, const glm::mat4& model, unsigned int material = 0)
+    {
+        DrawItem item = { &mesh, &shader, material, model, 0.0f, 0 };
+        items.push_back(item);
+    }
+
+    void Add(Model& model, Shader& shader, const glm::mat4& matrix, unsigned int material = 0)
+    {
+        for (unsigned int i = 0; i < model.meshes.size(); i++)
+            Add(model.meshes[i], shader, matrix, material);
+    }
+
+    const std::vector<DrawItem>& Items() const
+    {
+        return items;
+    }
+
+    const std::vector<DrawBatch>& Batches() const
+    {
+        return batches;
+    }
+
+    // front to back by the distance to the closest point of each mesh's bounds, then the items of a mesh and shader
+    // are pulled forward to their nearest one so they can go out as one batch
+    void Sort(const glm::vec3& cameraPos)
+    {
+        for (unsigned int i = 0; i < items.size(); i++)
+        {
+            AABB box = TransformAABB(items[i].model, items[i].mesh->bounds);
+            items[i].depth = glm::length(glm::clamp(cameraPos, box.min, box.max) - cameraPos);
+        }
+        std::sort(items.begin(), items.end(), [](const DrawItem& a, const DrawItem& b) { return a.depth < b.depth; });
+        std::map<std::pair<Mesh*, Shader*>, unsigned int> groups;
+        for (DrawItem& item : items)
+            item.group = groups.insert(std::make_pair(std::make_pair(item.mesh, item.shader), (unsigned int)groups.size())).first->second;
+        std::stable_sort(items.begin(), items.end(), [](const DrawItem& a, const DrawItem& b) { return a.group < b.group; });
+        for (unsigned int i = 0; i < items.size(); i++)
+        {
+            if (batches.empty() || items[i].group != items[i - 1].group || batches.back().count == MAX_DRAW_BATCH)
+            {
+                DrawBatch batch = { i, 0, -1 };
+                batches.push_back(batch);
+            }
+            batches.back().count++;
+        }
+        writeBlocks();
+    }
+
+    // after binding a shader that draws items, reads them from the DrawBlock until EndItems
+    void BeginItems(Shader& shader)
+    {
+        if (!blockPrograms.count(shader.ID))
+        {
+            GLuint index = glGetUniformBlockIndex(shader.ID, "DrawBlock");
+            if (index != GL_INVALID_INDEX)
+                glUniformBlockBinding(shader.ID, index, DRAW_BLOCK_BINDING);
+            blockPrograms.insert(shader.ID);
+        }
+        shader.setBool("fromDrawBlock", true);
+        blockOn = true;
+        itemShaders.insert(&shader);
+    }
+
+    // one instanced draw from the batch's block, or a draw per item with the uniforms when it has none
+    void Submit(Shader& shader, const DrawBatch& batch, bool depthOnly = false)
+    {
+        bool block = batch.block >= 0;
+        if (block != blockOn)
+        {
+            shader.setBool("fromDrawBlock", block);
+            blockOn = block;
+        }
+        Mesh& mesh = *items[batch.first].mesh;
+        // the batches are sorted by texture array, so it is only bound when it changes
+        if (!depthOnly && mesh.arrayTex && mesh.arrayTex != boundArray)
+        {
+            glActiveTexture(GL_TEXTURE0 + TEXTURE_ARRAY_UNIT);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, mesh.arrayTex);
+            boundArray = mesh.arrayTex;
+        }
+        if (block)
+        {
+            drawData.Bind(DRAW_BLOCK_BINDING, batch.block, BATCH_BYTES);
+            if (depthOnly)
+                mesh.DrawDepthInstanced(batch.count);
+            else
+                mesh.DrawInstanced(shader, batch.count, true);
+            return;
+        }
+        for (unsigned int i = batch.first; i < batch.first + batch.count; i++)
+        {
+            shader.setMat4("model", items[i].model);
+            shader.setInt("materialId", items[i].material);
+            if (depthOnly)
+                mesh.DrawDepth();
+            else
+                mesh.Draw(shader, true);
+        }
+    }
+
+    // the shaders go back to their uniforms for whatever else draws with them. Other passes bind the array unit
+    // too, so the next BeginItems starts with nothing known to be bound
+    void EndItems()
+    {
+        boundArray = 0;
+        for (Shader* shader : itemShaders)
+        {
+            shader->use();
+            shader->setBool("fromDrawBlock", false);
+            shader->setInt("materialId", 0);
+        }
+        itemShaders.clear();
+    }
+
+    // fences the frame's blocks, once the last pass reading them is submitted
+    void EndFrame()
+    {
+        drawData.EndFrame();
+    }
+
+    // fills the depth buffer in the sorted order when the pre-pass is on. Geometry that is not a mesh, like the
+    // terrain, writes its own depth in extra after the sorted items
+    void DrawDepth(const glm::mat4& view, const glm::mat4& projection, const std::function<void()>& extra = std::function<void()>())
+    {
+        overdrawShader.use();
+        overdrawShader.setMat4("view", view);
+        overdrawShader.setMat4("projection", projection);
+        if (!prepass)
+            return;
+
+        depthShader.use();
+        depthShader.setMat4("view", view);
+        depthShader.setMat4("projection", projection);
+        BeginItems(depthShader);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        for (const DrawBatch& batch : batches)
+            Submit(depthShader, batch, true);
+        EndItems();
+        if (extra)
+            extra();
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        depthItems = (unsigned int)batches.size();
+    }
+
+    // everything between BeginShading and EndShading is depth tested against the pre-pass and counted
+    void BeginShading(int width, int height)
+    {
+        readSamples();
+        pixels = (unsigned long long)width * height;
+        glBeginQuery(GL_SAMPLES_PASSED, samplesQuery[frame++ % 2]);
+        if (prepass)
+        {
+            glDepthFunc(GL_EQUAL);
+            glDepthMask(GL_FALSE);
+        }
+        if (showOverdraw)
+        {
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_ONE, GL_ONE);
+        }
+    }
+
+    // with the pre-pass the depth order no longer matters, so the batches are grouped by shader and texture array
+    // instead. Materials are in the blocks and never split a batch
+    void Draw()
+    {
+        if (prepass)
+            std::stable_sort(batches.begin(), batches.end(), [this](const DrawBatch& a, const DrawBatch& b)
+            {
+                const DrawItem& x = items[a.first];
+                const DrawItem& y = items[b.first];
+                if (x.shader != y.shader)
+                    return x.shader < y.shader;
+                return x.mesh->arrayTex < y.mesh->arrayTex;
+            });
+
+        Shader* bound = 0;
+        for (const DrawBatch& batch : batches)
+        {
+            Shader& shader = showOverdraw ? overdrawShader : *items[batch.first].shader;
+            if (bound != &shader)
+            {
+                shader.use();
+                BeginItems(shader);
+                bound = &shader;
+            }
+            Submit(shader, batch, showOverdraw);
+        }
+        EndItems();
+        drawn = (unsigned int)batches.size();
+    }
+
+    void EndShading()
+    {
+        glEndQuery(GL_SAMPLES_PASSED);
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        glDisable(GL_BLEND);
+    }
+
+    void Report(float time)
+    {
+        if (time - lastReport < 2.0f)
+            return;
+        lastReport = time;
+        std::cout << "Opaque pass: " << drawn << " draws for " << items.size() << " meshes, pre-pass " << (prepass ? "on" : "off") << " (" << (prepass ? depthItems : 0)
+            << " depth draws), " << shaded / 1000 << "K fragments shaded, " << overdraw << " per pixel" << std::endl;
+        drawData.Report(time);
+    }
+
+private:
+    static const GLsizeiptr BATCH_BYTES = sizeof(DrawBlock) * MAX_DRAW_BATCH; // the whole block is bound, even for one item
+
+    Shader depthShader;
+    Shader overdrawShader;
+    std::vector<DrawItem> items;
+    std::vector<DrawBatch> batches;
+    DynamicBuffer drawData;
+    std::set<GLuint> blockPrograms;  // programs whose DrawBlock is pointed at DRAW_BLOCK_BINDING
+    std::set<Shader*> itemShaders;   // bound since BeginItems, to be put back by EndItems
+    bool blockOn = false;
+    unsigned int boundArray = 0;     // texture array on TEXTURE_ARRAY_UNIT since BeginItems, 0 when not known
+    unsigned int samplesQuery[2];
+    unsigned int frame = 0;
+    unsigned int drawn = 0, depthItems = 0;
+    unsigned long long pixels = 0;
+    unsigned long long shaded = 0;
+    float overdraw = 0.0f;
+    float lastReport = 0.0f;
+
+    // one block per batch in the sorted order, so the passes walk the buffer forwards
+    void writeBlocks()
+    {
+        for (DrawBatch& batch : batches)
+        {
+            DrawBlock* block = (DrawBlock*)drawData.Alloc(BATCH_BYTES, batch.block);
+            if (!block)
+            {
+                batch.block = -1;
+                continue;
+            }
+            for (unsigned int i = 0; i < batch.count; i++)
+            {
+                const DrawItem& item = items[batch.first + i];
+                DrawBlock data;
+                data.model = item.model;
+                data.normalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(item.model))));
+                data.material = glm::ivec4((int)item.material, 0, 0, 0);
+                memcpy(block + i, &data, sizeof(DrawBlock)); // written in one go, the mapped memory may be write combined
+            }
+        }
+        drawData.Flush();
+    }
+
+    // the count from two frames ago, skipped when the gpu is not done with it instead of waited on
+    void readSamples()
+    {
+        if (frame < 2)
+            return;
+        unsigned int slot = frame % 2;
+        GLuint available = 0;
+        glGetQueryObjectuiv(samplesQuery[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return;
+        GLuint count = 0;
+        glGetQueryObjectuiv(samplesQuery[slot], GL_QUERY_RESULT, &count);
+        shaded = count;
+        overdraw = pixels ? (float)count / pixels : 0.0f;
+    }
+};
+#endif
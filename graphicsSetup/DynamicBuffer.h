@@ -0,0 +1,178 @@
+// Per-frame ring buffer for uniform data written by the cpu every frame
+// Persistent mapping reference https://www.khronos.org/opengl/wiki/Buffer_Object_Streaming#Persistent_mapped_streaming
+// One uniform buffer split into a region per frame in flight. Each frame blocks are written one after the other
+// into the current region and bound by range. With ARB_buffer_storage the buffer stays mapped for good and the
+// writes land in it directly; a fence at the end of a frame keeps the cpu from overwriting a region until the gpu
+// has read it. glad only loads GL 3.3 so glBufferStorage is fetched by hand. Without it the blocks go to a cpu
+// copy that is uploaded in one go into orphaned storage before the first draw.
+
+#ifndef DYNAMICBUFFER_H
+#define DYNAMICBUFFER_H
+#include <glad/glad.h>
+#include <vector>
+#include <cstring>
+#include <iostream>
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+typedef void (APIENTRYP BufferStorageProc)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+BufferStorageProc bufferStorage = 0;
+
+// call once after gladLoadGLLoader with the same loader
+void LoadBufferStorage(GLADloadproc load)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++)
+    {
+        const char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+        if (name && strcmp(name, "GL_ARB_buffer_storage") == 0)
+        {
+            bufferStorage = (BufferStorageProc)load("glBufferStorage");
+            return;
+        }
+    }
+}
+
+const unsigned int DYNAMIC_REGIONS = 3; // frames the gpu may still be reading
+
+class DynamicBuffer
+{
+public:
+    DynamicBuffer(GLsizeiptr regionBytes = 1024 * 1024) : regionSize(regionBytes)
+    {
+        GLint align = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+        alignment = align > 0 ? align : 256;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        if (bufferStorage)
+        {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            bufferStorage(GL_UNIFORM_BUFFER, regionSize * DYNAMIC_REGIONS, NULL, flags);
+            mapped = (unsigned char*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, regionSize * DYNAMIC_REGIONS, flags);
+        }
+        if (!mapped)
+        {
+            glBufferData(GL_UNIFORM_BUFFER, regionSize, NULL, GL_STREAM_DRAW);
+            staging.resize(regionSize);
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        for (unsigned int i = 0; i < DYNAMIC_REGIONS; i++)
+            fences[i] = 0;
+    }
+
+    ~DynamicBuffer()
+    {
+        for (unsigned int i = 0; i < DYNAMIC_REGIONS; i++)
+            if (fences[i])
+                glDeleteSync(fences[i]);
+        if (mapped)
+        {
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+            glUnmapBuffer(GL_UNIFORM_BUFFER);
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        }
+        glDeleteBuffers(1, &buffer);
+    }
+
+    bool Persistent() const
+    {
+        return mapped != 0;
+    }
+
+    // moves on to the next region, waiting only if the gpu is still reading it from three frames ago
+    void BeginFrame()
+    {
+        if (inFrame)
+            EndFrame();
+        inFrame = true;
+        used = 0;
+        uploaded = 0;
+        if (!mapped)
+            return;
+        region = (region + 1) % DYNAMIC_REGIONS;
+        if (fences[region])
+        {
+            if (glClientWaitSync(fences[region], 0, 0) == GL_TIMEOUT_EXPIRED)
+            {
+                stalls++;
+                glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+            }
+            glDeleteSync(fences[region]);
+            fences[region] = 0;
+        }
+    }
+
+    // after the frame's last draw that reads the region
+    void EndFrame()
+    {
+        if (!inFrame)
+            return;
+        inFrame = false;
+        lastFrameBytes = used;
+        if (mapped)
+            fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    // room for bytes at an offset usable with Bind, 0 when the region is full
+    void* Alloc(GLsizeiptr bytes, GLintptr& offset)
+    {
+        GLsizeiptr start = (used + alignment - 1) / alignment * alignment;
+        if (start + bytes > regionSize)
+        {
+            if (!overflowed)
+                std::cout << "Dynamic buffer: region of " << regionSize / 1024 << " KB is full" << std::endl;
+            overflowed = true;
+            return 0;
+        }
+        used = start + bytes;
+        offset = (mapped ? region * regionSize : 0) + start;
+        return mapped ? mapped + offset : &staging[start];
+    }
+
+    // the orphaning path uploads everything written so far, nothing to do when mapped
+    void Flush()
+    {
+        if (mapped || used == uploaded)
+            return;
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        if (uploaded == 0)
+            glBufferData(GL_UNIFORM_BUFFER, regionSize, NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_UNIFORM_BUFFER, uploaded, used - uploaded, &staging[uploaded]);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        uploaded = used;
+    }
+
+    void Bind(GLuint binding, GLintptr offset, GLsizeiptr size)
+    {
+        glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, offset, size);
+    }
+
+    void Report(float time)
+    {
+        if (time - lastReport < 2.0f)
+            return;
+        lastReport = time;
+        std::cout << "Dynamic buffer: " << (mapped ? "persistently mapped" : "orphaned") << ", " << lastFrameBytes / 1024 << " KB last frame, "
+            << stalls << " waits on the gpu" << std::endl;
+    }
+
+private:
+    GLuint buffer;
+    GLsizeiptr regionSize;
+    GLsizeiptr alignment;
+    unsigned char* mapped = 0;
+    std::vector<unsigned char> staging;
+    GLsync fences[DYNAMIC_REGIONS];
+    unsigned int region = 0;
+    GLsizeiptr used = 0, uploaded = 0, lastFrameBytes = 0;
+    bool inFrame = false;
+    bool overflowed = false;
+    unsigned int stalls = 0;
+    float lastReport = 0.0f;
+};
+#endif
@@ -0,0 +1,80 @@
+// Dynamic resolution driven by the gpu time of the scene
+// Dynamic resolution reference https://www.intel.com/content/www/us/en/developer/articles/technical/dynamic-resolution-rendering-article.html
+// A PI controller on the scene pass's gpu time picks the fraction of the window's pixels the HDR target renders,
+// the tone mapping pass scales it back up with a sharpening filter. The controller works on the pixel count since
+// that is what the cost follows, the scale per side is its square root. Scales move in steps so the render
+// targets are not rebuilt every frame.
+
+#ifndef DYNAMICRESOLUTION_H
+#define DYNAMICRESOLUTION_H
+#include <glm/glm.hpp>
+#include <cmath>
+#include <iostream>
+
+class DynamicResolution
+{
+public:
+    bool enabled = true;
+    float targetMs = 14.0f;   // gpu time for the scene, leaves room for tone mapping and the swap in 60Hz
+    float minScale = 0.5f;    // per side, so a quarter of the pixels at worst
+    float maxScale = 1.0f;
+    float step = 0.05f;       // scales are rounded to this
+    float kp = 0.25f;         // on the change in error
+    float ki = 0.05f;         // on the error itself
+    float maxSharpness = 0.8f; // at minScale, none at full resolution
+
+    // called with every new gpu time of the scene pass
+    void Update(float gpuMs)
+    {
+        if (!enabled)
+        {
+            area = maxScale * maxScale;
+            applied = maxScale;
+            return;
+        }
+        // positive when there is time to spare, velocity form so clamping the output cannot wind up the integral
+        float error = 1.0f - gpuMs / targetMs;
+        area += kp * (error - lastError) + ki * error;
+        area = glm::clamp(area, minScale * minScale, maxScale * maxScale);
+        lastError = error;
+        float scale = std::sqrt(area);
+        if (std::fabs(scale - applied) >= step || area <= minScale * minScale || area >= maxScale * maxScale)
+            applied = glm::clamp(std::round(scale / step) * step, minScale, maxScale);
+        lastMs = gpuMs;
+    }
+
+    float Scale() const
+    {
+        return applied;
+    }
+
+    int Size(int windowSize) const
+    {
+        return glm::max(1, (int)(windowSize * applied + 0.5f));
+    }
+
+    // how hard the upscale sharpens, more the further below native resolution it renders
+    float Sharpness() const
+    {
+        if (maxScale <= minScale)
+            return 0.0f;
+        return maxSharpness * glm::clamp((maxScale - applied) / (maxScale - minScale), 0.0f, 1.0f);
+    }
+
+    void Report(float time)
+    {
+        if (time - lastReport < 2.0f)
+            return;
+        lastReport = time;
+        std::cout << "Dynamic resolution " << (enabled ? "on" : "off") << ": scale " << applied << " (" << (int)(applied * applied * 100.0f + 0.5f)
+            << "% of the pixels), scene " << lastMs << " ms against " << targetMs << " ms" << std::endl;
+    }
+
+private:
+    float area = 1.0f;
+    float applied = 1.0f;
+    float lastError = 0.0f;
+    float lastMs = 0.0f;
+    float lastReport = 0.0f;
+};
+#endif
@@ -0,0 +1,419 @@
+// Instanced forest with octahedral impostors at distance
+// Impostor reference https://shaderbits.com/blog/octahedral-impostors
+// Trees are scattered over the ground from a density map. Close trees are drawn as instanced meshes with
+// manyLights, far trees as billboards that sample a hemi-octahedral atlas of views baked once at load time.
+// In between the two are crossfaded with complementary dither patterns so nothing is blended.
+
+#ifndef FOREST_H
+#define FOREST_H
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "Model.h"
+#include "Heightfield.h"
+#include "Bounds.h"
+#include "ThreadPool.h"
+#include "shader.h"
+#include <vector>
+#include <random>
+#include <cstddef>
+#include <iostream>
+
+const int IMPOSTOR_FRAMES = 8;        // views per side of the atlas
+const int IMPOSTOR_ATLAS_SIZE = 1024;
+const unsigned int FOREST_CULL_BLOCK = 256; // trees culled per job
+
+// per instance data for the near meshes, matches Mesh::InstanceSetup
+struct TreeInstanceData {
+    glm::mat4 model;
+    float fade;
+};
+
+// per instance data for the billboards
+struct ImpostorInstanceData {
+    glm::vec4 posScale;
+    glm::vec2 yawFade;
+};
+
+struct TreeInstance {
+    glm::vec3 pos;
+    float height;
+    float yaw;
+    unsigned int species;
+};
+
+class Forest
+{
+public:
+    float nearDistance = 6.0f;  // closer than this trees are full meshes
+    float fadeBand = 1.5f;      // distance over which mesh and impostor crossfade
+    float maxDistance = 60.0f;
+    std::vector<TreeInstance> trees;
+
+    Forest(ThreadPool& pool) : pool(pool), bakeShader("impostorBake.vs", "impostorBake.fs"), impostorShader("impostor.vs", "impostor.fs")
+    {
+        float corners[] = { -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f };
+        glGenVertexArrays(1, &quadVAO);
+        glGenBuffers(1, &quadVBO);
+        glBindVertexArray(quadVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+        glBindVertexArray(0);
+
+        impostorShader.use();
+        impostorShader.setInt("albedoAtlas", 0);
+        impostorShader.setInt("normalAtlas", 1);
+        impostorShader.setInt("frames", IMPOSTOR_FRAMES);
+    }
+
+    ~Forest()
+    {
+        glDeleteVertexArrays(1, &quadVAO);
+        glDeleteBuffers(1, &quadVBO);
+        for (unsigned int i = 0; i < species.size(); i++)
+        {
+            glDeleteBuffers(1, &species[i].meshVBO);
+            glDeleteBuffers(1, &species[i].impostorVBO);
+            glDeleteVertexArrays(1, &species[i].impostorVAO);
+            glDeleteTextures(1, &species[i].albedoAtlas);
+            glDeleteTextures(1, &species[i].normalAtlas);
+        }
+    }
+
+    // normalises the model to unit height standing on the origin and bakes its impostor
+    void AddSpecies(Model& model)
+    {
+        Species s;
+        s.model = &model;
+        glm::vec3 size = model.bounds.max - model.bounds.min;
+        float unit = 1.0f / glm::max(size.y, 0.0001f);
+        glm::vec3 base((model.bounds.min.x + model.bounds.max.x) * 0.5f, model.bounds.min.y, (model.bounds.min.z + model.bounds.max.z) * 0.5f);
+        s.normalise = glm::scale(glm::mat4(1.0f), glm::vec3(unit)) * glm::translate(glm::mat4(1.0f), -base);
+        s.radius = glm::length(size) * 0.5f * unit;
+        s.centreHeight = 0.5f;
+
+        glGenBuffers(1, &s.meshVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, s.meshVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(TreeInstanceData), NULL, GL_STREAM_DRAW);
+        for (unsigned int i = 0; i < model.meshes.size(); i++)
+        {
+            model.meshes[i].InstanceSetup(s.meshVBO, sizeof(TreeInstanceData));
+            // the impostors are baked from the full textures
+            for (unsigned int t = 0; t < model.meshes[i].textures.size(); t++)
+                TextureCache::Get().MakeResident(model.meshes[i].textures[t].id);
+        }
+
+        glGenVertexArrays(1, &s.impostorVAO);
+        glGenBuffers(1, &s.impostorVBO);
+        glBindVertexArray(s.impostorVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+        glBindBuffer(GL_ARRAY_BUFFER, s.impostorVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(ImpostorInstanceData), NULL, GL_STREAM_DRAW);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(ImpostorInstanceData), (void*)0);
+        glVertexAttribDivisor(1, 1);
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(ImpostorInstanceData), (void*)offsetof(ImpostorInstanceData, yawFade));
+        glVertexAttribDivisor(2, 1);
+        glBindVertexArray(0);
+
+        bakeImpostor(s);
+        species.push_back(s);
+    }
+
+    // scatters trees over the heightfield, brighter texels of the density map are more likely to get one
+    void Place(const char* densityPath, const Heightfield& ground, unsigned int count, float minHeight, float maxHeight, unsigned int seed = 1)
+    {
+        trees.clear();
+        if (species.empty())
+            return;
+        int w, h, channels;
+        unsigned char* density = stbi_load(densityPath, &w, &h, &channels, 1);
+        if (!density)
+        {
+            std::cout << "Density map failed to load :( Path: " << densityPath << std::endl;
+            return;
+        }
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> random(0.0f, 1.0f);
+        glm::vec2 size = ground.Size();
+        for (unsigned int attempt = 0; attempt < count * 20 && trees.size() < count; attempt++)
+        {
+            float u = random(rng), v = random(rng);
+            int px = glm::min((int)(u * w), w - 1);
+            int py = glm::min((int)(v * h), h - 1);
+            if (random(rng) * 255.0f >= density[py * w + px])
+                continue;
+            TreeInstance tree;
+            tree.pos.x = ground.origin.x + u * size.x;
+            tree.pos.z = ground.origin.y + v * size.y;
+            tree.pos.y = ground.Height(tree.pos.x, tree.pos.z);
+            tree.height = glm::mix(minHeight, maxHeight, random(rng));
+            tree.yaw = random(rng) * 6.2831853f;
+            tree.species = rng() % species.size();
+            trees.push_back(tree);
+        }
+        stbi_image_free(density);
+        std::cout << "Forest: placed " << trees.size() << " trees" << std::endl;
+    }
+
+    // sorts the visible trees into mesh and impostor lists and uploads them. Blocks of trees are culled on the
+    // workers into lists of their own and joined in block order, so the instance order never changes
+    void Update(const glm::vec3& cameraPos, const glm::mat4& viewProj)
+    {
+        Frustum frustum(viewProj);
+        unsigned int blockCount = (unsigned int)(trees.size() + FOREST_CULL_BLOCK - 1) / FOREST_CULL_BLOCK;
+        if (blocks.size() < blockCount)
+            blocks.resize(blockCount);
+        pool.ParallelFor(blockCount, [&](unsigned int b) {
+            CullBlock& block = blocks[b];
+            block.nearTrees.resize(species.size());
+            block.farTrees.resize(species.size());
+            for (unsigned int i = 0; i < species.size(); i++)
+            {
+                block.nearTrees[i].clear();
+                block.farTrees[i].clear();
+            }
+            unsigned int end = glm::min((b + 1) * FOREST_CULL_BLOCK, (unsigned int)trees.size());
+            for (unsigned int i = b * FOREST_CULL_BLOCK; i < end; i++)
+                cullTree(trees[i], frustum, cameraPos, block);
+        });
+        for (unsigned int i = 0; i < species.size(); i++)
+        {
+            species[i].nearTrees.clear();
+            species[i].farTrees.clear();
+            for (unsigned int b = 0; b < blockCount; b++)
+            {
+                species[i].nearTrees.insert(species[i].nearTrees.end(), blocks[b].nearTrees[i].begin(), blocks[b].nearTrees[i].end());
+                species[i].farTrees.insert(species[i].farTrees.end(), blocks[b].farTrees[i].begin(), blocks[b].farTrees[i].end());
+            }
+        }
+        for (unsigned int i = 0; i < species.size(); i++)
+        {
+            Species& s = species[i];
+            // orphan the old storage so the driver never waits on last frame's draws
+            if (!s.nearTrees.empty())
+            {
+                glBindBuffer(GL_ARRAY_BUFFER, s.meshVBO);
+                glBufferData(GL_ARRAY_BUFFER, s.nearTrees.size() * sizeof(TreeInstanceData), &s.nearTrees[0], GL_STREAM_DRAW);
+            }
+            if (!s.farTrees.empty())
+            {
+                glBindBuffer(GL_ARRAY_BUFFER, s.impostorVBO);
+                glBufferData(GL_ARRAY_BUFFER, s.farTrees.size() * sizeof(ImpostorInstanceData), &s.farTrees[0], GL_STREAM_DRAW);
+            }
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // the near trees' textures, at the sharpness the closest tree of each species needs
+    void StreamTextures(TextureStreamer& streamer, const glm::vec3& cameraPos, float pixelScale)
+    {
+        for (unsigned int i = 0; i < species.size(); i++)
+        {
+            Species& s = species[i];
+            unsigned int closest = 0;
+            float best = FLT_MAX;
+            for (unsigned int t = 0; t < s.nearTrees.size(); t++)
+            {
+                float dist = glm::length(glm::vec3(s.nearTrees[t].model[3]) - cameraPos);
+                if (dist < best)
+                {
+                    best = dist;
+                    closest = t;
+                }
+            }
+            if (s.nearTrees.empty())
+                continue;
+            for (unsigned int m = 0; m < s.model->meshes.size(); m++)
+                streamer.RequestMesh(s.model->meshes[m], s.nearTrees[closest].model, cameraPos, pixelScale);
+        }
+    }
+
+    // near trees with the lighting shader, which the caller has already set up
+    void DrawNear(Shader& shader)
+    {
+        shader.setBool("instanced", true);
+        for (unsigned int i = 0; i < species.size(); i++)
+        {
+            Species& s = species[i];
+            if (s.nearTrees.empty())
+                continue;
+            for (unsigned int m = 0; m < s.model->meshes.size(); m++)
+                s.model->meshes[m].DrawInstanced(shader, static_cast<unsigned int>(s.nearTrees.size()));
+        }
+        shader.setBool("instanced", false);
+    }
+
+    void DrawImpostors(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPos, const glm::vec3& lightDirection,
+        const glm::vec3& lightAmbient, const glm::vec3& lightDiffuse)
+    {
+        impostorShader.use();
+        impostorShader.setMat4("view", view);
+        impostorShader.setMat4("projection", projection);
+        impostorShader.setVec3("viewPos", viewPos);
+        impostorShader.setVec3("lightDirection", lightDirection);
+        impostorShader.setVec3("lightAmbient", lightAmbient);
+        impostorShader.setVec3("lightDiffuse", lightDiffuse);
+        for (unsigned int i = 0; i < species.size(); i++)
+        {
+            Species& s = species[i];
+            if (s.farTrees.empty())
+                continue;
+            impostorShader.setFloat("radius", s.radius);
+            impostorShader.setFloat("centreHeight", s.centreHeight);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, s.albedoAtlas);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, s.normalAtlas);
+            glBindVertexArray(s.impostorVAO);
+            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(s.farTrees.size()));
+        }
+        glBindVertexArray(0);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    void Report(float time)
+    {
+        if (time - lastReport < 2.0f)
+            return;
+        lastReport = time;
+        unsigned int nearCount = 0, farCount = 0, draws = 0, triangles = 0;
+        for (unsigned int i = 0; i < species.size(); i++)
+        {
+            nearCount += static_cast<unsigned int>(species[i].nearTrees.size());
+            farCount += static_cast<unsigned int>(species[i].farTrees.size());
+            if (!species[i].nearTrees.empty())
+            {
+                draws += static_cast<unsigned int>(species[i].model->meshes.size());
+                for (unsigned int m = 0; m < species[i].model->meshes.size(); m++)
+                    triangles += species[i].model->meshes[m].TriangleCount() * static_cast<unsigned int>(species[i].nearTrees.size());
+            }
+            if (!species[i].farTrees.empty())
+                draws++;
+        }
+        std::cout << "Forest: " << nearCount << " mesh trees, " << farCount << " impostors, " << draws << " draws, "
+            << triangles + farCount * 2 << " triangles" << std::endl;
+    }
+
+private:
+    struct Species {
+        Model* model;
+        glm::mat4 normalise;
+        float radius;
+        float centreHeight;
+        unsigned int meshVBO, impostorVAO, impostorVBO;
+        unsigned int albedoAtlas, normalAtlas;
+        std::vector<TreeInstanceData> nearTrees;
+        std::vector<ImpostorInstanceData> farTrees;
+    };
+
+    ThreadPool& pool;
+    Shader bakeShader;
+    Shader impostorShader;
+    // one job's share of the visible trees, per species
+    struct CullBlock {
+        std::vector<std::vector<TreeInstanceData>> nearTrees;
+        std::vector<std::vector<ImpostorInstanceData>> farTrees;
+    };
+
+    std::vector<Species> species;
+    std::vector<CullBlock> blocks;
+    unsigned int quadVAO, quadVBO;
+    float lastReport = 0.0f;
+
+    void cullTree(const TreeInstance& tree, const Frustum& frustum, const glm::vec3& cameraPos, CullBlock& block) const
+    {
+        const Species& s = species[tree.species];
+        glm::vec3 centre = tree.pos + glm::vec3(0.0f, s.centreHeight * tree.height, 0.0f);
+        if (!frustum.SphereVisible(centre, s.radius * tree.height))
+            return;
+        float dist = glm::length(centre - cameraPos);
+        if (dist > maxDistance)
+            return;
+        float t = glm::clamp((dist - nearDistance) / fadeBand, 0.0f, 1.0f);
+        if (t < 1.0f)
+        {
+            TreeInstanceData data;
+            data.model = glm::translate(glm::mat4(1.0f), tree.pos);
+            data.model = glm::rotate(data.model, tree.yaw, glm::vec3(0.0f, 1.0f, 0.0f));
+            data.model = glm::scale(data.model, glm::vec3(tree.height)) * s.normalise;
+            data.fade = 1.0f - t;
+            block.nearTrees[tree.species].push_back(data);
+        }
+        if (t > 0.0f)
+        {
+            ImpostorInstanceData data;
+            data.posScale = glm::vec4(tree.pos, tree.height);
+            data.yawFade = glm::vec2(tree.yaw, t);
+            block.farTrees[tree.species].push_back(data);
+        }
+    }
+
+    // renders the tree from every hemi-octahedral grid direction into its own cell of the atlas
+    void bakeImpostor(Species& s)
+    {
+        unsigned int* targets[2] = { &s.albedoAtlas, &s.normalAtlas };
+        for (int i = 0; i < 2; i++)
+        {
+            glGenTextures(1, targets[i]);
+            glBindTexture(GL_TEXTURE_2D, *targets[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, IMPOSTOR_ATLAS_SIZE, IMPOSTOR_ATLAS_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+        unsigned int FBO, depthRBO;
+        glGenFramebuffers(1, &FBO);
+        glGenRenderbuffers(1, &depthRBO);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthRBO);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, IMPOSTOR_ATLAS_SIZE, IMPOSTOR_ATLAS_SIZE);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, s.albedoAtlas, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, s.normalAtlas, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRBO);
+        unsigned int attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, attachments);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::FRAMEBUFFER:: impostor atlas is not complete :(" << std::endl;
+
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glViewport(0, 0, IMPOSTOR_ATLAS_SIZE, IMPOSTOR_ATLAS_SIZE);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        bakeShader.use();
+        bakeShader.setMat4("model", s.normalise);
+        float r = s.radius;
+        bakeShader.setMat4("projection", glm::ortho(-r, r, -r, r, 0.01f, 4.0f * r));
+        glm::vec3 centre(0.0f, s.centreHeight, 0.0f);
+        int cell = IMPOSTOR_ATLAS_SIZE / IMPOSTOR_FRAMES;
+        for (int y = 0; y < IMPOSTOR_FRAMES; y++)
+        {
+            for (int x = 0; x < IMPOSTOR_FRAMES; x++)
+            {
+                // hemi-octahedral decode of the grid point, the inverse of HemiOctEncode in impostor.vs
+                glm::vec2 uv = glm::vec2(x, y) / float(IMPOSTOR_FRAMES - 1) * 2.0f - 1.0f;
+                glm::vec3 dir((uv.x + uv.y) * 0.5f, 0.0f, (uv.x - uv.y) * 0.5f);
+                dir.y = 1.0f - glm::abs(dir.x) - glm::abs(dir.z);
+                dir = glm::normalize(dir + glm::vec3(0.0f, 1e-4f, 0.0f));
+                glm::vec3 up = glm::abs(dir.y) > 0.999f ? glm::vec3(0.0f, 0.0f, -1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+                bakeShader.setMat4("view", glm::lookAt(centre + dir * 2.0f * r, centre, up));
+                glViewport(x * cell, y * cell, cell, cell);
+                s.model->Draw(bakeShader);
+            }
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        glDeleteFramebuffers(1, &FBO);
+        glDeleteRenderbuffers(1, &depthRBO);
+    }
+};
+#endif
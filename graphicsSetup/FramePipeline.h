@@ -0,0 +1,167 @@
+// Two stage frame pipeline, a simulation thread ahead of the render thread
+// Frame pipelining reference https://www.gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+// The simulation thread moves the camera, runs the animation and writes everything the frame needs into a packet.
+// The render thread draws the oldest finished packet and hands its slot back, so while frame N is being submitted
+// frame N+1 is already being simulated. depth is the number of packets: 1 runs the two stages one after the other
+// with the least input lag, 2 overlaps them, 3 also soaks up a slow simulation step at the cost of one more frame
+// of lag. Input is gathered on the render thread, where GLFW needs it, and handed to the next simulation step.
+
+#ifndef FRAMEPIPELINE_H
+#define FRAMEPIPELINE_H
+#include <glm/glm.hpp>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <vector>
+#include <iostream>
+
+// what the user did since the last simulation step
+struct FrameInput {
+    unsigned int held = 0;             // one bit per key the simulation cares about, as of the latest poll
+    glm::vec2 mouse = glm::vec2(0.0f); // cursor movement, summed
+    float scroll = 0.0f;
+};
+
+template <typename Packet>
+class FramePipeline
+{
+public:
+    // input, seconds since the pipeline started, seconds since the previous step, packet to fill
+    typedef std::function<void(const FrameInput&, float, float, Packet&)> Simulate;
+
+    FramePipeline(unsigned int depth, Simulate simulate) : slots(depth < 1 ? 1 : depth), simulate(simulate)
+    {
+        start = Clock::now();
+        thread = std::thread([this] { simulationLoop(); });
+    }
+
+    ~FramePipeline()
+    {
+        Stop();
+    }
+
+    // finishes the simulation step in progress and joins the thread, nothing is simulated after this returns
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        if (thread.joinable())
+            thread.join();
+    }
+
+    unsigned int Depth() const
+    {
+        return (unsigned int)slots.size();
+    }
+
+    // render thread, after polling ---------------------------------------------------------------------------------
+    void SetHeld(unsigned int keys)
+    {
+        std::lock_guard<std::mutex> lock(inputMutex);
+        input.held = keys;
+    }
+
+    void AddMouse(const glm::vec2& offset)
+    {
+        std::lock_guard<std::mutex> lock(inputMutex);
+        input.mouse += offset;
+    }
+
+    void AddScroll(float offset)
+    {
+        std::lock_guard<std::mutex> lock(inputMutex);
+        input.scroll += offset;
+    }
+
+    // the oldest finished packet, waits for the simulation if none is ready. Valid until Release
+    const Packet& Acquire()
+    {
+        Clock::time_point waitStart = Clock::now();
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return ready > 0; });
+        waitMs += std::chrono::duration<double, std::milli>(Clock::now() - waitStart).count();
+        return slots[readSlot];
+    }
+
+    void Release()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            readSlot = (readSlot + 1) % slots.size();
+            ready--;
+            rendered++;
+        }
+        changed.notify_all();
+    }
+
+    void Report(float time)
+    {
+        if (time - lastReport < 2.0f)
+            return;
+        lastReport = time;
+        std::lock_guard<std::mutex> lock(mutex);
+        double frames = rendered > 0 ? (double)rendered : 1.0;
+        double steps = simulated > 0 ? (double)simulated : 1.0;
+        std::cout << "Frame pipeline: depth " << slots.size() << ", simulation " << simMs / steps << " ms a step, render waited "
+            << waitMs / frames << " ms a frame" << std::endl;
+        simMs = waitMs = 0.0;
+        simulated = rendered = 0;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    std::vector<Packet> slots;
+    Simulate simulate;
+    std::thread thread;
+    Clock::time_point start;
+    std::mutex mutex; // guards the slot counters
+    std::condition_variable changed;
+    unsigned int readSlot = 0, writeSlot = 0, ready = 0;
+    bool stopping = false;
+    std::mutex inputMutex;
+    FrameInput input;
+    double simMs = 0.0, waitMs = 0.0;
+    unsigned int simulated = 0, rendered = 0;
+    float lastReport = 0.0f;
+
+    void simulationLoop()
+    {
+        float previous = 0.0f;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [this] { return stopping || ready < slots.size(); });
+                if (stopping)
+                    return;
+            }
+            // the slot is free and only the render thread's Acquire can make it busy again, so no lock while filling it
+            FrameInput taken;
+            {
+                std::lock_guard<std::mutex> lock(inputMutex);
+                taken = input;
+                input.mouse = glm::vec2(0.0f);
+                input.scroll = 0.0f;
+            }
+            Clock::time_point stepStart = Clock::now();
+            float now = std::chrono::duration<float>(stepStart - start).count();
+            simulate(taken, now, now - previous, slots[writeSlot]);
+            previous = now;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                simMs += std::chrono::duration<double, std::milli>(Clock::now() - stepStart).count();
+                simulated++;
+                writeSlot = (writeSlot + 1) % slots.size();
+                ready++;
+            }
+            changed.notify_all();
+        }
+    }
+};
+#endif
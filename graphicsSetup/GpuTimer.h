@@ -0,0 +1,81 @@
+// GPU time of a stretch of commands
+// Timer query reference https://www.khronos.org/opengl/wiki/Query_Object
+// A pair of GL_TIMESTAMP queries per frame in a small ring so results are read a few frames late without
+// stalling. Timestamps rather than GL_TIME_ELAPSED so timers can overlap each other and the snowfall's.
+// A timestamp pair measures wall time on the GPU, so it also counts any time the GPU sits idle waiting for the CPU
+// to submit more. Begin goes right before the first draw of the timed work and End right after the last, with no
+// culling, sorting or uploads in between, otherwise a CPU bound frame reads as a slow GPU. Results are read after
+// End so they are ready before the next frame decides anything from them.
+
+#ifndef GPUTIMER_H
+#define GPUTIMER_H
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+const unsigned int GPU_TIMER_FRAMES = 4;
+
+class GpuTimer
+{
+public:
+    float lastMs = 0.0f;   // newest finished result
+    float smoothMs = 0.0f; // the same, smoothed over a few frames
+
+    GpuTimer()
+    {
+        glGenQueries(GPU_TIMER_FRAMES * 2, queries);
+    }
+
+    ~GpuTimer()
+    {
+        glDeleteQueries(GPU_TIMER_FRAMES * 2, queries);
+    }
+
+    void Begin()
+    {
+        glQueryCounter(queries[(issued % GPU_TIMER_FRAMES) * 2], GL_TIMESTAMP);
+    }
+
+    void End()
+    {
+        glQueryCounter(queries[(issued % GPU_TIMER_FRAMES) * 2 + 1], GL_TIMESTAMP);
+        issued++;
+        read();
+    }
+
+    // results read so far, one per finished query
+    unsigned int Results() const
+    {
+        return results;
+    }
+
+private:
+    unsigned int queries[GPU_TIMER_FRAMES * 2]; // start and end of every frame
+    unsigned int issued = 0;   // queries started
+    unsigned int finished = 0; // queries read back
+    unsigned int results = 0;
+
+    // reads every query that is done, oldest first, and stops at the first that is not
+    void read()
+    {
+        while (finished < issued)
+        {
+            unsigned int slot = (finished % GPU_TIMER_FRAMES) * 2;
+            GLuint available = 0;
+            // the ring is about to reuse this pair so it has to be read now
+            if (issued - finished < GPU_TIMER_FRAMES)
+            {
+                glGetQueryObjectuiv(queries[slot + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available)
+                    return;
+            }
+            GLuint64 start = 0, end = 0;
+            glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(queries[slot + 1], GL_QUERY_RESULT, &end);
+            lastMs = (end - start) / 1.0e6f;
+            smoothMs = results ? glm::mix(smoothMs, lastMs, 0.1f) : lastMs;
+            results++;
+            finished++;
+        }
+    }
+};
+#endif
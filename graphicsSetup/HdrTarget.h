@@ -0,0 +1,137 @@
+// HDR scene target with tone mapping
+// Tone mapping reference https://learnopengl.com/Advanced-Lighting/HDR
+// The scene renders into a floating point colour buffer so summed lights are no longer clamped at 1, then one
+// fullscreen pass applies the fog, exposure, a filmic curve and gamma. R11G11B10F is used by default since
+// nothing reads the alpha back, at half the bandwidth of RGBA16F. The target can be smaller than the window,
+// the same pass scales it up and sharpens it.
+
+#ifndef HDRTARGET_H
+#define HDRTARGET_H
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "shader.h"
+#include <iostream>
+
+class HdrTarget
+{
+public:
+    float exposure = 1.0f;
+    bool highPrecision = false; // RGBA16F instead of R11G11B10F
+
+    HdrTarget() : tonemapShader("hiz.vs", "tonemap.fs")
+    {
+        glGenFramebuffers(1, &FBO);
+        glGenVertexArrays(1, &emptyVAO);
+    }
+
+    ~HdrTarget()
+    {
+        glDeleteFramebuffers(1, &FBO);
+        glDeleteVertexArrays(1, &emptyVAO);
+        if (colorTex)
+            glDeleteTextures(1, &colorTex);
+        if (depthTex)
+            glDeleteTextures(1, &depthTex);
+    }
+
+    // the framebuffer the scene is drawn into, anything copying the scene depth reads from here
+    unsigned int Framebuffer() const
+    {
+        return FBO;
+    }
+
+    unsigned int ColorTexture() const
+    {
+        return colorTex;
+    }
+
+    unsigned int DepthTexture() const
+    {
+        return depthTex;
+    }
+
+    // binds the scene target, resized when the render size changed
+    void Begin(int width, int height)
+    {
+        GLenum format = highPrecision ? GL_RGBA16F : GL_R11F_G11F_B10F;
+        if (width != texW || height != texH || format != colorFormat)
+            textureSetup(width, height, format);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glViewport(0, 0, texW, texH);
+    }
+
+    // tone maps the scene onto the window. fogVolume is VolumetricFog's integrated grid, 0 for no fog
+    void Resolve(const glm::mat4& projection, unsigned int fogVolume, const glm::vec2& fogRange, int windowWidth, int windowHeight,
+        float sharpness = 0.0f)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, windowWidth, windowHeight);
+        glDisable(GL_DEPTH_TEST);
+        tonemapShader.use();
+        tonemapShader.setInt("hdrColor", 0);
+        tonemapShader.setInt("sceneDepth", 1);
+        tonemapShader.setFloat("exposure", exposure);
+        tonemapShader.setInt("fogVolume", 2);
+        tonemapShader.setBool("fog", fogVolume != 0);
+        tonemapShader.setVec2("fogRange", fogRange);
+        tonemapShader.setVec4("projParams", projection[0][0], projection[1][1], projection[3][2], projection[2][2]);
+        tonemapShader.setVec2("screenSize", (float)windowWidth, (float)windowHeight);
+        tonemapShader.setVec2("sceneSize", (float)texW, (float)texH);
+        tonemapShader.setFloat("sharpness", texW < windowWidth ? sharpness : 0.0f);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, colorTex);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, depthTex);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_3D, fogVolume);
+        glBindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_3D, 0);
+        glActiveTexture(GL_TEXTURE0);
+        glEnable(GL_DEPTH_TEST);
+    }
+
+private:
+    Shader tonemapShader;
+    unsigned int FBO = 0, emptyVAO = 0;
+    unsigned int colorTex = 0, depthTex = 0;
+    GLenum colorFormat = 0;
+    int texW = 0, texH = 0;
+
+    // depth is a texture in the same format as the default framebuffer so the culling and snow can blit it
+    void textureSetup(int width, int height, GLenum format)
+    {
+        if (colorTex)
+            glDeleteTextures(1, &colorTex);
+        if (depthTex)
+            glDeleteTextures(1, &depthTex);
+        texW = width;
+        texH = height;
+        colorFormat = format;
+
+        glGenTextures(1, &colorTex);
+        glBindTexture(GL_TEXTURE_2D, colorTex);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, texW, texH, 0, GL_RGBA, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glGenTextures(1, &depthTex);
+        glBindTexture(GL_TEXTURE_2D, depthTex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, texW, texH, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTex, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthTex, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "HDR framebuffer failed to complete :(" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+};
+#endif
@@ -0,0 +1,148 @@
+// Regular grid of ground heights built from the ground mesh
+// The triangles are rasterized from above onto the grid keeping the highest surface, holes are filled from
+// their neighbours. Used for placing things on the ground without casting rays against the mesh.
+
+#ifndef HEIGHTFIELD_H
+#define HEIGHTFIELD_H
+#include <glm/glm.hpp>
+#include "Bounds.h"
+#include <vector>
+#include <cfloat>
+
+class Heightfield
+{
+public:
+    int width = 0;  // samples along x
+    int depth = 0;  // samples along z
+    glm::vec2 origin = glm::vec2(0.0f); // world x and z of sample (0, 0)
+    glm::vec2 spacing = glm::vec2(1.0f);
+    std::vector<float> heights;
+
+    // VertexT only needs a Position member, resolution is the sample count along the longer side
+    template <typename VertexT>
+    void Build(const std::vector<VertexT>& vertices, const std::vector<unsigned int>& indices, const glm::mat4& model, int resolution)
+    {
+        std::vector<glm::vec3> world(vertices.size());
+        AABB bounds;
+        for (unsigned int i = 0; i < vertices.size(); i++)
+        {
+            world[i] = glm::vec3(model * glm::vec4(vertices[i].Position, 1.0f));
+            bounds.Grow(world[i]);
+        }
+        glm::vec2 size(bounds.max.x - bounds.min.x, bounds.max.z - bounds.min.z);
+        float step = glm::max(size.x, size.y) / (resolution - 1);
+        width = (int)(size.x / step) + 1;
+        depth = (int)(size.y / step) + 1;
+        origin = glm::vec2(bounds.min.x, bounds.min.z);
+        spacing = glm::vec2(size.x / (width - 1), size.y / (depth - 1));
+        heights.assign(width * depth, -FLT_MAX);
+
+        for (unsigned int i = 0; i + 2 < indices.size(); i += 3)
+            rasterize(world[indices[i]], world[indices[i + 1]], world[indices[i + 2]]);
+        fillHoles();
+    }
+
+    bool Contains(float x, float z) const
+    {
+        return width > 1 && x >= origin.x && z >= origin.y && x <= origin.x + spacing.x * (width - 1) && z <= origin.y + spacing.y * (depth - 1);
+    }
+
+    // bilinear height, clamped to the edges
+    float Height(float x, float z) const
+    {
+        if (width < 2)
+            return 0.0f;
+        float gx = glm::clamp((x - origin.x) / spacing.x, 0.0f, (float)(width - 1));
+        float gz = glm::clamp((z - origin.y) / spacing.y, 0.0f, (float)(depth - 1));
+        int x0 = glm::min((int)gx, width - 2);
+        int z0 = glm::min((int)gz, depth - 2);
+        float fx = gx - x0, fz = gz - z0;
+        float h0 = glm::mix(At(x0, z0), At(x0 + 1, z0), fx);
+        float h1 = glm::mix(At(x0, z0 + 1), At(x0 + 1, z0 + 1), fx);
+        return glm::mix(h0, h1, fz);
+    }
+
+    glm::vec3 Normal(float x, float z) const
+    {
+        float dx = Height(x + spacing.x, z) - Height(x - spacing.x, z);
+        float dz = Height(x, z + spacing.y) - Height(x, z - spacing.y);
+        return glm::normalize(glm::vec3(-dx, 2.0f * spacing.x, -dz * spacing.x / spacing.y));
+    }
+
+    float At(int x, int z) const
+    {
+        return heights[z * width + x];
+    }
+
+    glm::vec2 Size() const
+    {
+        return glm::vec2(spacing.x * (width - 1), spacing.y * (depth - 1));
+    }
+
+private:
+    void rasterize(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+    {
+        float area = (b.x - a.x) * (c.z - a.z) - (c.x - a.x) * (b.z - a.z);
+        if (glm::abs(area) < 1e-8f)
+            return;
+        int x0 = glm::max(0, (int)glm::ceil((glm::min(a.x, glm::min(b.x, c.x)) - origin.x) / spacing.x));
+        int x1 = glm::min(width - 1, (int)glm::floor((glm::max(a.x, glm::max(b.x, c.x)) - origin.x) / spacing.x));
+        int z0 = glm::max(0, (int)glm::ceil((glm::min(a.z, glm::min(b.z, c.z)) - origin.y) / spacing.y));
+        int z1 = glm::min(depth - 1, (int)glm::floor((glm::max(a.z, glm::max(b.z, c.z)) - origin.y) / spacing.y));
+        for (int z = z0; z <= z1; z++)
+        {
+            for (int x = x0; x <= x1; x++)
+            {
+                float px = origin.x + x * spacing.x, pz = origin.y + z * spacing.y;
+                float w0 = ((b.x - px) * (c.z - pz) - (c.x - px) * (b.z - pz)) / area;
+                float w1 = ((c.x - px) * (a.z - pz) - (a.x - px) * (c.z - pz)) / area;
+                float w2 = 1.0f - w0 - w1;
+                if (w0 < -1e-4f || w1 < -1e-4f || w2 < -1e-4f)
+                    continue;
+                float h = w0 * a.y + w1 * b.y + w2 * c.y;
+                float& dst = heights[z * width + x];
+                dst = h > dst ? h : dst;
+            }
+        }
+    }
+
+    // spreads known heights into samples no triangle covered
+    void fillHoles()
+    {
+        bool missing = true;
+        for (int pass = 0; pass < width + depth && missing; pass++)
+        {
+            missing = false;
+            std::vector<float> next = heights;
+            for (int z = 0; z < depth; z++)
+            {
+                for (int x = 0; x < width; x++)
+                {
+                    if (At(x, z) != -FLT_MAX)
+                        continue;
+                    float sum = 0.0f;
+                    int count = 0;
+                    const int nx[4] = { -1, 1, 0, 0 }, nz[4] = { 0, 0, -1, 1 };
+                    for (int n = 0; n < 4; n++)
+                    {
+                        int sx = x + nx[n], sz = z + nz[n];
+                        if (sx >= 0 && sz >= 0 && sx < width && sz < depth && At(sx, sz) != -FLT_MAX)
+                        {
+                            sum += At(sx, sz);
+                            count++;
+                        }
+                    }
+                    if (count)
+                        next[z * width + x] = sum / count;
+                    else
+                        missing = true;
+                }
+            }
+            heights.swap(next);
+        }
+        for (unsigned int i = 0; i < heights.size(); i++)
+            if (heights[i] == -FLT_MAX)
+                heights[i] = 0.0f;
+    }
+};
+#endif
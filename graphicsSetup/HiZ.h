@@ -0,0 +1,417 @@
+// Hierarchical-Z occlusion culling
+// Hi-Z map reference https://rastergrid.com/blog/2010/10/hierarchical-z-map-based-occlusion-culling/
+// The depth of the last frame is reduced into a max-depth mip chain on the GPU, a coarse level is read back
+// a frame later through a PBO and boxes are tested against it on the CPU before anything is submitted.
+// Boxes that fail the test are re-tested against the current depth buffer with occlusion queries and drawn
+// with conditional rendering so a stale pyramid never makes anything pop.
+
+#ifndef HIZ_H
+#define HIZ_H
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "shader.h"
+#include "Bounds.h"
+#include <vector>
+#include <iostream>
+
+// biggest pyramid level that gets copied back to the CPU
+const unsigned int HIZ_READBACK_WIDTH = 128;
+
+class HiZCuller
+{
+public:
+    bool enabled = true;
+    CullStats stats;
+    unsigned int sourceFramebuffer = 0; // where the scene is drawn, its depth is copied from here
+
+    HiZCuller() : reduceShader("hiz.vs", "hiz.fs"), boxShader("shadow.vs", "shadow.fs")
+    {
+        glGenFramebuffers(1, &FBO);
+        glGenVertexArrays(1, &emptyVAO);
+        glGenBuffers(2, PBO);
+        boxSetup();
+        reduceShader.use();
+        reduceShader.setInt("depthTex", 0);
+    }
+
+    ~HiZCuller()
+    {
+        glDeleteFramebuffers(1, &FBO);
+        glDeleteVertexArrays(1, &emptyVAO);
+        glDeleteVertexArrays(1, &boxVAO);
+        glDeleteBuffers(1, &boxVBO);
+        glDeleteBuffers(1, &boxEBO);
+        glDeleteBuffers(2, PBO);
+        if (depthTex)
+            glDeleteTextures(1, &depthTex);
+        for (unsigned int i = 0; i < 2; i++)
+            if (fence[i])
+                glDeleteSync(fence[i]);
+        if (!queries.empty())
+            glDeleteQueries(static_cast<GLsizei>(queries.size()), &queries[0]);
+    }
+
+    // picks up the newest finished readback and the results of last frame's re-test
+    void BeginFrame()
+    {
+        stats = CullStats();
+        culled.clear();
+
+        for (unsigned int i = 0; i < 2; i++)
+        {
+            if (!fence[i])
+                continue;
+            GLenum status = glClientWaitSync(fence[i], 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                continue;
+            glDeleteSync(fence[i]);
+            fence[i] = 0;
+            if (readbackSerial[i] < cpuSerial)
+                continue;
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, PBO[i]);
+            float* data = (float*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+            if (data)
+            {
+                cpuLevels.resize(1);
+                cpuLevels[0].assign(data, data + readbackW[i] * readbackH[i]);
+                cpuW.assign(1, readbackW[i]);
+                cpuH.assign(1, readbackH[i]);
+                depthViewProj = readbackViewProj[i];
+                cpuSerial = readbackSerial[i];
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+                cpuReduce();
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+
+        // boxes whose query passed last frame were false negatives, keep them visible until the pyramid catches up
+        for (unsigned int i = 0; i < pending.size(); i++)
+        {
+            unsigned int id = pending[i];
+            GLuint available = 0;
+            glGetQueryObjectuiv(queries[id], GL_QUERY_RESULT_AVAILABLE, &available);
+            GLuint passed = 1;
+            if (available)
+                glGetQueryObjectuiv(queries[id], GL_QUERY_RESULT, &passed);
+            if (passed)
+            {
+                forceVisible[id] = 2;
+                stats.retestVisible++;
+            }
+        }
+        pending.clear();
+    }
+
+    // true when the box could be visible, triangles only feed the statistics
+    bool Test(unsigned int id, const AABB& box, unsigned int triangles)
+    {
+        stats.draws++;
+        stats.triangles += triangles;
+        if (id >= forceVisible.size())
+        {
+            forceVisible.resize(id + 1, 0);
+            boxes.resize(id + 1);
+        }
+        boxes[id] = box;
+
+        if (!enabled || cpuLevels.empty())
+            return true;
+        if (forceVisible[id] > 0)
+        {
+            forceVisible[id]--;
+            return true;
+        }
+        if (occluded(box))
+        {
+            culled.push_back(id);
+            stats.drawsCulled++;
+            stats.trianglesCulled += triangles;
+            return false;
+        }
+        return true;
+    }
+
+    // draws the boxes of everything culled this frame against the current depth buffer
+    void QueryCulled(const glm::mat4& viewProj)
+    {
+        if (culled.empty())
+            return;
+        for (unsigned int i = 0; i < culled.size(); i++)
+        {
+            if (culled[i] >= queries.size())
+            {
+                size_t old = queries.size();
+                queries.resize(forceVisible.size());
+                glGenQueries(static_cast<GLsizei>(queries.size() - old), &queries[old]);
+            }
+        }
+
+        boxShader.use();
+        boxShader.setMat4("lightProjection", viewProj);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+        glBindVertexArray(boxVAO);
+        for (unsigned int i = 0; i < culled.size(); i++)
+        {
+            unsigned int id = culled[i];
+            glm::mat4 model = glm::translate(glm::mat4(1.0f), boxes[id].Center());
+            model = glm::scale(model, glm::max(boxes[id].Extent(), glm::vec3(0.001f)));
+            boxShader.setMat4("model", model);
+            glBeginQuery(GL_ANY_SAMPLES_PASSED, queries[id]);
+            glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+            glEndQuery(GL_ANY_SAMPLES_PASSED);
+        }
+        glBindVertexArray(0);
+        glDepthMask(GL_TRUE);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    }
+
+    // draws the culled objects only if their box query passed, the caller binds the shader first
+    template <typename DrawFn>
+    void DrawCulled(DrawFn draw)
+    {
+        for (unsigned int i = 0; i < culled.size(); i++)
+        {
+            unsigned int id = culled[i];
+            glBeginConditionalRender(queries[id], GL_QUERY_NO_WAIT);
+            draw(id);
+            glEndConditionalRender();
+            pending.push_back(id);
+            stats.retested++;
+        }
+    }
+
+    // copies the finished frame's depth and builds the pyramid, call before swapping buffers
+    void EndFrame(const glm::mat4& viewProj, int width, int height)
+    {
+        if (width <= 0 || height <= 0)
+            return;
+        if (width != texW || height != texH)
+            textureSetup(width, height);
+
+        // copy the scene depth into level 0
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, sourceFramebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, FBO);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthTex, 0);
+        glBlitFramebuffer(0, 0, texW, texH, 0, 0, texW, texH, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+        // max reduce every level into the next
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthFunc(GL_ALWAYS);
+        reduceShader.use();
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, depthTex);
+        glBindVertexArray(emptyVAO);
+        int w = texW, h = texH;
+        for (int level = 1; level < levels; level++)
+        {
+            reduceShader.setVec2("prevSize", (float)w, (float)h);
+            w = w / 2 > 1 ? w / 2 : 1;
+            h = h / 2 > 1 ? h / 2 : 1;
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthTex, level);
+            glViewport(0, 0, w, h);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+        glBindVertexArray(0);
+        glDepthFunc(GL_LESS);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+        // start an async readback of the coarse level
+        unsigned int slot = frame++ % 2;
+        if (!fence[slot])
+        {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthTex, readbackLevel);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, PBO[slot]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, readbackWidth * readbackHeight * sizeof(float), NULL, GL_STREAM_READ);
+            glReadPixels(0, 0, readbackWidth, readbackHeight, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            fence[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            readbackW[slot] = readbackWidth;
+            readbackH[slot] = readbackHeight;
+            readbackViewProj[slot] = viewProj;
+            readbackSerial[slot] = frame;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, texW, texH);
+    }
+
+    // prints the draw and triangle reduction every couple of seconds
+    void Report(float time)
+    {
+        if (time - lastReport < 2.0f)
+            return;
+        lastReport = time;
+        float drawPct = stats.draws ? 100.0f * stats.drawsCulled / stats.draws : 0.0f;
+        float triPct = stats.triangles ? 100.0f * stats.trianglesCulled / stats.triangles : 0.0f;
+        std::cout << "HiZ " << (enabled ? "on" : "off") << ": culled " << stats.drawsCulled << "/" << stats.draws << " draws (" << drawPct << "%), "
+            << stats.trianglesCulled << "/" << stats.triangles << " triangles (" << triPct << "%), re-tested " << stats.retested
+            << ", last frame's false negatives " << stats.retestVisible << std::endl;
+    }
+
+private:
+    Shader reduceShader;
+    Shader boxShader;
+    unsigned int FBO = 0, emptyVAO = 0, boxVAO = 0, boxVBO = 0, boxEBO = 0;
+    unsigned int depthTex = 0;
+    int texW = 0, texH = 0, levels = 1;
+    int readbackLevel = 0, readbackWidth = 1, readbackHeight = 1;
+    unsigned int PBO[2];
+    GLsync fence[2] = { 0, 0 };
+    int readbackW[2] = { 0, 0 }, readbackH[2] = { 0, 0 };
+    glm::mat4 readbackViewProj[2];
+    unsigned int readbackSerial[2] = { 0, 0 };
+    unsigned int frame = 0, cpuSerial = 0;
+    float lastReport = 0.0f;
+
+    // cpu copy of the pyramid, level 0 is the gpu readback level
+    std::vector<std::vector<float>> cpuLevels;
+    std::vector<int> cpuW, cpuH;
+    glm::mat4 depthViewProj;
+
+    std::vector<AABB> boxes;
+    std::vector<unsigned char> forceVisible;
+    std::vector<unsigned int> culled;
+    std::vector<unsigned int> pending;
+    std::vector<GLuint> queries;
+
+    void textureSetup(int width, int height)
+    {
+        if (depthTex)
+            glDeleteTextures(1, &depthTex);
+        texW = width;
+        texH = height;
+        levels = 1;
+        while ((texW >> levels) > 0 || (texH >> levels) > 0)
+            levels++;
+
+        glGenTextures(1, &depthTex);
+        glBindTexture(GL_TEXTURE_2D, depthTex);
+        int w = texW, h = texH;
+        readbackLevel = -1;
+        for (int level = 0; level < levels; level++)
+        {
+            glTexImage2D(GL_TEXTURE_2D, level, GL_DEPTH24_STENCIL8, w, h, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+            if (readbackLevel < 0 && w <= (int)HIZ_READBACK_WIDTH)
+            {
+                readbackLevel = level;
+                readbackWidth = w;
+                readbackHeight = h;
+            }
+            w = w / 2 > 1 ? w / 2 : 1;
+            h = h / 2 > 1 ? h / 2 : 1;
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+
+        // old readbacks no longer match the new size
+        cpuLevels.clear();
+        cpuSerial = frame + 1;
+    }
+
+    // unit cube used as the proxy for the occlusion queries
+    void boxSetup()
+    {
+        float corners[] = {
+            -1.0f, -1.0f, -1.0f,   1.0f, -1.0f, -1.0f,   1.0f,  1.0f, -1.0f,  -1.0f,  1.0f, -1.0f,
+            -1.0f, -1.0f,  1.0f,   1.0f, -1.0f,  1.0f,   1.0f,  1.0f,  1.0f,  -1.0f,  1.0f,  1.0f
+        };
+        unsigned int faces[] = {
+            0, 1, 2, 2, 3, 0,   4, 6, 5, 6, 4, 7,   0, 4, 5, 5, 1, 0,
+            3, 2, 6, 6, 7, 3,   0, 3, 7, 7, 4, 0,   1, 5, 6, 6, 2, 1
+        };
+        glGenVertexArrays(1, &boxVAO);
+        glGenBuffers(1, &boxVBO);
+        glGenBuffers(1, &boxEBO);
+        glBindVertexArray(boxVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, boxVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, boxEBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(faces), faces, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glBindVertexArray(0);
+    }
+
+    // builds the coarser levels of the readback on the CPU
+    void cpuReduce()
+    {
+        while (cpuW.back() > 1 || cpuH.back() > 1)
+        {
+            const std::vector<float>& src = cpuLevels.back();
+            int sw = cpuW.back(), sh = cpuH.back();
+            int w = sw / 2 > 1 ? sw / 2 : 1;
+            int h = sh / 2 > 1 ? sh / 2 : 1;
+            std::vector<float> dst(w * h);
+            for (int y = 0; y < h; y++)
+            {
+                for (int x = 0; x < w; x++)
+                {
+                    // odd sizes fold the extra row and column into the last texel
+                    int x1 = (x == w - 1) ? sw - 1 : 2 * x + 1;
+                    int y1 = (y == h - 1) ? sh - 1 : 2 * y + 1;
+                    float d = 0.0f;
+                    for (int yy = 2 * y; yy <= y1; yy++)
+                        for (int xx = 2 * x; xx <= x1; xx++)
+                            d = glm::max(d, src[yy * sw + xx]);
+                    dst[y * w + x] = d;
+                }
+            }
+            cpuLevels.push_back(dst);
+            cpuW.push_back(w);
+            cpuH.push_back(h);
+        }
+    }
+
+    // box against the pyramid using the camera the depth was rendered with
+    bool occluded(const AABB& box) const
+    {
+        glm::vec3 ndcMin(1.0f), ndcMax(-1.0f);
+        for (int i = 0; i < 8; i++)
+        {
+            glm::vec4 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z, 1.0f);
+            glm::vec4 clip = depthViewProj * corner;
+            if (clip.w <= 0.0001f)
+                return false; // crosses the near plane
+            glm::vec3 ndc = glm::vec3(clip) / clip.w;
+            ndcMin = glm::min(ndcMin, ndc);
+            ndcMax = glm::max(ndcMax, ndc);
+        }
+        // no depth information outside the old view
+        if (ndcMin.x < -1.0f || ndcMin.y < -1.0f || ndcMax.x > 1.0f || ndcMax.y > 1.0f)
+            return false;
+
+        float boxDepth = ndcMin.z * 0.5f + 0.5f;
+        int w = cpuW[0], h = cpuH[0];
+        int x0 = (int)((ndcMin.x * 0.5f + 0.5f) * w), x1 = (int)((ndcMax.x * 0.5f + 0.5f) * w);
+        int y0 = (int)((ndcMin.y * 0.5f + 0.5f) * h), y1 = (int)((ndcMax.y * 0.5f + 0.5f) * h);
+        x1 = x1 < w - 1 ? x1 : w - 1;
+        y1 = y1 < h - 1 ? y1 : h - 1;
+
+        // walk down the pyramid until the box covers at most 2x2 texels
+        unsigned int level = 0;
+        while ((x1 - x0 > 1 || y1 - y0 > 1) && level + 1 < cpuLevels.size())
+        {
+            level++;
+            x0 /= 2; y0 /= 2;
+            x1 = glm::min(x1 / 2, cpuW[level] - 1);
+            y1 = glm::min(y1 / 2, cpuH[level] - 1);
+        }
+        const std::vector<float>& depth = cpuLevels[level];
+        int lw = cpuW[level];
+        for (int y = y0; y <= y1; y++)
+            for (int x = x0; x <= x1; x++)
+                if (boxDepth <= depth[y * lw + x])
+                    return false;
+        return true;
+    }
+};
+#endif
@@ -0,0 +1,105 @@
+// Job system microbenchmarks
+// Started with --jobbench, runs before the window opens and quits. For pools of 1 worker up to one per core it
+// prints what a job costs to submit and run, from the main thread and spawned from inside jobs, then how a
+// ParallelFor over a fixed amount of arithmetic scales against running it serially on the main thread.
+
+#ifndef JOBBENCHMARK_H
+#define JOBBENCHMARK_H
+#include "ThreadPool.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include <atomic>
+
+class JobBenchmark
+{
+public:
+    unsigned int spawnJobs = 200000;
+    unsigned int scalingItems = 4096;
+    unsigned int workPerItem = 20000; // iterations of the arithmetic loop in each ParallelFor item
+
+    void Run()
+    {
+        unsigned int cores = std::thread::hardware_concurrency();
+        if (cores == 0)
+            cores = 1;
+        std::vector<unsigned int> sizes;
+        for (unsigned int workers = 1; workers < cores; workers *= 2)
+            sizes.push_back(workers);
+        sizes.push_back(cores > 1 ? cores - 1 : 1); // the default pool
+
+        double serial = serialTime();
+        std::printf("Job system, %u cores, serial run %.1f ms\n", cores, serial * 1000.0);
+        std::printf("%8s %14s %14s %14s %10s %10s\n", "threads", "submit ns/job", "nested ns/job", "for ms", "speedup", "stolen");
+        for (unsigned int workers : sizes)
+        {
+            ThreadPool pool(workers);
+            double submit = submitTime(pool);
+            double nested = nestedTime(pool);
+            unsigned int stolen = pool.Steals();
+            double parallel = forTime(pool);
+            std::printf("%8u %14.0f %14.0f %14.1f %9.2fx %10u\n", workers + 1, submit * 1e9 / spawnJobs, nested * 1e9 / spawnJobs,
+                parallel * 1000.0, serial / parallel, pool.Steals() - stolen);
+        }
+    }
+
+private:
+    typedef std::chrono::high_resolution_clock Clock;
+    std::atomic<float> sink{ 0.0f }; // keeps the arithmetic from being optimised away
+
+    static double seconds(Clock::time_point start)
+    {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    float work(unsigned int item) const
+    {
+        float x = (float)item;
+        for (unsigned int i = 0; i < workPerItem; i++)
+            x = std::sqrt(x * 1.0001f + 1.0f);
+        return x;
+    }
+
+    double serialTime()
+    {
+        Clock::time_point start = Clock::now();
+        float total = 0.0f;
+        for (unsigned int i = 0; i < scalingItems; i++)
+            total += work(i);
+        sink = total;
+        return seconds(start);
+    }
+
+    // empty jobs from outside the pool, every one goes through the round robin
+    double submitTime(ThreadPool& pool)
+    {
+        Clock::time_point start = Clock::now();
+        for (unsigned int i = 0; i < spawnJobs; i++)
+            pool.Submit([]() {});
+        pool.Wait();
+        return seconds(start);
+    }
+
+    // empty jobs that spawn more jobs, a binary tree so most pushes land on the worker's own deque
+    double nestedTime(ThreadPool& pool)
+    {
+        Clock::time_point start = Clock::now();
+        pool.ParallelFor(spawnJobs, [](unsigned int) {});
+        return seconds(start);
+    }
+
+    double forTime(ThreadPool& pool)
+    {
+        std::vector<float> results(scalingItems);
+        Clock::time_point start = Clock::now();
+        pool.ParallelFor(scalingItems, [&](unsigned int i) { results[i] = work(i); }, 4);
+        double time = seconds(start);
+        float total = 0.0f;
+        for (float r : results)
+            total += r;
+        sink = total;
+        return time;
+    }
+};
+#endif
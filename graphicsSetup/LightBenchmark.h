@@ -0,0 +1,102 @@
+// Forward against deferred lighting benchmark
+// Started with --lightbench. The scene is drawn from the start position with 4, 64 and 512 point lights, each
+// count once with manyLights.fs and once with the deferred renderer. The gpu time of the opaque and lighting
+// passes is averaged per run and a table is printed before the window closes.
+
+#ifndef LIGHTBENCHMARK_H
+#define LIGHTBENCHMARK_H
+#include "GpuTimer.h"
+#include <vector>
+#include <cstdio>
+#include <iostream>
+
+class LightBenchmark
+{
+public:
+    bool active = false;
+    unsigned int warmupFrames = 60;   // lets the timer ring flush the previous run and the streaming settle
+    unsigned int measureFrames = 300;
+
+    LightBenchmark()
+    {
+        unsigned int counts[] = { 4, 64, 512 };
+        for (unsigned int lights : counts)
+        {
+            Run forward = { lights, false, 0.0, 0.0, 0 };
+            Run deferred = { lights, true, 0.0, 0.0, 0 };
+            runs.push_back(forward);
+            runs.push_back(deferred);
+        }
+    }
+
+    void Start()
+    {
+        active = true;
+        current = 0;
+        frame = 0;
+    }
+
+    unsigned int Lights() const
+    {
+        return runs[current].lights;
+    }
+
+    bool Deferred() const
+    {
+        return runs[current].deferred;
+    }
+
+    // once a frame after the timed passes, true when every run is done
+    bool Frame(const GpuTimer& timer, float frameMs)
+    {
+        if (!active)
+            return false;
+        Run& run = runs[current];
+        if (frame >= warmupFrames && timer.Results() != lastResults)
+        {
+            run.gpuMs += timer.lastMs;
+            run.frameMs += frameMs;
+            run.samples++;
+        }
+        lastResults = timer.Results();
+        if (++frame < warmupFrames + measureFrames)
+            return false;
+        frame = 0;
+        if (++current < runs.size())
+            return false;
+        active = false;
+        print();
+        return true;
+    }
+
+private:
+    struct Run {
+        unsigned int lights;
+        bool deferred;
+        double gpuMs;
+        double frameMs;
+        unsigned int samples;
+    };
+
+    std::vector<Run> runs;
+    unsigned int current = 0;
+    unsigned int frame = 0;
+    unsigned int lastResults = 0;
+
+    void print()
+    {
+        std::cout << "Light benchmark, gpu ms for the opaque and lighting passes (whole frame ms)" << std::endl;
+        std::cout << "  lights      forward            deferred" << std::endl;
+        for (unsigned int i = 0; i + 1 < runs.size(); i += 2)
+        {
+            const Run& f = runs[i];
+            const Run& d = runs[i + 1];
+            char line[128];
+            snprintf(line, sizeof(line), "  %6u  %7.3f (%7.3f)  %7.3f (%7.3f)", f.lights,
+                f.samples ? f.gpuMs / f.samples : 0.0, f.samples ? f.frameMs / f.samples : 0.0,
+                d.samples ? d.gpuMs / d.samples : 0.0, d.samples ? d.frameMs / d.samples : 0.0);
+            std::cout << line << std::endl;
+        }
+    }
+};
+#endif
@@ -0,0 +1,102 @@
+// Point lights kept in a texture buffer
+// Light radius reference https://learnopengl.com/Advanced-Lighting/Deferred-Shading
+// The four scene point lights stay as uniforms, any number of extra ones live here so both renderers can read
+// more lights than fit in a uniform array. Every light is four RGBA32F texels: position and constant term,
+// ambient and linear term, diffuse and quadratic term, specular and the radius past which it is ignored.
+
+#ifndef LIGHTBUFFER_H
+#define LIGHTBUFFER_H
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <random>
+
+struct PointLightData {
+    glm::vec3 pos;
+    float cons;
+    glm::vec3 ambient;
+    float linear;
+    glm::vec3 diffuse;
+    float quadratic;
+    glm::vec3 specular;
+    float radius;
+};
+
+class LightBuffer
+{
+public:
+    std::vector<PointLightData> lights;
+
+    LightBuffer()
+    {
+        glGenBuffers(1, &TBO);
+        glGenTextures(1, &texture);
+        glBindBuffer(GL_TEXTURE_BUFFER, TBO);
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(PointLightData), NULL, GL_DYNAMIC_DRAW);
+        glBindTexture(GL_TEXTURE_BUFFER, texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, TBO);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    ~LightBuffer()
+    {
+        glDeleteTextures(1, &texture);
+        glDeleteBuffers(1, &TBO);
+    }
+
+    unsigned int Count() const
+    {
+        return static_cast<unsigned int>(lights.size());
+    }
+
+    // small coloured lights spread over a box, the same ones every run so timings can be compared
+    void Scatter(unsigned int count, const glm::vec3& min, const glm::vec3& max, unsigned int seed = 7)
+    {
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> random(0.0f, 1.0f);
+        lights.resize(count);
+        for (unsigned int i = 0; i < count; i++)
+        {
+            PointLightData& light = lights[i];
+            light.pos = glm::mix(min, max, glm::vec3(random(rng), random(rng), random(rng)));
+            glm::vec3 colour = glm::vec3(random(rng), random(rng), random(rng)) * 0.8f + 0.2f;
+            light.ambient = colour * 0.02f;
+            light.diffuse = colour;
+            light.specular = colour;
+            light.cons = 1.0f;
+            light.linear = 1.4f;
+            light.quadratic = 7.2f;
+            light.radius = Radius(light);
+        }
+        dirty = true;
+    }
+
+    // distance where the attenuation drops the brightest channel below 5/256
+    static float Radius(const PointLightData& light)
+    {
+        float brightest = glm::max(glm::max(light.diffuse.r, light.diffuse.g), light.diffuse.b);
+        float c = light.cons - brightest * 256.0f / 5.0f;
+        return (-light.linear + glm::sqrt(light.linear * light.linear - 4.0f * light.quadratic * c)) / (2.0f * light.quadratic);
+    }
+
+    // uploads when the lights changed and binds the buffer texture
+    void Bind(unsigned int unit)
+    {
+        if (dirty)
+        {
+            glBindBuffer(GL_TEXTURE_BUFFER, TBO);
+            glBufferData(GL_TEXTURE_BUFFER, glm::max((size_t)1, lights.size()) * sizeof(PointLightData), lights.empty() ? NULL : &lights[0], GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+            dirty = false;
+        }
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_BUFFER, texture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+private:
+    unsigned int TBO = 0, texture = 0;
+    bool dirty = true;
+};
+#endif
@@ -0,0 +1,83 @@
+// Registry of flat colour materials kept in one uniform buffer
+// Uniform buffer reference https://learnopengl.com/Advanced-OpenGL/Advanced-GLSL (uniform buffer objects)
+// Every material is registered once and gets an id, the row of the MaterialTable block holding its colours. A draw
+// only passes the id, in its DrawBlock or the materialId uniform, and shad.fs and deferred.fs look the colours up,
+// so changing material between draws costs one integer and draws of different materials can share an instanced
+// draw. Id 0 is no material, for surfaces that take their colours from textures.
+
+#ifndef MATERIALTABLE_H
+#define MATERIALTABLE_H
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "shader.h"
+#include <iostream>
+
+const unsigned int MAX_MATERIALS = 64;          // MAX_MATERIALS in shad.fs and deferred.fs
+const GLuint MATERIAL_TABLE_BINDING = 1;
+
+struct Material {
+    glm::vec3 ambient;
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+    float shininess;
+};
+
+class MaterialTable
+{
+public:
+    MaterialTable()
+    {
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(Row) * MAX_MATERIALS, NULL, GL_STATIC_DRAW);
+        Row none = { glm::vec4(0.0f), glm::vec4(0.0f), glm::vec4(0.0f, 0.0f, 0.0f, 1.0f) };
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Row), &none);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, MATERIAL_TABLE_BINDING, buffer);
+    }
+
+    ~MaterialTable()
+    {
+        glDeleteBuffers(1, &buffer);
+    }
+
+    // the material's id, 0 once the table is full
+    unsigned int Register(const Material& material)
+    {
+        if (count == MAX_MATERIALS)
+        {
+            std::cout << "Material table is full, " << MAX_MATERIALS << " materials" << std::endl;
+            return 0;
+        }
+        Row row = { glm::vec4(material.ambient, 0.0f), glm::vec4(material.diffuse, 0.0f), glm::vec4(material.specular, material.shininess) };
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, sizeof(Row) * count, sizeof(Row), &row);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        return count++;
+    }
+
+    // points a shader's MaterialTable block at the table
+    void Use(const Shader& shader)
+    {
+        GLuint index = glGetUniformBlockIndex(shader.ID, "MaterialTable");
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(shader.ID, index, MATERIAL_TABLE_BINDING);
+    }
+
+    unsigned int Count() const
+    {
+        return count - 1;
+    }
+
+private:
+    // std140 row of the MaterialTable block
+    struct Row {
+        glm::vec4 ambient;
+        glm::vec4 diffuse;
+        glm::vec4 specular; // w is the shininess
+    };
+
+    GLuint buffer;
+    unsigned int count = 1; // row 0 is no material
+};
+#endif
@@ -6,11 +6,13 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include "shader.h"
+#include "Bounds.h"
 #include <string>
 #include <vector>
 using namespace std;
 
 #define BONE_MAX 4
+const unsigned int TEXTURE_ARRAY_UNIT = 7; // diffuseArray in manyLights.fs and gbuffer.fs
 
 struct Vertex {
     glm::vec3 Position;
@@ -34,16 +36,117 @@ public:
     vector<unsigned int> indices;
     vector<Texture>      textures;
     unsigned int VAO;
+    unsigned int depthVAO; // positions only, for the depth pre-pass
+    string name;
+    AABB bounds; // model space bounds used for culling
+    unsigned int arrayTex = 0; // texture array holding the diffuse map when TextureArrays packed it, 0 when not
+    int arrayLayer = 0;
+    float uvExtent = 0.0f; // widest range of texture coordinates, how much texture the mesh spreads over its size
 
     Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
     {
         this->vertices = vertices;
         this->indices = indices;
         this->textures = textures;
+        glm::vec2 uvMin(FLT_MAX), uvMax(-FLT_MAX);
+        for (unsigned int i = 0; i < this->vertices.size(); i++)
+        {
+            bounds.Grow(this->vertices[i].Position);
+            uvMin = glm::min(uvMin, this->vertices[i].TexCoords);
+            uvMax = glm::max(uvMax, this->vertices[i].TexCoords);
+        }
+        if (!this->vertices.empty())
+            uvExtent = glm::max(uvMax.x - uvMin.x, uvMax.y - uvMin.y);
       meshSetup();
     }
 
-    void Draw(Shader& shader)
+    // arrayBound when the caller already has arrayTex on TEXTURE_ARRAY_UNIT
+    void Draw(Shader& shader, bool arrayBound = false)
+    {
+        bindMaterial(shader, arrayBound);
+        glBindVertexArray(VAO);
+        glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
+        glBindVertexArray(0);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // only the depth buffer is written so only positions are fetched
+    void DrawDepth()
+    {
+        glBindVertexArray(depthVAO);
+        glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
+        glBindVertexArray(0);
+    }
+
+    void DrawDepthInstanced(unsigned int count)
+    {
+        glBindVertexArray(depthVAO);
+        glDrawElementsInstanced(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0, count);
+        glBindVertexArray(0);
+    }
+
+    // per instance attributes: model matrix in locations 7-10 and a fade value in 11
+    void InstanceSetup(unsigned int instanceVBO, unsigned int stride)
+    {
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        for (unsigned int i = 0; i < 4; i++)
+        {
+            glEnableVertexAttribArray(7 + i);
+            glVertexAttribPointer(7 + i, 4, GL_FLOAT, GL_FALSE, stride, (void*)(i * sizeof(glm::vec4)));
+            glVertexAttribDivisor(7 + i, 1);
+        }
+        glEnableVertexAttribArray(11);
+        glVertexAttribPointer(11, 1, GL_FLOAT, GL_FALSE, stride, (void*)(4 * sizeof(glm::vec4)));
+        glVertexAttribDivisor(11, 1);
+        glBindVertexArray(0);
+    }
+
+    void DrawInstanced(Shader& shader, unsigned int count, bool arrayBound = false)
+    {
+        bindMaterial(shader, arrayBound);
+        glBindVertexArray(VAO);
+        glDrawElementsInstanced(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0, count);
+        glBindVertexArray(0);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    unsigned int TriangleCount() const
+    {
+        return static_cast<unsigned int>(indices.size() / 3);
+    }
+
+    // meshes are copied around by value so nothing is freed on destruction, this is for the few that are thrown away
+    void Delete()
+    {
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteVertexArrays(1, &depthVAO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &EBO);
+        glDeleteBuffers(1, &positionVBO);
+    }
+
+private:
+    unsigned int VBO, EBO, positionVBO;
+
+    // a packed mesh picks its layer and binds its array unless the caller, the draw list, has bound it already
+    void bindMaterial(Shader& shader, bool arrayBound)
+    {
+        shader.setBool("diffuseFromArray", arrayTex != 0);
+        if (!arrayTex)
+        {
+            bindTextures(shader);
+            return;
+        }
+        shader.setFloat("diffuseLayer", (float)arrayLayer);
+        if (!arrayBound)
+        {
+            glActiveTexture(GL_TEXTURE0 + TEXTURE_ARRAY_UNIT);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, arrayTex);
+        }
+    }
+
+    void bindTextures(Shader& shader)
     {
         unsigned int diffuseNo = 1;
         unsigned int specularNo = 1;
@@ -66,16 +169,8 @@ public:
             glUniform1i(glGetUniformLocation(shader.ID, (name + num).c_str()), i);
             glBindTexture(GL_TEXTURE_2D, textures[i].id);
         }
-
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-        glActiveTexture(GL_TEXTURE0);
     }
 
-private:
-    unsigned int VBO, EBO;
-
     // initializes variables
     void meshSetup()
     {
@@ -105,6 +200,20 @@ private:
         glEnableVertexAttribArray(6);
         glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, m_Weights));
         glBindVertexArray(0);
+
+        // tightly packed copy of the positions sharing the same indices, 12 bytes a vertex instead of the full Vertex
+        vector<glm::vec3> positions(vertices.size());
+        for (unsigned int i = 0; i < vertices.size(); i++)
+            positions[i] = vertices[i].Position;
+        glGenVertexArrays(1, &depthVAO);
+        glGenBuffers(1, &positionVBO);
+        glBindVertexArray(depthVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+        glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), &positions[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+        glBindVertexArray(0);
     }
 };
 #endif
@@ -0,0 +1,258 @@
+// Software mixer that renders to a wav file
+// Wav format reference http://soundfile.sapp.org/doc/WaveFormat/
+// Mixes every playing voice into 16 bit stereo on the audio thread with the same inverse distance rolloff
+// irrKlang uses and equal power panning against the listener's right, then appends the block to a wav file.
+// Needs no sound device, so the scheduling and spatialization cost can be measured on any machine. Only
+// decoded clips are mixed, streamed files play silently.
+
+#ifndef MIXERBACKEND_H
+#define MIXERBACKEND_H
+#include "AudioBackend.h"
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+
+class MixerBackend : public AudioBackend
+{
+public:
+    MixerBackend(const char* wavPath, int sampleRate = 44100)
+        : wav(wavPath, std::ios::binary), sampleRate(sampleRate)
+    {
+        if (!wav)
+            std::cout << "Audio mixer failed to open its output :( Path: " << wavPath << std::endl;
+        writeHeader(0);
+    }
+
+    ~MixerBackend()
+    {
+        // sizes are only known now
+        wav.seekp(0);
+        writeHeader(framesWritten * 4);
+    }
+
+    const char* Name() const { return "software mixer"; }
+
+    bool LoadClip(const std::string& name, const PcmClip* clip)
+    {
+        clips[name] = clip;
+        return true;
+    }
+
+    void UnloadClip(const std::string& name)
+    {
+        clips.erase(name);
+    }
+
+    bool ClipInUse(const std::string& name)
+    {
+        for (std::map<unsigned int, Voice>::iterator it = voices.begin(); it != voices.end(); ++it)
+            if (it->second.name == name)
+                return true;
+        return false;
+    }
+
+    bool LoadStream(const std::string& path)
+    {
+        return true;
+    }
+
+    unsigned int Play(const std::string& name, const glm::vec3* pos, bool looped, float volume, float minDistance, unsigned int offsetMs)
+    {
+        std::map<std::string, const PcmClip*>::iterator clip = clips.find(name);
+        if (clip == clips.end())
+            return 0;
+        Voice v;
+        v.name = name;
+        v.clip = clip->second;
+        v.positional = pos != 0;
+        v.pos = pos ? *pos : glm::vec3(0.0f);
+        v.looped = looped;
+        v.volume = volume;
+        v.minDistance = minDistance;
+        double frames = (double)v.clip->format.FrameCount;
+        v.cursor = offsetMs * 0.001 * v.clip->format.SampleRate;
+        if (looped && frames > 0.0)
+            v.cursor = v.cursor - frames * (long long)(v.cursor / frames);
+        v.finished = frames <= 0.0 || v.cursor >= frames;
+        voices[++lastVoice] = v;
+        return lastVoice;
+    }
+
+    void SetVoicePosition(unsigned int voice, const glm::vec3& pos)
+    {
+        std::map<unsigned int, Voice>::iterator it = voices.find(voice);
+        if (it != voices.end())
+            it->second.pos = pos;
+    }
+
+    bool VoiceFinished(unsigned int voice)
+    {
+        std::map<unsigned int, Voice>::iterator it = voices.find(voice);
+        return it == voices.end() || it->second.finished;
+    }
+
+    void StopVoice(unsigned int voice)
+    {
+        voices.erase(voice);
+    }
+
+    void SetListener(const glm::vec3& pos, const glm::vec3& front)
+    {
+        listenerPos = pos;
+        glm::vec3 right = glm::cross(front, glm::vec3(0.0f, 1.0f, 0.0f));
+        if (glm::length(right) > 1e-4f)
+            listenerRight = glm::normalize(right);
+    }
+
+    // mixes dt seconds of every voice and appends them to the file
+    void Update(float dt)
+    {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        pending += dt * sampleRate;
+        unsigned int frames = (unsigned int)pending;
+        pending -= frames;
+        if (frames == 0)
+            return;
+
+        mix.assign(frames * 2, 0.0f);
+        std::map<unsigned int, Voice>::iterator it = voices.begin();
+        while (it != voices.end())
+        {
+            Voice& v = it->second;
+            if (!v.finished)
+            {
+                float left = v.volume, right = v.volume;
+                if (v.positional)
+                    spatialize(v, left, right);
+                mixVoice(v, frames, left, right);
+                voicesMixed++;
+            }
+            // a finished one shot lets go of its clip so the asset cache can evict it
+            if (v.finished)
+                it = voices.erase(it);
+            else
+                ++it;
+        }
+
+        out.resize(frames * 2);
+        for (unsigned int i = 0; i < frames * 2; i++)
+            out[i] = (int16_t)glm::clamp(mix[i] * 32767.0f, -32768.0f, 32767.0f);
+        wav.write((const char*)&out[0], out.size() * sizeof(int16_t));
+        framesWritten += frames;
+        mixMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        updates++;
+    }
+
+    void Report(float time)
+    {
+        if (time - lastReport < 2.0f)
+            return;
+        lastReport = time;
+        std::cout << "Audio mixer: " << voices.size() << " voices, " << (updates ? (float)voicesMixed / updates : 0.0f) << " mixed per update, "
+            << (updates ? mixMs / updates : 0.0) << " ms per update, " << framesWritten / sampleRate << " s written" << std::endl;
+        voicesMixed = 0;
+        updates = 0;
+        mixMs = 0.0;
+    }
+
+private:
+    struct Voice {
+        std::string name;
+        const PcmClip* clip;
+        bool positional;
+        glm::vec3 pos;
+        bool looped;
+        float volume;
+        float minDistance;
+        double cursor; // in source frames, fractional for resampling
+        bool finished;
+    };
+
+    std::ofstream wav;
+    int sampleRate;
+    std::map<std::string, const PcmClip*> clips;
+    std::map<unsigned int, Voice> voices;
+    unsigned int lastVoice = 0;
+    glm::vec3 listenerPos = glm::vec3(0.0f);
+    glm::vec3 listenerRight = glm::vec3(1.0f, 0.0f, 0.0f);
+    float pending = 0.0f;
+    std::vector<float> mix;
+    std::vector<int16_t> out;
+    unsigned long long framesWritten = 0;
+    unsigned int voicesMixed = 0, updates = 0;
+    double mixMs = 0.0;
+    float lastReport = 0.0f;
+
+    // inverse distance rolloff and equal power panning
+    void spatialize(const Voice& v, float& left, float& right)
+    {
+        glm::vec3 rel = v.pos - listenerPos;
+        float dist = glm::length(rel);
+        float gain = v.volume * glm::min(1.0f, v.minDistance / glm::max(dist, 1e-4f));
+        float pan = dist > 1e-4f ? glm::dot(rel / dist, listenerRight) : 0.0f; // -1 left to 1 right
+        float angle = (pan + 1.0f) * 0.25f * 3.14159265f;
+        left = gain * glm::cos(angle);
+        right = gain * glm::sin(angle);
+    }
+
+    float sample(const PcmClip* clip, unsigned int frame, int channel)
+    {
+        int channels = clip->format.ChannelCount;
+        unsigned int index = frame * channels + glm::min(channel, channels - 1);
+        if (clip->format.SampleFormat == irrklang::ESF_U8)
+            return ((unsigned char)clip->data[index] - 128) / 128.0f;
+        return ((const int16_t*)&clip->data[0])[index] / 32768.0f;
+    }
+
+    // linear resampling from the clip's rate to the output rate
+    void mixVoice(Voice& v, unsigned int frames, float left, float right)
+    {
+        const PcmClip* clip = v.clip;
+        unsigned int length = (unsigned int)clip->format.FrameCount;
+        double step = (double)clip->format.SampleRate / sampleRate;
+        for (unsigned int i = 0; i < frames; i++)
+        {
+            if (v.cursor >= length)
+            {
+                if (!v.looped)
+                {
+                    v.finished = true;
+                    return;
+                }
+                v.cursor -= length;
+            }
+            unsigned int f0 = (unsigned int)v.cursor;
+            unsigned int f1 = f0 + 1 < length ? f0 + 1 : (v.looped ? 0 : f0);
+            float t = (float)(v.cursor - f0);
+            mix[i * 2] += left * glm::mix(sample(clip, f0, 0), sample(clip, f1, 0), t);
+            mix[i * 2 + 1] += right * glm::mix(sample(clip, f0, 1), sample(clip, f1, 1), t);
+            v.cursor += step;
+        }
+    }
+
+    void writeHeader(unsigned long long dataBytes)
+    {
+        uint32_t data = (uint32_t)dataBytes;
+        uint32_t riff = 36 + data;
+        uint32_t fmtSize = 16, rate = sampleRate, byteRate = sampleRate * 4;
+        uint16_t pcm = 1, channels = 2, align = 4, bits = 16;
+        wav.write("RIFF", 4);
+        wav.write((const char*)&riff, 4);
+        wav.write("WAVEfmt ", 8);
+        wav.write((const char*)&fmtSize, 4);
+        wav.write((const char*)&pcm, 2);
+        wav.write((const char*)&channels, 2);
+        wav.write((const char*)&rate, 4);
+        wav.write((const char*)&byteRate, 4);
+        wav.write((const char*)&align, 2);
+        wav.write((const char*)&bits, 2);
+        wav.write("data", 4);
+        wav.write((const char*)&data, 4);
+    }
+};
+#endif
@@ -8,7 +8,7 @@
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
-#include "stb_image.h"
+#include "TextureCache.h"
 #include "Mesh.h"
 #include "shader.h"
 #include <string>
@@ -21,61 +21,142 @@ using namespace std;
 
 unsigned int TextureFile(const char* path, const string& directory, bool gamma = false);
 
+// a mesh read from the file but not on the gpu yet, built on any thread
+struct MeshData {
+    vector<Vertex> vertices;
+    vector<unsigned int> indices;
+    vector<pair<string, string>> textures; // type and path relative to the model
+    string name;
+};
+
+// everything Assimp gives us for a model, without touching GL so it can be read on a worker thread
+struct ModelData {
+    bool loaded = false;
+    string directory;
+    vector<MeshData> meshes;
+    map<string, PreparedTexture> textureFiles; // the textures by full path, read and decoded ahead when asked
+};
+
 class Model
 {
 public:
-    vector<Texture> textures_loaded;
+    vector<Texture> textures_loaded; // every texture this model holds a reference to in the TextureCache
     vector<Mesh>    meshes;
     string directory;
     bool gammaCorrection;
+    AABB bounds; // model space bounds of all meshes
 
     Model(string const& path, bool gamma = false) : gammaCorrection(gamma)
     {
-        loadModel(path);
+        ModelData data = Import(path);
+        directory = data.directory;
+        for (unsigned int i = 0; i < data.meshes.size(); i++)
+            meshes.push_back(Upload(data.meshes[i], data));
+        for (unsigned int i = 0; i < meshes.size(); i++)
+            bounds.Grow(meshes[i].bounds);
+        ready = true;
+    }
+
+    // an empty model that the ModelLoader fills in later
+    Model() : gammaCorrection(false) {}
+
+    ~Model()
+    {
+        for (unsigned int i = 0; i < textures_loaded.size(); i++)
+            TextureCache::Get().Release(textures_loaded[i].id);
     }
 
+    // the texture references are owned, a copy would release them twice
+    Model(const Model&) = delete;
+    Model& operator=(const Model&) = delete;
+
     void Draw(Shader& shader)
     {
         for (unsigned int i = 0; i < meshes.size(); i++)
             meshes[i].Draw(shader);
     }
 
-private:
-    // loads model
-    void loadModel(string const& path)
+    // false while the ModelLoader is still bringing it in, meshes may hold a placeholder until then
+    bool Ready() const
+    {
+        return ready;
+    }
+
+    // reads and processes the file, any thread. Shared vertices are welded and the triangles reordered for the
+    // post-transform cache. readTextures also reads and decodes the texture files so the main thread only uploads them
+    static ModelData Import(string const& path, bool readTextures = false)
     {
+        ModelData data;
         Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace
+            | aiProcess_JoinIdenticalVertices | aiProcess_ImproveCacheLocality);
         if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) 
         {
             cout << "ERROR::ASSIMP :( ::  " << importer.GetErrorString() << endl;
-            return;
+            return data;
         }
-        directory = path.substr(0, path.find_last_of('/'));
-        std::cout << "Directory Location:" << directory << std::endl;
+        data.directory = path.substr(0, path.find_last_of('/'));
+        std::cout << "Directory Location:" << data.directory << std::endl;
+        NodeProcess(scene->mRootNode, scene, data);
+        data.loaded = true;
+
+        if (readTextures)
+            for (const MeshData& mesh : data.meshes)
+                for (const pair<string, string>& texture : mesh.textures)
+                {
+                    string file = data.directory + '/' + texture.second;
+                    if (data.textureFiles.count(file))
+                        continue;
+                    std::ifstream in(file, std::ios::binary);
+                    vector<unsigned char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+                    data.textureFiles[file] = TextureStreamer::Prepare(file, std::move(bytes));
+                }
+        return data;
+    }
 
-        NodeProcess(scene->mRootNode, scene);
+    // the gpu half, main thread only: buffers for the mesh and references to its textures
+    Mesh Upload(const MeshData& mesh, const ModelData& data)
+    {
+        vector<Texture> textures;
+        for (const pair<string, string>& ref : mesh.textures)
+        {
+            //the cache hands back the texture any model already loaded from this file or one with the same contents
+            Texture texture;
+            string file = data.directory + '/' + ref.second;
+            map<string, PreparedTexture>::const_iterator read = data.textureFiles.find(file);
+            texture.id = read != data.textureFiles.end() ? TextureCache::Get().Acquire(file, read->second) : TextureFile(ref.second.c_str(), data.directory);
+            texture.type = ref.first;
+            texture.path = ref.second;
+            textures.push_back(texture);
+            textures_loaded.push_back(texture);
+        }
+        Mesh result(mesh.vertices, mesh.indices, textures);
+        result.name = mesh.name;
+        return result;
     }
 
-    void NodeProcess(aiNode* node, const aiScene* scene)
+private:
+    bool ready = false;
+    friend class ModelLoader;
+
+    static void NodeProcess(aiNode* node, const aiScene* scene, ModelData& data)
     {
         for (unsigned int i = 0; i < node->mNumMeshes; i++)
         {
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(MeshProcess(mesh, scene));
+            data.meshes.push_back(MeshProcess(mesh, scene));
         }
         for (unsigned int i = 0; i < node->mNumChildren; i++)
         {
-            NodeProcess(node->mChildren[i], scene);
+            NodeProcess(node->mChildren[i], scene, data);
         }
     }
 
-    Mesh MeshProcess(aiMesh* mesh, const aiScene* scene)
+    static MeshData MeshProcess(aiMesh* mesh, const aiScene* scene)
     {
-        vector<Vertex> vertices;
-        vector<unsigned int> indices;
-        vector<Texture> textures;
-
+        MeshData result;
+        vector<Vertex>& vertices = result.vertices;
+        vector<unsigned int>& indices = result.indices;
         for (unsigned int i = 0; i < mesh->mNumVertices; i++)
         {
             Vertex vertex;
@@ -127,91 +208,32 @@ private:
       
         aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
      
-        //diffuse maps
-        vector<Texture> diffuseMaps = loadMaterialText(material, aiTextureType_DIFFUSE, "texture_diffuse");
-        textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-        // specular maps
-        vector<Texture> specularMaps = loadMaterialText(material, aiTextureType_SPECULAR, "texture_specular");
-        textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
-        // normal maps
-        std::vector<Texture> normalMaps = loadMaterialText(material, aiTextureType_HEIGHT, "texture_normal");
-        textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
-        // height maps
-        std::vector<Texture> heightMaps = loadMaterialText(material, aiTextureType_AMBIENT, "texture_height");
-        textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
-
-        return Mesh(vertices, indices, textures);
+        //diffuse, specular, normal and height maps
+        loadMaterialText(material, aiTextureType_DIFFUSE, "texture_diffuse", result.textures);
+        loadMaterialText(material, aiTextureType_SPECULAR, "texture_specular", result.textures);
+        loadMaterialText(material, aiTextureType_HEIGHT, "texture_normal", result.textures);
+        loadMaterialText(material, aiTextureType_AMBIENT, "texture_height", result.textures);
+
+        result.name = mesh->mName.C_Str();
+        return result;
     }
 
-    // load texture
-    vector<Texture> loadMaterialText(aiMaterial* material, aiTextureType type, string typeName)
+    // texture paths of one type, loaded later by Upload
+    static void loadMaterialText(aiMaterial* material, aiTextureType type, string typeName, vector<pair<string, string>>& textures)
     {
-        vector<Texture> textures;
         for (unsigned int i = 0; i < material->GetTextureCount(type); i++)
         {
             aiString str;
             material->GetTexture(type, i, &str);
-            //load a texture if not already loaded for optimisaton
-            bool skip = false;
-            for (unsigned int j = 0; j < textures_loaded.size(); j++)
-            {
-                if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true;
-                    break;
-                }
-            }
-            if (!skip)
-            {  
-                Texture texture;
-                texture.id = TextureFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  
-            }
+            textures.push_back(make_pair(typeName, string(str.C_Str())));
         }
-        return textures;
     }
 };
 
+// a reference to the image's texture in the TextureCache, released with TextureCache::Get().Release
 unsigned int TextureFile(const char* path, const string& directory, bool gamma)
 {
-    string filename = string(path);
-    filename = directory + '/' + filename;
-
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int w, h, noComponents;
-    unsigned char* data = stbi_load(filename.c_str(), &w, &h, &noComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (noComponents == 1)
-            format = GL_RED;
-        else if (noComponents == 3)
-            format = GL_RGB;
-        else if (noComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, w, h, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load :(. At path: " << path << std::endl;
-        stbi_image_free(data);
-    }
-    return textureID;
+    return TextureCache::Get().Acquire(directory + '/' + string(path));
 }
 #endif
 
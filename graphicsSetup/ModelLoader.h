@@ -0,0 +1,214 @@
+// Loading models in the background
+// Assimp reference https://assimp-docs.readthedocs.io/en/latest/usage/use_the_lib.html
+// Load hands back an empty Model straight away and imports the file on the worker threads: Assimp's processing,
+// vertex cache reordering and reading and decoding every texture file all happen there. Once a model is imported it shows as a
+// grey box the size of its bounds, then the main thread builds its meshes a few at a time within a per-frame
+// upload budget and swaps them in when the last one is on the gpu, so the window comes up before anything loads.
+
+#ifndef MODELLOADER_H
+#define MODELLOADER_H
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "Model.h"
+#include "ThreadPool.h"
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <set>
+#include <iostream>
+
+class ModelLoader
+{
+public:
+    size_t uploadBudget = 4 * 1024 * 1024; // vertex, index and texture bytes a frame, one mesh always goes through
+
+    ModelLoader(ThreadPool& threads) : pool(threads)
+    {
+        // 1x1 grey for the placeholders, not in the TextureCache so no model releases it
+        unsigned char grey[4] = { 160, 160, 160, 255 };
+        glGenTextures(1, &greyTex);
+        glBindTexture(GL_TEXTURE_2D, greyTex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    ~ModelLoader()
+    {
+        pool.Wait(); // imports still write into this loader
+        for (Pending& pending : models)
+            if (pending.placeholder)
+                pending.model->meshes[0].Delete();
+        glDeleteTextures(1, &greyTex);
+    }
+
+    // the model stays empty until it is imported and is not Ready until all its meshes are uploaded
+    Model& Load(const std::string& path)
+    {
+        unsigned int index = (unsigned int)models.size();
+        Pending pending;
+        pending.model.reset(new Model());
+        pending.path = path;
+        models.push_back(std::move(pending));
+        pool.Submit([this, index, path]() {
+            ModelData data = Model::Import(path, true);
+            std::lock_guard<std::mutex> lock(importMutex);
+            imported.push_back(std::make_pair(index, std::move(data)));
+        });
+        return *models[index].model;
+    }
+
+    // once a frame: placeholders for new imports, then meshes uploaded until the budget runs out
+    void Update()
+    {
+        std::vector<std::pair<unsigned int, ModelData>> arrived;
+        {
+            std::lock_guard<std::mutex> lock(importMutex);
+            arrived.swap(imported);
+        }
+        for (std::pair<unsigned int, ModelData>& result : arrived)
+            begin(models[result.first], result.second);
+
+        bytesThisFrame = 0;
+        for (Pending& pending : models)
+        {
+            if (!pending.imported || pending.model->ready)
+                continue;
+            while (pending.built.size() < pending.data.meshes.size() && (bytesThisFrame == 0 || bytesThisFrame < uploadBudget))
+            {
+                const MeshData& mesh = pending.data.meshes[pending.built.size()];
+                pending.built.push_back(pending.model->Upload(mesh, pending.data));
+                bytesThisFrame += mesh.vertices.size() * (sizeof(Vertex) + sizeof(glm::vec3)) + mesh.indices.size() * sizeof(unsigned int);
+                // a texture shared by several meshes is uploaded with the first
+                for (const pair<string, string>& ref : mesh.textures)
+                {
+                    std::map<std::string, PreparedTexture>::const_iterator file = pending.data.textureFiles.find(pending.data.directory + '/' + ref.second);
+                    if (file != pending.data.textureFiles.end() && pending.texturesSent.insert(file->first).second)
+                        bytesThisFrame += file->second.LevelBytes();
+                }
+                meshesUploaded++;
+            }
+            if (pending.built.size() < pending.data.meshes.size())
+                break;
+            finish(pending);
+        }
+        bytesUploaded += bytesThisFrame;
+    }
+
+    bool AllReady() const
+    {
+        for (const Pending& pending : models)
+            if (!pending.model->ready)
+                return false;
+        return true;
+    }
+
+    void Report(float time)
+    {
+        if (time - lastReport < 2.0f || reportedDone)
+            return;
+        lastReport = time;
+        unsigned int ready = 0;
+        for (const Pending& pending : models)
+            ready += pending.model->ready ? 1 : 0;
+        std::cout << "Model loader: " << ready << "/" << models.size() << " models ready, " << meshesUploaded << " meshes and "
+            << bytesUploaded / (1024 * 1024) << " MB uploaded, " << bytesThisFrame / 1024 << " KB last frame" << std::endl;
+        reportedDone = ready == models.size();
+    }
+
+private:
+    struct Pending {
+        std::unique_ptr<Model> model; // owned here so the reference Load gave out stays valid
+        std::string path;
+        ModelData data;
+        bool imported = false;
+        bool placeholder = false;
+        std::vector<Mesh> built;
+        std::set<std::string> texturesSent; // counted against the budget already
+    };
+
+    ThreadPool& pool;
+    std::vector<Pending> models;
+    std::vector<std::pair<unsigned int, ModelData>> imported;
+    std::mutex importMutex;
+    unsigned int greyTex;
+    size_t bytesThisFrame = 0, bytesUploaded = 0;
+    unsigned int meshesUploaded = 0;
+    float lastReport = 0.0f;
+    bool reportedDone = false;
+
+    // the imported file is kept until its meshes are built, a grey box stands in for them meanwhile
+    void begin(Pending& pending, ModelData& data)
+    {
+        pending.data = std::move(data);
+        pending.imported = true;
+        Model& model = *pending.model;
+        model.directory = pending.data.directory;
+        if (!pending.data.loaded)
+        {
+            std::cout << "Model failed to load: " << pending.path << std::endl;
+            model.ready = true;
+            return;
+        }
+        for (const MeshData& mesh : pending.data.meshes)
+            for (const Vertex& vertex : mesh.vertices)
+                model.bounds.Grow(vertex.Position);
+        if (model.bounds.Valid())
+        {
+            model.meshes.push_back(box(model.bounds));
+            pending.placeholder = true;
+        }
+    }
+
+    void finish(Pending& pending)
+    {
+        Model& model = *pending.model;
+        if (pending.placeholder)
+            model.meshes[0].Delete();
+        pending.placeholder = false;
+        model.meshes.swap(pending.built);
+        model.ready = true;
+        pending.built.clear();
+        pending.data = ModelData();
+        pending.texturesSent.clear();
+    }
+
+    Mesh box(const AABB& bounds)
+    {
+        static const glm::vec3 normals[6] = { glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1) };
+        vector<Vertex> vertices;
+        vector<unsigned int> indices;
+        glm::vec3 center = bounds.Center(), extent = bounds.Extent();
+        for (int f = 0; f < 6; f++)
+        {
+            glm::vec3 n = normals[f];
+            glm::vec3 u = glm::abs(n.y) > 0.5f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+            glm::vec3 v = glm::cross(n, u);
+            unsigned int first = (unsigned int)vertices.size();
+            for (int c = 0; c < 4; c++)
+            {
+                glm::vec2 corner(c == 1 || c == 2 ? 1.0f : -1.0f, c >= 2 ? 1.0f : -1.0f);
+                Vertex vertex = Vertex();
+                vertex.Position = center + (n + u * corner.x + v * corner.y) * extent;
+                vertex.Normal = n;
+                vertex.TexCoords = corner * 0.5f + 0.5f;
+                vertex.Tangent = u;
+                vertex.Bitangent = v;
+                vertices.push_back(vertex);
+            }
+            unsigned int quad[6] = { 0, 1, 2, 0, 2, 3 };
+            for (unsigned int i : quad)
+                indices.push_back(first + i);
+        }
+        Texture grey;
+        grey.id = greyTex;
+        grey.type = "texture_diffuse";
+        grey.path = "placeholder";
+        Mesh mesh(vertices, indices, vector<Texture>(1, grey));
+        mesh.name = "placeholder";
+        return mesh;
+    }
+};
+#endif
@@ -0,0 +1,147 @@
+// Software occlusion regression test
+// Started with --occlusiontest, runs before the window opens and exits with 1 if anything is off. Fixed occluders
+// are rasterized into the depth buffer, which is compared tile by tile against depths worked out by hand for
+// every pixel centre, then boxes with a known answer are put through Test. The first cases draw straight in
+// normalized device coordinates so the expected depth is a simple formula, the last one is a floor seen through
+// a perspective camera with its near end behind the camera, so near plane clipping is covered too.
+
+#ifndef OCCLUSIONTEST_H
+#define OCCLUSIONTEST_H
+#include "SoftwareOcclusion.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <functional>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+class OcclusionTest
+{
+public:
+    int tileSize = 16;
+    float tolerance = 1e-4f; // in depth buffer units
+
+    // 0 when every case matches
+    int Run()
+    {
+        ThreadPool pool;
+        SoftwareOcclusion occlusion(pool);
+        glm::mat4 ndc(1.0f);
+        std::printf("Software occlusion test, %dx%d depth buffer in %dx%d tiles\n", OCCLUSION_WIDTH, OCCLUSION_HEIGHT, tileSize, tileSize);
+        std::printf("%14s %12s %12s %8s %8s\n", "case", "worst error", "tiles wrong", "boxes", "result");
+        bool pass = true;
+
+        // depth 0.5 over the whole screen
+        occlusion.ClearOccluders();
+        addQuad(occlusion, -1.0f, -1.0f, 1.0f, 1.0f, 0.0f, 0.0f);
+        BoxCase full[] = {
+            { box(glm::vec3(-0.5f, -0.5f, 0.2f), glm::vec3(0.5f, 0.5f, 0.6f)), false }, // behind
+            { box(glm::vec3(-0.5f, -0.5f, -0.4f), glm::vec3(0.5f, 0.5f, 0.6f)), true }, // reaches in front
+            { box(glm::vec3(2.0f, -0.5f, 0.2f), glm::vec3(3.0f, 0.5f, 0.6f)), true }    // off screen, left to frustum culling
+        };
+        pass = check("full screen", occlusion, ndc, [](float px, float py) { return 0.5f; }, full, 3) && pass;
+
+        // the left half at depth 0.25, pixel centres left of column 128 are covered
+        occlusion.ClearOccluders();
+        addQuad(occlusion, -1.0f, -1.0f, 0.0f, 1.0f, -0.5f, -0.5f);
+        BoxCase half[] = {
+            { box(glm::vec3(-0.9f, -0.5f, 0.0f), glm::vec3(-0.2f, 0.5f, 0.5f)), false }, // behind the left half
+            { box(glm::vec3(0.2f, -0.5f, 0.0f), glm::vec3(0.9f, 0.5f, 0.5f)), true },    // right half is empty
+            { box(glm::vec3(-0.9f, -0.5f, -0.8f), glm::vec3(-0.2f, 0.5f, 0.5f)), true }, // in front of the left half
+            { box(glm::vec3(-0.2f, -0.5f, 0.0f), glm::vec3(0.2f, 0.5f, 0.5f)), true }    // over the edge
+        };
+        pass = check("left half", occlusion, ndc, [](float px, float py) { return px < OCCLUSION_WIDTH / 2 ? 0.25f : 1.0f; }, half, 4) && pass;
+
+        // depth rising from 0 on the left edge to 1 on the right
+        occlusion.ClearOccluders();
+        addQuad(occlusion, -1.0f, -1.0f, 1.0f, 1.0f, -1.0f, 1.0f);
+        BoxCase slope[] = {
+            { box(glm::vec3(0.5f, -0.5f, 0.95f), glm::vec3(0.9f, 0.5f, 1.0f)), false },
+            { box(glm::vec3(-0.9f, -0.5f, -0.4f), glm::vec3(-0.5f, 0.5f, 0.0f)), false },
+            { box(glm::vec3(0.5f, -0.5f, 0.6f), glm::vec3(0.9f, 0.5f, 1.0f)), true }
+        };
+        pass = check("slope", occlusion, ndc, [](float px, float py) { return px / OCCLUSION_WIDTH; }, slope, 3) && pass;
+
+        // a floor one unit below a camera looking along it, from behind the camera out to 50 units. With a 90 degree
+        // field of view a row at ndc height y < 0 sees the floor at view depth -1 / y
+        const float nearPlane = 0.1f, farPlane = 100.0f, floorEnd = 50.0f;
+        glm::mat4 viewProj = glm::perspective(glm::radians(90.0f), 2.0f, nearPlane, farPlane);
+        occlusion.ClearOccluders();
+        std::vector<Point> floor = {
+            { glm::vec3(-1000.0f, -1.0f, 5.0f) }, { glm::vec3(1000.0f, -1.0f, 5.0f) }, { glm::vec3(1000.0f, -1.0f, -floorEnd) },
+            { glm::vec3(-1000.0f, -1.0f, 5.0f) }, { glm::vec3(1000.0f, -1.0f, -floorEnd) }, { glm::vec3(-1000.0f, -1.0f, -floorEnd) }
+        };
+        occlusion.AddOccluder(floor, { 0, 1, 2, 3, 4, 5 }, glm::mat4(1.0f));
+        BoxCase perspective[] = {
+            { box(glm::vec3(-1.0f, -3.0f, -12.0f), glm::vec3(1.0f, -2.0f, -8.0f)), false }, // under the floor
+            { box(glm::vec3(-1.0f, -1.0f, -12.0f), glm::vec3(1.0f, 0.5f, -8.0f)), true },   // standing on it
+            { box(glm::vec3(-1.0f, -3.0f, -2.0f), glm::vec3(1.0f, -2.0f, 2.0f)), true }     // around the camera
+        };
+        pass = check("floor", occlusion, viewProj, [=](float px, float py) {
+            float y = py / OCCLUSION_HEIGHT * 2.0f - 1.0f;
+            float distance = y < 0.0f ? -1.0f / y : floorEnd + 1.0f;
+            if (distance > floorEnd)
+                return 1.0f;
+            float z = ((farPlane + nearPlane) * distance - 2.0f * farPlane * nearPlane) / ((farPlane - nearPlane) * distance);
+            return z * 0.5f + 0.5f;
+        }, perspective, 3) && pass;
+
+        std::printf(pass ? "every case matches\n" : "MISMATCH\n");
+        return pass ? 0 : 1;
+    }
+
+private:
+    struct Point {
+        glm::vec3 Position;
+    };
+
+    struct BoxCase {
+        AABB box;
+        bool visible;
+    };
+
+    static AABB box(const glm::vec3& min, const glm::vec3& max)
+    {
+        AABB b;
+        b.min = min;
+        b.max = max;
+        return b;
+    }
+
+    // counter clockwise on screen, depth in ndc varying from left to right
+    static void addQuad(SoftwareOcclusion& occlusion, float x0, float y0, float x1, float y1, float zLeft, float zRight)
+    {
+        std::vector<Point> corners = {
+            { glm::vec3(x0, y0, zLeft) }, { glm::vec3(x1, y0, zRight) }, { glm::vec3(x1, y1, zRight) }, { glm::vec3(x0, y1, zLeft) }
+        };
+        occlusion.AddOccluder(corners, { 0, 1, 2, 0, 2, 3 }, glm::mat4(1.0f));
+    }
+
+    // expected is the depth at a pixel centre, in pixels from the bottom left
+    bool check(const char* name, SoftwareOcclusion& occlusion, const glm::mat4& viewProj, std::function<float(float, float)> expected,
+        const BoxCase* boxes, int boxCount)
+    {
+        occlusion.Render(viewProj);
+        const float* depth = occlusion.Depth();
+        float worst = 0.0f;
+        int tilesX = OCCLUSION_WIDTH / tileSize, tilesY = OCCLUSION_HEIGHT / tileSize;
+        std::vector<bool> tileWrong(tilesX * tilesY, false);
+        for (int y = 0; y < OCCLUSION_HEIGHT; y++)
+            for (int x = 0; x < OCCLUSION_WIDTH; x++)
+            {
+                float error = std::fabs(depth[y * OCCLUSION_WIDTH + x] - expected(x + 0.5f, y + 0.5f));
+                worst = glm::max(worst, error);
+                if (error > tolerance)
+                    tileWrong[(y / tileSize) * tilesX + x / tileSize] = true;
+            }
+        int wrong = 0;
+        for (bool w : tileWrong)
+            wrong += w ? 1 : 0;
+        int boxesRight = 0;
+        for (int i = 0; i < boxCount; i++)
+            boxesRight += occlusion.Test(boxes[i].box, 1) == boxes[i].visible ? 1 : 0;
+        bool pass = wrong == 0 && boxesRight == boxCount;
+        std::printf("%14s %12.2e %12d %6d/%d %8s\n", name, worst, wrong, boxesRight, boxCount, pass ? "pass" : "FAIL");
+        return pass;
+    }
+};
+#endif
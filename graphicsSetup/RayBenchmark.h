@@ -0,0 +1,236 @@
+// Ray query microbenchmarks
+// Started with --raybench, runs before the window opens and quits. Builds a stand in for the scene out of plain
+// vertex arrays, a bumpy ground grid with houses and snowmen placed on it, then times rays straight down like
+// the ground following, level rays like picking and walking into walls, and whole camera steps. A sample of the
+// rays is checked against testing every triangle of every instance.
+
+#ifndef RAYBENCHMARK_H
+#define RAYBENCHMARK_H
+#include "RayQuery.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include <atomic>
+
+class RayBenchmark
+{
+public:
+    int groundCells = 256;         // grid cells per side, two triangles each
+    float groundSize = 400.0f;
+    unsigned int houses = 400;
+    unsigned int snowmen = 200;
+    unsigned int rays = 200000;
+    unsigned int bruteSamples = 200;
+
+    void Run()
+    {
+        std::mt19937 random(99);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        makeGround();
+        makeBox();
+        makeSphere(24, 12);
+
+        RayQuery query;
+        Clock::time_point start = Clock::now();
+        add(query, ground, groundIndices, glm::mat4(1.0f));
+        for (unsigned int i = 0; i < houses; i++)
+        {
+            glm::vec3 pos = randomGround(random);
+            glm::mat4 m = glm::translate(glm::mat4(1.0f), pos);
+            m = glm::rotate(m, unit(random) * 6.2831853f, glm::vec3(0.0f, 1.0f, 0.0f));
+            m = glm::scale(m, glm::vec3(3.0f + unit(random) * 4.0f, 3.0f + unit(random) * 3.0f, 3.0f + unit(random) * 4.0f));
+            add(query, box, boxIndices, m);
+        }
+        for (unsigned int i = 0; i < snowmen; i++)
+            add(query, sphere, sphereIndices, glm::scale(glm::translate(glm::mat4(1.0f), randomGround(random) + glm::vec3(0.0f, 0.5f, 0.0f)), glm::vec3(0.5f)));
+        query.Update();
+        double build = seconds(start);
+        unsigned int triangles = 0;
+        for (const Placed& p : placed)
+            triangles += (unsigned int)(p.indices->size() / 3);
+        std::printf("Ray queries, %u triangles in %u instances (%u unique), build %.1f ms\n", triangles, (unsigned int)placed.size(),
+            query.TriangleCount(), build * 1000.0);
+        std::printf("%10s %14s %14s %10s %8s %9s\n", "rays", "rays/s", "brute rays/s", "speedup", "hit %", "matches");
+
+        std::vector<glm::vec3> origins(rays), dirs(rays);
+        for (unsigned int i = 0; i < rays; i++)
+        {
+            origins[i] = randomGround(random) + glm::vec3(0.0f, 50.0f, 0.0f);
+            dirs[i] = glm::vec3(0.0f, -1.0f, 0.0f);
+        }
+        rayRow("down", query, origins, dirs, 100.0f);
+        for (unsigned int i = 0; i < rays; i++)
+        {
+            float a = unit(random) * 6.2831853f;
+            origins[i] = randomGround(random) + glm::vec3(0.0f, 1.5f, 0.0f);
+            dirs[i] = glm::vec3(std::cos(a), 0.0f, std::sin(a));
+        }
+        rayRow("level", query, origins, dirs, 100.0f);
+
+        // a camera step is a slide along the move plus a ground ray, about three rays
+        start = Clock::now();
+        float heights = 0.0f;
+        for (unsigned int i = 0; i < rays; i++)
+        {
+            glm::vec3 to = origins[i] + dirs[i] * 0.05f;
+            glm::vec3 pos = query.Slide(origins[i], to, 0.3f);
+            float height;
+            if (query.Ground(pos, 0.5f, 100.0f, height))
+                heights += height;
+        }
+        double stepTime = seconds(start);
+        sink = heights;
+        std::printf("%10s %14.0f camera steps/s (%.2f us each)\n", "camera", rays / stepTime, stepTime * 1e6 / rays);
+    }
+
+private:
+    typedef std::chrono::high_resolution_clock Clock;
+    std::atomic<float> sink{ 0.0f }; // keeps the camera steps from being optimised away
+
+    struct BenchVertex {
+        glm::vec3 Position;
+    };
+
+    struct Placed {
+        const std::vector<BenchVertex>* vertices;
+        const std::vector<unsigned int>* indices;
+        glm::mat4 matrix;
+    };
+
+    std::vector<BenchVertex> ground, box, sphere;
+    std::vector<unsigned int> groundIndices, boxIndices, sphereIndices;
+    std::vector<Placed> placed;
+
+    static double seconds(Clock::time_point start)
+    {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    float groundHeight(float x, float z) const
+    {
+        return std::sin(x * 0.05f) * 2.0f + std::cos(z * 0.07f) * 1.5f;
+    }
+
+    glm::vec3 randomGround(std::mt19937& random) const
+    {
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        float x = (unit(random) - 0.5f) * groundSize * 0.95f;
+        float z = (unit(random) - 0.5f) * groundSize * 0.95f;
+        return glm::vec3(x, groundHeight(x, z), z);
+    }
+
+    void add(RayQuery& query, const std::vector<BenchVertex>& vertices, const std::vector<unsigned int>& indices, const glm::mat4& matrix)
+    {
+        query.Add(vertices, indices, matrix, (unsigned int)placed.size());
+        placed.push_back(Placed{ &vertices, &indices, matrix });
+    }
+
+    void makeGround()
+    {
+        int n = groundCells + 1;
+        for (int z = 0; z < n; z++)
+            for (int x = 0; x < n; x++)
+            {
+                float px = ((float)x / groundCells - 0.5f) * groundSize;
+                float pz = ((float)z / groundCells - 0.5f) * groundSize;
+                ground.push_back(BenchVertex{ glm::vec3(px, groundHeight(px, pz), pz) });
+            }
+        for (int z = 0; z < groundCells; z++)
+            for (int x = 0; x < groundCells; x++)
+            {
+                unsigned int a = z * n + x;
+                unsigned int quad[6] = { a, a + n, a + 1, a + 1, a + n, a + n + 1 };
+                groundIndices.insert(groundIndices.end(), quad, quad + 6);
+            }
+    }
+
+    // unit cube standing on the origin
+    void makeBox()
+    {
+        for (int i = 0; i < 8; i++)
+            box.push_back(BenchVertex{ glm::vec3(i & 1 ? 0.5f : -0.5f, i & 2 ? 1.0f : 0.0f, i & 4 ? 0.5f : -0.5f) });
+        unsigned int faces[36] = { 0, 1, 3, 0, 3, 2, 4, 6, 7, 4, 7, 5, 0, 4, 5, 0, 5, 1, 2, 3, 7, 2, 7, 6, 0, 2, 6, 0, 6, 4, 1, 5, 7, 1, 7, 3 };
+        boxIndices.assign(faces, faces + 36);
+    }
+
+    void makeSphere(int slices, int stacks)
+    {
+        for (int s = 0; s <= stacks; s++)
+            for (int l = 0; l <= slices; l++)
+            {
+                float theta = 3.14159265f * s / stacks, phi = 6.2831853f * l / slices;
+                sphere.push_back(BenchVertex{ glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)) });
+            }
+        for (int s = 0; s < stacks; s++)
+            for (int l = 0; l < slices; l++)
+            {
+                unsigned int a = s * (slices + 1) + l, b = a + slices + 1;
+                unsigned int quad[6] = { a, b, a + 1, a + 1, b, b + 1 };
+                sphereIndices.insert(sphereIndices.end(), quad, quad + 6);
+            }
+    }
+
+    // every triangle of every instance, in world space
+    bool brute(const glm::vec3& o, const glm::vec3& d, float& tMax) const
+    {
+        bool found = false;
+        for (const Placed& p : placed)
+        {
+            const std::vector<unsigned int>& indices = *p.indices;
+            for (size_t i = 0; i < indices.size(); i += 3)
+            {
+                glm::vec3 v0 = glm::vec3(p.matrix * glm::vec4((*p.vertices)[indices[i]].Position, 1.0f));
+                glm::vec3 e1 = glm::vec3(p.matrix * glm::vec4((*p.vertices)[indices[i + 1]].Position, 1.0f)) - v0;
+                glm::vec3 e2 = glm::vec3(p.matrix * glm::vec4((*p.vertices)[indices[i + 2]].Position, 1.0f)) - v0;
+                glm::vec3 pv = glm::cross(d, e2);
+                float det = glm::dot(e1, pv);
+                if (std::fabs(det) <= 1e-12f)
+                    continue;
+                glm::vec3 s = o - v0;
+                float u = glm::dot(s, pv) / det;
+                glm::vec3 q = glm::cross(s, e1);
+                float v = glm::dot(d, q) / det;
+                float t = glm::dot(e2, q) / det;
+                if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t > 0.0f && t < tMax)
+                {
+                    tMax = t;
+                    found = true;
+                }
+            }
+        }
+        return found;
+    }
+
+    void rayRow(const char* name, const RayQuery& query, const std::vector<glm::vec3>& origins, const std::vector<glm::vec3>& dirs, float maxDistance)
+    {
+        std::vector<float> t(rays, -1.0f);
+        unsigned int hits = 0;
+        Clock::time_point start = Clock::now();
+        for (unsigned int i = 0; i < rays; i++)
+        {
+            RayHit hit;
+            if (query.Raycast(origins[i], dirs[i], maxDistance, hit))
+            {
+                t[i] = hit.t;
+                hits++;
+            }
+        }
+        double time = seconds(start);
+        unsigned int samples = std::min(bruteSamples, rays);
+        bool matches = true;
+        start = Clock::now();
+        for (unsigned int i = 0; i < samples; i++)
+        {
+            float bruteT = maxDistance;
+            bool found = brute(origins[i], dirs[i], bruteT);
+            matches = matches && found == (t[i] >= 0.0f) && (!found || std::fabs(bruteT - t[i]) < 1e-3f * std::max(1.0f, bruteT));
+        }
+        double bruteTime = seconds(start);
+        std::printf("%10s %14.0f %14.0f %9.0fx %7.1f%% %9s\n", name, rays / time, samples / bruteTime, (rays / time) / (samples / bruteTime),
+            100.0 * hits / rays, matches ? "yes" : "NO");
+    }
+};
+#endif
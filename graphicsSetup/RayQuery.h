@@ -0,0 +1,502 @@
+// CPU ray casts against mesh triangles, for picking and for keeping the camera out of the ground and houses
+// Ray triangle test reference https://www.graphics.cornell.edu/pubs/1997/MT97.pdf (Moller Trumbore)
+// Triangle BVH reference https://jacco.ompf2.com/2022/04/13/how-to-build-a-bvh-part-1-basics/
+// Every mesh gets a triangle BVH in its own model space the first time it is added, built from the vertices Mesh
+// keeps after upload. Leaves hold up to four triangles stored lane by lane, so SSE tests a ray against all four at
+// once. Instances place a mesh in the world and their boxes go in a Bvh; a ray only goes into an instance's
+// model space, untouched in length so distances stay in world units, once it reaches the instance's box.
+// Queries never change anything, so a set of instances that no longer moves can be read from several threads.
+
+#ifndef RAYQUERY_H
+#define RAYQUERY_H
+#include <glm/glm.hpp>
+#include "Bounds.h"
+#include "Bvh.h"
+#include <vector>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+
+const unsigned int MESH_BVH_LEAF_SIZE = 4; // one packet of triangles per leaf
+const int MESH_BVH_STACK = 256;
+
+// four triangles lane by lane, a corner and the two edges leaving it
+struct TrianglePacket {
+    float v0x[4], v0y[4], v0z[4];
+    float e1x[4], e1y[4], e1z[4];
+    float e2x[4], e2y[4], e2z[4];
+    unsigned int triangle[4]; // index into the mesh's triangles, the unused lanes are degenerate
+};
+
+// triangle BVH of one mesh in model space
+class MeshBvh
+{
+public:
+    template <typename VertexT>
+    void Build(const std::vector<VertexT>& vertices, const std::vector<unsigned int>& indices)
+    {
+        unsigned int count = (unsigned int)(indices.size() / 3);
+        corners.resize(count * 3);
+        normals.resize(count);
+        centroids.resize(count);
+        boxes.resize(count);
+        order.resize(count);
+        for (unsigned int i = 0; i < count; i++)
+        {
+            for (int c = 0; c < 3; c++)
+                corners[i * 3 + c] = vertices[indices[i * 3 + c]].Position;
+            glm::vec3 n = glm::cross(corners[i * 3 + 1] - corners[i * 3], corners[i * 3 + 2] - corners[i * 3]);
+            float length = glm::length(n);
+            normals[i] = length > 0.0f ? n / length : glm::vec3(0.0f, 1.0f, 0.0f);
+            boxes[i] = AABB();
+            for (int c = 0; c < 3; c++)
+                boxes[i].Grow(corners[i * 3 + c]);
+            centroids[i] = boxes[i].Center();
+            order[i] = i;
+        }
+        nodes.clear();
+        packets.clear();
+        if (count > 0)
+        {
+            nodes.push_back(Node());
+            split(0, 0, count);
+        }
+        // only the packets and normals are needed from here on
+        corners.clear();
+        corners.shrink_to_fit();
+        centroids.clear();
+        centroids.shrink_to_fit();
+        boxes.clear();
+        boxes.shrink_to_fit();
+        order.clear();
+        order.shrink_to_fit();
+    }
+
+    AABB Bounds() const
+    {
+        return nodes.empty() ? AABB() : nodes[0].box;
+    }
+
+    unsigned int TriangleCount() const
+    {
+        return (unsigned int)normals.size();
+    }
+
+    // model space normal of a triangle, by its winding
+    const glm::vec3& Normal(unsigned int triangle) const
+    {
+        return normals[triangle];
+    }
+
+    // nearest triangle along the ray before tMax, lowering tMax to it
+    bool Raycast(const glm::vec3& origin, const glm::vec3& dir, float& tMax, unsigned int& triangle) const
+    {
+        if (nodes.empty())
+            return false;
+        glm::vec3 inv = Bvh::InverseDir(dir);
+        float tEnter;
+        if (!Bvh::RayBox(nodes[0].box, origin, inv, tMax, tEnter))
+            return false;
+        struct Entry {
+            unsigned int node;
+            float t;
+        };
+        Entry stack[MESH_BVH_STACK];
+        int top = 0;
+        stack[top++] = Entry{ 0, tEnter };
+        bool found = false;
+        while (top > 0)
+        {
+            Entry entry = stack[--top];
+            if (entry.t > tMax)
+                continue;
+            const Node& node = nodes[entry.node];
+            if (node.count > 0)
+            {
+                for (unsigned int p = node.first; p < node.first + node.count; p++)
+                    if (intersect(packets[p], origin, dir, tMax, triangle))
+                        found = true;
+                continue;
+            }
+            // the nearer child is taken next
+            float tA, tB;
+            bool a = Bvh::RayBox(nodes[node.first].box, origin, inv, tMax, tA);
+            bool b = Bvh::RayBox(nodes[node.first + 1].box, origin, inv, tMax, tB);
+            if (a && b)
+            {
+                bool aFirst = tA <= tB;
+                stack[top++] = aFirst ? Entry{ node.first + 1, tB } : Entry{ node.first, tA };
+                stack[top++] = aFirst ? Entry{ node.first, tA } : Entry{ node.first + 1, tB };
+            }
+            else if (a)
+                stack[top++] = Entry{ node.first, tA };
+            else if (b)
+                stack[top++] = Entry{ node.first + 1, tB };
+        }
+        return found;
+    }
+
+private:
+    // leaves point at their packets, inner nodes at the first of their two children, which sit side by side
+    struct Node {
+        AABB box;
+        unsigned int first = 0;
+        unsigned int count = 0; // packets in a leaf, 0 for an inner node
+    };
+
+    std::vector<Node> nodes;
+    std::vector<TrianglePacket> packets;
+    std::vector<glm::vec3> normals;
+    // build only
+    std::vector<glm::vec3> corners;
+    std::vector<glm::vec3> centroids;
+    std::vector<AABB> boxes;
+    std::vector<unsigned int> order;
+
+    // node over order[first, first + count), split at the cheapest bin boundary like the instance Bvh
+    void split(unsigned int index, unsigned int first, unsigned int count)
+    {
+        AABB box, centres;
+        for (unsigned int i = first; i < first + count; i++)
+        {
+            box.Grow(boxes[order[i]]);
+            centres.Grow(centroids[order[i]]);
+        }
+        nodes[index].box = box;
+        if (count <= MESH_BVH_LEAF_SIZE)
+        {
+            nodes[index].first = (unsigned int)packets.size();
+            nodes[index].count = 1;
+            packets.push_back(makePacket(first, count));
+            return;
+        }
+
+        int bestAxis = -1;
+        unsigned int bestBin = 0;
+        float bestCost = FLT_MAX;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float extent = centres.max[axis] - centres.min[axis];
+            if (extent <= 0.0f)
+                continue;
+            AABB binBoxes[BVH_BINS];
+            unsigned int binCounts[BVH_BINS] = {};
+            float scale = BVH_BINS / extent;
+            for (unsigned int i = first; i < first + count; i++)
+            {
+                unsigned int b = binOf(centroids[order[i]][axis], centres.min[axis], scale);
+                binBoxes[b].Grow(boxes[order[i]]);
+                binCounts[b]++;
+            }
+            float leftArea[BVH_BINS - 1];
+            unsigned int leftCount[BVH_BINS - 1];
+            AABB grow;
+            unsigned int n = 0;
+            for (unsigned int b = 0; b < BVH_BINS - 1; b++)
+            {
+                grow.Grow(binBoxes[b]);
+                n += binCounts[b];
+                leftArea[b] = surfaceArea(grow);
+                leftCount[b] = n;
+            }
+            grow = AABB();
+            n = 0;
+            for (unsigned int b = BVH_BINS - 1; b > 0; b--)
+            {
+                grow.Grow(binBoxes[b]);
+                n += binCounts[b];
+                if (leftCount[b - 1] == 0 || n == 0)
+                    continue;
+                float cost = leftArea[b - 1] * leftCount[b - 1] + surfaceArea(grow) * n;
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = b;
+                }
+            }
+        }
+
+        unsigned int middle = first + count / 2;
+        if (bestAxis >= 0)
+        {
+            float scale = BVH_BINS / (centres.max[bestAxis] - centres.min[bestAxis]);
+            float lo = centres.min[bestAxis];
+            middle = (unsigned int)(std::partition(order.begin() + first, order.begin() + first + count, [&](unsigned int t)
+            {
+                return binOf(centroids[t][bestAxis], lo, scale) < bestBin;
+            }) - order.begin());
+        }
+        if (middle == first || middle == first + count)
+            middle = first + count / 2;
+
+        unsigned int children = (unsigned int)nodes.size();
+        nodes.push_back(Node());
+        nodes.push_back(Node());
+        nodes[index].first = children;
+        nodes[index].count = 0;
+        split(children, first, middle - first);
+        split(children + 1, middle, first + count - middle);
+    }
+
+    static unsigned int binOf(float centre, float lo, float scale)
+    {
+        unsigned int b = (unsigned int)((centre - lo) * scale);
+        return b < BVH_BINS ? b : BVH_BINS - 1;
+    }
+
+    static float surfaceArea(const AABB& box)
+    {
+        if (!box.Valid())
+            return 0.0f;
+        glm::vec3 d = box.max - box.min;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    TrianglePacket makePacket(unsigned int first, unsigned int count) const
+    {
+        TrianglePacket packet;
+        for (unsigned int k = 0; k < 4; k++)
+        {
+            glm::vec3 v0(0.0f), e1(0.0f), e2(0.0f);
+            unsigned int t = 0;
+            if (k < count)
+            {
+                t = order[first + k];
+                v0 = corners[t * 3];
+                e1 = corners[t * 3 + 1] - v0;
+                e2 = corners[t * 3 + 2] - v0;
+            }
+            packet.v0x[k] = v0.x;
+            packet.v0y[k] = v0.y;
+            packet.v0z[k] = v0.z;
+            packet.e1x[k] = e1.x;
+            packet.e1y[k] = e1.y;
+            packet.e1z[k] = e1.z;
+            packet.e2x[k] = e2.x;
+            packet.e2y[k] = e2.y;
+            packet.e2z[k] = e2.z;
+            packet.triangle[k] = t;
+        }
+        return packet;
+    }
+
+    // Moller Trumbore on the four lanes, both faces count. Lowers tMax to the nearest hit
+    static bool intersect(const TrianglePacket& p, const glm::vec3& o, const glm::vec3& d, float& tMax, unsigned int& triangle)
+    {
+        float t[4];
+        int mask;
+#ifdef BVH_SSE
+        __m128 dx = _mm_set1_ps(d.x), dy = _mm_set1_ps(d.y), dz = _mm_set1_ps(d.z);
+        __m128 e1x = _mm_loadu_ps(p.e1x), e1y = _mm_loadu_ps(p.e1y), e1z = _mm_loadu_ps(p.e1z);
+        __m128 e2x = _mm_loadu_ps(p.e2x), e2y = _mm_loadu_ps(p.e2y), e2z = _mm_loadu_ps(p.e2z);
+        // p = d x e2
+        __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+        __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+        __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+        __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+        __m128 absDet = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+        __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+        // s = o - v0, q = s x e1
+        __m128 sx = _mm_sub_ps(_mm_set1_ps(o.x), _mm_loadu_ps(p.v0x));
+        __m128 sy = _mm_sub_ps(_mm_set1_ps(o.y), _mm_loadu_ps(p.v0y));
+        __m128 sz = _mm_sub_ps(_mm_set1_ps(o.z), _mm_loadu_ps(p.v0z));
+        __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+        __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+        __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+        __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+        __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+        __m128 tt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+        __m128 zero = _mm_setzero_ps();
+        __m128 hit = _mm_and_ps(_mm_cmpgt_ps(absDet, _mm_set1_ps(1e-12f)), _mm_cmpge_ps(u, zero));
+        hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f))));
+        hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpgt_ps(tt, zero), _mm_cmplt_ps(tt, _mm_set1_ps(tMax))));
+        mask = _mm_movemask_ps(hit);
+        _mm_storeu_ps(t, tt);
+#else
+        mask = 0;
+        for (int k = 0; k < 4; k++)
+        {
+            glm::vec3 e1(p.e1x[k], p.e1y[k], p.e1z[k]), e2(p.e2x[k], p.e2y[k], p.e2z[k]);
+            glm::vec3 pv = glm::cross(d, e2);
+            float det = glm::dot(e1, pv);
+            if (std::fabs(det) <= 1e-12f)
+                continue;
+            float invDet = 1.0f / det;
+            glm::vec3 s = o - glm::vec3(p.v0x[k], p.v0y[k], p.v0z[k]);
+            float u = glm::dot(s, pv) * invDet;
+            glm::vec3 q = glm::cross(s, e1);
+            float v = glm::dot(d, q) * invDet;
+            t[k] = glm::dot(e2, q) * invDet;
+            if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t[k] > 0.0f && t[k] < tMax)
+                mask |= 1 << k;
+        }
+#endif
+        if (!mask)
+            return false;
+        for (int k = 0; k < 4; k++)
+        {
+            if ((mask & (1 << k)) && t[k] < tMax)
+            {
+                tMax = t[k];
+                triangle = p.triangle[k];
+            }
+        }
+        return true;
+    }
+};
+
+struct RayHit {
+    unsigned int data = 0;   // what the instance was added with
+    float t = 0.0f;          // distance along the ray
+    glm::vec3 point = glm::vec3(0.0f);
+    glm::vec3 normal = glm::vec3(0.0f, 1.0f, 0.0f); // world space, facing back along the ray
+};
+
+// placed meshes to cast rays against
+class RayQuery
+{
+public:
+    // places a mesh, whose triangle tree is built the first time its vertices are seen. Returns the handle for Move
+    template <typename VertexT>
+    int Add(const std::vector<VertexT>& vertices, const std::vector<unsigned int>& indices, const glm::mat4& matrix, unsigned int data)
+    {
+        std::unique_ptr<MeshBvh>& tree = trees[&vertices];
+        if (!tree)
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            tree.reset(new MeshBvh());
+            tree->Build(vertices, indices);
+            triangles += tree->TriangleCount();
+            buildMs += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+        Instance instance;
+        instance.tree = tree.get();
+        instance.data = data;
+        instance.matrix = matrix;
+        instance.inverse = glm::inverse(matrix);
+        instance.proxy = bvh.Insert(TransformAABB(matrix, tree->Bounds()), (unsigned int)instances.size());
+        instances.push_back(instance);
+        return (int)instances.size() - 1;
+    }
+
+    void Move(int handle, const glm::mat4& matrix)
+    {
+        Instance& instance = instances[handle];
+        instance.matrix = matrix;
+        instance.inverse = glm::inverse(matrix);
+        bvh.Move(instance.proxy, TransformAABB(matrix, instance.tree->Bounds()));
+    }
+
+    // after Add or Move, before the next query
+    void Update()
+    {
+        bvh.Update();
+    }
+
+    unsigned int TriangleCount() const
+    {
+        return triangles;
+    }
+
+    // nearest triangle along a unit length ray within maxDistance
+    bool Raycast(const glm::vec3& origin, const glm::vec3& dir, float maxDistance, RayHit& hit) const
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        float tMax = maxDistance;
+        int nearest = -1;
+        unsigned int triangle = 0;
+        bvh.Raycast(origin, dir, tMax, [&](unsigned int index, float, float& t)
+        {
+            const Instance& instance = instances[index];
+            glm::vec3 localOrigin = glm::vec3(instance.inverse * glm::vec4(origin, 1.0f));
+            glm::vec3 localDir = glm::mat3(instance.inverse) * dir;
+            if (!instance.tree->Raycast(localOrigin, localDir, t, triangle))
+                return false;
+            nearest = (int)index;
+            return true;
+        });
+        // t only ever shrinks, so the last instance and triangle that took a hit are the nearest
+        bool found = nearest >= 0;
+        if (found)
+        {
+            const Instance& instance = instances[nearest];
+            hit.data = instance.data;
+            hit.t = tMax;
+            hit.point = origin + dir * tMax;
+            glm::vec3 n = glm::transpose(glm::mat3(instance.inverse)) * instance.tree->Normal(triangle);
+            n = glm::normalize(n);
+            hit.normal = glm::dot(n, dir) > 0.0f ? -n : n;
+        }
+        rays++;
+        rayNs += (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        return found;
+    }
+
+    // height of the first surface below pos, looking from above it so a slope just climbed is still found
+    bool Ground(const glm::vec3& pos, float above, float below, float& height) const
+    {
+        RayHit hit;
+        if (!Raycast(pos + glm::vec3(0.0f, above, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), above + below, hit))
+            return false;
+        height = hit.point.y;
+        return true;
+    }
+
+    // moves from towards to, stopping radius short of whatever is in the way and sliding the rest of the move
+    // along it, up to three surfaces like the corner of two walls and the ground
+    glm::vec3 Slide(const glm::vec3& from, const glm::vec3& to, float radius) const
+    {
+        glm::vec3 pos = from;
+        glm::vec3 move = to - from;
+        for (int i = 0; i < 3; i++)
+        {
+            float length = glm::length(move);
+            if (length < 1e-6f)
+                break;
+            glm::vec3 dir = move / length;
+            RayHit hit;
+            if (!Raycast(pos, dir, length + radius, hit))
+                return pos + move;
+            float travel = std::max(hit.t - radius, 0.0f);
+            pos += dir * travel;
+            glm::vec3 rest = dir * (length - travel);
+            move = rest - hit.normal * glm::dot(rest, hit.normal);
+        }
+        return pos;
+    }
+
+    void Report(float time)
+    {
+        if (time - lastReport < 2.0f)
+            return;
+        float seconds = time - lastReport;
+        lastReport = time;
+        unsigned long long count = rays.exchange(0);
+        unsigned long long ns = rayNs.exchange(0);
+        std::cout << "Ray queries: " << instances.size() << " instances, " << triangles << " triangles built in " << buildMs << " ms, "
+            << (unsigned int)(count / seconds) << " rays a second, " << (count ? ns / 1000.0 / count : 0.0) << " us a ray" << std::endl;
+    }
+
+private:
+    struct Instance {
+        const MeshBvh* tree;
+        glm::mat4 matrix;
+        glm::mat4 inverse;
+        unsigned int data;
+        int proxy;
+    };
+
+    Bvh bvh;
+    std::vector<Instance> instances;
+    std::map<const void*, std::unique_ptr<MeshBvh>> trees; // keyed by the mesh's vertex vector
+    unsigned int triangles = 0;
+    float buildMs = 0.0f;
+    mutable std::atomic<unsigned long long> rays{ 0 };
+    mutable std::atomic<unsigned long long> rayNs{ 0 };
+    float lastReport = 0.0f;
+};
+#endif
@@ -0,0 +1,231 @@
+// GPU snowfall
+// Transform feedback reference https://open.gl/feedback
+// Flakes live in two vertex buffers, every frame a vertex shader reads one and writes the moved flakes into the
+// other with rasterization off, so the CPU never touches them after the first upload. They are drawn as
+// instanced camera facing quads that fade against a copy of the scene depth. GPU timer queries measure the
+// update and the render pass separately.
+
+#ifndef SNOWFALL_H
+#define SNOWFALL_H
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "shader.h"
+#include <vector>
+#include <random>
+#include <cstddef>
+#include <iostream>
+
+const unsigned int SNOW_FLAKES = 1 << 20;
+
+struct SnowFlake {
+    glm::vec4 posSize;  // position and quad radius
+    glm::vec4 velSeed;  // fall velocity and a random phase
+};
+
+class Snowfall
+{
+public:
+    bool enabled = true;
+    glm::vec3 area = glm::vec3(30.0f, 16.0f, 30.0f);
+    glm::vec3 wind = glm::vec3(0.15f, 0.0f, 0.05f);
+    glm::vec3 color = glm::vec3(0.95f, 0.97f, 1.0f);
+    float softness = 0.3f;
+    float opacity = 0.9f;
+    float updateMs = 0.0f, renderMs = 0.0f; // smoothed gpu time of the last frames
+    unsigned int sourceFramebuffer = 0;    // where the scene is drawn, its depth is copied for the soft edges
+
+    Snowfall(unsigned int count = SNOW_FLAKES)
+        : updateShader("snowUpdate.vs", "snowUpdate.fs", feedbackVaryings(), 2), drawShader("snow.vs", "snow.fs"), count(count)
+    {
+        std::vector<SnowFlake> flakes(count);
+        std::mt19937 rng(7);
+        std::uniform_real_distribution<float> random(0.0f, 1.0f);
+        for (unsigned int i = 0; i < count; i++)
+        {
+            glm::vec3 pos = (glm::vec3(random(rng), random(rng), random(rng)) - 0.5f) * area;
+            flakes[i].posSize = glm::vec4(pos, glm::mix(0.008f, 0.02f, random(rng)));
+            flakes[i].velSeed = glm::vec4((random(rng) - 0.5f) * 0.1f, -glm::mix(0.4f, 0.9f, random(rng)), (random(rng) - 0.5f) * 0.1f, random(rng));
+        }
+
+        const float corners[] = { -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f };
+        glGenBuffers(1, &cornerVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, cornerVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+
+        glGenBuffers(2, flakeVBO);
+        glGenVertexArrays(2, updateVAO);
+        glGenVertexArrays(2, drawVAO);
+        for (int i = 0; i < 2; i++)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, flakeVBO[i]);
+            glBufferData(GL_ARRAY_BUFFER, count * sizeof(SnowFlake), &flakes[0], GL_DYNAMIC_COPY);
+
+            glBindVertexArray(updateVAO[i]);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(SnowFlake), (void*)offsetof(SnowFlake, posSize));
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(SnowFlake), (void*)offsetof(SnowFlake, velSeed));
+
+            glBindVertexArray(drawVAO[i]);
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(SnowFlake), (void*)offsetof(SnowFlake, posSize));
+            glVertexAttribDivisor(1, 1);
+            glBindBuffer(GL_ARRAY_BUFFER, cornerVBO);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+        }
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glGenQueries(2, updateQuery);
+        glGenQueries(2, renderQuery);
+        glGenFramebuffers(1, &FBO);
+    }
+
+    ~Snowfall()
+    {
+        glDeleteVertexArrays(2, updateVAO);
+        glDeleteVertexArrays(2, drawVAO);
+        glDeleteBuffers(2, flakeVBO);
+        glDeleteBuffers(1, &cornerVBO);
+        glDeleteQueries(2, updateQuery);
+        glDeleteQueries(2, renderQuery);
+        glDeleteFramebuffers(1, &FBO);
+        if (depthTex)
+            glDeleteTextures(1, &depthTex);
+    }
+
+    // moves every flake on the gpu, the volume is centred on the camera
+    void Update(float dt, float time, const glm::vec3& cameraPos)
+    {
+        if (!enabled)
+            return;
+        readTimers();
+        unsigned int slot = frame % 2;
+        glBeginQuery(GL_TIME_ELAPSED, updateQuery[slot]);
+        updateShader.use();
+        updateShader.setFloat("dt", dt);
+        updateShader.setFloat("time", time);
+        updateShader.setVec3("center", cameraPos);
+        updateShader.setVec3("area", area);
+        updateShader.setVec3("wind", wind);
+        glEnable(GL_RASTERIZER_DISCARD);
+        glBindVertexArray(updateVAO[current]);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, flakeVBO[1 - current]);
+        glBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, 0, count);
+        glEndTransformFeedback();
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+        glBindVertexArray(0);
+        glDisable(GL_RASTERIZER_DISCARD);
+        glEndQuery(GL_TIME_ELAPSED);
+        current = 1 - current;
+    }
+
+    // draws after everything opaque, copies the depth buffer first for the soft edges
+    void Draw(const glm::mat4& view, const glm::mat4& projection, int width, int height)
+    {
+        if (!enabled || width <= 0 || height <= 0)
+            return;
+        unsigned int slot = frame++ % 2;
+        glBeginQuery(GL_TIME_ELAPSED, renderQuery[slot]);
+        if (width != texW || height != texH)
+            textureSetup(width, height);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, sourceFramebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, FBO);
+        glBlitFramebuffer(0, 0, texW, texH, 0, 0, texW, texH, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, sourceFramebuffer);
+
+        drawShader.use();
+        drawShader.setMat4("view", view);
+        drawShader.setMat4("projection", projection);
+        drawShader.setInt("sceneDepth", 0);
+        drawShader.setVec2("screenSize", (float)texW, (float)texH);
+        drawShader.setVec2("depthParams", projection[3][2], projection[2][2]);
+        drawShader.setFloat("softness", softness);
+        drawShader.setFloat("opacity", opacity);
+        drawShader.setVec3("color", color);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, depthTex);
+
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glDepthMask(GL_FALSE);
+        glBindVertexArray(drawVAO[current]);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+        glBindVertexArray(0);
+        glDepthMask(GL_TRUE);
+        glDisable(GL_BLEND);
+        glEndQuery(GL_TIME_ELAPSED);
+    }
+
+    void Report(float time)
+    {
+        if (time - lastReport < 2.0f)
+            return;
+        lastReport = time;
+        if (!enabled)
+        {
+            std::cout << "Snowfall off" << std::endl;
+            return;
+        }
+        std::cout << "Snowfall: " << count << " flakes, gpu update " << updateMs << " ms, render " << renderMs << " ms ("
+            << (updateMs > 0.0f ? count / (updateMs * 1000.0f) : 0.0f) << "M flakes/s simulated)" << std::endl;
+    }
+
+private:
+    Shader updateShader;
+    Shader drawShader;
+    unsigned int count;
+    unsigned int flakeVBO[2], updateVAO[2], drawVAO[2], cornerVBO;
+    unsigned int current = 0; // buffer holding the latest flakes
+    unsigned int updateQuery[2], renderQuery[2];
+    unsigned int frame = 0;
+    unsigned int FBO = 0, depthTex = 0;
+    int texW = 0, texH = 0;
+    float lastReport = 0.0f;
+
+    // outputs of snowUpdate.vs in SnowFlake order
+    static const char* const* feedbackVaryings()
+    {
+        static const char* const names[] = { "posSize", "velSeed" };
+        return names;
+    }
+
+    // the queries of two frames ago are usually done by now, results that are not are skipped instead of waited on
+    void readTimers()
+    {
+        if (frame < 2)
+            return;
+        unsigned int slot = frame % 2;
+        GLuint available = 0;
+        glGetQueryObjectuiv(renderQuery[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return;
+        GLuint64 update = 0, render = 0;
+        glGetQueryObjectui64v(updateQuery[slot], GL_QUERY_RESULT, &update);
+        glGetQueryObjectui64v(renderQuery[slot], GL_QUERY_RESULT, &render);
+        updateMs = glm::mix(updateMs, update / 1.0e6f, 0.1f);
+        renderMs = glm::mix(renderMs, render / 1.0e6f, 0.1f);
+    }
+
+    // same format as the default framebuffer so the depth can be blitted
+    void textureSetup(int width, int height)
+    {
+        if (depthTex)
+            glDeleteTextures(1, &depthTex);
+        texW = width;
+        texH = height;
+        glGenTextures(1, &depthTex);
+        glBindTexture(GL_TEXTURE_2D, depthTex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, texW, texH, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthTex, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+};
+#endif
@@ -0,0 +1,291 @@
+// CPU occlusion culling with a small software rasterizer
+// Rasterizer reference https://fgiesen.wordpress.com/2013/02/17/optimizing-sw-occlusion-culling-index/
+// Low poly occluders are drawn into a coarse depth buffer split into horizontal bands, one band per job,
+// with four pixels evaluated at once using SSE. Boxes are tested against the buffer before any GL call.
+// Nothing here touches OpenGL so the buffer can be rendered and checked without a window.
+
+#ifndef SOFTWAREOCCLUSION_H
+#define SOFTWAREOCCLUSION_H
+#include <glm/glm.hpp>
+#include "Bounds.h"
+#include "ThreadPool.h"
+#include <vector>
+#include <chrono>
+#include <iostream>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OCCLUSION_SSE 1
+#endif
+
+const int OCCLUSION_WIDTH = 256;  // must be a multiple of 4
+const int OCCLUSION_HEIGHT = 128;
+const int OCCLUSION_BANDS = 8;
+const unsigned int OCCLUDER_MAX_TRIANGLES = 1500; // anything heavier is not worth rasterizing
+
+class SoftwareOcclusion
+{
+public:
+    bool enabled = true;
+    CullStats stats;
+    float rasterMs = 0.0f;
+
+    SoftwareOcclusion(ThreadPool& pool) : pool(pool), depth(OCCLUSION_WIDTH * OCCLUSION_HEIGHT, 1.0f)
+    {
+    }
+
+    void ClearOccluders()
+    {
+        occluders.clear();
+    }
+
+    // adds the triangles of a mesh in world space, VertexT only needs a Position member
+    template <typename VertexT>
+    bool AddOccluder(const std::vector<VertexT>& vertices, const std::vector<unsigned int>& indices, const glm::mat4& model)
+    {
+        if (indices.size() / 3 > OCCLUDER_MAX_TRIANGLES)
+            return false;
+        for (unsigned int i = 0; i < indices.size(); i++)
+            occluders.push_back(glm::vec3(model * glm::vec4(vertices[indices[i]].Position, 1.0f)));
+        return true;
+    }
+
+    unsigned int OccluderTriangles() const
+    {
+        return static_cast<unsigned int>(occluders.size() / 3);
+    }
+
+    // clears the depth buffer and draws every occluder into it
+    void Render(const glm::mat4& viewProj)
+    {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        stats = CullStats();
+        matrix = viewProj;
+
+        // transform and near clip on this thread, the bands share the result
+        screenTris.clear();
+        for (unsigned int i = 0; i + 2 < occluders.size(); i += 3)
+        {
+            glm::vec4 clip[3];
+            for (int v = 0; v < 3; v++)
+                clip[v] = viewProj * glm::vec4(occluders[i + v], 1.0f);
+            clipAndSetup(clip);
+        }
+
+        pool.ParallelFor(OCCLUSION_BANDS, [this](unsigned int band) {
+            int rows = OCCLUSION_HEIGHT / OCCLUSION_BANDS;
+            int y0 = band * rows;
+            int y1 = (band == OCCLUSION_BANDS - 1) ? OCCLUSION_HEIGHT : y0 + rows;
+            for (int i = y0 * OCCLUSION_WIDTH; i < y1 * OCCLUSION_WIDTH; i++)
+                depth[i] = 1.0f;
+            for (unsigned int t = 0; t < screenTris.size(); t++)
+                rasterize(screenTris[t], y0, y1);
+        });
+
+        rasterMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // true when some part of the box is in front of the occluders
+    bool Test(const AABB& box, unsigned int triangles)
+    {
+        stats.draws++;
+        stats.triangles += triangles;
+        if (!enabled || Visible(box))
+            return true;
+        stats.drawsCulled++;
+        stats.trianglesCulled += triangles;
+        return false;
+    }
+
+    bool Visible(const AABB& box) const
+    {
+        glm::vec3 ndcMin(FLT_MAX), ndcMax(-FLT_MAX);
+        for (int i = 0; i < 8; i++)
+        {
+            glm::vec4 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z, 1.0f);
+            glm::vec4 clip = matrix * corner;
+            if (clip.w <= 0.0001f)
+                return true;
+            glm::vec3 ndc = glm::vec3(clip) / clip.w;
+            ndcMin = glm::min(ndcMin, ndc);
+            ndcMax = glm::max(ndcMax, ndc);
+        }
+        if (ndcMax.x < -1.0f || ndcMax.y < -1.0f || ndcMin.x > 1.0f || ndcMin.y > 1.0f)
+            return true; // outside the view, left to frustum culling
+
+        float boxDepth = ndcMin.z * 0.5f + 0.5f;
+        int x0 = glm::clamp((int)((ndcMin.x * 0.5f + 0.5f) * OCCLUSION_WIDTH), 0, OCCLUSION_WIDTH - 1);
+        int x1 = glm::clamp((int)((ndcMax.x * 0.5f + 0.5f) * OCCLUSION_WIDTH), 0, OCCLUSION_WIDTH - 1);
+        int y0 = glm::clamp((int)((ndcMin.y * 0.5f + 0.5f) * OCCLUSION_HEIGHT), 0, OCCLUSION_HEIGHT - 1);
+        int y1 = glm::clamp((int)((ndcMax.y * 0.5f + 0.5f) * OCCLUSION_HEIGHT), 0, OCCLUSION_HEIGHT - 1);
+
+#ifdef OCCLUSION_SSE
+        // extra columns from rounding out to 4 only make the test more conservative
+        x0 &= ~3;
+        __m128 boxZ = _mm_set1_ps(boxDepth);
+        for (int y = y0; y <= y1; y++)
+        {
+            const float* row = &depth[y * OCCLUSION_WIDTH];
+            for (int x = x0; x <= x1; x += 4)
+            {
+                if (_mm_movemask_ps(_mm_cmple_ps(boxZ, _mm_loadu_ps(row + x))))
+                    return true;
+            }
+        }
+#else
+        for (int y = y0; y <= y1; y++)
+            for (int x = x0; x <= x1; x++)
+                if (boxDepth <= depth[y * OCCLUSION_WIDTH + x])
+                    return true;
+#endif
+        return false;
+    }
+
+    // depth in [0, 1], row 0 is the bottom of the screen
+    const float* Depth() const
+    {
+        return &depth[0];
+    }
+
+    void Report(float time)
+    {
+        if (time - lastReport < 2.0f)
+            return;
+        lastReport = time;
+        float drawPct = stats.draws ? 100.0f * stats.drawsCulled / stats.draws : 0.0f;
+        float triPct = stats.triangles ? 100.0f * stats.trianglesCulled / stats.triangles : 0.0f;
+        std::cout << "Software occlusion: " << OccluderTriangles() << " occluder triangles in " << rasterMs << "ms, culled "
+            << stats.drawsCulled << "/" << stats.draws << " draws (" << drawPct << "%), "
+            << stats.trianglesCulled << "/" << stats.triangles << " triangles (" << triPct << "%)" << std::endl;
+    }
+
+private:
+    // triangle in pixel space with edge functions and a depth plane ready for stepping
+    struct ScreenTri {
+        float minX, maxX, minY, maxY;
+        float edgeA[3], edgeB[3], edgeC[3];
+        float zA, zB, zC;
+    };
+
+    ThreadPool& pool;
+    std::vector<float> depth;
+    std::vector<glm::vec3> occluders;
+    std::vector<ScreenTri> screenTris;
+    glm::mat4 matrix = glm::mat4(1.0f);
+    float lastReport = 0.0f;
+
+    // clips against the near plane (z > -w) and turns what is left into screen triangles
+    void clipAndSetup(const glm::vec4* clip)
+    {
+        glm::vec4 poly[4];
+        int count = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            const glm::vec4& a = clip[i];
+            const glm::vec4& b = clip[(i + 1) % 3];
+            float da = a.z + a.w, db = b.z + b.w;
+            if (da >= 0.0f)
+                poly[count++] = a;
+            if ((da >= 0.0f) != (db >= 0.0f))
+                poly[count++] = a + (b - a) * (da / (da - db));
+        }
+        for (int i = 1; i + 1 < count; i++)
+            setup(poly[0], poly[i], poly[i + 1]);
+    }
+
+    void setup(const glm::vec4& c0, const glm::vec4& c1, const glm::vec4& c2)
+    {
+        glm::vec3 p[3];
+        const glm::vec4* c[3] = { &c0, &c1, &c2 };
+        for (int i = 0; i < 3; i++)
+        {
+            float invW = 1.0f / c[i]->w;
+            p[i].x = (c[i]->x * invW * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+            p[i].y = (c[i]->y * invW * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+            p[i].z = c[i]->z * invW * 0.5f + 0.5f;
+        }
+        // counter clockwise is front facing, back faces of closed occluders are hidden anyway
+        float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[2].x - p[0].x) * (p[1].y - p[0].y);
+        if (area <= 0.0f)
+            return;
+
+        ScreenTri tri;
+        tri.minX = glm::min(p[0].x, glm::min(p[1].x, p[2].x));
+        tri.maxX = glm::max(p[0].x, glm::max(p[1].x, p[2].x));
+        tri.minY = glm::min(p[0].y, glm::min(p[1].y, p[2].y));
+        tri.maxY = glm::max(p[0].y, glm::max(p[1].y, p[2].y));
+        if (tri.maxX < 0.0f || tri.maxY < 0.0f || tri.minX >= OCCLUSION_WIDTH || tri.minY >= OCCLUSION_HEIGHT)
+            return;
+
+        // edge i is opposite vertex i, E(x, y) = A * x + B * y + C is positive inside
+        for (int i = 0; i < 3; i++)
+        {
+            const glm::vec3& a = p[(i + 1) % 3];
+            const glm::vec3& b = p[(i + 2) % 3];
+            tri.edgeA[i] = a.y - b.y;
+            tri.edgeB[i] = b.x - a.x;
+            tri.edgeC[i] = a.x * b.y - a.y * b.x;
+        }
+        // depth as a plane through the three vertices
+        float invArea = 1.0f / area;
+        float z10 = p[1].z - p[0].z, z20 = p[2].z - p[0].z;
+        tri.zA = (z10 * (p[2].y - p[0].y) - z20 * (p[1].y - p[0].y)) * invArea;
+        tri.zB = (z20 * (p[1].x - p[0].x) - z10 * (p[2].x - p[0].x)) * invArea;
+        tri.zC = p[0].z - tri.zA * p[0].x - tri.zB * p[0].y;
+        screenTris.push_back(tri);
+    }
+
+    // draws the part of a triangle inside rows [y0, y1), pixel centres are sampled
+    void rasterize(const ScreenTri& tri, int y0, int y1)
+    {
+        int minY = glm::max(y0, (int)tri.minY);
+        int maxY = glm::min(y1 - 1, (int)tri.maxY);
+        int minX = glm::max(0, (int)tri.minX) & ~3;
+        int maxX = glm::min(OCCLUSION_WIDTH - 1, (int)tri.maxX);
+        if (minY > maxY || minX > maxX)
+            return;
+
+#ifdef OCCLUSION_SSE
+        __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        __m128 zero = _mm_setzero_ps();
+        for (int y = minY; y <= maxY; y++)
+        {
+            float py = y + 0.5f;
+            float* row = &depth[y * OCCLUSION_WIDTH];
+            for (int x = minX; x <= maxX; x += 4)
+            {
+                __m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+                __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+                for (int e = 0; e < 3; e++)
+                {
+                    __m128 ev = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.edgeA[e]), px), _mm_set1_ps(tri.edgeB[e] * py + tri.edgeC[e]));
+                    inside = _mm_and_ps(inside, _mm_cmpge_ps(ev, zero));
+                }
+                if (!_mm_movemask_ps(inside))
+                    continue;
+                __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.zA), px), _mm_set1_ps(tri.zB * py + tri.zC));
+                __m128 old = _mm_loadu_ps(row + x);
+                __m128 closer = _mm_min_ps(old, z);
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, closer), _mm_andnot_ps(inside, old)));
+            }
+        }
+#else
+        for (int y = minY; y <= maxY; y++)
+        {
+            float py = y + 0.5f;
+            for (int x = minX; x <= maxX; x++)
+            {
+                float px = x + 0.5f;
+                bool inside = true;
+                for (int e = 0; e < 3; e++)
+                    inside = inside && (tri.edgeA[e] * px + tri.edgeB[e] * py + tri.edgeC[e] >= 0.0f);
+                if (!inside)
+                    continue;
+                float z = tri.zA * px + tri.zB * py + tri.zC;
+                float& d = depth[y * OCCLUSION_WIDTH + x];
+                d = z < d ? z : d;
+            }
+        }
+#endif
+    }
+};
+#endif
@@ -0,0 +1,175 @@
+// Positional sound emitters with voice virtualization
+// Voice management reference https://www.gamedeveloper.com/audio/the-audio-voice-management-of-a-game
+// Any number of emitters can be attached to things in the scene, but only the most audible ones own a real
+// backend voice. The rest are virtual: they keep their play position ticking so they pick up where they would
+// have been when they become audible again. Positions are written by the scene during the frame and pushed to
+// the backend in one batch per frame.
+
+#ifndef SOUNDEMITTERS_H
+#define SOUNDEMITTERS_H
+#include <glm/glm.hpp>
+#include "AudioBackend.h"
+#include "AudioAssets.h"
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+
+struct SoundEmitter {
+    std::string clip;
+    glm::vec3 pos;
+    float volume;
+    float minDistance;
+    float priority;     // scales audibility, for sounds that matter more than their loudness says
+    bool looped;
+    bool alive;
+    float startTime;    // when the emitter started playing, real or not
+    float audibility;
+    unsigned int voice; // 0 while virtual
+};
+
+class SoundEmitters
+{
+public:
+    unsigned int maxVoices = 16;
+    float hysteresis = 1.25f; // real voices rank this much louder so two close emitters do not keep swapping
+
+    SoundEmitters(AudioAssets& audio, AudioBackend& backend)
+        : audio(audio), backend(backend)
+    {
+    }
+
+    ~SoundEmitters()
+    {
+        for (unsigned int i = 0; i < emitters.size(); i++)
+            virtualize(emitters[i]);
+    }
+
+    unsigned int Add(const std::string& clip, const glm::vec3& pos, float volume, float minDistance, bool looped = true, float priority = 1.0f)
+    {
+        SoundEmitter e;
+        e.clip = clip;
+        e.pos = pos;
+        e.volume = volume;
+        e.minDistance = minDistance;
+        e.priority = priority;
+        e.looped = looped;
+        e.alive = true;
+        e.startTime = clock;
+        e.audibility = 0.0f;
+        e.voice = 0;
+        if (!freeIds.empty())
+        {
+            unsigned int id = freeIds.back();
+            freeIds.pop_back();
+            emitters[id] = e;
+            return id;
+        }
+        emitters.push_back(e);
+        return static_cast<unsigned int>(emitters.size() - 1);
+    }
+
+    void Remove(unsigned int id)
+    {
+        virtualize(emitters[id]);
+        emitters[id].alive = false;
+        freeIds.push_back(id);
+    }
+
+    // only stored, the backend sees it in Update
+    void SetPosition(unsigned int id, const glm::vec3& pos)
+    {
+        emitters[id].pos = pos;
+    }
+
+    // ranks every emitter, hands the voices to the most audible ones and moves the listener, once per frame
+    void Update(float time, const glm::vec3& listenerPos, const glm::vec3& listenerFront)
+    {
+        AudioCallTimer timer(audio.callMs);
+        clock = time;
+        ranked.clear();
+        for (unsigned int i = 0; i < emitters.size(); i++)
+        {
+            SoundEmitter& e = emitters[i];
+            if (!e.alive)
+                continue;
+            // a one shot that ran out, real or virtual, is done
+            if (!e.looped && (e.voice ? backend.VoiceFinished(e.voice) : time - e.startTime > oneShotSeconds))
+            {
+                Remove(i);
+                continue;
+            }
+            float dist = glm::length(e.pos - listenerPos);
+            e.audibility = e.volume * e.priority * glm::min(1.0f, e.minDistance / glm::max(dist, 1e-4f));
+            if (e.voice)
+                e.audibility *= hysteresis;
+            ranked.push_back(i);
+        }
+
+        unsigned int real = glm::min(maxVoices, (unsigned int)ranked.size());
+        std::nth_element(ranked.begin(), ranked.begin() + real, ranked.end(),
+            [this](unsigned int a, unsigned int b) { return emitters[a].audibility > emitters[b].audibility; });
+
+        realVoices = 0;
+        for (unsigned int r = real; r < ranked.size(); r++)
+        {
+            if (emitters[ranked[r]].voice)
+                steals++;
+            virtualize(emitters[ranked[r]]);
+        }
+        for (unsigned int r = 0; r < real; r++)
+        {
+            SoundEmitter& e = emitters[ranked[r]];
+            if (!e.voice)
+                realize(e);
+            if (e.voice)
+            {
+                backend.SetVoicePosition(e.voice, e.pos);
+                realVoices++;
+            }
+        }
+
+        backend.SetListener(listenerPos, listenerFront);
+    }
+
+    void Report(float time)
+    {
+        if (time - lastReport < 2.0f)
+            return;
+        lastReport = time;
+        unsigned int alive = static_cast<unsigned int>(emitters.size() - freeIds.size());
+        std::cout << "Sound emitters: " << alive << " emitters, " << realVoices << "/" << maxVoices << " real voices, "
+            << alive - realVoices << " virtual, " << starts << " voices started, " << steals << " stolen" << std::endl;
+        starts = 0;
+        steals = 0;
+    }
+
+private:
+    AudioAssets& audio;
+    AudioBackend& backend;
+    std::vector<SoundEmitter> emitters;
+    std::vector<unsigned int> freeIds;
+    std::vector<unsigned int> ranked;
+    float clock = 0.0f;
+    float oneShotSeconds = 5.0f; // how long a virtual one shot lives, its length is unknown without a voice
+    unsigned int realVoices = 0, starts = 0, steals = 0;
+    float lastReport = 0.0f;
+
+    // starts a voice where the virtual one got to
+    void realize(SoundEmitter& e)
+    {
+        unsigned int elapsed = (unsigned int)((clock - e.startTime) * 1000.0f);
+        e.voice = backend.Play(audio.Get(e.clip), &e.pos, e.looped, e.volume, e.minDistance, elapsed);
+        if (e.voice)
+            starts++;
+    }
+
+    void virtualize(SoundEmitter& e)
+    {
+        if (!e.voice)
+            return;
+        backend.StopVoice(e.voice);
+        e.voice = 0;
+    }
+};
+#endif
@@ -5,7 +5,7 @@ It implements all 3 required basic features (crowd,textures and lighting) and th
 1. Music using irrklang audio library
 2. Skybox 
 3. Handmade models
-4. Fog (implementation can be seen in manyLights.fs and shad.fs)
+4. Fog (implementation can be seen in tonemap.fs)
 5. Advanced lighting (Blinn-Phong and Gamma correction)
 6. Hierachal animated crowd
 
@@ -21,7 +21,40 @@ Code references have been listed in the source files and report
 #include "shader.h"
 #include "Camera.h"
 #include "Model.h"
+#include "HiZ.h"
+#include "SoftwareOcclusion.h"
+#include "Forest.h"
+#include "TextureStreamer.h"
+#include "Terrain.h"
+#include "Snowfall.h"
+#include "HdrTarget.h"
+#include "DrawList.h"
+#include "MaterialTable.h"
+#include "Deferred.h"
+#include "LightBuffer.h"
+#include "VolumetricFog.h"
+#include "GpuTimer.h"
+#include "LightBenchmark.h"
+#include "DynamicResolution.h"
+#include "TextureCooker.h"
+#include "TextureArrays.h"
+#include "ModelLoader.h"
+#include "JobBenchmark.h"
+#include "OcclusionTest.h"
+#include "Bvh.h"
+#include "BvhBenchmark.h"
+#include "RayQuery.h"
+#include "RayBenchmark.h"
+#include "FramePipeline.h"
+#include "AudioAssets.h"
+#include "SoundEmitters.h"
+#include "AudioThread.h"
+#include "AudioBackend.h"
+#include "MixerBackend.h"
+#include "AudioBenchmark.h"
 #include <iostream>
+#include <memory>
+#include <cstring>
 //audio library
 #include <irrklang/irrKlang.h>
 using namespace irrklang;
@@ -31,6 +64,9 @@ void framebufferSize(GLFWwindow* window, int width, int height);
 void mouse(GLFWwindow* window, double xpos, double ypos);
 void scroll(GLFWwindow* window, double xoffset, double yoffset);
 void keyboardInput(GLFWwindow* window);
+void runScene(GLFWwindow* window, int argc, char* argv[]);
+struct ScenePacket;
+void simulate(const FrameInput& input, float time, float dt, ScenePacket& packet);
 unsigned int loadSkybox(vector<std::string> faces);
 
 // window settings
@@ -39,6 +75,29 @@ const unsigned int SCR_HEIGHT = 556;
 //variables to control fog
 bool fog = false;
 bool fogKey = false;
+//occlusion culling mode, H cycles through them
+enum CullingMode { CULL_OFF, CULL_HIZ, CULL_SOFTWARE, CULL_MODES };
+int cullingMode = CULL_HIZ;
+bool cullKey = false;
+//snowfall on or off
+bool snow = true;
+bool snowKey = false;
+//depth pre-pass and the overdraw view
+bool prepass = true;
+bool prepassKey = false;
+bool overdrawView = false;
+bool overdrawKey = false;
+//forward lighting in manyLights.fs or the deferred renderer, G switches
+bool deferredShading = false;
+bool deferredKey = false;
+//dynamic resolution on or off, R switches
+bool dynamicResolution = true;
+bool dynamicResolutionKey = false;
+//walking on the ground or flying, C switches, and a left click picks what is in the middle of the screen
+std::atomic<bool> walking{ false };
+bool walkKey = false;
+bool pickRequested = false;
+bool pickKey = false;
 // lighting
 glm::vec3 lightPos(1.2f, 3.0f, 2.0f);
 float ambient = 0.05f;
@@ -49,15 +108,90 @@ Camera camera(glm::vec3(0.0f, 2.0f, 3.0f)); //starting position for camera
 float lastXPos = SCR_WIDTH / 2.0f;
 float lastYPos = SCR_HEIGHT / 2.0f;
 bool firstMouse = true;
+const float CAMERA_RADIUS = 0.2f;     //how close the camera gets to walls and the ground
+const float CAMERA_EYE_HEIGHT = 0.6f; //above the ground when walking
+const float CAMERA_STEP = 0.3f;       //highest ledge walked up without being stopped
+const float PICK_DISTANCE = 100.0f;
 // time
 float dTime = 0.0f;
 float last = 0.0f;
-//creating the sound engine to play music
-ISoundEngine* musicEngine = createIrrKlangDevice();
+//keys the simulation thread reads, one bit each in FrameInput::held
+enum SimulationKey { KEY_FORWARD, KEY_BACKWARD, KEY_LEFT, KEY_RIGHT, KEY_AMBIENT_UP, KEY_AMBIENT_DOWN, KEY_DIFFUSE_UP, KEY_DIFFUSE_DOWN,
+    KEY_SPECULAR_UP, KEY_SPECULAR_DOWN };
+//what the simulation thread hands the render thread each frame, the camera, lights and animated transforms
+struct ScenePacket {
+    glm::vec3 cameraPos;
+    glm::vec3 cameraFront;
+    float zoom;
+    glm::mat4 view;
+    float ambient, diffuse, specular;
+    glm::mat4 modelBody, rightArm, leftArm;
+};
+//the camera and the lighting levels above belong to the simulation thread once the render loop starts
+FramePipeline<ScenePacket>* framePipeline = NULL;
+//the ground model's triangles the simulation thread moves the camera against, never changed once the render loop starts
+RayQuery* cameraRays = NULL;
+//every audio call goes through the audio thread, set up in main once the engine is running
+AudioThread* audioThread = NULL;
 
 
-int main()
+int main(int argc, char* argv[])
 {
+    //--cook compresses the scene's textures, or the images named after it, into .dds files the loaders prefer, then quits
+    if (argc > 1 && strcmp(argv[1], "--cook") == 0)
+    {
+        vector<std::string> images(argv + 2, argv + argc);
+        if (images.empty())
+            images = {
+                "floorModel/LightBlue.png", "floorModel/darkBrown.png", "floorModel/fox.png", "floorModel/lightBrown.png",
+                "floorModel/red.png", "floorModel/snow01.png", "floorModel/snowGrass.png", "floorModel/stoneGray.png",
+                "floorModel/wall.png", "snowManMatt/snowmanFinalWork.png", "snowManMatt/snowmanPaint.png",
+                "sky/right.jpg", "sky/left.jpg", "sky/top.jpg", "sky/bottom.jpg", "sky/front.jpg", "sky/back.jpg"
+            };
+        TextureCooker cooker;
+        int failed = 0;
+        for (const std::string& image : images)
+            failed += cooker.Cook(image) ? 0 : 1;
+        return failed ? 1 : 0;
+    }
+    //--jobbench times the job system on every pool size up to one thread per core, then quits
+    if (argc > 1 && strcmp(argv[1], "--jobbench") == 0)
+    {
+        JobBenchmark jobBench;
+        jobBench.Run();
+        return 0;
+    }
+    //--occlusiontest checks the software occlusion rasterizer against known depths, exits with 1 on a mismatch
+    if (argc > 1 && strcmp(argv[1], "--occlusiontest") == 0)
+    {
+        OcclusionTest occlusionTest;
+        return occlusionTest.Run();
+    }
+
+    //--audiobench checks the mixer's panning and clip lengths through the emitters, times voice scheduling and
+    //mixing on the null and mixer backends, exits with 1 when a check fails
+    if (argc > 1 && strcmp(argv[1], "--audiobench") == 0)
+    {
+        AudioBenchmark audioBench;
+        return audioBench.Run();
+    }
+
+    //--bvhbench times building, refitting and querying the scene BVH at 100k instances, then quits
+    if (argc > 1 && strcmp(argv[1], "--bvhbench") == 0)
+    {
+        BvhBenchmark bvhBench;
+        bvhBench.Run();
+        return 0;
+    }
+
+    //--raybench times rays against a stand in town of triangle meshes, the ground following, picking and camera steps, then quits
+    if (argc > 1 && strcmp(argv[1], "--raybench") == 0)
+    {
+        RayBenchmark rayBench;
+        rayBench.Run();
+        return 0;
+    }
+
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
@@ -84,12 +218,43 @@ int main()
         std::cout << "Failed to initialize GLAD :(" << std::endl;
         return -1;
     }
+    LoadBufferStorage((GLADloadproc)glfwGetProcAddress); //not in GL 3.3, used by the dynamic buffer when the driver has it
     glEnable(GL_DEPTH_TEST);
 
+    //everything that owns GL objects lives in runScene, so it is all deleted while the context still exists
+    runScene(window, argc, argv);
+    TextureCache::Get().Clear();
+    glfwTerminate();
+    return 0;
+}
+
+// the scene from loading to the end of the render loop -------------------------------------------------------------------------------------------------------
+void runScene(GLFWwindow* window, int argc, char* argv[])
+{
     // build and compile shaders 
     Shader matShader("shad.vs", "shad.fs"); //shaders that work for material properties specifically specified
     Shader skyShader("skybox.vs","skybox.fs");
     Shader lightingShader("manyLights.vs", "manyLights.fs");   //multiple light source shaders
+    Shader terrainShader("terrain.vs", "manyLights.fs"); //streamed ground chunks lit the same way
+    Shader terrainDepthShader("terrain.vs", "depth.fs");
+    Shader terrainOverdrawShader("terrain.vs", "overdraw.fs");
+    DrawList drawList; //opaque meshes sorted front to back behind an optional depth pre-pass
+    DeferredRenderer deferred; //G-buffer and tiled light pass, the alternative to lighting in manyLights.fs
+    Shader terrainGBufferShader("terrain.vs", "gbuffer.fs");
+    LightBuffer extraLights; //point lights beyond the four scene ones, only the light benchmark adds any
+    GpuTimer opaqueTimer;
+    GpuTimer sceneTimer; //the scene's draws into the HDR target, what dynamic resolution keeps under budget
+    DynamicResolution dynamicRes;
+    unsigned int sceneSamples = 0;
+    LightBenchmark lightBench;
+    HiZCuller hiz; //hierarchical z occlusion culling of the forest and houses in the ground model
+    HdrTarget hdr; //the scene is lit in HDR and tone mapped onto the window
+    VolumetricFog volumetricFog; //lit fog in a froxel grid, applied when the scene is tone mapped
+    hiz.sourceFramebuffer = hdr.Framebuffer();
+    ThreadPool workers;
+    TextureStreamer textureStreamer(workers); //model textures start blurry and sharpen as they are needed
+    TextureCache::Get().Stream(&textureStreamer);
+    SoftwareOcclusion softOcclusion(workers); //cpu alternative that needs no gpu readback
     
     // Pos of the point lights
     glm::vec3 pointLightPos[] = {
@@ -169,43 +334,170 @@ int main()
 
     // load models------------------------------------------------------------------------------------------------------------------------------
     //floor and presents
+    //the floor is needed right away for the terrain and occluders, everything else loads in the background and
+    //shows up as a grey box until its meshes are uploaded
     Model floor("floorModel/ground.obj"); 
-    Model prez("floorModel/prez.obj");
-    Model armRight("snowManMatt/rightArm.obj");
-    Model armLeft("snowManMatt/leftArm.obj");
+    ModelLoader modelLoader(workers);
+    Model& prez = modelLoader.Load("floorModel/prez.obj");
+    Model& armRight = modelLoader.Load("snowManMatt/rightArm.obj");
+    Model& armLeft = modelLoader.Load("snowManMatt/leftArm.obj");
     //snowmanHierachy model
-    Model snowManBasic("snowManMatt/snowmanBasic.obj"); //snowmanBasic is the model with no arms
-    Model basicLeft("snowManMatt/snowmanBasicLeft.obj");
-    Model basicRight("snowManMatt/snowmanBasicRight.obj");
+    Model& snowManBasic = modelLoader.Load("snowManMatt/snowmanBasic.obj"); //snowmanBasic is the model with no arms
+    Model& basicLeft = modelLoader.Load("snowManMatt/snowmanBasicLeft.obj");
+    Model& basicRight = modelLoader.Load("snowManMatt/snowmanBasicRight.obj");
 
-    //music setup --------------------------------------------------------------------------------------------------------------------------------
-    if (!musicEngine)
+    //their diffuse maps become layers of a few texture arrays so the opaque pass does not rebind textures,
+    //packed once the loader is done
+    TextureArrays textureArrays(textureStreamer, workers);
+    bool texturesPacked = false;
+    Shader* arrayShaders[] = { &lightingShader, &terrainShader, &terrainGBufferShader, &deferred.GeometryShader() };
+    for (Shader* shader : arrayShaders)
+    {
+        shader->use();
+        shader->setInt("diffuseArray", TEXTURE_ARRAY_UNIT);
+    }
+
+    //the big low poly meshes of the ground (hills, houses, snowmen) become occluders for the software rasterizer
+    glm::mat4 floorTransform = glm::scale(glm::mat4(1.0f), glm::vec3(0.25f, 0.25f, 0.25f)); //same as modelFloor below
+    for (unsigned int i = 0; i < floor.meshes.size(); i++)
     {
-        printf("Could not startup engine\n");
-        return 0; // error starting up the engine
+        if (glm::length(floor.meshes[i].bounds.max - floor.meshes[i].bounds.min) > 2.0f)
+            softOcclusion.AddOccluder(floor.meshes[i].vertices, floor.meshes[i].indices, floorTransform);
     }
 
-    ISoundSource* backgroundMusic = musicEngine->addSoundSourceFromFile("music/morning.mp3"); //background song
-    backgroundMusic->setDefaultVolume(0.08f);
-    musicEngine->play2D(backgroundMusic,true);
+    //heightfield of the ground surface, the mesh of the ground model covering the largest area
+    unsigned int groundMesh = 0;
+    float groundArea = 0.0f;
+    for (unsigned int i = 0; i < floor.meshes.size(); i++)
+    {
+        glm::vec3 size = floor.meshes[i].bounds.max - floor.meshes[i].bounds.min;
+        if (size.x * size.z > groundArea)
+        {
+            groundArea = size.x * size.z;
+            groundMesh = i;
+        }
+    }
+    Heightfield ground;
+    ground.Build(floor.meshes[groundMesh].vertices, floor.meshes[groundMesh].indices, floorTransform, 256);
 
-    vec3df crowdPosition(0, 0, 0);
-    ISound* snowSound = musicEngine->play3D("music/snow.mp3", crowdPosition,true);   //crowd moving through snow positional sound 
-    if (snowSound)
+    //the ground mesh itself is replaced by chunked terrain streamed in around the camera
+    Terrain terrain(ground, ground.origin, ground.origin + ground.Size(), workers);
+    for (unsigned int i = 0; i < floor.meshes[groundMesh].textures.size(); i++)
     {
-        snowSound->setVolume(.006f);
-        snowSound->setMinDistance(0.05f);
-        snowSound->setIsPaused(false);
+        if (floor.meshes[groundMesh].textures[i].type == "texture_diffuse")
+            terrain.diffuseTex = floor.meshes[groundMesh].textures[i].id;
     }
+    terrain.Preload(camera.Pos);
+
+    //the meshes of the ground model and the snowmen in one BVH, the crowd is refitted every frame as it moves
+    const unsigned int SCENE_CROWD = 1u << 24; //instance numbers from here on are snowmen, below are ground model meshes
+    Bvh sceneBvh;
+    for (unsigned int i = 0; i < floor.meshes.size(); i++)
+        if (i != groundMesh)
+            sceneBvh.Insert(TransformAABB(floorTransform, floor.meshes[i].bounds), i);
+    int crowdProxies[5];
+    for (int i = 0; i < 5; i++)
+        crowdProxies[i] = sceneBvh.Insert(AABB(), SCENE_CROWD + i);
+    std::vector<bool> floorVisible(floor.meshes.size());
 
-    vec3df birdPosition(-5.0, 10, -30);
-    ISound* birdSound = musicEngine->play3D("music/birds.mp3", birdPosition, true); //birds in the forest positional sound 
-    if (birdSound)
+    //every triangle of the ground model for the camera to walk on and bump into, and for picking
+    RayQuery worldRays;
+    for (unsigned int i = 0; i < floor.meshes.size(); i++)
+        worldRays.Add(floor.meshes[i].vertices, floor.meshes[i].indices, floorTransform, i);
+    worldRays.Update();
+    //the presents and the crowd can be picked too, added once their models have loaded
+    RayQuery pickRays;
+    std::vector<int> crowdPicks;
+    bool pickablesAdded = false;
+
+    //forest of instanced trees with impostors in the distance
+    Model snowTree("floorModel/SnowTree.obj");
+    Model tree("floorModel/tree.obj");
+    Forest forest(workers);
+    forest.AddSpecies(snowTree);
+    forest.AddSpecies(tree);
+    forest.Place("floorModel/forestDensity.png", ground, 3000, 0.5f, 1.1f);
+    TextureCache::Get().Report();
+
+    //a million snowflakes simulated on the gpu
+    Snowfall snowfall;
+    snowfall.sourceFramebuffer = hdr.Framebuffer();
+
+    //music setup --------------------------------------------------------------------------------------------------------------------------------
+    //sound card by default, --audio=null plays nothing and --audio=wav mixes to a file, both need no sound device
+    //--lightbench times forward against deferred lighting and quits
+    //--pipeline=1 simulates and renders each frame in turn for the least lag, 2 (the default) or 3 overlap them
+    std::unique_ptr<AudioBackend> audioOut;
+    unsigned int pipelineDepth = 2;
+    for (int i = 1; i < argc; i++)
     {
-        birdSound->setVolume(.08f);
-        birdSound->setMinDistance(0.2f);
+        if (strcmp(argv[i], "--audio=null") == 0)
+            audioOut.reset(new NullBackend());
+        else if (strcmp(argv[i], "--audio=wav") == 0)
+            audioOut.reset(new MixerBackend("audioMix.wav"));
+        else if (strcmp(argv[i], "--lightbench") == 0)
+            lightBench.Start();
+        else if (strncmp(argv[i], "--pipeline=", 11) == 0)
+            pipelineDepth = (unsigned int)atoi(argv[i] + 11);
     }
+    if (!audioOut)
+    {
+        ISoundEngine* musicEngine = createIrrKlangDevice(); //creating the sound engine to play music
+        if (musicEngine)
+            audioOut.reset(new IrrKlangBackend(musicEngine));
+        else
+        {
+            printf("Could not startup engine, carrying on without sound\n");
+            audioOut.reset(new NullBackend());
+        }
+    }
+    std::cout << "Audio output: " << audioOut->Name() << std::endl;
+
+    //effects are decoded up front so playing them never decodes on the render thread, long tracks stream
+    AudioAssets audio(*audioOut, workers);
+    audio.Preload("music/beep.mp3");
+    audio.Preload("music/snow.mp3");
+    audio.Preload("music/birds.mp3");
+    audio.WaitForLoads();
+
+    audio.Stream("music/morning.mp3"); //background song
+    audio.Play2D("music/morning.mp3", true, 0.08f);
+
+    //positional sounds, only the most audible get a real voice
+    SoundEmitters emitters(audio, *audioOut);
+    unsigned int crowdSounds[5];
+    for (int i = 0; i < 5; i++)
+        crowdSounds[i] = emitters.Add("music/snow.mp3", glm::vec3(0.0f), .006f, 0.05f); //each snowman moving through snow, placed every frame
+    emitters.Add("music/birds.mp3", glm::vec3(-5.0f, 10.0f, -30.0f), .08f, 0.2f); //birds in the forest
+    for (unsigned int i = 0; i < forest.trees.size(); i++)
+        emitters.Add("music/birds.mp3", forest.trees[i].pos + glm::vec3(0.0f, forest.trees[i].height, 0.0f), .02f, 0.2f); //a flock in every tree
+
+    //the audio thread owns the engine from here on, the render loop only queues commands
+    AudioThread sound(audio, emitters, *audioOut);
+    audioThread = &sound;
+    sound.Start();
     
+    //gold, ruby, emerald, jade and bronze for the presents
+    const Material presentMaterials[] = {
+        { glm::vec3(0.24725f, 0.1995f, 0.0745f), glm::vec3(0.75164f, 0.60648f, 0.22648f), glm::vec3(0.628281f, 0.555802f, 0.366065f), 0.4f },
+        { glm::vec3(0.1745f, 0.01175f, 0.01175f), glm::vec3(0.61424f, 0.04136f, 0.04136f), glm::vec3(0.727811f, 0.626959f, 0.626959f), 0.6f },
+        { glm::vec3(0.0215f, 0.1745f, 0.0215f), glm::vec3(0.07568f, 0.61424f, 0.07568f), glm::vec3(0.633f, 0.727811f, 0.633f), 0.6f },
+        { glm::vec3(0.19225f, 0.19225f, 0.19225f), glm::vec3(0.50754f, 0.50754f, 0.50754f), glm::vec3(0.508273f, 0.508273f, 0.508273f), 0.4f },
+        { glm::vec3(0.2125f, 0.1275f, 0.054f), glm::vec3(0.714f, 0.4284f, 0.18144f), glm::vec3(0.393548f, 0.271906f, 0.166721f), 0.2f }
+    };
+    //registered once, draws only pass the ids so the five presents go out as one instanced draw
+    MaterialTable materialTable;
+    unsigned int presentIds[5];
+    for (int i = 0; i < 5; i++)
+        presentIds[i] = materialTable.Register(presentMaterials[i]);
+    materialTable.Use(matShader);
+    materialTable.Use(deferred.LightShader());
+
+    //the simulation thread works on the next frame while this one is drawn
+    cameraRays = &worldRays;
+    FramePipeline<ScenePacket> pipeline(pipelineDepth, simulate);
+    framePipeline = &pipeline;
+
     //render loop ------------------------------------------------------------------------------------------------------------------------------------------
     while (!glfwWindowShouldClose(window))
     {
@@ -215,88 +507,111 @@ int main()
         last = current;
 
         keyboardInput(window);
+        const ScenePacket& frame = pipeline.Acquire();
+        float ambient = frame.ambient, diffuse = frame.diffuse, specular = frame.specular;
 
-        //listener position set to camera
-        musicEngine->setListenerPosition(vec3df(camera.Pos.x, camera.Pos.y, camera.Pos.z), vec3df(0, 0, 1));
 
+        //the scene renders at a fraction of the window when the gpu falls behind
+        int fbWidth, fbHeight;
+        glfwGetFramebufferSize(window, &fbWidth, &fbHeight);
+        dynamicRes.enabled = dynamicResolution && !lightBench.active;
+        if (sceneTimer.Results() != sceneSamples)
+        {
+            sceneSamples = sceneTimer.Results();
+            dynamicRes.Update(sceneTimer.lastMs);
+        }
+        int renderWidth = dynamicRes.Size(fbWidth), renderHeight = dynamicRes.Size(fbHeight);
+        hdr.Begin(renderWidth, renderHeight);
         glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        // lighting setup ---------------------------------------------------------------------------------------------------------------------------------
-        lightingShader.use();
-        lightingShader.setFloat("material.shininess", 32.0f);
-        lightingShader.setVec3("viewPos", camera.Pos);
-        lightingShader.setInt("fog", fog);
-
-        //point lights---------------------------------------------------------------------------------------------------------------------------
-        lightingShader.setVec3("pointLights[0].pos", pointLightPos[0]); 
-        lightingShader.setVec3("pointLights[0].ambient", ambient, ambient, ambient);
-        lightingShader.setVec3("pointLights[0].diffuse", diffuse, diffuse, diffuse);
-        lightingShader.setVec3("pointLights[0].specular", specular, specular, specular);
-        lightingShader.setFloat("pointLights[0].cons", 1.0f);
-        lightingShader.setFloat("pointLights[0].linear", 0.09f);
-        lightingShader.setFloat("pointLights[0].quadratic", 0.032f);
-
-        lightingShader.setVec3("pointLights[1].pos", pointLightPos[1]);
-        lightingShader.setVec3("pointLights[1].ambient", ambient, ambient, ambient);
-        lightingShader.setVec3("pointLights[1].diffuse", diffuse, diffuse, diffuse);
-        lightingShader.setVec3("pointLights[1].specular", specular, specular, specular);
-        lightingShader.setFloat("pointLights[1].cons", 1.0f);
-        lightingShader.setFloat("pointLights[1].linear", 0.09f);
-        lightingShader.setFloat("pointLights[1].quadratic", 0.032f);
-
-        lightingShader.setVec3("pointLights[2].pos", pointLightPos[2]);
-        lightingShader.setVec3("pointLights[2].ambient", ambient, ambient, ambient);
-        lightingShader.setVec3("pointLights[2].diffuse", diffuse, diffuse, diffuse);
-        lightingShader.setVec3("pointLights[2].specular", specular, specular, specular);
-        lightingShader.setFloat("pointLights[2].cons", 1.0f);
-        lightingShader.setFloat("pointLights[2].linear", 0.09f);
-        lightingShader.setFloat("pointLights[2].quadratic", 0.032f);
-
-        lightingShader.setVec3("pointLights[3].pos", pointLightPos[3]);
-        lightingShader.setVec3("pointLights[3].ambient", ambient, ambient, ambient);
-        lightingShader.setVec3("pointLights[3].diffuse", diffuse, diffuse, diffuse);
-        lightingShader.setVec3("pointLights[3].specular", specular, specular, specular);
-        lightingShader.setFloat("pointLights[3].cons", 1.0f);
-        lightingShader.setFloat("pointLights[3].linear", 0.09f);
-        lightingShader.setFloat("pointLights[3].quadratic", 0.032f);
-        
-        // spotLight ---------------------------------------------------------------------------------------------------------------------------------
-        lightingShader.setVec3("spotLight.pos", camera.Pos);
-        lightingShader.setVec3("spotLight.direction", camera.Front);
-        lightingShader.setVec3("spotLight.ambient", ambient, ambient, ambient);
-        lightingShader.setVec3("spotLight.diffuse", diffuse, diffuse, diffuse);
-        lightingShader.setVec3("spotLight.specular", specular, specular, specular);
-        lightingShader.setFloat("spotLight.cons", 1.0f);
-        lightingShader.setFloat("spotLight.linear", 0.08f);
-        lightingShader.setFloat("spotLight.quadratic", 0.040f);
-        lightingShader.setFloat("spotLight.cutOff", glm::cos(glm::radians(12.0f)));
-        lightingShader.setFloat("spotLight.outerCutOff", glm::cos(glm::radians(14.0f)));
-        
-        // directional light ---------------------------------------------------------------------------------------------------------------------------
+        glm::mat4 projection = glm::perspective(glm::radians(frame.zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+        glm::mat4 view = frame.view;
         glm::vec3 lightColor(1.0f, 1.0f, 1.0f);
         glm::vec3 diffuseColor = lightColor * glm::vec3(0.5f); 
         glm::vec3 ambientColor = diffuseColor * glm::vec3(0.2f); 
-        lightingShader.setVec3("directLight.direction", lightPos);
-        lightingShader.setVec3("directLight.ambient", ambientColor);
-        lightingShader.setVec3("directLight.diffuse", diffuseColor);
-        lightingShader.setVec3("directLight.specular", 0.5f, 0.5f, 0.5f);
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-        glm::mat4 view = camera.GetViewMatrix();
-        lightingShader.setMat4("projection", projection);
-        lightingShader.setMat4("view", view);
-        glm::mat4 model = glm::mat4(1.0f);
-        lightingShader.setMat4("model", model);
-
-        matShader.use();
-        matShader.setVec3("light.pos", lightPos);
-        matShader.setVec3("viewPos", camera.Pos);
-        matShader.setMat4("projection", projection);
-        matShader.setMat4("view", view);
-        matShader.setInt("fog", fog);
-        matShader.setVec3("light.ambient", ambientColor);
-        matShader.setVec3("light.diffuse", diffuseColor);
-        matShader.setVec3("light.specular", 1.0f, 1.0f, 1.0f);
+
+        // lighting setup for every shader using manyLights.fs --------------------------------------------------------------------------------------------
+        Shader* litShaders[] = { &lightingShader, &terrainShader, &deferred.LightShader(), &volumetricFog.InjectShader() };
+        for (Shader* lit : litShaders)
+        {
+            Shader& shader = *lit;
+            shader.use();
+            shader.setFloat("material.shininess", 32.0f);
+            shader.setVec3("viewPos", frame.cameraPos);
+            shader.setInt("extraLights", 6);
+            shader.setInt("extraLightCount", (int)extraLights.Count());
+
+            //point lights---------------------------------------------------------------------------------------------------------------------------
+            shader.setVec3("pointLights[0].pos", pointLightPos[0]); 
+            shader.setVec3("pointLights[0].ambient", ambient, ambient, ambient);
+            shader.setVec3("pointLights[0].diffuse", diffuse, diffuse, diffuse);
+            shader.setVec3("pointLights[0].specular", specular, specular, specular);
+            shader.setFloat("pointLights[0].cons", 1.0f);
+            shader.setFloat("pointLights[0].linear", 0.09f);
+            shader.setFloat("pointLights[0].quadratic", 0.032f);
+
+            shader.setVec3("pointLights[1].pos", pointLightPos[1]);
+            shader.setVec3("pointLights[1].ambient", ambient, ambient, ambient);
+            shader.setVec3("pointLights[1].diffuse", diffuse, diffuse, diffuse);
+            shader.setVec3("pointLights[1].specular", specular, specular, specular);
+            shader.setFloat("pointLights[1].cons", 1.0f);
+            shader.setFloat("pointLights[1].linear", 0.09f);
+            shader.setFloat("pointLights[1].quadratic", 0.032f);
+
+            shader.setVec3("pointLights[2].pos", pointLightPos[2]);
+            shader.setVec3("pointLights[2].ambient", ambient, ambient, ambient);
+            shader.setVec3("pointLights[2].diffuse", diffuse, diffuse, diffuse);
+            shader.setVec3("pointLights[2].specular", specular, specular, specular);
+            shader.setFloat("pointLights[2].cons", 1.0f);
+            shader.setFloat("pointLights[2].linear", 0.09f);
+            shader.setFloat("pointLights[2].quadratic", 0.032f);
+
+            shader.setVec3("pointLights[3].pos", pointLightPos[3]);
+            shader.setVec3("pointLights[3].ambient", ambient, ambient, ambient);
+            shader.setVec3("pointLights[3].diffuse", diffuse, diffuse, diffuse);
+            shader.setVec3("pointLights[3].specular", specular, specular, specular);
+            shader.setFloat("pointLights[3].cons", 1.0f);
+            shader.setFloat("pointLights[3].linear", 0.09f);
+            shader.setFloat("pointLights[3].quadratic", 0.032f);
+        
+            // spotLight ---------------------------------------------------------------------------------------------------------------------------------
+            shader.setVec3("spotLight.pos", frame.cameraPos);
+            shader.setVec3("spotLight.direction", frame.cameraFront);
+            shader.setVec3("spotLight.ambient", ambient, ambient, ambient);
+            shader.setVec3("spotLight.diffuse", diffuse, diffuse, diffuse);
+            shader.setVec3("spotLight.specular", specular, specular, specular);
+            shader.setFloat("spotLight.cons", 1.0f);
+            shader.setFloat("spotLight.linear", 0.08f);
+            shader.setFloat("spotLight.quadratic", 0.040f);
+            shader.setFloat("spotLight.cutOff", glm::cos(glm::radians(12.0f)));
+            shader.setFloat("spotLight.outerCutOff", glm::cos(glm::radians(14.0f)));
+        
+            // directional light ---------------------------------------------------------------------------------------------------------------------------
+            shader.setVec3("directLight.direction", lightPos);
+            shader.setVec3("directLight.ambient", ambientColor);
+            shader.setVec3("directLight.diffuse", diffuseColor);
+            shader.setVec3("directLight.specular", 0.5f, 0.5f, 0.5f);
+            shader.setMat4("projection", projection);
+            shader.setMat4("view", view);
+            glm::mat4 model = glm::mat4(1.0f);
+            shader.setMat4("model", model);
+        }
+
+        //the presents, lit the same way when deferred
+        Shader* flatShaders[] = { &matShader, &deferred.LightShader() };
+        for (Shader* flat : flatShaders)
+        {
+            Shader& shader = *flat;
+            shader.use();
+            shader.setVec3("light.pos", lightPos);
+            shader.setVec3("viewPos", frame.cameraPos);
+            shader.setMat4("projection", projection);
+            shader.setMat4("view", view);
+            shader.setVec3("light.ambient", ambientColor);
+            shader.setVec3("light.diffuse", diffuseColor);
+            shader.setVec3("light.specular", 1.0f, 1.0f, 1.0f);
+        }
   
         //model translations, scale and rotations  -------------------------------------------------------------------------------------------------------------------
         glm::mat4 modelFloor = glm::mat4(1.0f); //ground model
@@ -324,23 +639,10 @@ int main()
         modelPrez5 = glm::translate(modelPrez5, glm::vec3(0.1f, 0.0f, 0.0f));
         modelPrez5 = glm::scale(modelPrez5, glm::vec3(0.3f, 0.25f, 0.3f));
 
-        // Main snowman translations and rotations ---------------------------------------------------------------------------------------------------------
-        glm::mat4 modelBody = glm::mat4(1.0f);
-        modelBody = glm::translate(modelBody, glm::vec3(0.0f, -0.3f, cos((float)glfwGetTime()) * 2)); // making it move around the scene
-        modelBody = glm::scale(modelBody, glm::vec3(0.10f, 0.10f, 0.10f));	
-        modelBody = glm::rotate(modelBody, cos((float)glfwGetTime()) / 8, glm::vec3(1.0f, 0.0f, 1.0f));  //rotating body
-
-        //render the rightArm 
-        glm::mat4 rightArm = glm::mat4(1.0f);
-        rightArm = glm::translate(rightArm, glm::vec3(0.2f, 0.0f, 0.0f));
-        rightArm = glm::scale(rightArm, glm::vec3(1.0f, 1.0f, 1.0f));
-        rightArm = glm::rotate(rightArm, cos((float)glfwGetTime()) / 3, glm::vec3(2.0f, 0.0f, 0.0f)); //moving arm
-
-        //render the leftArm 
-        glm::mat4 leftArm = glm::mat4(1.0f);
-        leftArm = glm::translate(leftArm, glm::vec3(-0.2f, 0.0f, .5f));
-        leftArm = glm::scale(leftArm, glm::vec3(1.0f, 1.0f, 1.0f));
-        leftArm = glm::rotate(leftArm, sin((float)glfwGetTime()) / 3, glm::vec3(2.0f, 0.0f, 0.0f)); 
+        // Main snowman and its arms, animated on the simulation thread ---------------------------------------------------------------------------------
+        const glm::mat4& modelBody = frame.modelBody;
+        const glm::mat4& rightArm = frame.rightArm;
+        const glm::mat4& leftArm = frame.leftArm;
 
         //snowman Crowd connected to modelBody ------------------------------------------------------------------------------------------------------------
         glm::mat4 modelSnowman2 = glm::mat4(1.0f);
@@ -371,91 +673,200 @@ int main()
         glm::mat4 rightArm5 = glm::mat4(1.0f);
         rightArm5 = glm::translate(rightArm5, glm::vec3(0.2f, 0.0f, 0.0f));
 
+        //snowman sounds follow the crowd, listener set to the camera
+        glm::mat4 crowd[5] = { modelBody, modelBody * modelSnowman2, modelBody * modelSnowman3, modelBody * modelSnowman4, modelBody * modelSnowman5 };
+        for (int i = 0; i < 5; i++)
+            sound.SetEmitterPosition(crowdSounds[i], glm::vec3(crowd[i][3]));
+        sound.SetListener(frame.cameraPos, frame.cameraFront);
+
         //Drawing Models --------------------------------------------------------------------------------------------------------------------------
+        glm::mat4 viewProj = projection * view;
+        hiz.enabled = cullingMode == CULL_HIZ;
+        softOcclusion.enabled = cullingMode == CULL_SOFTWARE;
+        hiz.BeginFrame();
+        if (softOcclusion.enabled)
+            softOcclusion.Render(viewProj);
+
+        //models still loading get a few more meshes uploaded
+        modelLoader.Update();
+        if (!texturesPacked && modelLoader.AllReady())
+        {
+            textureArrays.Pack({ &floor, &prez, &armRight, &armLeft, &snowManBasic, &basicLeft, &basicRight });
+            texturesPacked = true;
+        }
+        textureArrays.Update(); //the arrays are built once the workers have read every source
+
+        //opaque meshes go through the draw list so they can be sorted and depth pre-passed
+        drawList.prepass = prepass;
+        drawList.showOverdraw = overdrawView;
+        drawList.Clear();
 
+        //each snowman is a body and two arms
+        struct CrowdPart {
+            Model* model;
+            glm::mat4 matrix;
+        };
+        CrowdPart crowdParts[5][3] = {
+            { { &snowManBasic, modelBody }, { &armRight, modelBody * rightArm }, { &armLeft, modelBody * leftArm } },
+            { { &snowManBasic, modelBody * modelSnowman2 }, { &armLeft, modelBody * modelSnowman2 * leftArm2 * rightArm }, { &armRight, modelBody * modelSnowman2 * rightArm2 * rightArm } },
+            { { &snowManBasic, modelBody * modelSnowman3 }, { &armLeft, modelBody * modelSnowman3 * leftArm3 * rightArm }, { &armRight, modelBody * modelSnowman3 * rightArm3 * rightArm } },
+            { { &snowManBasic, modelBody * modelSnowman4 }, { &basicLeft, modelBody * modelSnowman4 * leftArm * leftArm4 }, { &basicRight, modelBody * modelSnowman4 * leftArm * rightArm4 } },
+            { { &snowManBasic, modelBody * modelSnowman5 }, { &basicLeft, modelBody * modelSnowman5 * leftArm * leftArm5 }, { &basicRight, modelBody * modelSnowman5 * leftArm * rightArm5 } }
+        };
+
+        //the crowd's boxes follow the animation, then one frustum query finds what the camera can see
+        for (int i = 0; i < 5; i++)
+        {
+            AABB box;
+            for (const CrowdPart& part : crowdParts[i])
+                for (const Mesh& mesh : part.model->meshes)
+                    box.Grow(TransformAABB(part.matrix, mesh.bounds));
+            sceneBvh.Move(crowdProxies[i], box);
+        }
+        sceneBvh.Update();
+        bool crowdVisible[5] = { false, false, false, false, false };
+        std::fill(floorVisible.begin(), floorVisible.end(), false);
+        sceneBvh.Query(Frustum(viewProj), [&](unsigned int instance)
+        {
+            if (instance >= SCENE_CROWD)
+                crowdVisible[instance - SCENE_CROWD] = true;
+            else
+                floorVisible[instance] = true;
+        });
+
+        //the presents stay put, the crowd's triangles follow the animation
+        glm::mat4 presents[5] = { modelPrez, modelPrez2, modelPrez3, modelPrez4, modelPrez5 };
+        if (!pickablesAdded && modelLoader.AllReady())
+        {
+            for (int i = 0; i < 5; i++)
+                for (const Mesh& mesh : prez.meshes)
+                    pickRays.Add(mesh.vertices, mesh.indices, presents[i], i);
+            for (int i = 0; i < 5; i++)
+                for (const CrowdPart& part : crowdParts[i])
+                    for (const Mesh& mesh : part.model->meshes)
+                        crowdPicks.push_back(pickRays.Add(mesh.vertices, mesh.indices, part.matrix, 5 + i));
+            pickablesAdded = true;
+        }
+        else if (pickablesAdded)
+        {
+            unsigned int pick = 0;
+            for (int i = 0; i < 5; i++)
+                for (const CrowdPart& part : crowdParts[i])
+                    for (unsigned int m = 0; m < part.model->meshes.size(); m++)
+                        pickRays.Move(crowdPicks[pick++], part.matrix);
+        }
+        pickRays.Update();
+
+        //the cursor is captured so picking goes through the middle of the screen, where the camera looks
+        if (pickRequested)
+        {
+            pickRequested = false;
+            const char* pickNames[10] = { "gold present", "ruby present", "emerald present", "jade present", "bronze present",
+                "snowman 1", "snowman 2", "snowman 3", "snowman 4", "snowman 5" };
+            RayHit worldHit, pickHit;
+            bool onWorld = worldRays.Raycast(frame.cameraPos, frame.cameraFront, PICK_DISTANCE, worldHit);
+            if (pickRays.Raycast(frame.cameraPos, frame.cameraFront, onWorld ? worldHit.t : PICK_DISTANCE, pickHit))
+                std::cout << "Picked the " << pickNames[pickHit.data] << " " << pickHit.t << " away" << std::endl;
+            else if (onWorld)
+                std::cout << "Picked ground model mesh " << worldHit.data << " " << worldHit.t << " away" << std::endl;
+            else
+                std::cout << "Nothing to pick" << std::endl;
+        }
+
+        //the ground model holds the houses, trees and snowballs as separate meshes so each one is tested on its own
+        for (unsigned int i = 0; i < floor.meshes.size(); i++)
+        {
+            if (!floorVisible[i])
+                continue;
+            AABB box = TransformAABB(modelFloor, floor.meshes[i].bounds);
+            unsigned int triangles = floor.meshes[i].TriangleCount();
+            if (softOcclusion.Test(box, triangles) && hiz.Test(i, box, triangles))
+                drawList.Add(floor.meshes[i], lightingShader, modelFloor);
+        }
+
+        //presents to show different materials
+        for (int i = 0; i < 5; i++)
+            drawList.Add(prez, matShader, presents[i], presentIds[i]);
+
+        //crowd of snowman  hierachy connected to modelBody, the arms move along with the body
+        for (int i = 0; i < 5; i++)
+        {
+            if (!crowdVisible[i])
+                continue;
+            for (const CrowdPart& part : crowdParts[i])
+                drawList.Add(*part.model, lightingShader, part.matrix);
+        }
+
+        //ground chunks join the pre-pass after the sorted meshes, most of them are behind something
+        terrain.Update(frame.cameraPos);
+        forest.Update(frame.cameraPos, viewProj);
+        Shader* terrainPasses[] = { &terrainDepthShader, &terrainOverdrawShader, &terrainGBufferShader };
+        for (Shader* pass : terrainPasses)
+        {
+            pass->use();
+            pass->setMat4("view", view);
+            pass->setMat4("projection", projection);
+            pass->setVec3("viewPos", frame.cameraPos);
+        }
+        drawList.Sort(frame.cameraPos);
+
+        //the draws ask for the texture mips their size on screen needs, the streamer loads them in the background
+        float pixelScale = projection[1][1] * renderHeight * 0.5f;
+        for (const DrawItem& item : drawList.Items())
+            textureStreamer.RequestMesh(*item.mesh, item.model, frame.cameraPos, pixelScale);
+        forest.StreamTextures(textureStreamer, frame.cameraPos, pixelScale);
+        float groundDistance = glm::max(frame.cameraPos.y - ground.Height(frame.cameraPos.x, frame.cameraPos.z), 0.5f);
+        textureStreamer.RequestDensity(terrain.diffuseTex, terrain.uvScale, groundDistance, pixelScale);
+        textureStreamer.Update();
+        //timed from the first draw into the HDR target, the culling, sorting and uploads above are CPU work the gpu would only wait on
+        sceneTimer.Begin();
+        opaqueTimer.Begin();
+        if (deferredShading)
+        {
+            //everything opaque into the G-buffer, then one lighting pass over the screen
+            deferred.Begin(renderWidth, renderHeight, hdr.DepthTexture());
+            deferred.Draw(drawList, view, projection);
+            terrainGBufferShader.use();
+            terrain.Draw(terrainGBufferShader, frame.cameraPos, viewProj);
+            deferred.GeometryShader().use();
+            forest.DrawNear(deferred.GeometryShader());
+            deferred.LightPass(view, projection, extraLights, hdr.ColorTexture(), hdr.DepthTexture(), hdr.Framebuffer());
+        }
+        else
+        {
+            extraLights.Bind(6);
+            drawList.DrawDepth(view, projection, [&]() {
+                terrainDepthShader.use();
+                terrain.Draw(terrainDepthShader, frame.cameraPos, viewProj);
+            });
+
+            drawList.BeginShading(renderWidth, renderHeight);
+            drawList.Draw();
+            Shader& terrainPass = overdrawView ? terrainOverdrawShader : terrainShader;
+            terrainPass.use();
+            terrain.Draw(terrainPass, frame.cameraPos, viewProj);
+            drawList.EndShading();
+
+            //forest trees close to the camera as instanced meshes, they dither between levels so they stay out of the pre-pass
+            lightingShader.use();
+            forest.DrawNear(lightingShader);
+        }
+        opaqueTimer.End();
+        drawList.EndFrame(); //no later pass reads the draw blocks
+
+        //forest trees in the distance as impostors
+        forest.DrawImpostors(view, projection, frame.cameraPos, lightPos, ambientColor, diffuseColor);
+
+        //re-test what the old depth pyramid culled against this frame's depth so nothing pops in
+        hiz.QueryCulled(viewProj);
         lightingShader.use();
         lightingShader.setMat4("model", modelFloor);
-        floor.Draw(lightingShader);
-
-        //presents to show different materials --------------------------------------------------------------------------------------------------
-        matShader.use();
-            //gold
-            matShader.setVec3("material.ambient", 0.24725f, 0.1995f, 0.0745f);
-            matShader.setVec3("material.diffuse", 0.75164f, 0.60648f, 0.22648f);
-            matShader.setVec3("material.specular", 0.628281f, 0.555802f, 0.366065f);
-            matShader.setFloat("material.shininess", 0.4f);
-            matShader.setMat4("model", modelPrez);
-            prez.Draw(matShader);
-            //ruby
-            matShader.setVec3("material.ambient", 0.1745f, 0.01175f, 0.01175f);
-            matShader.setVec3("material.diffuse", 0.61424f, 0.04136f, 0.04136f);
-            matShader.setVec3("material.specular", 0.727811f, 0.626959f, 0.626959f);
-            matShader.setFloat("material.shininess", 0.6f);
-            matShader.setMat4("model", modelPrez2);
-            prez.Draw(matShader);
-            //emerald
-            matShader.setVec3("material.ambient", 0.0215f, 0.1745f, 0.0215f);
-            matShader.setVec3("material.diffuse", 0.07568, 0.61424, 0.07568);
-            matShader.setVec3("material.specular", 0.633, 0.727811, 0.633);
-            matShader.setFloat("material.shininess", 0.6f);
-            matShader.setMat4("model", modelPrez3);
-            prez.Draw(matShader);
-            //jade
-            matShader.setVec3("material.ambient", 0.19225, 0.19225, 0.19225);
-            matShader.setVec3("material.diffuse", 0.50754, 0.50754, 0.50754);
-            matShader.setVec3("material.specular", 0.508273, 0.508273, 0.508273);
-            matShader.setFloat("material.shininess", 0.4f);
-            matShader.setMat4("model", modelPrez4);
-            prez.Draw(matShader);
-            //bronze
-            matShader.setVec3("material.ambient", 0.2125, 0.1275, 0.054);
-            matShader.setVec3("material.diffuse", .714, 0.4284, 0.18144);
-            matShader.setVec3("material.specular", 0.393548, 0.271906, 0.166721);
-            matShader.setFloat("material.shininess", 0.2f);
-            matShader.setMat4("model", modelPrez5);
-            prez.Draw(matShader);
-
-        //crowd of snowman  hierachy connected to modelBody  ------------------------------------------------------------------------------------
-        lightingShader.use();
-        lightingShader.setMat4("model", modelBody);
-        snowManBasic.Draw(lightingShader);
-            lightingShader.setMat4("model", modelBody* rightArm); //right arm moves along with the body
-            armRight.Draw(lightingShader);
-            lightingShader.setMat4("model", modelBody* leftArm); //left arn moves along with the body
-            armLeft.Draw(lightingShader);
-     
-            lightingShader.setMat4("model", modelBody * modelSnowman2);
-            snowManBasic.Draw(lightingShader);
-            lightingShader.setMat4("model", modelBody * modelSnowman2* leftArm2 * rightArm);
-            armLeft.Draw(lightingShader);
-            lightingShader.setMat4("model", modelBody* modelSnowman2* rightArm2 *rightArm);
-            armRight.Draw(lightingShader);
-
-            lightingShader.setMat4("model", modelBody* modelSnowman3);
-            snowManBasic.Draw(lightingShader);
-            lightingShader.setMat4("model", modelBody* modelSnowman3* leftArm3* rightArm);
-            armLeft.Draw(lightingShader);
-            lightingShader.setMat4("model", modelBody* modelSnowman3* rightArm3* rightArm);
-            armRight.Draw(lightingShader);
-
-            lightingShader.setMat4("model", modelBody * modelSnowman4);
-            snowManBasic.Draw(lightingShader);
-            lightingShader.setMat4("model", modelBody* modelSnowman4 * leftArm * leftArm4);
-            basicLeft.Draw(lightingShader);
-            lightingShader.setMat4("model", modelBody* modelSnowman4 * leftArm * rightArm4);
-            basicRight.Draw(lightingShader);
-     
-            lightingShader.setMat4("model", modelBody* modelSnowman5);
-            snowManBasic.Draw(lightingShader);
-            lightingShader.setMat4("model", modelBody* modelSnowman5 * leftArm* leftArm5);
-            basicLeft.Draw(lightingShader);
-            lightingShader.setMat4("model", modelBody* modelSnowman5 * leftArm* rightArm5);
-            basicRight.Draw(lightingShader);
+        hiz.DrawCulled([&](unsigned int i) { floor.meshes[i].Draw(lightingShader); });
 
          // draw skybox ---------------------------------------------------------------------------------------------------------------------
         glDepthFunc(GL_LEQUAL);
         skyShader.use();
-        view = glm::mat4(glm::mat3(camera.GetViewMatrix())); 
+        view = glm::mat4(glm::mat3(frame.view)); 
         skyShader.setMat4("view", view);
         skyShader.setMat4("projection", projection);
         glBindVertexArray(skyVAO);
@@ -465,60 +876,83 @@ int main()
         glBindVertexArray(0);
         glDepthFunc(GL_LESS);
 
-        //enable gamma correction disable for a darker scene------------------------------------------------------------------------------------------------
-        if (!fog)
-        {
-            glEnable(GL_FRAMEBUFFER_SRGB);
-        }
-        else {
-         
-            glDisable(GL_FRAMEBUFFER_SRGB);
-        }
-       
+        //snow after everything opaque so it can fade against the depth
+        snowfall.enabled = snow;
+        snowfall.Update(dTime, current, frame.cameraPos);
+        snowfall.Draw(frame.view, projection, renderWidth, renderHeight);
+
+        //the fog is lit and integrated into its froxel grid, then applied along with exposure, tone mapping and gamma correction
+        if (fog)
+            volumetricFog.Update(frame.view, projection, extraLights, hdr.Framebuffer(), renderWidth, renderHeight);
+        sceneTimer.End();
+        hdr.Resolve(projection, fog ? volumetricFog.Texture() : 0, volumetricFog.Range(), fbWidth, fbHeight, dynamicRes.Sharpness());
+
+        //build the depth pyramid the next frame is culled against
+        if (cullingMode == CULL_HIZ)
+            hiz.EndFrame(viewProj, renderWidth, renderHeight);
+        if (cullingMode == CULL_SOFTWARE)
+            softOcclusion.Report(current);
+        else
+            hiz.Report(current);
+        forest.Report(current);
+        sceneBvh.Report(current);
+        worldRays.Report(current);
+        terrain.Report(current);
+        snowfall.Report(current);
+        dynamicRes.Report(current);
+        textureStreamer.Report(current);
+        modelLoader.Report(current);
+        workers.Report(current);
+        if (fog)
+            volumetricFog.Report(current);
+        if (deferredShading)
+            deferred.Report(current);
+        else
+            drawList.Report(current);
+        sound.Report(current);
+        pipeline.Report(current);
 
         glfwSwapBuffers(window);
+        pipeline.Release();
         glfwPollEvents();
+
+        //the benchmark picks the light count and renderer for the next frame
+        if (lightBench.Frame(opaqueTimer, dTime * 1000.0f))
+            glfwSetWindowShouldClose(window, true);
+        if (lightBench.active)
+        {
+            deferredShading = lightBench.Deferred();
+            unsigned int extra = lightBench.Lights() - 4;
+            if (extraLights.Count() != extra)
+                extraLights.Scatter(extra, glm::vec3(-10.0f, 0.1f, -15.0f), glm::vec3(10.0f, 2.0f, 2.0f));
+        }
     }
 
+    //the simulation thread reads the globals below, so it is stopped before they are cleared
+    pipeline.Stop();
+    framePipeline = NULL;
+    cameraRays = NULL;
     //delete resources
     glDeleteVertexArrays(1, &skyVAO);
     glDeleteBuffers(1, &skyVBO);
-    if (musicEngine)
-    {
-        musicEngine->drop();
-    }
-    glfwTerminate();
-    return 0;  
 }
 
 //keyboard controls function
 void keyboardInput(GLFWwindow* window)
 {
     //camera and escape controls ---------------------------------------------------------------------------------------------------------------------------------------
+    //camera movement and the lighting levels are passed on to the simulation thread
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-        camera.ProcessKeyboard(FORWARD, dTime);
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-        camera.ProcessKeyboard(LEFT, dTime);
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-        camera.ProcessKeyboard(BACKWARD, dTime);
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-        camera.ProcessKeyboard(RIGHT, dTime);
-
-    //lighting controls ------------------------------------------------------------------------------------------------------------------------------------------------
-    if (glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS)
-        ambient = ambient + .02f;
-    if (glfwGetKey(window, GLFW_KEY_J) == GLFW_PRESS)
-        ambient = ambient - .02f;
-    if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS)
-        diffuse = diffuse + .02f;
-    if (glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS)
-        diffuse = diffuse - .02f;
-    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS)
-        specular = specular + .02f;
-    if (glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS)
-        specular = specular - .02f;  
+    const int simulationKeys[] = { GLFW_KEY_W, GLFW_KEY_S, GLFW_KEY_A, GLFW_KEY_D, GLFW_KEY_I, GLFW_KEY_J, GLFW_KEY_O, GLFW_KEY_K, GLFW_KEY_P, GLFW_KEY_L }; //SimulationKey order
+    unsigned int held = 0;
+    for (unsigned int i = 0; i < sizeof(simulationKeys) / sizeof(simulationKeys[0]); i++)
+    {
+        if (glfwGetKey(window, simulationKeys[i]) == GLFW_PRESS)
+            held |= 1u << i;
+    }
+    if (framePipeline)
+        framePipeline->SetHeld(held);
        
     //fog ---------------------------------------------------------------------------------------------------------------------------------------------------------------
     if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS && !fogKey)
@@ -526,12 +960,96 @@ void keyboardInput(GLFWwindow* window)
         fog = !fog;
         fogKey = true;
         //play beep sound
-        musicEngine->play2D("music/beep.mp3");
+        audioThread->Play2D("music/beep.mp3");
     }
     if (glfwGetKey(window, GLFW_KEY_F) == GLFW_RELEASE)
     {
         fogKey = false;
     }
+
+    //occlusion culling off / hi-z / software to compare the draw counts ---------------------------------------------------------------------------------------
+    if (glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS && !cullKey)
+    {
+        cullingMode = (cullingMode + 1) % CULL_MODES;
+        cullKey = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_H) == GLFW_RELEASE)
+    {
+        cullKey = false;
+    }
+
+    //snowfall ----------------------------------------------------------------------------------------------------------------------------------------------------------
+    if (glfwGetKey(window, GLFW_KEY_N) == GLFW_PRESS && !snowKey)
+    {
+        snow = !snow;
+        snowKey = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_N) == GLFW_RELEASE)
+    {
+        snowKey = false;
+    }
+
+    //dynamic resolution ------------------------------------------------------------------------------------------------------------------------------------------------
+    if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS && !dynamicResolutionKey)
+    {
+        dynamicResolution = !dynamicResolution;
+        dynamicResolutionKey = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_R) == GLFW_RELEASE)
+    {
+        dynamicResolutionKey = false;
+    }
+
+    //forward or deferred lighting --------------------------------------------------------------------------------------------------------------------------------
+    if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS && !deferredKey)
+    {
+        deferredShading = !deferredShading;
+        deferredKey = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_G) == GLFW_RELEASE)
+    {
+        deferredKey = false;
+    }
+
+    //depth pre-pass on or off, and the overdraw view to compare them -----------------------------------------------------------------------------------------------
+    if (glfwGetKey(window, GLFW_KEY_Z) == GLFW_PRESS && !prepassKey)
+    {
+        prepass = !prepass;
+        prepassKey = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_Z) == GLFW_RELEASE)
+    {
+        prepassKey = false;
+    }
+    if (glfwGetKey(window, GLFW_KEY_X) == GLFW_PRESS && !overdrawKey)
+    {
+        overdrawView = !overdrawView;
+        overdrawKey = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_X) == GLFW_RELEASE)
+    {
+        overdrawKey = false;
+    }
+
+    //walk or fly, and picking with the left mouse button ---------------------------------------------------------------------------------------------------------
+    if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS && !walkKey)
+    {
+        walking = !walking;
+        walkKey = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_C) == GLFW_RELEASE)
+    {
+        walkKey = false;
+    }
+    if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS && !pickKey)
+    {
+        pickRequested = true;
+        pickKey = true;
+    }
+    if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_RELEASE)
+    {
+        pickKey = false;
+    }
 }
 
 //window Size changes
@@ -555,13 +1073,84 @@ void mouse(GLFWwindow* window, double x, double y)
     float yoffset = lastYPos - yPos; 
     lastXPos = xPos;
     lastYPos = yPos;
-    camera.MouseMovement(xoffset, yoffset);
+    if (framePipeline)
+        framePipeline->AddMouse(glm::vec2(xoffset, yoffset));
 }
 
 // mouse Zoom controls
 void scroll(GLFWwindow* window, double xoffset, double yoffset)
 {
-    camera.MouseZoom(static_cast<float>(yoffset));
+    if (framePipeline)
+        framePipeline->AddScroll(static_cast<float>(yoffset));
+}
+
+// one step of the simulation thread: camera and lighting from the input, then the animated transforms -------------------------------------------------
+void simulate(const FrameInput& input, float time, float dt, ScenePacket& packet)
+{
+    glm::vec3 from = camera.Pos;
+    if (input.held & (1u << KEY_FORWARD))
+        camera.ProcessKeyboard(FORWARD, dt);
+    if (input.held & (1u << KEY_LEFT))
+        camera.ProcessKeyboard(LEFT, dt);
+    if (input.held & (1u << KEY_BACKWARD))
+        camera.ProcessKeyboard(BACKWARD, dt);
+    if (input.held & (1u << KEY_RIGHT))
+        camera.ProcessKeyboard(RIGHT, dt);
+    camera.MouseMovement(input.mouse.x, input.mouse.y);
+    if (input.scroll != 0.0f)
+        camera.MouseZoom(input.scroll);
+
+    //the camera slides along walls instead of passing through, then stands on the ground or stays just above it
+    if (cameraRays)
+    {
+        camera.Pos = cameraRays->Slide(from, camera.Pos, CAMERA_RADIUS);
+        float ground;
+        if (walking)
+        {
+            if (cameraRays->Ground(camera.Pos - glm::vec3(0.0f, CAMERA_EYE_HEIGHT, 0.0f), CAMERA_STEP, PICK_DISTANCE, ground))
+                camera.Pos.y = ground + CAMERA_EYE_HEIGHT;
+        }
+        else if (cameraRays->Ground(camera.Pos, CAMERA_STEP, CAMERA_RADIUS, ground))
+            camera.Pos.y = std::max(camera.Pos.y, ground + CAMERA_RADIUS);
+    }
+
+    //lighting controls
+    if (input.held & (1u << KEY_AMBIENT_UP))
+        ambient = ambient + .02f;
+    if (input.held & (1u << KEY_AMBIENT_DOWN))
+        ambient = ambient - .02f;
+    if (input.held & (1u << KEY_DIFFUSE_UP))
+        diffuse = diffuse + .02f;
+    if (input.held & (1u << KEY_DIFFUSE_DOWN))
+        diffuse = diffuse - .02f;
+    if (input.held & (1u << KEY_SPECULAR_UP))
+        specular = specular + .02f;
+    if (input.held & (1u << KEY_SPECULAR_DOWN))
+        specular = specular - .02f;
+
+    packet.cameraPos = camera.Pos;
+    packet.cameraFront = camera.Front;
+    packet.zoom = camera.Zoom;
+    packet.view = camera.GetViewMatrix();
+    packet.ambient = ambient;
+    packet.diffuse = diffuse;
+    packet.specular = specular;
+
+    // Main snowman translations and rotations
+    packet.modelBody = glm::mat4(1.0f);
+    packet.modelBody = glm::translate(packet.modelBody, glm::vec3(0.0f, -0.3f, cos(time) * 2)); // making it move around the scene
+    packet.modelBody = glm::scale(packet.modelBody, glm::vec3(0.10f, 0.10f, 0.10f));
+    packet.modelBody = glm::rotate(packet.modelBody, cos(time) / 8, glm::vec3(1.0f, 0.0f, 1.0f));  //rotating body
+
+    //the rightArm 
+    packet.rightArm = glm::mat4(1.0f);
+    packet.rightArm = glm::translate(packet.rightArm, glm::vec3(0.2f, 0.0f, 0.0f));
+    packet.rightArm = glm::rotate(packet.rightArm, cos(time) / 3, glm::vec3(2.0f, 0.0f, 0.0f)); //moving arm
+
+    //the leftArm 
+    packet.leftArm = glm::mat4(1.0f);
+    packet.leftArm = glm::translate(packet.leftArm, glm::vec3(-0.2f, 0.0f, .5f));
+    packet.leftArm = glm::rotate(packet.leftArm, sin(time) / 3, glm::vec3(2.0f, 0.0f, 0.0f));
 }
 
 // set up the skybox cubemap ------------------------------------------------------------------------------------------------------------------------------
@@ -574,6 +1163,13 @@ unsigned int loadSkybox(vector<std::string> skyFaces)
     int nChannels,w, h ;
     for (unsigned int i = 0; i < skyFaces.size(); i++)
     {
+        // the sky has no mips, only the top level of a cooked face is used
+        DdsImage cooked;
+        if (ReadDds(DdsPath(skyFaces[i]), cooked) && DdsSupported(cooked.format))
+        {
+            UploadDds(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, cooked, false);
+            continue;
+        }
         unsigned char* data = stbi_load(skyFaces[i].c_str(), &w, &h, &nChannels, 0);
         if (data)
         {
@@ -0,0 +1,61 @@
+// Lock-free single producer single consumer ring buffer
+// Reference https://rigtorp.se/ringbuffer/
+// One thread pushes and one other thread pops, neither ever waits on a lock. A full queue refuses the push
+// instead of blocking so the producer can decide what to drop.
+
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+template <typename T>
+class SpscQueue
+{
+public:
+    // capacity is rounded up to a power of two
+    SpscQueue(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    // producer only
+    bool Push(const T& item)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == slots.size())
+            return false;
+        slots[h & mask] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer only
+    bool Pop(T& item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire))
+            return false;
+        item = slots[t & mask];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // approximate when called while the other side is running
+    size_t Size() const
+    {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+private:
+    std::vector<T> slots;
+    size_t mask;
+    // on their own cache lines so the two threads do not fight over one
+    alignas(64) std::atomic<size_t> head{ 0 };
+    alignas(64) std::atomic<size_t> tail{ 0 };
+};
+#endif
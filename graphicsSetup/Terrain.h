@@ -0,0 +1,314 @@
+// Chunked terrain with CDLOD quadtree level selection
+// CDLOD reference https://github.com/fstrugar/CDLOD/blob/master/cdlod_paper_latest.pdf
+// The world is split into square tiles whose heights are generated from the heightfield on worker threads
+// when the camera comes near and dropped again when it leaves. Each resident tile is a quadtree, nodes are
+// picked by distance and drawn with one shared grid patch that morphs into the coarser level before the
+// switch so neighbouring levels always meet without cracks.
+
+#ifndef TERRAIN_H
+#define TERRAIN_H
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "Heightfield.h"
+#include "ThreadPool.h"
+#include "Bounds.h"
+#include "shader.h"
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <cfloat>
+#include <iostream>
+
+const int TERRAIN_GRID = 16;          // quads per side of the patch every node is drawn with
+const int TERRAIN_TILE_RES = 65;      // height samples per side of a tile, edges are shared with the neighbours
+const float TERRAIN_TILE_SIZE = 4.0f; // world units per tile
+const int TERRAIN_LEVELS = 4;         // level 0 are the leaves, the tile itself is the last level
+const float TERRAIN_LOD_RANGE = 4.0f; // distance at which a level switches to the next, in node sizes
+
+class Terrain
+{
+public:
+    float loadRadius = 30.0f;    // tiles closer than this are streamed in
+    float unloadRadius = 40.0f;  // and dropped again past this
+    unsigned int uploadsPerFrame = 2;
+    float uvScale = 0.5f;
+    unsigned int diffuseTex = 0;
+
+    Terrain(const Heightfield& source, glm::vec2 worldMin, glm::vec2 worldMax, ThreadPool& pool)
+        : source(source), worldMin(worldMin), pool(pool)
+    {
+        tilesX = (int)glm::ceil((worldMax.x - worldMin.x) / TERRAIN_TILE_SIZE);
+        tilesZ = (int)glm::ceil((worldMax.y - worldMin.y) / TERRAIN_TILE_SIZE);
+        float leaf = TERRAIN_TILE_SIZE / (1 << (TERRAIN_LEVELS - 1));
+        for (int level = 0; level < TERRAIN_LEVELS; level++)
+            ranges[level] = leaf * (1 << level) * TERRAIN_LOD_RANGE;
+        patchSetup();
+    }
+
+    ~Terrain()
+    {
+        pool.Wait(); // jobs still write into this terrain
+        for (std::map<int, Tile>::iterator it = tiles.begin(); it != tiles.end(); ++it)
+            glDeleteTextures(1, &it->second.heightTex);
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &EBO);
+    }
+
+    // requests tiles around the camera, uploads finished ones and evicts far ones
+    void Update(const glm::vec3& cameraPos)
+    {
+        glm::vec2 cam(cameraPos.x, cameraPos.z);
+        for (int z = 0; z < tilesZ; z++)
+        {
+            for (int x = 0; x < tilesX; x++)
+            {
+                int key = z * tilesX + x;
+                float dist = tileDistance(x, z, cam);
+                bool resident = tiles.count(key) > 0;
+                if (!resident && dist < loadRadius && requested.count(key) == 0)
+                {
+                    requested.insert(key);
+                    pool.Submit([this, x, z]() { buildTile(x, z); });
+                }
+                else if (resident && dist > unloadRadius)
+                {
+                    glDeleteTextures(1, &tiles[key].heightTex);
+                    tiles.erase(key);
+                }
+            }
+        }
+
+        // gpu uploads are spread over frames
+        std::vector<TileData> ready;
+        {
+            std::lock_guard<std::mutex> lock(readyMutex);
+            while (!finished.empty() && ready.size() < uploadsPerFrame)
+            {
+                ready.push_back(finished.back());
+                finished.pop_back();
+            }
+        }
+        for (unsigned int i = 0; i < ready.size(); i++)
+            upload(ready[i]);
+    }
+
+    // blocks until the tiles around the camera are resident, for the first frame
+    void Preload(const glm::vec3& cameraPos)
+    {
+        Update(cameraPos);
+        pool.Wait();
+        unsigned int batch = uploadsPerFrame;
+        uploadsPerFrame = 0xffffffff;
+        Update(cameraPos);
+        uploadsPerFrame = batch;
+    }
+
+    // picks quadtree nodes for every resident tile and draws them, the shader's lights are already set
+    void Draw(Shader& shader, const glm::vec3& cameraPos, const glm::mat4& viewProj)
+    {
+        Frustum frustum(viewProj);
+        nodesDrawn = 0;
+        nodesCulled = 0;
+        shader.setInt("heightMap", 5);
+        shader.setInt("material.diffuse", 0);
+        shader.setInt("material.specular", 0);
+        shader.setFloat("tileSize", TERRAIN_TILE_SIZE);
+        shader.setFloat("tileRes", (float)TERRAIN_TILE_RES);
+        shader.setFloat("gridSize", (float)TERRAIN_GRID);
+        shader.setFloat("uvScale", uvScale);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, diffuseTex);
+        glBindVertexArray(VAO);
+        for (std::map<int, Tile>::iterator it = tiles.begin(); it != tiles.end(); ++it)
+        {
+            Tile& tile = it->second;
+            shader.setVec2("tileOrigin", tileOrigin(tile.x, tile.z));
+            glActiveTexture(GL_TEXTURE5);
+            glBindTexture(GL_TEXTURE_2D, tile.heightTex);
+            selectNode(shader, tile, TERRAIN_LEVELS - 1, 0, 0, cameraPos, frustum);
+        }
+        glBindVertexArray(0);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    void Report(float time)
+    {
+        if (time - lastReport < 2.0f)
+            return;
+        lastReport = time;
+        std::cout << "Terrain: " << tiles.size() << "/" << tilesX * tilesZ << " tiles resident, " << requested.size() << " streaming, "
+            << nodesDrawn << " chunks drawn, " << nodesCulled << " frustum culled, " << nodesDrawn * TERRAIN_GRID * TERRAIN_GRID * 2 << " triangles" << std::endl;
+    }
+
+private:
+    struct TileData {
+        int x, z;
+        std::vector<float> heights;
+        std::vector<std::vector<glm::vec2>> nodeRange; // min and max height of every node, per level
+    };
+
+    struct Tile {
+        int x, z;
+        unsigned int heightTex;
+        std::vector<std::vector<glm::vec2>> nodeRange;
+    };
+
+    const Heightfield& source;
+    glm::vec2 worldMin;
+    ThreadPool& pool;
+    int tilesX, tilesZ;
+    float ranges[TERRAIN_LEVELS];
+    std::map<int, Tile> tiles;
+    std::set<int> requested;
+    std::vector<TileData> finished;
+    std::mutex readyMutex;
+    unsigned int VAO, VBO, EBO;
+    unsigned int indexCount;
+    unsigned int nodesDrawn = 0, nodesCulled = 0;
+    float lastReport = 0.0f;
+
+    glm::vec2 tileOrigin(int x, int z) const
+    {
+        return worldMin + glm::vec2(x, z) * TERRAIN_TILE_SIZE;
+    }
+
+    float tileDistance(int x, int z, const glm::vec2& cam) const
+    {
+        glm::vec2 lo = tileOrigin(x, z);
+        glm::vec2 nearest = glm::clamp(cam, lo, lo + glm::vec2(TERRAIN_TILE_SIZE));
+        return glm::length(nearest - cam);
+    }
+
+    // runs on a worker, samples the heightfield and builds the min/max quadtree used for culling
+    void buildTile(int x, int z)
+    {
+        TileData data;
+        data.x = x;
+        data.z = z;
+        data.heights.resize(TERRAIN_TILE_RES * TERRAIN_TILE_RES);
+        glm::vec2 origin = tileOrigin(x, z);
+        float step = TERRAIN_TILE_SIZE / (TERRAIN_TILE_RES - 1);
+        for (int j = 0; j < TERRAIN_TILE_RES; j++)
+            for (int i = 0; i < TERRAIN_TILE_RES; i++)
+                data.heights[j * TERRAIN_TILE_RES + i] = source.Height(origin.x + i * step, origin.y + j * step);
+
+        data.nodeRange.resize(TERRAIN_LEVELS);
+        for (int level = 0; level < TERRAIN_LEVELS; level++)
+        {
+            int nodes = 1 << (TERRAIN_LEVELS - 1 - level);
+            int span = (TERRAIN_TILE_RES - 1) / nodes;
+            data.nodeRange[level].resize(nodes * nodes);
+            for (int nz = 0; nz < nodes; nz++)
+            {
+                for (int nx = 0; nx < nodes; nx++)
+                {
+                    glm::vec2 range(FLT_MAX, -FLT_MAX);
+                    for (int j = nz * span; j <= (nz + 1) * span; j++)
+                    {
+                        for (int i = nx * span; i <= (nx + 1) * span; i++)
+                        {
+                            float h = data.heights[j * TERRAIN_TILE_RES + i];
+                            range.x = glm::min(range.x, h);
+                            range.y = glm::max(range.y, h);
+                        }
+                    }
+                    data.nodeRange[level][nz * nodes + nx] = range;
+                }
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(readyMutex);
+        finished.push_back(data);
+    }
+
+    void upload(const TileData& data)
+    {
+        int key = data.z * tilesX + data.x;
+        requested.erase(key);
+        if (tiles.count(key))
+            return;
+        Tile tile;
+        tile.x = data.x;
+        tile.z = data.z;
+        tile.nodeRange = data.nodeRange;
+        glGenTextures(1, &tile.heightTex);
+        glBindTexture(GL_TEXTURE_2D, tile.heightTex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, TERRAIN_TILE_RES, TERRAIN_TILE_RES, 0, GL_RED, GL_FLOAT, &data.heights[0]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        tiles[key] = tile;
+    }
+
+    // a node is drawn at its own level once its closest point is past the range of the level below
+    void selectNode(Shader& shader, const Tile& tile, int level, int nx, int nz, const glm::vec3& cameraPos, const Frustum& frustum)
+    {
+        int nodes = 1 << (TERRAIN_LEVELS - 1 - level);
+        float size = TERRAIN_TILE_SIZE / nodes;
+        glm::vec2 origin = tileOrigin(tile.x, tile.z) + glm::vec2(nx, nz) * size;
+        glm::vec2 heights = tile.nodeRange[level][nz * nodes + nx];
+        AABB box;
+        box.min = glm::vec3(origin.x, heights.x, origin.y);
+        box.max = glm::vec3(origin.x + size, heights.y, origin.y + size);
+        if (!frustum.BoxVisible(box))
+        {
+            nodesCulled++;
+            return;
+        }
+
+        glm::vec3 nearest = glm::clamp(cameraPos, box.min, box.max);
+        if (level > 0 && glm::length(nearest - cameraPos) < ranges[level - 1])
+        {
+            for (int child = 0; child < 4; child++)
+                selectNode(shader, tile, level - 1, nx * 2 + (child & 1), nz * 2 + (child >> 1), cameraPos, frustum);
+            return;
+        }
+
+        // the coarsest level has nothing to morph into
+        glm::vec2 morph(FLT_MAX * 0.5f, FLT_MAX);
+        if (level < TERRAIN_LEVELS - 1)
+            morph = glm::vec2(ranges[level] * 0.7f, ranges[level]);
+        shader.setVec2("nodeOrigin", origin);
+        shader.setFloat("nodeSize", size);
+        shader.setVec2("morphRange", morph);
+        glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+        nodesDrawn++;
+    }
+
+    // (TERRAIN_GRID + 1)^2 grid shared by every node
+    void patchSetup()
+    {
+        std::vector<glm::vec2> grid;
+        std::vector<unsigned int> indices;
+        for (int z = 0; z <= TERRAIN_GRID; z++)
+            for (int x = 0; x <= TERRAIN_GRID; x++)
+                grid.push_back(glm::vec2(x, z));
+        for (int z = 0; z < TERRAIN_GRID; z++)
+        {
+            for (int x = 0; x < TERRAIN_GRID; x++)
+            {
+                unsigned int i = z * (TERRAIN_GRID + 1) + x;
+                unsigned int below = i + TERRAIN_GRID + 1;
+                // counter clockwise seen from above
+                indices.push_back(i); indices.push_back(below); indices.push_back(i + 1);
+                indices.push_back(i + 1); indices.push_back(below); indices.push_back(below + 1);
+            }
+        }
+        indexCount = static_cast<unsigned int>(indices.size());
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, grid.size() * sizeof(glm::vec2), &grid[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void*)0);
+        glBindVertexArray(0);
+    }
+};
+#endif
@@ -0,0 +1,252 @@
+// Packing mesh textures into texture arrays
+// Texture array reference https://www.khronos.org/opengl/wiki/Array_Texture
+// Run once after the models load. Every packed mesh's diffuse map becomes a layer of a GL_TEXTURE_2D_ARRAY shared
+// with the other textures of the same size, format and mip count, so drawing them only changes the layer uniform
+// and the draws can be batched with no texture binds in between. Images of a single colour, like most of
+// floorModel's materials, are shrunk to a 4x4 layer of one small array whatever their size. Each source image is
+// read and checked on the worker threads, then the arrays are made from the layers' small mips and handed to the
+// TextureStreamer, which streams them under its budget like any other texture. Cooked textures stay compressed.
+// The source textures stay in the TextureCache for the meshes that hold them, cut back to their small mips.
+
+#ifndef TEXTUREARRAYS_H
+#define TEXTUREARRAYS_H
+#include <glad/glad.h>
+#include "Model.h"
+#include "TextureStreamer.h"
+#include "ThreadPool.h"
+#include <vector>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+
+const int FLAT_LAYER_SIZE = 4; // a single colour still needs whole blocks and a few mips
+const int FLAT_LAYER_MIPS = 3;
+
+class TextureArrays
+{
+public:
+    TextureArrays(TextureStreamer& textureStreamer, ThreadPool& threads) : streamer(textureStreamer), pool(threads) {}
+
+    ~TextureArrays()
+    {
+        pool.Wait(); // descriptions still write into this
+        for (const Group& group : groups)
+        {
+            streamer.Forget(group.texture);
+            glDeleteTextures(1, &group.texture);
+        }
+    }
+
+    // meshes with exactly one texture, a diffuse map, are packed, anything else keeps binding its own. The meshes
+    // draw with their own textures until Update has built the arrays
+    void Pack(const std::vector<Model*>& models)
+    {
+        // the formats are checked here since that needs GL, the workers only read files
+        bool supported[3] = { DdsSupported(DDS_BC1), DdsSupported(DDS_BC3), DdsSupported(DDS_BC5) };
+        int residentSize = streamer.residentSize;
+        for (Model* model : models)
+            for (Mesh& mesh : model->meshes)
+                if (mesh.textures.size() == 1 && mesh.textures[0].type == "texture_diffuse")
+                {
+                    meshes.push_back(&mesh);
+                    sources.push_back(mesh.textures[0].id);
+                }
+
+        // every layer is in the map before the workers start filling it in
+        std::vector<std::pair<unsigned int, std::string>> reads;
+        for (unsigned int source : sources)
+        {
+            if (layers.count(source))
+                continue;
+            layers[source];
+            std::string path = streamer.Path(source);
+            if (path.empty())
+                described++; // not streamed, left as it is
+            else
+                reads.push_back(std::make_pair(source, path));
+        }
+        for (const std::pair<unsigned int, std::string>& read : reads)
+        {
+            unsigned int source = read.first;
+            std::string path = read.second;
+            pool.Submit([this, source, path, supported, residentSize]() {
+                Layer layer = describe(path, supported, residentSize);
+                std::lock_guard<std::mutex> lock(describedMutex);
+                layers[source] = std::move(layer);
+                described++;
+            });
+        }
+    }
+
+    // once a frame: builds the arrays when every source is described
+    void Update()
+    {
+        if (built || meshes.empty())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(describedMutex);
+            if (described < layers.size())
+                return;
+        }
+        built = true;
+
+        // one group per size, format and mip count, each source once
+        std::map<unsigned int, std::pair<int, int>> placed; // source texture to group and layer
+        std::map<std::tuple<int, int, GLenum, int>, int> byKey;
+        for (std::map<unsigned int, Layer>::iterator it = layers.begin(); it != layers.end(); ++it)
+        {
+            Layer& layer = it->second;
+            if (!layer.prepared.valid)
+                continue; // failed to load, left as it is
+            GLenum format = layer.flat || !layer.prepared.dds ? GL_RGBA8 : DdsGLFormat(layer.prepared.ddsFormat);
+            std::tuple<int, int, GLenum, int> key = layer.flat
+                ? std::make_tuple(FLAT_LAYER_SIZE, FLAT_LAYER_SIZE, format, FLAT_LAYER_MIPS)
+                : std::make_tuple(layer.prepared.width, layer.prepared.height, format, layer.prepared.mips);
+            if (!byKey.count(key))
+            {
+                byKey[key] = (int)groups.size();
+                groups.push_back(Group());
+            }
+            Group& group = groups[byKey[key]];
+            placed[it->first] = std::make_pair(byKey[key], (int)group.layers.size());
+            group.layers.push_back(&layer);
+        }
+
+        for (Group& group : groups)
+            build(group);
+        for (std::map<unsigned int, std::pair<int, int>>::const_iterator it = placed.begin(); it != placed.end(); ++it)
+            streamer.Evict(it->first);
+
+        packedMeshes = 0;
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            std::map<unsigned int, std::pair<int, int>>::const_iterator at = placed.find(sources[i]);
+            if (at == placed.end())
+                continue;
+            packedMeshes++;
+            meshes[i]->arrayTex = groups[at->second.first].texture;
+            meshes[i]->arrayLayer = at->second.second;
+        }
+        for (Group& group : groups)
+            group.layers.clear();
+        layers.clear(); // the small mips are the streamer's now
+        Report();
+    }
+
+    void Report()
+    {
+        std::cout << "Texture arrays: " << packedMeshes << " meshes share " << layerCount << " layers in " << groups.size() << " arrays, "
+            << arrayBytes / 1024 << " KB of small mips streamed from there" << std::endl;
+    }
+
+private:
+    struct Layer {
+        PreparedTexture prepared; // the source's size and small mips, as the streamer loaded them
+        bool flat = false;
+        unsigned char colour[4] = { 0, 0, 0, 0 };
+    };
+
+    struct Group {
+        unsigned int texture = 0;
+        std::vector<Layer*> layers;
+    };
+
+    TextureStreamer& streamer;
+    ThreadPool& pool;
+    std::vector<Mesh*> meshes;
+    std::vector<unsigned int> sources;  // each mesh's diffuse texture
+    std::map<unsigned int, Layer> layers;
+    std::mutex describedMutex;
+    size_t described = 0;
+    std::vector<Group> groups;
+    bool built = false;
+    unsigned int packedMeshes = 0, layerCount = 0;
+    size_t arrayBytes = 0;
+
+    // size, small mips and whether the whole image is one colour, the same way the streamer loads it. Runs on the
+    // workers
+    static Layer describe(const std::string& path, const bool supported[3], int residentSize)
+    {
+        std::ifstream file(path, std::ios::binary);
+        std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        Layer layer;
+        std::vector<unsigned char> top;
+        layer.prepared = TextureStreamer::Prepare(path, bytes, residentSize, true, &top);
+        if (layer.prepared.dds && !supported[layer.prepared.ddsFormat])
+            layer.prepared = TextureStreamer::Prepare(path, layer.prepared.bytes, residentSize, false);
+        layer.prepared.bytes.clear();
+        if (!layer.prepared.valid || top.empty())
+            return layer;
+        layer.flat = true;
+        for (size_t i = 4; i < top.size() && layer.flat; i += 4)
+            layer.flat = top[i] == top[0] && top[i + 1] == top[1] && top[i + 2] == top[2] && top[i + 3] == top[3];
+        for (int c = 0; c < 4; c++)
+            layer.colour[c] = top[c];
+        return layer;
+    }
+
+    // the array with every layer's small mips, the streamer brings in the rest
+    void build(Group& group)
+    {
+        const Layer& first = *group.layers[0];
+        PreparedTexture prepared;
+        std::vector<ArrayLayer> streamed;
+        if (first.flat)
+        {
+            prepared.width = prepared.height = FLAT_LAYER_SIZE;
+            prepared.mips = FLAT_LAYER_MIPS;
+            prepared.firstMip = 0;
+        }
+        else
+        {
+            prepared.dds = first.prepared.dds;
+            prepared.ddsFormat = first.prepared.ddsFormat;
+            prepared.width = first.prepared.width;
+            prepared.height = first.prepared.height;
+            prepared.mips = first.prepared.mips;
+            prepared.firstMip = first.prepared.firstMip;
+        }
+        prepared.path = first.prepared.path;
+        prepared.levels.resize(prepared.mips - prepared.firstMip);
+        for (const Layer* layer : group.layers)
+        {
+            ArrayLayer described;
+            described.path = layer->prepared.path;
+            described.flat = layer->flat;
+            for (int c = 0; c < 4; c++)
+                described.colour[c] = layer->colour[c];
+            streamed.push_back(described);
+            for (int mip = prepared.firstMip; mip < prepared.mips; mip++)
+            {
+                std::vector<unsigned char>& level = prepared.levels[mip - prepared.firstMip];
+                if (layer->flat)
+                {
+                    size_t texels = (size_t)glm::max(prepared.width >> mip, 1) * glm::max(prepared.height >> mip, 1);
+                    for (size_t t = 0; t < texels; t++)
+                        level.insert(level.end(), layer->colour, layer->colour + 4);
+                }
+                else
+                {
+                    const std::vector<unsigned char>& own = layer->prepared.levels[mip - layer->prepared.firstMip];
+                    level.insert(level.end(), own.begin(), own.end());
+                }
+            }
+        }
+        prepared.valid = true;
+        arrayBytes += prepared.LevelBytes();
+        layerCount += (unsigned int)group.layers.size();
+
+        glGenTextures(1, &group.texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, group.texture);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        streamer.RegisterArray(group.texture, prepared, streamed);
+    }
+};
+#endif
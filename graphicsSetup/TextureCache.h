@@ -0,0 +1,254 @@
+// Textures shared by every Model
+// Each image is decoded and uploaded once for the whole program. Lookups go by the canonical absolute path first
+// and then by a hash of the file's contents, so the same image under two names or copied into two folders is
+// still one GL texture. Every Acquire is matched by a Release and the texture is deleted with its last user.
+// With a TextureStreamer attached new textures only get their small mips, the streamer brings in the rest.
+
+#ifndef TEXTURECACHE_H
+#define TEXTURECACHE_H
+#include <glad/glad.h>
+#include "TextureStreamer.h" // stb_image and the DDS loader
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#ifdef _WIN32
+#include <cctype>
+#endif
+
+class TextureCache
+{
+public:
+    static TextureCache& Get()
+    {
+        static TextureCache cache;
+        return cache;
+    }
+
+    // textures loaded from now on are streamed, 0 loads them whole again
+    void Stream(TextureStreamer* textureStreamer)
+    {
+        streamer = textureStreamer;
+    }
+
+    // for anything that needs every texel, like the impostor bake
+    void MakeResident(unsigned int id)
+    {
+        if (streamer)
+            streamer->LoadNow(id);
+    }
+
+    // the texture for an image file, loaded if nothing holds it yet
+    unsigned int Acquire(const std::string& path)
+    {
+        requests++;
+        std::string key = canonical(path);
+        std::unordered_map<std::string, unsigned int>::iterator named = byPath.find(key);
+        if (named != byPath.end())
+        {
+            pathHits++;
+            entries[named->second].refs++;
+            return named->second;
+        }
+
+        std::ifstream file(path, std::ios::binary);
+        std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        return add(path, key, bytes, HashBytes(bytes), NULL);
+    }
+
+    // the same with the file already read and decoded, for loaders that do that on a worker thread
+    unsigned int Acquire(const std::string& path, const PreparedTexture& prepared)
+    {
+        requests++;
+        std::string key = canonical(path);
+        std::unordered_map<std::string, unsigned int>::iterator named = byPath.find(key);
+        if (named != byPath.end())
+        {
+            pathHits++;
+            entries[named->second].refs++;
+            return named->second;
+        }
+        return add(path, key, prepared.bytes, prepared.hash, &prepared);
+    }
+
+    void Release(unsigned int id)
+    {
+        std::unordered_map<unsigned int, Entry>::iterator it = entries.find(id);
+        if (it == entries.end() || --it->second.refs > 0)
+            return;
+        for (const std::string& key : it->second.paths)
+            byPath.erase(key);
+        if (it->second.hashed)
+            byContent.erase(it->second.content);
+        if (streamer)
+            streamer->Forget(id);
+        glDeleteTextures(1, &id);
+        entries.erase(it);
+    }
+
+    // deletes whatever is still held, for shutting down before the GL context goes
+    void Clear()
+    {
+        for (std::unordered_map<unsigned int, Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+        {
+            unsigned int id = it->first;
+            glDeleteTextures(1, &id);
+        }
+        entries.clear();
+        byPath.clear();
+        byContent.clear();
+        streamer = 0;
+    }
+
+    void Report()
+    {
+        std::cout << "Texture cache: " << entries.size() << " textures for " << requests << " requests, " << pathHits
+            << " found by path and " << contentHits << " by contents" << std::endl;
+    }
+
+private:
+    struct ContentKey {
+        uint64_t hash;
+        uint64_t size;
+        bool operator==(const ContentKey& other) const
+        {
+            return hash == other.hash && size == other.size;
+        }
+    };
+
+    struct ContentHash {
+        size_t operator()(const ContentKey& key) const
+        {
+            return (size_t)(key.hash ^ (key.size * 0x9E3779B97F4A7C15ull));
+        }
+    };
+
+    struct Entry {
+        unsigned int refs = 0;
+        ContentKey content;
+        bool hashed = false;
+        std::vector<std::string> paths; // every name it was asked for by
+    };
+
+    std::unordered_map<std::string, unsigned int> byPath;
+    std::unordered_map<ContentKey, unsigned int, ContentHash> byContent;
+    std::unordered_map<unsigned int, Entry> entries;
+    unsigned int requests = 0, pathHits = 0, contentHits = 0;
+    TextureStreamer* streamer = 0;
+
+    TextureCache() {}
+    TextureCache(const TextureCache&) = delete;
+    TextureCache& operator=(const TextureCache&) = delete;
+
+    // absolute with forward slashes, and lower case on Windows where names are not case sensitive
+    static std::string canonical(const std::string& path)
+    {
+        std::string result = path;
+#ifdef _WIN32
+        char full[_MAX_PATH];
+        if (_fullpath(full, path.c_str(), _MAX_PATH))
+            result = full;
+        for (char& c : result)
+            c = c == '\\' ? '/' : (char)std::tolower((unsigned char)c);
+#else
+        char* full = realpath(path.c_str(), NULL);
+        if (full)
+        {
+            result = full;
+            free(full);
+        }
+#endif
+        return result;
+    }
+
+    // first request under this name, shared with any texture of the same contents. Without a streamer a
+    // prepared image is still decoded whole here
+    unsigned int add(const std::string& path, const std::string& key, const std::vector<unsigned char>& bytes, uint64_t hash,
+        const PreparedTexture* prepared)
+    {
+        ContentKey content = { hash, (uint64_t)bytes.size() };
+        if (!bytes.empty())
+        {
+            std::unordered_map<ContentKey, unsigned int, ContentHash>::iterator same = byContent.find(content);
+            if (same != byContent.end())
+            {
+                contentHits++;
+                Entry& entry = entries[same->second];
+                entry.refs++;
+                entry.paths.push_back(key);
+                byPath[key] = same->second;
+                return same->second;
+            }
+        }
+
+        unsigned int id;
+        if (streamer)
+        {
+            glGenTextures(1, &id);
+            setParameters(id);
+            if (prepared)
+                streamer->Register(id, *prepared);
+            else
+                streamer->Register(id, path, bytes);
+        }
+        else
+            id = load(path, bytes);
+        Entry& entry = entries[id];
+        entry.refs = 1;
+        entry.content = content;
+        entry.hashed = !bytes.empty();
+        entry.paths.push_back(key);
+        byPath[key] = id;
+        if (entry.hashed)
+            byContent[content] = id;
+        return id;
+    }
+
+    // leaves the texture bound
+    static void setParameters(unsigned int id)
+    {
+        glBindTexture(GL_TEXTURE_2D, id);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+
+    // a copy from the texture cooker is uploaded as it is, mips included, otherwise the image is decoded here
+    static unsigned int load(const std::string& path, const std::vector<unsigned char>& bytes)
+    {
+        unsigned int textureID;
+        glGenTextures(1, &textureID);
+        setParameters(textureID);
+
+        DdsImage cooked;
+        if (ReadDds(DdsPath(path), cooked) && DdsSupported(cooked.format))
+        {
+            UploadDds(GL_TEXTURE_2D, cooked);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (int)cooked.levels.size() - 1);
+            return textureID;
+        }
+
+        int w, h, noComponents;
+        unsigned char* data = bytes.empty() ? NULL : stbi_load_from_memory(&bytes[0], (int)bytes.size(), &w, &h, &noComponents, 0);
+        if (data)
+        {
+            GLenum format = GL_RGB;
+            if (noComponents == 1)
+                format = GL_RED;
+            else if (noComponents == 4)
+                format = GL_RGBA;
+            glTexImage2D(GL_TEXTURE_2D, 0, format, w, h, 0, format, GL_UNSIGNED_BYTE, data);
+            glGenerateMipmap(GL_TEXTURE_2D);
+            stbi_image_free(data);
+        }
+        else
+            std::cout << "Texture failed to load :(. At path: " << path << std::endl;
+        return textureID;
+    }
+};
+#endif
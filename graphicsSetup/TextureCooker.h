@@ -0,0 +1,224 @@
+// Offline texture cooker, run with --cook
+// Block compression reference https://www.reedbeta.com/blog/understanding-bcn-texture-compression-formats/
+// Decodes an image once, builds its mip chain with a box filter and compresses every level into 4x4 blocks,
+// written next to the image as a .dds (see Dds.h) that the loaders upload as it is. Opaque images become BC1
+// at 4 bits a texel, images with alpha BC3 at 8, and normal maps BC5 which keeps x and y at 8 bits each.
+// Endpoints are fitted along the main axis of each block's colours, good enough for the scene's textures
+// and quick enough to cook everything in a few seconds.
+
+#ifndef TEXTURECOOKER_H
+#define TEXTURECOOKER_H
+#include "Dds.h"
+#include "Model.h" // stb_image
+#include <glm/glm.hpp>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+class TextureCooker
+{
+public:
+    // cooks one image, the format is picked from its contents unless it is named as a normal map
+    bool Cook(const std::string& path)
+    {
+        int w, h, channels;
+        unsigned char* data = stbi_load(path.c_str(), &w, &h, &channels, 4);
+        if (!data)
+        {
+            std::cout << "Cooker could not read " << path << std::endl;
+            return false;
+        }
+        std::vector<unsigned char> rgba(data, data + w * h * 4);
+        stbi_image_free(data);
+
+        DdsImage image;
+        image.width = w;
+        image.height = h;
+        image.format = pickFormat(path, rgba);
+        while (true)
+        {
+            image.levels.push_back(compress(rgba, w, h, image.format));
+            if (w == 1 && h == 1)
+                break;
+            rgba = DownsampleRGBA(rgba, w, h);
+            w = w > 1 ? w / 2 : 1;
+            h = h > 1 ? h / 2 : 1;
+        }
+
+        std::string out = DdsPath(path);
+        if (!WriteDds(out, image))
+        {
+            std::cout << "Cooker could not write " << out << std::endl;
+            return false;
+        }
+        size_t bytes = 0;
+        for (const std::vector<unsigned char>& level : image.levels)
+            bytes += level.size();
+        const char* names[] = { "BC1", "BC3", "BC5" };
+        std::cout << "Cooked " << path << " to " << names[image.format] << ", " << image.width << "x" << image.height << " with "
+            << image.levels.size() << " mips in " << bytes / 1024 << " KB" << std::endl;
+        return true;
+    }
+
+private:
+    DdsFormat pickFormat(const std::string& path, const std::vector<unsigned char>& rgba)
+    {
+        if (path.find("normal") != std::string::npos || path.find("Normal") != std::string::npos)
+            return DDS_BC5;
+        for (size_t i = 3; i < rgba.size(); i += 4)
+            if (rgba[i] < 255)
+                return DDS_BC3;
+        return DDS_BC1;
+    }
+
+    std::vector<unsigned char> compress(const std::vector<unsigned char>& rgba, int w, int h, DdsFormat format)
+    {
+        std::vector<unsigned char> out(DdsLevelBytes(format, w, h));
+        unsigned char* block = &out[0];
+        unsigned char texels[16][4];
+        for (int by = 0; by < h; by += 4)
+            for (int bx = 0; bx < w; bx += 4)
+            {
+                // blocks hanging over the edge repeat the last texel
+                for (int i = 0; i < 16; i++)
+                {
+                    int x = glm::min(bx + i % 4, w - 1), y = glm::min(by + i / 4, h - 1);
+                    for (int c = 0; c < 4; c++)
+                        texels[i][c] = rgba[(y * w + x) * 4 + c];
+                }
+                if (format == DDS_BC1)
+                    colourBlock(texels, block);
+                else if (format == DDS_BC3)
+                {
+                    channelBlock(texels, 3, block);
+                    colourBlock(texels, block + 8);
+                }
+                else
+                {
+                    channelBlock(texels, 0, block);
+                    channelBlock(texels, 1, block + 8);
+                }
+                block += DdsBlockBytes(format);
+            }
+        return out;
+    }
+
+    static unsigned short pack565(const glm::vec3& c)
+    {
+        glm::vec3 q = glm::clamp(c, 0.0f, 255.0f);
+        return (unsigned short)(((int)(q.r * 31.0f / 255.0f + 0.5f) << 11) | ((int)(q.g * 63.0f / 255.0f + 0.5f) << 5) | (int)(q.b * 31.0f / 255.0f + 0.5f));
+    }
+
+    static glm::vec3 unpack565(unsigned short c)
+    {
+        return glm::vec3((c >> 11) * 255.0f / 31.0f, ((c >> 5) & 63) * 255.0f / 63.0f, (c & 31) * 255.0f / 31.0f);
+    }
+
+    // BC1 colour block: two 565 endpoints, two colours between them and a 2 bit index per texel
+    void colourBlock(const unsigned char texels[16][4], unsigned char* out)
+    {
+        glm::vec3 colours[16];
+        glm::vec3 mean(0.0f);
+        for (int i = 0; i < 16; i++)
+        {
+            colours[i] = glm::vec3(texels[i][0], texels[i][1], texels[i][2]);
+            mean += colours[i] / 16.0f;
+        }
+        // main axis of the colours from a few power iterations on their covariance
+        glm::mat3 covariance(0.0f);
+        for (int i = 0; i < 16; i++)
+        {
+            glm::vec3 d = colours[i] - mean;
+            covariance += glm::outerProduct(d, d);
+        }
+        glm::vec3 axis(1.0f, 1.0f, 1.0f);
+        for (int k = 0; k < 8; k++)
+        {
+            axis = covariance * axis;
+            float len = glm::length(axis);
+            if (len < 1e-6f)
+                break;
+            axis /= len;
+        }
+        float lo = 1e9f, hi = -1e9f;
+        for (int i = 0; i < 16; i++)
+        {
+            float t = glm::dot(colours[i] - mean, axis);
+            lo = glm::min(lo, t);
+            hi = glm::max(hi, t);
+        }
+        unsigned short c0 = pack565(mean + axis * hi), c1 = pack565(mean + axis * lo);
+        // c0 above c1 selects the four colour mode, equal endpoints leave every index at 0
+        if (c0 < c1)
+            std::swap(c0, c1);
+        glm::vec3 palette[4];
+        palette[0] = unpack565(c0);
+        palette[1] = unpack565(c1);
+        palette[2] = (palette[0] * 2.0f + palette[1]) / 3.0f;
+        palette[3] = (palette[0] + palette[1] * 2.0f) / 3.0f;
+        unsigned int indices = 0;
+        if (c0 != c1)
+            for (int i = 0; i < 16; i++)
+            {
+                int best = 0;
+                float bestError = 1e9f;
+                for (int p = 0; p < 4; p++)
+                {
+                    glm::vec3 d = colours[i] - palette[p];
+                    float error = glm::dot(d, d);
+                    if (error < bestError)
+                    {
+                        bestError = error;
+                        best = p;
+                    }
+                }
+                indices |= (unsigned int)best << (i * 2);
+            }
+        out[0] = c0 & 0xFF;
+        out[1] = c0 >> 8;
+        out[2] = c1 & 0xFF;
+        out[3] = c1 >> 8;
+        for (int b = 0; b < 4; b++)
+            out[4 + b] = (indices >> (b * 8)) & 0xFF;
+    }
+
+    // BC3 alpha and BC5 channel block: two 8 bit endpoints, six values between them and a 3 bit index per texel
+    void channelBlock(const unsigned char texels[16][4], int channel, unsigned char* out)
+    {
+        int a0 = 0, a1 = 255;
+        for (int i = 0; i < 16; i++)
+        {
+            a0 = glm::max(a0, (int)texels[i][channel]);
+            a1 = glm::min(a1, (int)texels[i][channel]);
+        }
+        float palette[8];
+        palette[0] = (float)a0;
+        palette[1] = (float)a1;
+        for (int p = 1; p < 7; p++)
+            palette[p + 1] = ((7 - p) * a0 + p * a1) / 7.0f;
+        unsigned long long indices = 0;
+        if (a0 != a1)
+            for (int i = 0; i < 16; i++)
+            {
+                int best = 0;
+                float bestError = 1e9f;
+                for (int p = 0; p < 8; p++)
+                {
+                    float error = std::fabs(texels[i][channel] - palette[p]);
+                    if (error < bestError)
+                    {
+                        bestError = error;
+                        best = p;
+                    }
+                }
+                indices |= (unsigned long long)best << (i * 3);
+            }
+        out[0] = (unsigned char)a0;
+        out[1] = (unsigned char)a1;
+        for (int b = 0; b < 6; b++)
+            out[2 + b] = (indices >> (b * 8)) & 0xFF;
+    }
+};
+#endif
@@ -0,0 +1,573 @@
+// Texture streaming by mip level
+// Texture streaming reference https://www.gdcvault.com/play/1024418/Efficient-Texture-Streaming-in-Titanfall
+// Textures start with only their small mips on the gpu. Every frame the draws say how sharp each texture needs
+// to be from how big its mesh is on screen, finer mips are decoded on worker threads and uploaded a few a frame.
+// GL 3.3 has no sparse textures so a texture is re-specified with the new top level and its id never changes.
+// Past the budget the least recently used textures that are finer than they need are trimmed back to their small
+// mips, re-specified from a copy kept in memory so nothing is read back from the gpu, and any still being drawn
+// stream up to what they need again. Texture arrays are streamed the same way, every layer decoded and uploaded
+// together, so they count against the budget like any other texture. Textures a loader needs whole, like the
+// impostor bake, are made resident at once with LoadNow.
+
+#ifndef TEXTURESTREAMER_H
+#define TEXTURESTREAMER_H
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "stb_image.h"
+#include "Dds.h"
+#include "Mesh.h"
+#include "ThreadPool.h"
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+
+const int STREAM_RESIDENT_SIZE = 64; // TextureStreamer::residentSize unless changed, loaders decode this far ahead
+
+// half the size each way, averaging 2x2 texels, odd edges reuse their last row or column
+inline std::vector<unsigned char> DownsampleRGBA(const std::vector<unsigned char>& src, int w, int h)
+{
+    int nw = w > 1 ? w / 2 : 1, nh = h > 1 ? h / 2 : 1;
+    std::vector<unsigned char> dst(nw * nh * 4);
+    for (int y = 0; y < nh; y++)
+        for (int x = 0; x < nw; x++)
+        {
+            int x0 = glm::min(x * 2, w - 1), x1 = glm::min(x * 2 + 1, w - 1);
+            int y0 = glm::min(y * 2, h - 1), y1 = glm::min(y * 2 + 1, h - 1);
+            for (int c = 0; c < 4; c++)
+            {
+                int sum = src[(y0 * w + x0) * 4 + c] + src[(y0 * w + x1) * 4 + c] + src[(y1 * w + x0) * 4 + c] + src[(y1 * w + x1) * 4 + c];
+                dst[(y * nw + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+            }
+        }
+    return dst;
+}
+
+// FNV-1a, how the texture cache spots the same image under two names
+inline uint64_t HashBytes(const std::vector<unsigned char>& bytes)
+{
+    uint64_t h = 0xCBF29CE484222325ull;
+    for (unsigned char b : bytes)
+    {
+        h ^= b;
+        h *= 0x100000001B3ull;
+    }
+    return h;
+}
+
+// an image file read, hashed and decoded down to its small mips off the render thread, so Register only uploads
+struct PreparedTexture {
+    std::string path;
+    std::vector<unsigned char> bytes; // the file as read
+    uint64_t hash = 0;                // of bytes
+    bool valid = false;               // the size is known and the levels decoded
+    bool dds = false;                 // the levels are the cooked copy's
+    DdsFormat ddsFormat = DDS_BC1;
+    int width = 0, height = 0;        // of mip 0
+    int mips = 1;
+    int firstMip = 0;                 // levels hold this mip down to the end of the chain
+    std::vector<std::vector<unsigned char>> levels;
+
+    size_t LevelBytes() const
+    {
+        size_t total = 0;
+        for (const std::vector<unsigned char>& level : levels)
+            total += level.size();
+        return total;
+    }
+};
+
+// a layer of a streamed texture array, decoded from the image at path or filled with one colour
+struct ArrayLayer {
+    std::string path;
+    bool flat = false;
+    unsigned char colour[4] = { 0, 0, 0, 0 };
+};
+
+class TextureStreamer
+{
+public:
+    size_t budgetBytes = 64u << 20;  // for every streamed texture together
+    int residentSize = STREAM_RESIDENT_SIZE; // mips this size and smaller never leave
+    unsigned int uploadsPerFrame = 2;
+    unsigned int maxLoading = 4;     // jobs on the workers at once
+    unsigned int idleFrames = 120;   // frames without a draw before a texture counts as unused
+    float mipBias = 0.0f;            // above 0 asks for blurrier mips everywhere
+
+    TextureStreamer(ThreadPool& pool) : pool(pool) {}
+
+    ~TextureStreamer()
+    {
+        pool.Wait(); // jobs still hand their results to this streamer
+    }
+
+    // reads the image's size and decodes its mips of residentSize and smaller, any thread. The cooked copy is
+    // used when there is one and cooked is set, Register checks the gpu can take it since that needs GL. With top
+    // the image's mip 0 is handed back decoded to RGBA as well, even when the levels are the cooked copy's
+    static PreparedTexture Prepare(const std::string& path, std::vector<unsigned char> bytes, int residentSize = STREAM_RESIDENT_SIZE, bool cooked = true,
+        std::vector<unsigned char>* top = NULL)
+    {
+        PreparedTexture prepared;
+        prepared.path = path;
+        prepared.bytes = std::move(bytes);
+        prepared.hash = HashBytes(prepared.bytes);
+        Streamed tex;
+        tex.path = path;
+        DdsImage dds;
+        if (cooked && ReadDds(DdsPath(path), dds))
+        {
+            tex.dds = true;
+            tex.compressed = true;
+            tex.ddsFormat = dds.format;
+            tex.width = dds.width;
+            tex.height = dds.height;
+            tex.mips = (int)dds.levels.size();
+        }
+        else
+        {
+            int channels;
+            const std::vector<unsigned char>& file = prepared.bytes;
+            if (file.empty() || !stbi_info_from_memory(&file[0], (int)file.size(), &tex.width, &tex.height, &channels))
+                return prepared;
+            tex.mips = 1;
+            for (int size = glm::max(tex.width, tex.height); size > 1; size /= 2)
+                tex.mips++;
+        }
+        tex.tailMip = tex.mips - 1;
+        while (tex.tailMip > 0 && glm::max(tex.width >> (tex.tailMip - 1), tex.height >> (tex.tailMip - 1)) <= residentSize)
+            tex.tailMip--;
+
+        if (tex.dds)
+        {
+            prepared.levels.assign(dds.levels.begin() + tex.tailMip, dds.levels.end());
+            if (top)
+                decodeTop(prepared.bytes, *top);
+        }
+        else
+            prepared.levels = decode(tex, tex.tailMip, &prepared.bytes, top);
+        prepared.valid = (int)prepared.levels.size() == tex.mips - tex.tailMip;
+        prepared.dds = tex.dds;
+        prepared.ddsFormat = tex.ddsFormat;
+        prepared.width = tex.width;
+        prepared.height = tex.height;
+        prepared.mips = tex.mips;
+        prepared.firstMip = tex.tailMip;
+        return prepared;
+    }
+
+    // takes over a new texture object, uploading only the small mips of the image at path
+    void Register(unsigned int id, const std::string& path, const std::vector<unsigned char>& bytes)
+    {
+        Register(id, Prepare(path, bytes, residentSize));
+    }
+
+    // the same with the image prepared ahead, the prepared mips stay resident
+    void Register(unsigned int id, const PreparedTexture& prepared)
+    {
+        if (prepared.dds && !DdsSupported(prepared.ddsFormat))
+        {
+            Register(id, Prepare(prepared.path, prepared.bytes, residentSize, false));
+            return;
+        }
+        if (!prepared.valid)
+        {
+            std::cout << "Texture failed to load :(. At path: " << prepared.path << std::endl;
+            return;
+        }
+        add(id, prepared, std::vector<ArrayLayer>());
+    }
+
+    // takes over a GL_TEXTURE_2D_ARRAY. prepared describes one layer, its levels hold every layer's small mips one
+    // after the other, and its format has to be one the gpu takes
+    void RegisterArray(unsigned int id, const PreparedTexture& prepared, const std::vector<ArrayLayer>& layers)
+    {
+        add(id, prepared, layers);
+    }
+
+    // back to its small mips now, for a texture nothing draws any more. It streams up again if it is asked for
+    void Evict(unsigned int id)
+    {
+        std::unordered_map<unsigned int, Streamed>::iterator it = textures.find(id);
+        if (it == textures.end())
+            return;
+        Streamed& tex = it->second;
+        tex.wanted = (float)tex.tailMip;
+        tex.generation++;
+        if (tex.resident < tex.tailMip)
+            respecify(id, tex, tex.tailMip, tails[id]);
+    }
+
+    // the image a texture streams from, empty for one the streamer does not hold
+    std::string Path(unsigned int id) const
+    {
+        std::unordered_map<unsigned int, Streamed>::const_iterator it = textures.find(id);
+        return it != textures.end() ? it->second.path : std::string();
+    }
+
+    // drops a texture the cache deleted, a job still loading it is ignored when it finishes
+    void Forget(unsigned int id)
+    {
+        std::unordered_map<unsigned int, Streamed>::iterator it = textures.find(id);
+        if (it == textures.end())
+            return;
+        residentBytes -= bytes(it->second, it->second.resident);
+        textures.erase(it);
+        tails.erase(id);
+    }
+
+    // every mip on the gpu now, for anything reading the texels back
+    void LoadNow(unsigned int id)
+    {
+        std::unordered_map<unsigned int, Streamed>::iterator it = textures.find(id);
+        if (it == textures.end() || it->second.resident == 0)
+            return;
+        Streamed& tex = it->second;
+        tex.lastUsed = frame;
+        tex.wanted = 0.0f;
+        std::vector<std::vector<unsigned char>> levels = decode(tex, 0, NULL);
+        tex.generation++; // anything already loading is now stale
+        respecify(id, tex, 0, levels);
+    }
+
+    // asks for mip level mip or finer this frame
+    void Request(unsigned int id, float mip)
+    {
+        std::unordered_map<unsigned int, Streamed>::iterator it = textures.find(id);
+        if (it == textures.end())
+            return;
+        it->second.wanted = it->second.lastUsed == frame ? glm::min(it->second.wanted, mip) : mip;
+        it->second.lastUsed = frame;
+    }
+
+    // mip for a surface with uvPerUnit of texture across each world unit, seen from distance away.
+    // pixelScale is the screen pixels a world unit covers at distance 1, projection[1][1] * height / 2
+    void RequestDensity(unsigned int id, float uvPerUnit, float distance, float pixelScale)
+    {
+        std::unordered_map<unsigned int, Streamed>::iterator it = textures.find(id);
+        if (it == textures.end())
+            return;
+        float texelsPerUnit = uvPerUnit * glm::max(it->second.width, it->second.height);
+        float pixelsPerUnit = pixelScale / glm::max(distance, 0.1f);
+        Request(id, glm::max(std::log2(glm::max(texelsPerUnit / pixelsPerUnit, 1e-6f)) + mipBias, 0.0f));
+    }
+
+    // the textures of a mesh drawn with model, from the size of its bounds and its uv range
+    void RequestMesh(const Mesh& mesh, const glm::mat4& model, const glm::vec3& cameraPos, float pixelScale)
+    {
+        if (mesh.textures.empty())
+            return;
+        AABB world = TransformAABB(model, mesh.bounds);
+        float size = glm::length(world.max - world.min);
+        float distance = glm::length(world.Center() - cameraPos) - size * 0.5f;
+        float uvPerUnit = mesh.uvExtent / glm::max(size, 1e-4f);
+        // a packed mesh's only texture is its layer, the array streams for every mesh in it
+        if (mesh.arrayTex)
+        {
+            RequestDensity(mesh.arrayTex, uvPerUnit, distance, pixelScale);
+            return;
+        }
+        for (unsigned int i = 0; i < mesh.textures.size(); i++)
+            RequestDensity(mesh.textures[i].id, uvPerUnit, distance, pixelScale);
+    }
+
+    // once a frame: uploads finished loads, trims to the budget and starts new loads
+    void Update()
+    {
+        std::vector<Loaded> ready;
+        {
+            std::lock_guard<std::mutex> lock(readyMutex);
+            while (!finished.empty() && ready.size() < uploadsPerFrame)
+            {
+                ready.push_back(std::move(finished.back()));
+                finished.pop_back();
+            }
+        }
+        for (Loaded& loaded : ready)
+        {
+            loading--;
+            std::unordered_map<unsigned int, Streamed>::iterator it = textures.find(loaded.id);
+            if (it == textures.end())
+                continue;
+            if (it->second.loadingGeneration == loaded.generation)
+                it->second.loading = false;
+            if (it->second.generation == loaded.generation && loaded.firstMip < it->second.resident)
+                respecify(loaded.id, it->second, loaded.firstMip, loaded.levels);
+        }
+
+        // what every texture needs now, unused ones fall back to their small mips
+        requestedBytes = 0;
+        std::vector<unsigned int> wantsMore;
+        for (std::unordered_map<unsigned int, Streamed>::iterator it = textures.begin(); it != textures.end(); ++it)
+        {
+            Streamed& tex = it->second;
+            tex.target = frame - tex.lastUsed > idleFrames ? tex.tailMip : glm::clamp((int)std::floor(tex.wanted), 0, tex.tailMip);
+            requestedBytes += bytes(tex, tex.target);
+            if (tex.target < tex.resident && !tex.loading)
+                wantsMore.push_back(it->first);
+        }
+
+        if (residentBytes > budgetBytes)
+            trim(budgetBytes);
+
+        // the most blurred first
+        std::sort(wantsMore.begin(), wantsMore.end(), [this](unsigned int a, unsigned int b)
+            { return textures[a].resident - textures[a].target > textures[b].resident - textures[b].target; });
+        for (unsigned int id : wantsMore)
+        {
+            if (loading >= maxLoading)
+                break;
+            Streamed& tex = textures[id];
+            // never more than the budget allows, even if that means stopping short of the wanted mip
+            int mip = tex.target;
+            size_t extra = bytes(tex, mip) - bytes(tex, tex.resident);
+            if (residentBytes + extra > budgetBytes)
+                trim(budgetBytes - glm::min(extra, budgetBytes));
+            while (mip < tex.resident && residentBytes + bytes(tex, mip) - bytes(tex, tex.resident) > budgetBytes)
+                mip++;
+            if (mip >= tex.resident)
+                continue;
+            load(id, tex, mip);
+        }
+        frame++;
+    }
+
+    void Report(float time)
+    {
+        if (time - lastReport < 2.0f)
+            return;
+        lastReport = time;
+        unsigned int streaming = 0, full = 0, arrays = 0;
+        for (std::unordered_map<unsigned int, Streamed>::const_iterator it = textures.begin(); it != textures.end(); ++it)
+        {
+            if (it->second.loading)
+                streaming++;
+            if (it->second.resident == 0)
+                full++;
+            if (!it->second.layers.empty())
+                arrays++;
+        }
+        std::cout << "Texture streaming: " << residentBytes / 1024 << " KB resident, " << requestedBytes / 1024 << " KB requested, budget "
+            << budgetBytes / 1024 << " KB, " << textures.size() << " textures (" << arrays << " arrays, " << full << " at full size, "
+            << streaming << " loading)" << std::endl;
+    }
+
+private:
+    struct Streamed {
+        std::string path;
+        bool dds = false;
+        bool compressed = false;
+        GLenum format = GL_RGBA8;
+        DdsFormat ddsFormat = DDS_BC1;
+        int width = 0, height = 0;  // of mip 0
+        int mips = 1;               // in the whole chain
+        int tailMip = 0;            // always resident from here down
+        int resident = 0;           // finest mip on the gpu
+        int target = 0;             // finest mip needed this frame
+        float wanted = 0.0f;        // finest mip asked for by the draws
+        unsigned int lastUsed = 0;
+        unsigned int generation = 0; // bumped whenever a running load would be stale
+        unsigned int loadingGeneration = 0; // of the load on the workers
+        bool loading = false;
+        std::vector<ArrayLayer> layers; // of a GL_TEXTURE_2D_ARRAY, empty for a GL_TEXTURE_2D
+    };
+
+    struct Loaded {
+        unsigned int id;
+        unsigned int generation;
+        int firstMip;
+        std::vector<std::vector<unsigned char>> levels;
+    };
+
+    ThreadPool& pool;
+    std::unordered_map<unsigned int, Streamed> textures;
+    std::unordered_map<unsigned int, std::vector<std::vector<unsigned char>>> tails; // the always resident mips, what trim goes back to
+    std::mutex readyMutex;
+    std::vector<Loaded> finished;
+    unsigned int loading = 0;
+    unsigned int frame = 0;
+    size_t residentBytes = 0, requestedBytes = 0;
+    float lastReport = 0.0f;
+
+    // starts streaming a texture from its prepared small mips
+    void add(unsigned int id, const PreparedTexture& prepared, const std::vector<ArrayLayer>& layers)
+    {
+        Streamed tex;
+        tex.path = prepared.path;
+        tex.dds = prepared.dds;
+        tex.compressed = prepared.dds;
+        if (prepared.dds)
+            tex.format = DdsGLFormat(prepared.ddsFormat);
+        tex.ddsFormat = prepared.ddsFormat;
+        tex.width = prepared.width;
+        tex.height = prepared.height;
+        tex.mips = prepared.mips;
+        tex.tailMip = prepared.firstMip;
+        tex.resident = tex.mips;
+        tex.wanted = (float)tex.tailMip;
+        tex.layers = layers;
+        textures[id] = tex;
+        respecify(id, textures[id], tex.tailMip, prepared.levels);
+        tails[id] = prepared.levels;
+    }
+
+    // every layer together
+    static size_t bytes(const Streamed& tex, int firstMip)
+    {
+        size_t total = 0;
+        for (int mip = firstMip; mip < tex.mips; mip++)
+        {
+            int w = glm::max(tex.width >> mip, 1), h = glm::max(tex.height >> mip, 1);
+            total += tex.compressed ? DdsLevelBytes(tex.ddsFormat, w, h) : (size_t)w * h * 4;
+        }
+        return total * glm::max(tex.layers.size(), (size_t)1);
+    }
+
+    // the whole image as RGBA, false if it does not decode
+    static bool decodeTop(const std::vector<unsigned char>& bytes, std::vector<unsigned char>& rgba)
+    {
+        int w, h, channels;
+        unsigned char* data = bytes.empty() ? NULL : stbi_load_from_memory(&bytes[0], (int)bytes.size(), &w, &h, &channels, 4);
+        if (!data)
+            return false;
+        rgba.assign(data, data + w * h * 4);
+        stbi_image_free(data);
+        return true;
+    }
+
+    // the levels from firstMip down, read from the cooked file or decoded and filtered, with top given mip 0 of
+    // a decoded image. An array's levels hold its layers one after the other. Runs on the workers
+    static std::vector<std::vector<unsigned char>> decode(const Streamed& tex, int firstMip, const std::vector<unsigned char>* bytes,
+        std::vector<unsigned char>* top = NULL)
+    {
+        std::vector<std::vector<unsigned char>> levels;
+        if (!tex.layers.empty())
+        {
+            levels.resize(tex.mips - firstMip);
+            Streamed single = tex;
+            single.layers.clear();
+            for (const ArrayLayer& layer : tex.layers)
+            {
+                std::vector<std::vector<unsigned char>> own;
+                if (layer.flat)
+                    for (int mip = firstMip; mip < tex.mips; mip++)
+                    {
+                        own.push_back(std::vector<unsigned char>((size_t)glm::max(tex.width >> mip, 1) * glm::max(tex.height >> mip, 1) * 4));
+                        for (size_t t = 0; t < own.back().size(); t++)
+                            own.back()[t] = layer.colour[t % 4];
+                    }
+                else
+                {
+                    single.path = layer.path;
+                    own = decode(single, firstMip, NULL);
+                }
+                if (own.size() != levels.size())
+                    return std::vector<std::vector<unsigned char>>();
+                for (size_t level = 0; level < own.size(); level++)
+                    levels[level].insert(levels[level].end(), own[level].begin(), own[level].end());
+            }
+            return levels;
+        }
+        if (tex.dds)
+        {
+            DdsImage cooked;
+            if (ReadDds(DdsPath(tex.path), cooked) && (int)cooked.levels.size() == tex.mips)
+                levels.assign(cooked.levels.begin() + firstMip, cooked.levels.end());
+            return levels;
+        }
+        int w, h, channels;
+        unsigned char* data = bytes && !bytes->empty()
+            ? stbi_load_from_memory(&(*bytes)[0], (int)bytes->size(), &w, &h, &channels, 4)
+            : stbi_load(tex.path.c_str(), &w, &h, &channels, 4);
+        if (!data)
+            return levels;
+        std::vector<unsigned char> rgba(data, data + w * h * 4);
+        stbi_image_free(data);
+        if (top)
+            *top = rgba;
+        for (int mip = 0; mip < tex.mips; mip++)
+        {
+            if (mip >= firstMip)
+                levels.push_back(rgba);
+            if (mip + 1 < tex.mips)
+            {
+                rgba = DownsampleRGBA(rgba, w, h);
+                w = w > 1 ? w / 2 : 1;
+                h = h > 1 ? h / 2 : 1;
+            }
+        }
+        return levels;
+    }
+
+    void load(unsigned int id, Streamed& tex, int firstMip)
+    {
+        tex.loading = true;
+        tex.loadingGeneration = tex.generation;
+        loading++;
+        Streamed copy = tex;
+        pool.Submit([this, id, copy, firstMip]() {
+            Loaded loaded;
+            loaded.id = id;
+            loaded.generation = copy.generation;
+            loaded.firstMip = firstMip;
+            loaded.levels = decode(copy, firstMip, NULL);
+            std::lock_guard<std::mutex> lock(readyMutex);
+            finished.push_back(std::move(loaded));
+        });
+    }
+
+    // the texture becomes mips firstMip to the end of the chain, level 0 being mip firstMip
+    void respecify(unsigned int id, Streamed& tex, int firstMip, const std::vector<std::vector<unsigned char>>& levels)
+    {
+        if ((int)levels.size() != tex.mips - firstMip)
+            return;
+        GLenum target = tex.layers.empty() ? GL_TEXTURE_2D : GL_TEXTURE_2D_ARRAY;
+        GLsizei depth = (GLsizei)tex.layers.size();
+        glBindTexture(target, id);
+        for (int level = 0; level < (int)levels.size(); level++)
+        {
+            int mip = firstMip + level;
+            int w = glm::max(tex.width >> mip, 1), h = glm::max(tex.height >> mip, 1);
+            GLsizei size = (GLsizei)levels[level].size();
+            if (target == GL_TEXTURE_2D_ARRAY && tex.compressed)
+                glCompressedTexImage3D(target, level, tex.format, w, h, depth, 0, size, &levels[level][0]);
+            else if (target == GL_TEXTURE_2D_ARRAY)
+                glTexImage3D(target, level, GL_RGBA8, w, h, depth, 0, GL_RGBA, GL_UNSIGNED_BYTE, &levels[level][0]);
+            else if (tex.compressed)
+                glCompressedTexImage2D(target, level, tex.format, w, h, 0, size, &levels[level][0]);
+            else
+                glTexImage2D(target, level, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, &levels[level][0]);
+        }
+        glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, (int)levels.size() - 1);
+        glBindTexture(target, 0);
+        if (tex.resident < tex.mips)
+            residentBytes -= bytes(tex, tex.resident);
+        tex.resident = firstMip;
+        residentBytes += bytes(tex, firstMip);
+    }
+
+    // least recently used first, textures finer than they need are cut back to their small mips until under limit
+    void trim(size_t limit)
+    {
+        std::vector<unsigned int> order;
+        for (std::unordered_map<unsigned int, Streamed>::iterator it = textures.begin(); it != textures.end(); ++it)
+            if (it->second.resident < it->second.target)
+                order.push_back(it->first);
+        std::sort(order.begin(), order.end(), [this](unsigned int a, unsigned int b) { return textures[a].lastUsed < textures[b].lastUsed; });
+        for (unsigned int id : order)
+        {
+            if (residentBytes <= limit)
+                break;
+            Streamed& tex = textures[id];
+            // reading the coarser levels back from the gpu would stall on it, the tail is kept for this. A texture
+            // that needs more than its tail is loaded up to its target again on the workers next frame
+            tex.generation++;
+            respecify(id, tex, tex.tailMip, tails[id]);
+        }
+    }
+};
+#endif
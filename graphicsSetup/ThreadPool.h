@@ -0,0 +1,346 @@
+// Work stealing job system
+// Work stealing reference https://www.dre.vanderbilt.edu/~schmidt/PDF/work-stealing-dequeue.pdf (Chase and Lev)
+// Job system reference https://blog.molecular-matters.com/2015/08/24/job-system-2-0-lock-free-work-stealing-part-1-basics/
+// Every worker owns a deque. Jobs a worker submits go on the back of its own deque and it takes its newest job
+// first, so nested work stays depth first and cache warm; a worker that runs dry steals the oldest job from the
+// front of someone else's. Jobs from outside the pool are dealt round robin. The deques are locked rather than
+// lock free, the lock is almost never contended. Waiting threads run jobs instead of blocking, and a JobGroup can
+// be given a continuation that is submitted when its last job finishes, so no fibers are needed. Jobs from Submit
+// are background work like asset loads; the render thread only picks those up in Wait, never while it helps a
+// JobGroup, so a ParallelFor on it cannot end up holding the frame for a texture decode.
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <iostream>
+
+class ThreadPool
+{
+public:
+    // 0 threads uses every core but the one running the render loop
+    ThreadPool(unsigned int threads = 0)
+    {
+        if (threads == 0)
+        {
+            unsigned int cores = std::thread::hardware_concurrency();
+            threads = cores > 1 ? cores - 1 : 1;
+        }
+        for (unsigned int i = 0; i < threads; i++)
+            queues.push_back(std::unique_ptr<Queue>(new Queue()));
+        for (unsigned int i = 0; i < threads; i++)
+            workers.push_back(std::thread([this, i] { workerLoop(i); }));
+    }
+
+    ~ThreadPool()
+    {
+        Wait();
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (unsigned int i = 0; i < workers.size(); i++)
+            workers[i].join();
+    }
+
+    unsigned int Size() const
+    {
+        return static_cast<unsigned int>(workers.size());
+    }
+
+    void Submit(std::function<void()> job)
+    {
+        push(std::move(job), true);
+    }
+
+    // runs jobs until every submitted job has finished, then sleeps if the last ones are still running elsewhere.
+    // Not for use inside a job, that job would be waiting on itself
+    void Wait()
+    {
+        while (busy > 0 && runOne(true))
+        {
+        }
+        std::unique_lock<std::mutex> lock(doneMutex);
+        done.wait(lock, [this] { return busy == 0; });
+    }
+
+    // runs one queued job on the calling thread, false if there was none to take. Outside the pool only jobs of a
+    // JobGroup are taken
+    bool RunOne()
+    {
+        return runOne(currentWorker() >= 0);
+    }
+
+    // runs fn(0) .. fn(count - 1) spread over the workers in ranges of at least grain, the calling thread helps out
+    template <typename Fn>
+    void ParallelFor(unsigned int count, Fn fn, unsigned int grain = 1);
+
+    // jobs workers have taken from each other's deques
+    unsigned int Steals() const
+    {
+        return steals;
+    }
+
+    void Report(float time)
+    {
+        if (time - lastReport < 2.0f)
+            return;
+        lastReport = time;
+        unsigned int ran = jobsRun.exchange(0), stolen = steals.load();
+        std::cout << "Jobs: " << Size() << " workers ran " << ran << " jobs, " << stolen - stealsReported << " stolen" << std::endl;
+        stealsReported = stolen;
+    }
+
+private:
+    struct Job {
+        std::function<void()> run;
+        bool background;
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::atomic<unsigned int> queued{ 0 };    // jobs sitting in a deque
+    std::atomic<unsigned int> busy{ 0 };      // jobs submitted and not finished, what Wait waits on
+    std::atomic<unsigned int> nextQueue{ 0 }; // round robin for jobs from outside the pool
+    std::atomic<unsigned int> jobsRun{ 0 }, steals{ 0 };
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::mutex doneMutex;
+    std::condition_variable done;
+    bool stopping = false;
+    float lastReport = 0.0f;
+    unsigned int stealsReported = 0;
+
+    // which worker of this pool the calling thread is, -1 for any other thread
+    int currentWorker() const
+    {
+        return current().pool == this ? current().index : -1;
+    }
+
+    struct WorkerSlot {
+        const ThreadPool* pool;
+        int index;
+    };
+
+    static WorkerSlot& current()
+    {
+        static thread_local WorkerSlot slot = { 0, -1 };
+        return slot;
+    }
+
+    friend class JobGroup;
+
+    void push(std::function<void()> job, bool background)
+    {
+        busy++;
+        int self = currentWorker();
+        unsigned int target = self >= 0 ? (unsigned int)self : nextQueue++ % (unsigned int)queues.size();
+        {
+            // counted before it is in the deque, so queued is never below the real number of jobs
+            std::lock_guard<std::mutex> lock(queues[target]->mutex);
+            queued++;
+            Job queuedJob = { std::move(job), background };
+            queues[target]->jobs.push_back(std::move(queuedJob));
+        }
+        // taking the lock orders this against a worker checking queued before it sleeps, so the wake is not lost
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        wake.notify_one();
+    }
+
+    bool runOne(bool background)
+    {
+        std::function<void()> job;
+        if (!take(currentWorker(), background, job))
+            return false;
+        run(job);
+        return true;
+    }
+
+    // newest job of our own deque, otherwise the oldest of the first other deque that has one
+    bool take(int self, bool background, std::function<void()>& job)
+    {
+        if (queued == 0)
+            return false;
+        if (self >= 0)
+        {
+            Queue& own = *queues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.jobs.empty())
+            {
+                job = std::move(own.jobs.back().run);
+                own.jobs.pop_back();
+                queued--;
+                return true;
+            }
+        }
+        unsigned int count = (unsigned int)queues.size();
+        unsigned int start = victim(count);
+        for (unsigned int i = 0; i < count; i++)
+        {
+            unsigned int v = (start + i) % count;
+            if ((int)v == self)
+                continue;
+            Queue& other = *queues[v];
+            std::lock_guard<std::mutex> lock(other.mutex);
+            for (std::deque<Job>::iterator it = other.jobs.begin(); it != other.jobs.end(); ++it)
+            {
+                if (it->background && !background)
+                    continue;
+                job = std::move(it->run);
+                other.jobs.erase(it);
+                queued--;
+                if (self >= 0)
+                    steals++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // a different starting victim per attempt so thieves spread out, xorshift per thread
+    static unsigned int victim(unsigned int count)
+    {
+        static thread_local unsigned int state = (unsigned int)std::hash<std::thread::id>()(std::this_thread::get_id()) | 1u;
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state % count;
+    }
+
+    void run(std::function<void()>& job)
+    {
+        job();
+        jobsRun++;
+        if (--busy == 0)
+        {
+            std::lock_guard<std::mutex> lock(doneMutex);
+            done.notify_all();
+        }
+    }
+
+    void workerLoop(unsigned int index)
+    {
+        current().pool = this;
+        current().index = (int)index;
+        while (true)
+        {
+            std::function<void()> job;
+            if (take((int)index, true, job))
+            {
+                run(job);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [this] { return stopping || queued > 0; });
+            if (stopping && queued == 0)
+                return;
+        }
+    }
+};
+
+// jobs that are waited on together. Wait runs queued jobs while it waits so it is safe inside a job as well,
+// and Then gives a continuation that runs once every job so far is done, without blocking anything meanwhile
+class JobGroup
+{
+public:
+    JobGroup(ThreadPool& pool) : pool(pool) {}
+
+    ~JobGroup()
+    {
+        Wait(); // the jobs hold a pointer to this group
+    }
+
+    JobGroup(const JobGroup&) = delete;
+    JobGroup& operator=(const JobGroup&) = delete;
+
+    void Run(std::function<void()> job)
+    {
+        pending++;
+        submit(std::move(job));
+    }
+
+    // submitted when the last job still pending finishes, straight away when none are
+    void Then(std::function<void()> continuation)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (pending > 0)
+            {
+                next = std::move(continuation);
+                return;
+            }
+            pending++;
+        }
+        submit(std::move(continuation));
+    }
+
+    // the continuation counts as part of the group, Wait returns after it too
+    void Wait()
+    {
+        while (pending > 0)
+        {
+            if (!pool.RunOne())
+                std::this_thread::yield();
+        }
+        std::lock_guard<std::mutex> lock(mutex); // the last job may still be unlocking it
+    }
+
+private:
+    ThreadPool& pool;
+    std::atomic<unsigned int> pending{ 0 };
+    std::function<void()> next;
+    std::mutex mutex;
+
+    void submit(std::function<void()> job)
+    {
+        pool.push([this, job]() {
+            job();
+            std::function<void()> continuation;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (pending == 1 && next)
+                    continuation.swap(next); // takes the finished job's place so pending never touches 0
+                else
+                    pending--;
+            }
+            if (continuation)
+                submit(std::move(continuation));
+        }, false);
+    }
+};
+
+// the range is halved until it is down to grain, the far halves becoming jobs other workers can steal
+template <typename Fn>
+void ThreadPool::ParallelFor(unsigned int count, Fn fn, unsigned int grain)
+{
+    if (grain == 0)
+        grain = 1;
+    JobGroup group(*this);
+    std::function<void(unsigned int, unsigned int)> split = [&](unsigned int begin, unsigned int end) {
+        while (end - begin > grain)
+        {
+            unsigned int mid = begin + (end - begin) / 2;
+            group.Run([&split, mid, end]() { split(mid, end); });
+            end = mid;
+        }
+        for (unsigned int i = begin; i < end; i++)
+            fn(i);
+    };
+    split(0, count);
+    group.Wait();
+}
+#endif
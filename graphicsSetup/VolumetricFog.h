@@ -0,0 +1,184 @@
+// Volumetric fog in a froxel grid
+// Froxel fog reference https://bartwronski.files.wordpress.com/2014/08/bwronski_volumetric_fog_siggraph2014.pdf
+// The view frustum is cut into a low resolution grid of cells, exponentially spaced in depth. froxelInject.fs
+// fills each cell with the fog's density and the light every light scatters towards the camera through it,
+// froxelIntegrate.fs then sums the cells front to back so each one holds the fog between it and the camera,
+// carrying the running sum from slice to slice in a pair of 2D textures so each cell is only read once.
+// There is no compute in GL 3.3 so both are fullscreen passes drawn once per slice of a 3D texture. Applying
+// the fog is a single 3D texture fetch per pixel in tonemap.fs, the cost of the lights is paid per cell.
+
+#ifndef VOLUMETRICFOG_H
+#define VOLUMETRICFOG_H
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "shader.h"
+#include "LightBuffer.h"
+#include "GpuTimer.h"
+#include <iostream>
+
+class VolumetricFog
+{
+public:
+    float density = 0.08f;        // extinction per unit at baseHeight
+    float baseHeight = 0.0f;      // below here the fog is at full density
+    float heightFalloff = 0.15f;  // how fast it thins out above baseHeight
+    float anisotropy = 0.4f;      // forward scattering, lights glow more when looking towards them
+    glm::vec3 ambientFog = glm::vec3(0.15f);
+    float nearDepth = 0.5f;       // view depth of the first slice boundary
+    float farDepth = 40.0f;       // and of the last, anything further is fogged as if it were here
+
+    VolumetricFog(int width = 64, int height = 36, int slices = 64)
+        : injectShader("hiz.vs", "froxelInject.fs"), integrateShader("hiz.vs", "froxelIntegrate.fs"),
+        gridW(width), gridH(height), gridD(slices)
+    {
+        glGenFramebuffers(1, &FBO);
+        glGenVertexArrays(1, &emptyVAO);
+        injectTex = volumeSetup();
+        integratedTex = volumeSetup();
+        for (int i = 0; i < 2; i++)
+            runningTex[i] = runningSetup();
+    }
+
+    ~VolumetricFog()
+    {
+        glDeleteFramebuffers(1, &FBO);
+        glDeleteVertexArrays(1, &emptyVAO);
+        glDeleteTextures(1, &injectTex);
+        glDeleteTextures(1, &integratedTex);
+        glDeleteTextures(2, runningTex);
+    }
+
+    // reads the same lighting uniforms as manyLights.fs, set them on this too
+    Shader& InjectShader()
+    {
+        return injectShader;
+    }
+
+    // the integrated fog, in-scattered light in rgb and transmittance in alpha
+    unsigned int Texture() const
+    {
+        return integratedTex;
+    }
+
+    glm::vec2 Range() const
+    {
+        return glm::vec2(nearDepth, farDepth);
+    }
+
+    // fills and integrates the grid then binds sceneFramebuffer again with the given viewport
+    void Update(const glm::mat4& view, const glm::mat4& projection, LightBuffer& lights, unsigned int sceneFramebuffer,
+        int viewportWidth, int viewportHeight)
+    {
+        timer.Begin();
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glViewport(0, 0, gridW, gridH);
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_BLEND);
+        glBindVertexArray(emptyVAO);
+        glm::vec3 grid((float)gridW, (float)gridH, (float)gridD);
+        glm::vec2 projScale(projection[0][0], projection[1][1]);
+
+        injectShader.use();
+        injectShader.setVec3("gridSize", grid);
+        injectShader.setVec2("depthRange", Range());
+        injectShader.setVec2("projScale", projScale);
+        injectShader.setMat4("invView", glm::inverse(view));
+        injectShader.setFloat("density", density);
+        injectShader.setFloat("baseHeight", baseHeight);
+        injectShader.setFloat("heightFalloff", heightFalloff);
+        injectShader.setFloat("anisotropy", anisotropy);
+        injectShader.setVec3("ambientFog", ambientFog);
+        injectShader.setInt("extraLights", 6);
+        injectShader.setInt("extraLightCount", (int)lights.Count());
+        lights.Bind(6);
+        for (int slice = 0; slice < gridD; slice++)
+        {
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, injectTex, 0, slice);
+            injectShader.setFloat("slice", (float)slice);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+
+        integrateShader.use();
+        integrateShader.setInt("injected", 0);
+        integrateShader.setInt("previous", 1);
+        integrateShader.setVec3("gridSize", grid);
+        integrateShader.setVec2("depthRange", Range());
+        integrateShader.setVec2("projScale", projScale);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_3D, injectTex);
+        GLenum both[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, both);
+        for (int slice = 0; slice < gridD; slice++)
+        {
+            // the running sum ping-pongs, read from one 2D texture and written to the other
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, integratedTex, 0, slice);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, runningTex[slice & 1], 0);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, runningTex[(slice + 1) & 1]);
+            integrateShader.setFloat("slice", (float)slice);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, 0, 0);
+        glDrawBuffer(GL_COLOR_ATTACHMENT0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_3D, 0);
+
+        glBindVertexArray(0);
+        glEnable(GL_DEPTH_TEST);
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+        glViewport(0, 0, viewportWidth, viewportHeight);
+        timer.End();
+    }
+
+    void Report(float time)
+    {
+        if (time - lastReport < 2.0f)
+            return;
+        lastReport = time;
+        std::cout << "Volumetric fog: " << gridW << "x" << gridH << "x" << gridD << " froxels, "
+            << timer.smoothMs << " ms to inject and integrate" << std::endl;
+    }
+
+private:
+    Shader injectShader;
+    Shader integrateShader;
+    GpuTimer timer;
+    unsigned int FBO = 0, emptyVAO = 0;
+    unsigned int injectTex = 0, integratedTex = 0;
+    unsigned int runningTex[2] = { 0, 0 };
+    int gridW, gridH, gridD;
+    float lastReport = 0.0f;
+
+    // linear filtering so the coarse grid blends smoothly between cells
+    unsigned int volumeSetup()
+    {
+        unsigned int tex;
+        glGenTextures(1, &tex);
+        glBindTexture(GL_TEXTURE_3D, tex);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, gridW, gridH, gridD, 0, GL_RGBA, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_3D, 0);
+        return tex;
+    }
+
+    // one slice of the running sum, 32 bit so the transmittance does not drift over the slices
+    unsigned int runningSetup()
+    {
+        unsigned int tex;
+        glGenTextures(1, &tex);
+        glBindTexture(GL_TEXTURE_2D, tex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, gridW, gridH, 0, GL_RGBA, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return tex;
+    }
+};
+#endif
@@ -0,0 +1,223 @@
+//Deferred light pass, one fullscreen triangle shading every pixel once
+//Tiled shading reference https://www.cse.chalmers.se/~uffe/tiled_shading_preprint.pdf
+//The same Blinn-Phong lights as manyLights.fs and shad.fs, read from the G-buffer instead of the vertex shader.
+//Extra point lights are binned into screen tiles on the cpu, a pixel only loops over the lights of its tile.
+#version 330 core
+out vec4 fragColour;
+
+struct TexturedMaterial {
+    float shininess;
+};
+
+struct FlatMaterial {
+    vec4 ambient;
+    vec4 diffuse;
+    vec4 specular; // w is the shininess
+};
+
+struct DirectLight {
+    vec3 direction;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct PointLight {
+    vec3 pos;
+    float cons;
+    float linear;
+    float quadratic;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct SpotLight {
+    vec3 pos;
+    vec3 direction;
+    float cutOff;
+    float outerCutOff;
+    float cons;
+    float linear;
+    float quadratic;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct Light {
+    vec3 pos;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+#define NO_LIGHTS 4
+#define MAX_MATERIALS 64
+
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+uniform sampler2D sceneDepth;
+uniform samplerBuffer extraLights;  // see LightBuffer.h
+uniform usamplerBuffer tileLights;  // light indices of every tile back to back
+uniform usampler2D tileRanges;      // first index and count per tile
+uniform int tileSize;
+uniform vec2 screenSize;
+uniform mat4 invViewProj;
+
+// textured surfaces, lit like manyLights.fs
+uniform vec3 viewPos;
+uniform DirectLight directLight;
+uniform PointLight pointLights[NO_LIGHTS];
+uniform SpotLight spotLight;
+uniform TexturedMaterial material;
+
+// material id n above 0 is row n of the material table, lit by the single light of shad.fs
+layout (std140) uniform MaterialTable { // see MaterialTable.h
+    FlatMaterial materials[MAX_MATERIALS];
+};
+uniform Light light;
+
+vec3 OctDecode(vec2 e);
+vec3 DirectLightCalc(DirectLight light, vec3 albedo, vec3 norm, vec3 viewDir);
+vec3 PointLightCalc(PointLight light, vec3 albedo, vec3 norm, vec3 fragPos, vec3 viewDir);
+vec3 SpotLightCalc(SpotLight light, vec3 albedo, vec3 norm, vec3 fragPos, vec3 viewDir);
+vec3 FlatCalc(FlatMaterial mat, vec3 norm, vec3 fragPos, vec3 viewDir);
+PointLight FetchLight(int index);
+
+void main()
+{
+    vec2 uv = gl_FragCoord.xy / screenSize;
+    float depth = texture(sceneDepth, uv).r;
+    // the sky is drawn later
+    if (depth == 1.0)
+        discard;
+
+    vec4 world = invViewProj * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    vec3 fragPos = world.xyz / world.w;
+    vec4 packedNormal = texture(gNormal, uv);
+    vec3 norm = OctDecode(packedNormal.xy);
+    int materialId = int(packedNormal.z * 1023.0 + 0.5);
+    vec3 viewDir = normalize(viewPos - fragPos);
+
+    vec3 result;
+    if (materialId > 0)
+        result = FlatCalc(materials[min(materialId, MAX_MATERIALS - 1)], norm, fragPos, viewDir);
+    else
+    {
+        vec3 albedo = texture(gAlbedo, uv).rgb;
+        result = DirectLightCalc(directLight, albedo, norm, viewDir);
+        for (int i = 0; i < NO_LIGHTS; i++)
+            result += PointLightCalc(pointLights[i], albedo, norm, fragPos, viewDir);
+        // only the extra lights whose range touches this tile
+        uvec2 range = texelFetch(tileRanges, ivec2(gl_FragCoord.xy) / tileSize, 0).xy;
+        for (uint i = 0u; i < range.y; i++)
+        {
+            int index = int(texelFetch(tileLights, int(range.x + i)).r);
+            vec3 lightPos = texelFetch(extraLights, index * 4).xyz;
+            float radius = texelFetch(extraLights, index * 4 + 3).w;
+            if (distance(lightPos, fragPos) < radius)
+                result += PointLightCalc(FetchLight(index), albedo, norm, fragPos, viewDir);
+        }
+        result += SpotLightCalc(spotLight, albedo, norm, fragPos, viewDir);
+    }
+
+    // fog is applied when the HDR scene is tone mapped, see tonemap.fs
+    fragColour = vec4(result, 1.0);
+}
+
+vec3 OctDecode(vec2 e)
+{
+    e = e * 2.0 - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+vec3 DirectLightCalc(DirectLight light, vec3 albedo, vec3 norm, vec3 viewDir)
+{
+    vec3 lightDir = normalize(-light.direction);
+    float diff = max(dot(norm, lightDir), 0.0);
+    //blinn phong
+    vec3 halfwayDirection = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(norm, halfwayDirection), 0.0), material.shininess);
+
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * albedo;
+    return (ambient + diffuse + specular);
+}
+
+vec3 SpotLightCalc(SpotLight light, vec3 albedo, vec3 norm, vec3 fragPos, vec3 viewDir)
+{
+    vec3 lightDir = normalize(light.pos - fragPos);
+    float diff = max(dot(norm, lightDir), 0.0);
+    //blinn phong
+    vec3 halfwayDirection = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(norm, halfwayDirection), 0.0), material.shininess);
+
+    // attenuation
+    float distance = length(light.pos - fragPos);
+    float attenuation = 1.0 / (light.cons + light.linear * distance + light.quadratic * (distance * distance));
+    // spotlight intensity
+    float theta = dot(lightDir, normalize(-light.direction));
+    float epsilon = light.cutOff - light.outerCutOff;
+    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * albedo;
+    return (ambient + diffuse + specular) * attenuation * intensity;
+}
+
+vec3 PointLightCalc(PointLight light, vec3 albedo, vec3 norm, vec3 fragPos, vec3 viewDir)
+{
+    vec3 lightDir = normalize(light.pos - fragPos);
+    float diff = max(dot(norm, lightDir), 0.0);
+    //blinn phong
+    vec3 halfwayDirection = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(norm, halfwayDirection), 0.0), material.shininess);
+
+    // attenuation
+    float distance = length(light.pos - fragPos);
+    float attenuation = 1.0 / (light.cons + light.linear * distance + light.quadratic * (distance * distance));
+
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * albedo;
+    return (ambient + diffuse + specular) * attenuation;
+}
+
+// shad.fs
+vec3 FlatCalc(FlatMaterial mat, vec3 norm, vec3 fragPos, vec3 viewDir)
+{
+    vec3 ambient = light.ambient * mat.ambient.rgb;
+    vec3 lightDir = normalize(light.pos - fragPos);
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec3 diffuse = light.diffuse * (diff * mat.diffuse.rgb);
+    //blinn phong
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(norm, halfwayDir), 0.0), mat.specular.w);
+    vec3 specular = light.specular * (spec * mat.specular.rgb);
+    return ambient + diffuse + specular;
+}
+
+// extra point light from the buffer, four texels a light
+PointLight FetchLight(int index)
+{
+    vec4 a = texelFetch(extraLights, index * 4);
+    vec4 b = texelFetch(extraLights, index * 4 + 1);
+    vec4 c = texelFetch(extraLights, index * 4 + 2);
+    vec4 d = texelFetch(extraLights, index * 4 + 3);
+    PointLight light;
+    light.pos = a.xyz;
+    light.cons = a.w;
+    light.ambient = b.xyz;
+    light.linear = b.w;
+    light.diffuse = c.xyz;
+    light.quadratic = c.w;
+    light.specular = d.xyz;
+    return light;
+}
@@ -0,0 +1,6 @@
+//Depth pre-pass, colour writes are masked off so nothing is output
+#version 330 core
+
+void main()
+{
+}
@@ -0,0 +1,27 @@
+//Depth pre-pass, positions only
+//written the same way as the lit vertex shaders so the shading pass can test with GL_EQUAL
+#version 330 core
+layout (location = 0) in vec3 vPos;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+struct DrawData {
+    mat4 model;
+    mat4 normalMatrix;
+    ivec4 material; // x is the row of the MaterialTable block
+};
+#define MAX_DRAW_BATCH 16
+layout (std140) uniform DrawBlock { // per draw data the DrawList writes into its dynamic buffer, one per instance
+    DrawData draws[MAX_DRAW_BATCH];
+};
+uniform bool fromDrawBlock; // model and material from draws[gl_InstanceID] instead of the uniforms
+
+invariant gl_Position;
+
+void main()
+{
+    mat4 m = fromDrawBlock ? draws[gl_InstanceID].model : model;
+    vec3 fragPos = vec3(m * vec4(vPos, 1.0));
+    gl_Position = projection * view * vec4(fragPos, 1.0);
+}
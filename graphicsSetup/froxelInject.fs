@@ -0,0 +1,110 @@
+//Volumetric fog, light injection into one slice of the froxel grid
+//Froxel fog reference https://bartwronski.files.wordpress.com/2014/08/bwronski_volumetric_fog_siggraph2014.pdf
+//Every texel is a cell of the view frustum. It gets the fog density there and the light all the lights scatter
+//towards the camera through it, using the same light uniforms as manyLights.fs
+#version 330 core
+out vec4 fragColour; // in-scattered light and extinction
+
+struct DirectLight {
+    vec3 direction;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct PointLight {
+    vec3 pos;
+    float cons;
+    float linear;
+    float quadratic;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct SpotLight {
+    vec3 pos;
+    vec3 direction;
+    float cutOff;
+    float outerCutOff;
+    float cons;
+    float linear;
+    float quadratic;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+#define NO_LIGHTS 4
+uniform DirectLight directLight;
+uniform PointLight pointLights[NO_LIGHTS];
+uniform SpotLight spotLight;
+uniform samplerBuffer extraLights; // see LightBuffer.h
+uniform int extraLightCount;
+uniform vec3 viewPos;
+
+uniform vec3 gridSize;     // froxels along x, y and z
+uniform float slice;       // the slice being filled
+uniform vec2 depthRange;   // view depth of the first and last slice boundary, slices are spaced exponentially
+uniform vec2 projScale;    // projection[0][0] and [1][1]
+uniform mat4 invView;
+uniform float density;     // extinction at the base height
+uniform float baseHeight;
+uniform float heightFalloff;
+uniform float anisotropy;  // Henyey-Greenstein g, above 0 scatters forwards
+uniform vec3 ambientFog;   // light the fog has with no lights at all
+
+// Henyey-Greenstein phase function, cosTheta between the light's direction of travel and the way to the camera
+float Phase(float cosTheta)
+{
+    float g = anisotropy;
+    return (1.0 - g * g) / (4.0 * 3.14159265 * pow(1.0 + g * g - 2.0 * g * cosTheta, 1.5));
+}
+
+float Attenuation(float cons, float linear, float quadratic, float distance)
+{
+    return 1.0 / (cons + linear * distance + quadratic * (distance * distance));
+}
+
+void main()
+{
+    // centre of the froxel in world space
+    vec2 uv = gl_FragCoord.xy / gridSize.xy;
+    float viewZ = depthRange.x * pow(depthRange.y / depthRange.x, (slice + 0.5) / gridSize.z);
+    vec2 ndc = uv * 2.0 - 1.0;
+    vec3 pos = vec3(invView * vec4(ndc.x / projScale.x * viewZ, ndc.y / projScale.y * viewZ, -viewZ, 1.0));
+    vec3 toCamera = normalize(viewPos - pos);
+
+    float sigma = density * exp(-heightFalloff * max(pos.y - baseHeight, 0.0));
+
+    vec3 light = ambientFog;
+    light += directLight.diffuse * Phase(dot(normalize(directLight.direction), toCamera));
+    for (int i = 0; i < NO_LIGHTS; i++)
+    {
+        float d = length(pos - pointLights[i].pos);
+        float att = Attenuation(pointLights[i].cons, pointLights[i].linear, pointLights[i].quadratic, d);
+        light += pointLights[i].diffuse * att * Phase(dot((pos - pointLights[i].pos) / max(d, 1e-4), toCamera));
+    }
+    for (int i = 0; i < extraLightCount; i++)
+    {
+        vec4 a = texelFetch(extraLights, i * 4);
+        vec4 b = texelFetch(extraLights, i * 4 + 1);
+        vec4 c = texelFetch(extraLights, i * 4 + 2);
+        float radius = texelFetch(extraLights, i * 4 + 3).w;
+        float d = length(pos - a.xyz);
+        if (d < radius)
+            light += c.rgb * Attenuation(a.w, b.w, c.w, d) * Phase(dot((pos - a.xyz) / max(d, 1e-4), toCamera));
+    }
+    // the camera's torch, a visible cone in the fog
+    {
+        vec3 lightDir = normalize(spotLight.pos - pos);
+        float theta = dot(lightDir, normalize(-spotLight.direction));
+        float intensity = clamp((theta - spotLight.outerCutOff) / (spotLight.cutOff - spotLight.outerCutOff), 0.0, 1.0);
+        float d = length(spotLight.pos - pos);
+        float att = Attenuation(spotLight.cons, spotLight.linear, spotLight.quadratic, d);
+        light += spotLight.diffuse * att * intensity * Phase(dot(-lightDir, toCamera));
+    }
+
+    // all of the extinction is scattering, the fog is white
+    fragColour = vec4(light * sigma, sigma);
+}
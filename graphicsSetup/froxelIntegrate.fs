@@ -0,0 +1,45 @@
+//Volumetric fog, front to back integration of the froxel grid
+//Energy conserving integration reference https://www.ea.com/frostbite/news/physically-based-unified-volumetric-rendering-in-frostbite
+//Drawn once per slice from the camera out. Each texel adds its own froxel to the running sum the previous slice left
+//in a 2D texture, so every froxel is read once. The result goes to this slice of the 3D texture and to the other 2D
+//texture for the next slice. The scene then needs one fetch.
+#version 330 core
+layout (location = 0) out vec4 fragColour; // in-scattered light and transmittance up to the far side of this slice
+layout (location = 1) out vec4 running;    // the same, carried to the next slice
+
+uniform sampler3D injected;
+uniform sampler2D previous; // what the slice in front wrote to running
+uniform vec3 gridSize;
+uniform float slice;
+uniform vec2 depthRange;
+uniform vec2 projScale;
+
+float SliceDepth(float s)
+{
+    return depthRange.x * pow(depthRange.y / depthRange.x, s / gridSize.z);
+}
+
+void main()
+{
+    vec2 uv = gl_FragCoord.xy / gridSize.xy;
+    vec2 ndc = uv * 2.0 - 1.0;
+    // view depth to distance along the ray through this column
+    float rayScale = length(vec3(ndc.x / projScale.x, ndc.y / projScale.y, 1.0));
+
+    // the first slice starts at the camera, fog in front of depthRange.x is folded into it
+    vec4 front = vec4(0.0, 0.0, 0.0, 1.0);
+    float near = 0.0;
+    if (slice > 0.5)
+    {
+        front = texelFetch(previous, ivec2(gl_FragCoord.xy), 0);
+        near = SliceDepth(slice);
+    }
+    vec4 froxel = texture(injected, vec3(uv, (slice + 0.5) / gridSize.z));
+    float stepLength = (SliceDepth(slice + 1.0) - near) * rayScale;
+    float sigma = max(froxel.a, 1e-6);
+    float stepTransmittance = exp(-sigma * stepLength);
+    // light scattered inside the step, dimmed by the fog in front of it
+    vec3 scattered = front.rgb + front.a * (froxel.rgb - froxel.rgb * stepTransmittance) / sigma;
+    fragColour = vec4(scattered, front.a * stepTransmittance);
+    running = fragColour;
+}
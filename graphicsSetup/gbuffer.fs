@@ -0,0 +1,59 @@
+//G-buffer fill for the deferred renderer
+//Octahedral normal encoding reference https://knarkowicz.wordpress.com/2014/04/16/octahedron-normal-vector-encoding/
+//Writes the albedo and an oct encoded normal with the material id, the position comes back from the depth buffer.
+//Runs after manyLights.vs and terrain.vs in place of manyLights.fs
+#version 330 core
+layout (location = 0) out vec4 gAlbedo;
+layout (location = 1) out vec4 gNormal;
+
+struct Material {
+    sampler2D diffuse;
+    sampler2D specular;
+    float shininess;
+};
+
+in vec3 fragPos;
+in vec3 normal;
+in vec2 texCoord;
+flat in float fade;
+flat in int flatMaterial; // 0 lights with the textures like manyLights.fs, above that a row of the material table
+
+uniform Material material;
+uniform bool diffuseFromArray; // see manyLights.fs
+uniform sampler2DArray diffuseArray;
+uniform float diffuseLayer;
+
+vec2 OctEncode(vec3 n);
+float Bayer(vec2 pixel);
+
+void main()
+{
+    // same dithered crossfade with the impostors as manyLights.fs
+    if (fade < 1.0 && Bayer(gl_FragCoord.xy) >= fade)
+        discard;
+
+    // the scene binds one texture for both maps so only the diffuse one is stored
+    vec3 albedo = diffuseFromArray ? texture(diffuseArray, vec3(texCoord, diffuseLayer)).rgb : texture(material.diffuse, texCoord).rgb;
+    gAlbedo = vec4(albedo, 1.0);
+    gNormal = vec4(OctEncode(normalize(normal)), float(flatMaterial) / 1023.0, 1.0);
+}
+
+// unit vector onto the octahedron and its lower half folded over the upper, in [0, 1]
+vec2 OctEncode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.xy;
+    if (n.z < 0.0)
+        e = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return e * 0.5 + 0.5;
+}
+
+// 4x4 ordered dither threshold in (0, 1)
+float Bayer(vec2 pixel)
+{
+    int x = int(mod(pixel.x, 4.0));
+    int y = int(mod(pixel.y, 4.0));
+    int index = x + y * 4;
+    int pattern[16] = int[16](0, 8, 2, 10, 12, 4, 14, 6, 3, 11, 1, 9, 15, 7, 13, 5);
+    return (float(pattern[index]) + 0.5) / 16.0;
+}
@@ -0,0 +1,34 @@
+//Hi-Z pyramid downsample, every texel keeps the farthest depth of the texels below it
+#version 330 core
+uniform sampler2D depthTex; // base level is set to the previous level
+uniform vec2 prevSize;
+
+void main()
+{
+    ivec2 size = ivec2(prevSize);
+    ivec2 coord = ivec2(gl_FragCoord.xy) * 2;
+    ivec2 last = size - 1;
+
+    float d = texelFetch(depthTex, min(coord, last), 0).r;
+    d = max(d, texelFetch(depthTex, min(coord + ivec2(1, 0), last), 0).r);
+    d = max(d, texelFetch(depthTex, min(coord + ivec2(0, 1), last), 0).r);
+    d = max(d, texelFetch(depthTex, min(coord + ivec2(1, 1), last), 0).r);
+
+    // odd sized levels, the last row and column also cover the leftover texels
+    bool extraX = (size.x & 1) != 0 && coord.x + 2 == last.x;
+    bool extraY = (size.y & 1) != 0 && coord.y + 2 == last.y;
+    if (extraX)
+    {
+        d = max(d, texelFetch(depthTex, ivec2(last.x, coord.y), 0).r);
+        d = max(d, texelFetch(depthTex, ivec2(last.x, min(coord.y + 1, last.y)), 0).r);
+    }
+    if (extraY)
+    {
+        d = max(d, texelFetch(depthTex, ivec2(coord.x, last.y), 0).r);
+        d = max(d, texelFetch(depthTex, ivec2(min(coord.x + 1, last.x), last.y), 0).r);
+    }
+    if (extraX && extraY)
+        d = max(d, texelFetch(depthTex, last, 0).r);
+
+    gl_FragDepth = d;
+}
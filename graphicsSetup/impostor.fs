@@ -0,0 +1,42 @@
+//Impostor shading with the directional light, fogged later in tonemap.fs like everything else
+#version 330 core
+out vec4 fragColour;
+
+in vec2 atlasCoord;
+flat in float yaw;
+flat in float fade;
+
+uniform sampler2D albedoAtlas;
+uniform sampler2D normalAtlas;
+uniform vec3 lightDirection;
+uniform vec3 lightAmbient;
+uniform vec3 lightDiffuse;
+
+float Bayer(vec2 pixel);
+
+void main()
+{
+    vec4 albedo = texture(albedoAtlas, atlasCoord);
+    if (albedo.a < 0.5)
+        discard;
+    // keeps the pixels the mesh drops while the two crossfade
+    if (fade < 1.0 && 1.0 - Bayer(gl_FragCoord.xy) > fade)
+        discard;
+
+    vec3 n = texture(normalAtlas, atlasCoord).xyz * 2.0 - 1.0;
+    float c = cos(yaw), s = sin(yaw);
+    n = normalize(vec3(c * n.x + s * n.z, n.y, -s * n.x + c * n.z));
+    float diff = max(dot(n, normalize(-lightDirection)), 0.0);
+    vec3 result = albedo.rgb * (lightAmbient + lightDiffuse * diff);
+    fragColour = vec4(result, 1.0);
+}
+
+// 4x4 ordered dither threshold in (0, 1), same pattern as manyLights.fs
+float Bayer(vec2 pixel)
+{
+    int x = int(mod(pixel.x, 4.0));
+    int y = int(mod(pixel.y, 4.0));
+    int index = x + y * 4;
+    int pattern[16] = int[16](0, 8, 2, 10, 12, 4, 14, 6, 3, 11, 1, 9, 15, 7, 13, 5);
+    return (float(pattern[index]) + 0.5) / 16.0;
+}
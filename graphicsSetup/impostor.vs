@@ -0,0 +1,49 @@
+//Octahedral impostor billboards
+//Impostor reference https://shaderbits.com/blog/octahedral-impostors
+#version 330 core
+layout (location = 0) in vec2 vCorner;   // quad corner in [-1, 1]
+layout (location = 1) in vec4 vPosScale; // instance base position and height
+layout (location = 2) in vec2 vYawFade;  // instance rotation and crossfade
+
+out vec2 atlasCoord;
+out vec3 fragPos;
+flat out float yaw;
+flat out float fade;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec3 viewPos;
+uniform float radius;       // bounding sphere of the tree at unit height
+uniform float centreHeight; // height of the sphere centre at unit height
+uniform int frames;         // views per side of the atlas
+
+// upper hemisphere to [-1, 1] square, must match the decode used when baking
+vec2 HemiOctEncode(vec3 d)
+{
+    d /= abs(d.x) + abs(d.y) + abs(d.z);
+    return vec2(d.x + d.z, d.x - d.z);
+}
+
+void main()
+{
+    float scale = vPosScale.w;
+    yaw = vYawFade.x;
+    fade = vYawFade.y;
+    vec3 centre = vPosScale.xyz + vec3(0.0, centreHeight * scale, 0.0);
+    vec3 toCam = normalize(viewPos - centre);
+
+    // pick the baked view closest to the camera direction in the tree's own space
+    float c = cos(-yaw), s = sin(-yaw);
+    vec3 local = vec3(c * toCam.x + s * toCam.z, max(toCam.y, 0.0), -s * toCam.x + c * toCam.z);
+    vec2 grid = (HemiOctEncode(normalize(local + vec3(0.0, 1e-4, 0.0))) * 0.5 + 0.5) * float(frames - 1);
+    vec2 cell = floor(grid + 0.5);
+    atlasCoord = (cell + vCorner * 0.5 + 0.5) / float(frames);
+
+    // camera facing quad with the same basis lookAt used for the bake
+    vec3 f = -toCam;
+    vec3 up = abs(f.y) > 0.999 ? vec3(0.0, 0.0, -1.0) : vec3(0.0, 1.0, 0.0);
+    vec3 right = normalize(cross(f, up));
+    up = cross(right, f);
+    fragPos = centre + (vCorner.x * right + vCorner.y * up) * radius * scale;
+    gl_Position = projection * view * vec4(fragPos, 1.0);
+}
@@ -0,0 +1,15 @@
+//Bakes one view of a tree into the impostor atlas, colour in the first target and the normal in the second
+#version 330 core
+layout (location = 0) out vec4 albedo;
+layout (location = 1) out vec4 normalOut;
+
+in vec3 normal;
+in vec2 texCoord;
+
+uniform sampler2D texture_diffuse1;
+
+void main()
+{
+    albedo = vec4(texture(texture_diffuse1, texCoord).rgb, 1.0);
+    normalOut = vec4(normalize(normal) * 0.5 + 0.5, 1.0);
+}
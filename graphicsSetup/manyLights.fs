@@ -45,20 +45,33 @@ struct SpotLight {
 in vec3 fragPos;
 in vec3 normal;
 in vec2 texCoord;
+flat in float fade;
 
 uniform vec3 viewPos;
 uniform DirectLight directLight;
 uniform PointLight pointLights[NO_LIGHTS];
 uniform SpotLight spotLight;
 uniform Material material;
-uniform bool fog;
+uniform samplerBuffer extraLights; // any number of point lights beyond the four above, see LightBuffer.h
+uniform int extraLightCount;
+uniform bool diffuseFromArray;    // the mesh's texture was packed into a layer of a texture array, see TextureArrays.h
+uniform sampler2DArray diffuseArray;
+uniform float diffuseLayer;
 
 vec3 DirectLightCalc(DirectLight light, vec3 norm, vec3 viewDir);
 vec3 PointLightCalc(PointLight light, vec3 norm, vec3 fragPos, vec3 viewDir);
 vec3 SpotLightCalc(SpotLight light, vec3 norm, vec3 fragPos, vec3 viewDir);
+vec3 Albedo();
+vec3 SpecularMap();
+float Bayer(vec2 pixel);
+PointLight FetchLight(int index);
 
 void main()
 {    
+    // dithered crossfade with the impostors, the impostor keeps exactly the pixels dropped here
+    if (fade < 1.0 && Bayer(gl_FragCoord.xy) >= fade)
+        discard;
+
     vec3 norm = normalize(normal);
     vec3 viewDir = normalize(viewPos -fragPos);
     
@@ -67,28 +80,19 @@ void main()
     // point lights
     for(int i = 0; i < NO_LIGHTS; i++)
         result += PointLightCalc(pointLights[i], norm,fragPos, viewDir);    
+    // every extra light is looked at by every fragment, the ones out of range are skipped
+    for (int i = 0; i < extraLightCount; i++)
+    {
+        vec3 lightPos = texelFetch(extraLights, i * 4).xyz;
+        float radius = texelFetch(extraLights, i * 4 + 3).w;
+        if (distance(lightPos, fragPos) < radius)
+            result += PointLightCalc(FetchLight(i), norm, fragPos, viewDir);
+    }
     //spot light
     result += SpotLightCalc(spotLight, norm,fragPos, viewDir);   
     
-    if(fog)
-    {
-    fragColour = vec4(result, 1.0);
-    float fogMax = 10.0;
-    float fogDensity = 0.30 ;
-    vec4  fogColor = vec4(0.5f, 0.5f, 0.5f, 1.0f);
-
-    // fog -----------------------------------------------------------------------------------------------------------------------------------
-    //distance from pixel to camera
-    float dist = length(fragPos.xyz - viewPos.xyz);
-    //exponential squared fog
-    float distRatio = 4.0 * dist/fogMax ;
-    float fogFactor = exp(-distRatio * fogDensity * distRatio * fogDensity);
-        fragColour = mix(fogColor, fragColour, fogFactor);
-    }
-    else 
-    {      
+    // fog is applied when the HDR scene is tone mapped, see tonemap.fs
     fragColour = vec4(result, 1.0);
-    }
 }
 
 // calcs the color when using a directional light.
@@ -107,9 +111,9 @@ vec3 DirectLightCalc(DirectLight light, vec3 norm, vec3 viewDir)
     vec3 halfwayDirection = normalize(lightDir + viewDir);  
     float spec = pow(max(dot(norm, halfwayDirection), 0.0), material.shininess);
 
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, texCoord));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, texCoord));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, texCoord));
+    vec3 ambient = light.ambient * Albedo();
+    vec3 diffuse = light.diffuse * diff * Albedo();
+    vec3 specular = light.specular * spec * SpecularMap();
     return (ambient + diffuse + specular);
 }
 
@@ -133,9 +137,9 @@ vec3 SpotLightCalc(SpotLight light, vec3 norm, vec3 fragPos, vec3 viewDir)
     float epsilon = light.cutOff - light.outerCutOff;
     float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
 
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, texCoord));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, texCoord));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, texCoord));
+    vec3 ambient = light.ambient * Albedo();
+    vec3 diffuse = light.diffuse * diff * Albedo();
+    vec3 specular = light.specular * spec * SpecularMap();
     ambient *= attenuation * intensity;
     diffuse *= attenuation * intensity;
     specular *= attenuation * intensity;
@@ -157,11 +161,54 @@ vec3 PointLightCalc(PointLight light, vec3 norm, vec3 fragPos, vec3 viewDir)
     float distance = length(light.pos -fragPos);
     float attenuation = 1.0 / (light.cons + light.linear * distance + light.quadratic * (distance * distance));    
 
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, texCoord));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, texCoord));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, texCoord));
+    vec3 ambient = light.ambient * Albedo();
+    vec3 diffuse = light.diffuse * diff * Albedo();
+    vec3 specular = light.specular * spec * SpecularMap();
     ambient *= attenuation;
     diffuse *= attenuation;
     specular *= attenuation;
     return (ambient + diffuse + specular);
 }
+
+vec3 Albedo()
+{
+    if (diffuseFromArray)
+        return texture(diffuseArray, vec3(texCoord, diffuseLayer)).rgb;
+    return texture(material.diffuse, texCoord).rgb;
+}
+
+// arrays only hold the diffuse map, the meshes that use them bind it for both
+vec3 SpecularMap()
+{
+    if (diffuseFromArray)
+        return Albedo();
+    return texture(material.specular, texCoord).rgb;
+}
+
+// 4x4 ordered dither threshold in (0, 1)
+float Bayer(vec2 pixel)
+{
+    int x = int(mod(pixel.x, 4.0));
+    int y = int(mod(pixel.y, 4.0));
+    int index = x + y * 4;
+    int pattern[16] = int[16](0, 8, 2, 10, 12, 4, 14, 6, 3, 11, 1, 9, 15, 7, 13, 5);
+    return (float(pattern[index]) + 0.5) / 16.0;
+}
+
+// extra point light from the buffer, four texels a light
+PointLight FetchLight(int index)
+{
+    vec4 a = texelFetch(extraLights, index * 4);
+    vec4 b = texelFetch(extraLights, index * 4 + 1);
+    vec4 c = texelFetch(extraLights, index * 4 + 2);
+    vec4 d = texelFetch(extraLights, index * 4 + 3);
+    PointLight light;
+    light.pos = a.xyz;
+    light.cons = a.w;
+    light.ambient = b.xyz;
+    light.linear = b.w;
+    light.diffuse = c.xyz;
+    light.quadratic = c.w;
+    light.specular = d.xyz;
+    return light;
+}
@@ -2,19 +2,43 @@
 layout (location = 0) in vec3 vPos;
 layout (location = 1) in vec3 vNormal;
 layout (location = 2) in vec2 vTexCoord;
+layout (location = 7) in mat4 vInstanceModel;
+layout (location = 11) in float vInstanceFade;
 
 out vec3 fragPos;
 out vec3 normal;
 out vec2 texCoord;
+flat out float fade;
+flat out int flatMaterial;
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+uniform bool instanced; // take the model matrix from the instance attributes
+struct DrawData {
+    mat4 model;
+    mat4 normalMatrix;
+    ivec4 material; // x is the row of the MaterialTable block
+};
+#define MAX_DRAW_BATCH 16
+layout (std140) uniform DrawBlock { // per draw data the DrawList writes into its dynamic buffer, one per instance
+    DrawData draws[MAX_DRAW_BATCH];
+};
+uniform int materialId;     // row of the MaterialTable block when not from DrawBlock, see gbuffer.fs
+uniform bool fromDrawBlock; // model and material from draws[gl_InstanceID] instead of the uniforms
+
+invariant gl_Position; // must match depth.vs exactly for the GL_EQUAL pass
 
 void main()
 {
-    fragPos = vec3(model * vec4(vPos, 1.0));
-    normal = mat3(transpose(inverse(model))) * vNormal;  
+    bool block = fromDrawBlock && !instanced;
+    int i = block ? gl_InstanceID : 0;
+    mat4 m = instanced ? vInstanceModel : (block ? draws[i].model : model);
+    fade = instanced ? vInstanceFade : 1.0;
+    flatMaterial = instanced ? 0 : (block ? draws[i].material.x : materialId);
+    fragPos = vec3(m * vec4(vPos, 1.0));
+    mat3 normalMatrix = block ? mat3(draws[i].normalMatrix) : mat3(transpose(inverse(m)));
+    normal = normalMatrix * vNormal;  
     texCoord = vTexCoord;
     gl_Position = projection * view * vec4(fragPos, 1.0);
 }
\ No newline at end of file
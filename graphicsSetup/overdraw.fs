@@ -0,0 +1,9 @@
+//Overdraw view, every fragment that gets past the depth test adds a little heat
+//drawn with additive blending, the more often a pixel is shaded the brighter it gets
+#version 330 core
+out vec4 fragColour;
+
+void main()
+{
+    fragColour = vec4(0.15, 0.06, 0.02, 1.0);
+}
@@ -1,4 +1,4 @@
-//Fog and lighting
+//Lighting for the material presents, fog is applied in tonemap.fs
 #version 330 core
 out vec4 fragColour;
 
@@ -9,6 +9,14 @@ struct Material {
     float shininess;
 }; 
 
+struct MaterialRow {
+    vec4 ambient;
+    vec4 diffuse;
+    vec4 specular; // w is the shininess
+};
+
+#define MAX_MATERIALS 64
+
 struct Light {
     vec3 pos;
     vec3 ambient;
@@ -20,56 +28,44 @@ in vec2 texCoord;
 
 in vec3 normal;  
 in vec3 fragPos;  
+flat in int flatMaterial; // row of the material table, from the DrawBlock or the materialId uniform
 
 uniform vec3 viewPos; 
-uniform Material material;
+layout (std140) uniform MaterialTable { // see MaterialTable.h
+    MaterialRow materials[MAX_MATERIALS];
+};
 uniform Light light;
-uniform bool fog;
 
 uniform sampler2D texture_diffuse1;
 
 void main()
 {
+    MaterialRow row = materials[flatMaterial];
+    Material mat = Material(row.ambient.rgb, row.diffuse.rgb, row.specular.rgb, row.specular.w);
+
    // ambient
-    vec3 ambient = light.ambient * material.ambient;
+    vec3 ambient = light.ambient * mat.ambient;
   	
     // diffuse 
     vec3 norm = normalize(normal);
     vec3 lightDir = normalize(light.pos - fragPos);
     float diff = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = light.diffuse * (diff * material.diffuse);
+    vec3 diffuse = light.diffuse * (diff * mat.diffuse);
     
     // specular
     vec3 viewDir = normalize(viewPos - fragPos);
 
     //blinn phong
     vec3 halfwayDir = normalize(lightDir + viewDir);  
-    float spec = pow(max(dot(norm, halfwayDir), 0.0), material.shininess);
+    float spec = pow(max(dot(norm, halfwayDir), 0.0), mat.shininess);
 
-    vec3 specular = light.specular * (spec * material.specular);  
+    vec3 specular = light.specular * (spec * mat.specular);  
     vec3 result = (ambient + diffuse + specular) ;
         
     //direct light
     fragColour = texture(texture_diffuse1, texCoord) * vec4(result, 1.0) ;
 
-     if(fog)
-    {
-    fragColour = vec4(result, 1.0);
-    float fogMax = 10.0;
-    float fogDensity = 0.30 ;
-    vec4  fogColor = vec4(0.5f, 0.5f, 0.5f, 1.0f);
-
-    // Calculate fog
-    //distance from pixel to camera
-    float dist = length(fragPos.xyz - viewPos.xyz);
-    //exponential squared fog
-    float distRatio = 4.0 * dist/fogMax ;
-    float fogFactor = exp(-distRatio * fogDensity * distRatio * fogDensity);
-        fragColour = mix(fogColor, fragColour, fogFactor);
-    }
-    else 
-    {      
+    // fog is applied when the HDR scene is tone mapped, see tonemap.fs
     fragColour = vec4(result, 1.0);
-    }
   
 }
\ No newline at end of file
@@ -6,16 +6,33 @@ layout (location = 2) in vec2 vTexCoord;
 out vec2 texCoord;
 out vec3 fragPos;
 out vec3 normal;
+flat out int flatMaterial;
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+struct DrawData {
+    mat4 model;
+    mat4 normalMatrix;
+    ivec4 material; // x is the row of the MaterialTable block
+};
+#define MAX_DRAW_BATCH 16
+layout (std140) uniform DrawBlock { // per draw data the DrawList writes into its dynamic buffer, one per instance
+    DrawData draws[MAX_DRAW_BATCH];
+};
+uniform int materialId;     // row of the MaterialTable block when not from DrawBlock
+uniform bool fromDrawBlock; // model and material from draws[gl_InstanceID] instead of the uniforms
+
+invariant gl_Position; // must match depth.vs exactly for the GL_EQUAL pass
 
 void main()
 {
-    fragPos = vec3(model * vec4(vPos, 1.0));
-    normal = mat3(transpose(inverse(model))) * vNormal;  
+    int i = fromDrawBlock ? gl_InstanceID : 0;
+    mat4 m = fromDrawBlock ? draws[i].model : model;
+    fragPos = vec3(m * vec4(vPos, 1.0));
+    normal = (fromDrawBlock ? mat3(draws[i].normalMatrix) : mat3(transpose(inverse(m)))) * vNormal;  
+    flatMaterial = fromDrawBlock ? draws[i].material.x : materialId;
 
     texCoord = vTexCoord;    
-    gl_Position = projection * view * model * vec4(vPos, 1.0);
+    gl_Position = projection * view * vec4(fragPos, 1.0);
 }
\ No newline at end of file
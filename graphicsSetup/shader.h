@@ -13,7 +13,8 @@ class Shader
 {
 public:
     unsigned int ID;
-    Shader(const char* vertexPath, const char* fragmentPath)
+    // feedbackVaryings are the vertex outputs captured with transform feedback, linked interleaved
+    Shader(const char* vertexPath, const char* fragmentPath, const char* const* feedbackVaryings = NULL, int feedbackCount = 0)
     {
         // get the fragment and vertex code from path
         std::string vCode;
@@ -61,6 +62,8 @@ public:
         ID = glCreateProgram();
         glAttachShader(ID, vertex);
         glAttachShader(ID, fragment);
+        if (feedbackCount > 0)
+            glTransformFeedbackVaryings(ID, feedbackCount, feedbackVaryings, GL_INTERLEAVED_ATTRIBS);
         glLinkProgram(ID);
         errorCheck(ID, "PROG");
      
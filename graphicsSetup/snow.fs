@@ -0,0 +1,25 @@
+//soft round flakes that fade out where they meet the scene instead of clipping into it
+//soft particles reference https://developer.download.nvidia.com/whitepapers/2007/SDK10/SoftParticles_hi.pdf
+#version 330 core
+in vec2 corner;
+in float viewDepth;
+
+out vec4 FragColor;
+
+uniform sampler2D sceneDepth;
+uniform vec2 screenSize;
+uniform vec2 depthParams; // projection[3][2] and projection[2][2] to turn depth back into a distance
+uniform float softness;
+uniform float opacity;
+uniform vec3 color;
+
+void main()
+{
+    float r = dot(corner, corner);
+    if (r > 1.0)
+        discard;
+    float depth = texture(sceneDepth, gl_FragCoord.xy / screenSize).r;
+    float sceneDist = depthParams.x / (depth * 2.0 - 1.0 + depthParams.y);
+    float soft = clamp((sceneDist - viewDepth) / softness, 0.0, 1.0);
+    FragColor = vec4(color, (1.0 - r) * soft * opacity);
+}
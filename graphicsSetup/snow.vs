@@ -0,0 +1,19 @@
+//snowflakes as camera facing quads, one instance per flake
+#version 330 core
+layout (location = 0) in vec2 vCorner;  // quad corner in [-1, 1]
+layout (location = 1) in vec4 vPosSize; // flake position and radius
+
+out vec2 corner;
+out float viewDepth;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+void main()
+{
+    vec4 viewPos = view * vec4(vPosSize.xyz, 1.0);
+    viewPos.xy += vCorner * vPosSize.w;
+    corner = vCorner;
+    viewDepth = -viewPos.z;
+    gl_Position = projection * viewPos;
+}
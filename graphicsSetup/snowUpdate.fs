@@ -0,0 +1,5 @@
+//nothing is rasterized while the snow is simulated
+#version 330 core
+void main()
+{
+}
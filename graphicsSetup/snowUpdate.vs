@@ -0,0 +1,31 @@
+//snowfall simulation, one vertex per flake captured back into the other buffer with transform feedback
+#version 330 core
+layout (location = 0) in vec4 vPosSize;
+layout (location = 1) in vec4 vVelSeed;
+
+out vec4 posSize;
+out vec4 velSeed;
+
+uniform float dt;
+uniform float time;
+uniform vec3 center; // the volume follows the camera
+uniform vec3 area;   // size of the volume
+uniform vec3 wind;
+
+void main()
+{
+    vec3 pos = vPosSize.xyz;
+    float seed = vVelSeed.w;
+
+    // flakes flutter on their own phase on top of falling and the wind
+    vec3 sway = vec3(sin(time * 1.3 + seed * 6.2831), 0.0, cos(time * 1.1 + seed * 12.7)) * 0.25;
+    pos += (vVelSeed.xyz + wind + sway) * dt;
+
+    // wrap around the volume so the density around the camera never changes
+    vec3 rel = pos - center + area * 0.5;
+    rel = rel - floor(rel / area) * area;
+    pos = center + rel - area * 0.5;
+
+    posSize = vec4(pos, vPosSize.w);
+    velSeed = vVelSeed;
+}
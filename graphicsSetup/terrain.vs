@@ -0,0 +1,54 @@
+//CDLOD terrain, one grid patch drawn per selected quadtree node
+//CDLOD reference https://github.com/fstrugar/CDLOD/blob/master/cdlod_paper_latest.pdf
+#version 330 core
+layout (location = 0) in vec2 vGrid; // vertex position on the patch grid in [0, gridSize]
+
+out vec3 fragPos;
+out vec3 normal;
+out vec2 texCoord;
+flat out float fade;
+flat out int flatMaterial; // always 0, the terrain is textured
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec3 viewPos;
+
+uniform sampler2D heightMap;  // heights of the streamed tile the node is in
+uniform vec2 tileOrigin;
+uniform float tileSize;
+uniform float tileRes;        // height samples per side of the tile
+uniform vec2 nodeOrigin;
+uniform float nodeSize;
+uniform float gridSize;
+uniform vec2 morphRange;      // distances where vertices start and finish morphing to the coarser level
+uniform float uvScale;
+
+invariant gl_Position; // the depth pre-pass runs this same shader with depth.fs
+
+float HeightAt(vec2 xz)
+{
+    vec2 uv = (xz - tileOrigin) / tileSize;
+    uv = uv * (tileRes - 1.0) / tileRes + 0.5 / tileRes;
+    return textureLod(heightMap, uv, 0.0).r;
+}
+
+void main()
+{
+    vec2 xz = nodeOrigin + vGrid / gridSize * nodeSize;
+    float dist = distance(viewPos, vec3(xz.x, HeightAt(xz), xz.y));
+    float k = clamp((dist - morphRange.x) / (morphRange.y - morphRange.x), 0.0, 1.0);
+
+    // odd vertices slide onto their even neighbours so a fully morphed patch matches the next level exactly
+    vec2 grid = vGrid - fract(vGrid * 0.5) * 2.0 * k;
+    xz = nodeOrigin + grid / gridSize * nodeSize;
+
+    float e = tileSize / (tileRes - 1.0);
+    float hx = HeightAt(xz - vec2(e, 0.0)) - HeightAt(xz + vec2(e, 0.0));
+    float hz = HeightAt(xz - vec2(0.0, e)) - HeightAt(xz + vec2(0.0, e));
+    normal = normalize(vec3(hx, 2.0 * e, hz));
+    fragPos = vec3(xz.x, HeightAt(xz), xz.y);
+    texCoord = xz * uvScale;
+    fade = 1.0;
+    flatMaterial = 0;
+    gl_Position = projection * view * vec4(fragPos, 1.0);
+}
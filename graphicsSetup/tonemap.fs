@@ -0,0 +1,68 @@
+//fog, exposure, filmic tone mapping and gamma in one fullscreen pass over the HDR scene
+//ACES fit reference https://knarkowicz.wordpress.com/2016/01/06/aces-filmic-tone-mapping-curve/
+//Contrast adaptive sharpening reference https://gpuopen.com/fidelityfx-cas/
+//the scene may be rendered below the window's resolution, it is scaled up here and sharpened to make up for it
+//the fog is looked up in the integrated froxel grid, see VolumetricFog.h
+#version 330 core
+out vec4 fragColour;
+
+uniform sampler2D hdrColor;
+uniform sampler2D sceneDepth;
+uniform float exposure;
+uniform bool fog;
+uniform sampler3D fogVolume; // in-scattered light and transmittance from the camera to each froxel
+uniform vec2 fogRange;       // view depth the froxel slices start and end at
+uniform vec4 projParams; // projection[3][2] and [2][2] in zw rebuild view space depth
+uniform vec2 screenSize;  // the window
+uniform vec2 sceneSize;   // the HDR target, smaller than the window under dynamic resolution
+uniform float sharpness;  // 0 is a plain bilinear upscale
+
+vec3 ACESFilm(vec3 x)
+{
+    return clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+}
+
+// the HDR scene with the fog in front of it, the sky is left clear
+vec3 Scene(vec2 uv)
+{
+    vec3 colour = texture(hdrColor, uv).rgb;
+    float depth = texture(sceneDepth, uv).r;
+    if (fog && depth < 1.0)
+    {
+        // slices are exponential in depth, each stores the fog up to its far side
+        float viewZ = projParams.z / (depth * 2.0 - 1.0 + projParams.w);
+        float slices = float(textureSize(fogVolume, 0).z);
+        float w = log(max(viewZ, fogRange.x) / fogRange.x) / log(fogRange.y / fogRange.x);
+        vec4 f = texture(fogVolume, vec3(uv, w - 0.5 / slices));
+        colour = colour * f.a + f.rgb;
+    }
+    return colour;
+}
+
+vec3 Tonemap(vec2 uv)
+{
+    return pow(ACESFilm(Scene(uv) * exposure), vec3(1.0 / 2.2));
+}
+
+void main()
+{
+    vec2 uv = gl_FragCoord.xy / screenSize;
+    vec3 colour = Tonemap(uv);
+
+    // sharpen against the four neighbours one scene texel away, less where the contrast is already high
+    if (sharpness > 0.0)
+    {
+        vec2 texel = 1.0 / sceneSize;
+        vec3 n = Tonemap(uv + vec2(0.0, texel.y));
+        vec3 s = Tonemap(uv - vec2(0.0, texel.y));
+        vec3 e = Tonemap(uv + vec2(texel.x, 0.0));
+        vec3 w = Tonemap(uv - vec2(texel.x, 0.0));
+        vec3 lo = min(colour, min(min(n, s), min(e, w)));
+        vec3 hi = max(colour, max(max(n, s), max(e, w)));
+        vec3 amount = sqrt(clamp(min(lo, 1.0 - hi) / max(hi, 1e-4), 0.0, 1.0));
+        vec3 weight = -amount * mix(0.125, 0.2, sharpness);
+        colour = clamp((colour + (n + s + e + w) * weight) / (1.0 + 4.0 * weight), 0.0, 1.0);
+    }
+
+    fragColour = vec4(colour, 1.0);
+}